@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cassert>
+#include <set>
+
+#include <analysis/classhierarchy.h>
+#include <analysis/semanticcontext.h>
+#include <analysis/symbol.h>
+#include <analysis/symboltable.h>
+#include <analysis/type.h>
+
+using namespace std;
+
+namespace venom {
+namespace analysis {
+
+ClassHierarchy::ClassHierarchy(SemanticContext* ctx)
+  : numSites(0), numDevirtualized(0) {
+  // every symbol table of the program hangs off of the root table of
+  // <prelude>, including the tables of the builtin classes, of the
+  // specializations of templates, and of lifted classes
+  vector<ClassSymbol*> all;
+  ctx->getProgramRoot()->getRootSymbolTable()->getAllClassSymbols(all);
+
+  set<ClassSymbol*> classes;
+  for (vector<ClassSymbol*>::iterator it = all.begin();
+       it != all.end(); ++it) {
+    ClassSymbol* csym = (*it)->followLiftedChain();
+    if (csym->isCodeGeneratable()) classes.insert(csym);
+  }
+
+  for (set<ClassSymbol*>::iterator it = classes.begin();
+       it != classes.end(); ++it) {
+    InstantiatedType* parent = (*it)->getType()->getParent();
+    if (!parent) continue;
+    subclasses[parent->findCodeGeneratableClassSymbol()].push_back(*it);
+  }
+}
+
+const vector<FuncSymbol*>&
+ClassHierarchy::methodsOf(ClassSymbol* klass) {
+  MethodMap::iterator it = methods.find(klass);
+  if (it != methods.end()) return it->second;
+  vector<Symbol*> attributes;
+  vector<FuncSymbol*>& ret = methods[klass];
+  klass->linearizedOrder(attributes, ret);
+  return ret;
+}
+
+FuncSymbol*
+ClassHierarchy::findUniqueMethod(ClassSymbol* klass, size_t slot) {
+  numSites++;
+  const vector<FuncSymbol*>& klassMethods = methodsOf(klass);
+  if (slot >= klassMethods.size()) return NULL;
+  FuncSymbol* ret = klassMethods[slot];
+  if (!ret->isCodeGeneratable()) return NULL;
+
+  vector<ClassSymbol*> work(1, klass);
+  while (!work.empty()) {
+    ClassSymbol* cur = work.back();
+    work.pop_back();
+    const vector<FuncSymbol*>& curMethods = methodsOf(cur);
+    if (slot >= curMethods.size() || curMethods[slot] != ret) return NULL;
+    SubclassMap::iterator it = subclasses.find(cur);
+    if (it != subclasses.end()) {
+      work.insert(work.end(), it->second.begin(), it->second.end());
+    }
+  }
+  numDevirtualized++;
+  return ret;
+}
+
+void
+ClassHierarchy::printStats(ostream& o) const {
+  o << "; class hierarchy analysis: devirtualized " << numDevirtualized
+    << " of " << numSites << " virtual call sites" << endl;
+}
+
+}
+}
@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_ANALYSIS_CLASSHIERARCHY_H
+#define VENOM_ANALYSIS_CLASSHIERARCHY_H
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+namespace venom {
+namespace analysis {
+
+/** Forward decls */
+class ClassSymbol;
+class FuncSymbol;
+class SemanticContext;
+
+/**
+ * ClassHierarchy is a whole program view of the classes, built once every
+ * module has been rewritten (so templates are instantiated and nested
+ * classes are lifted), and before any code is generated.
+ *
+ * It answers which method a virtual call runs, when the answer is the same
+ * for every class an object of the receiver's static type could have
+ */
+class ClassHierarchy {
+public:
+  /** Collects every code generatable class of the program ctx is in */
+  ClassHierarchy(SemanticContext* ctx);
+
+  /**
+   * Returns the method in vtable slot of every subclass of klass (including
+   * klass itself), or NULL if some subclass overrides it. Each call counts
+   * as one virtual call site, for printStats()
+   */
+  FuncSymbol* findUniqueMethod(ClassSymbol* klass, size_t slot);
+
+  /** Prints how many of the call sites given to findUniqueMethod() could be
+   * devirtualized */
+  void printStats(std::ostream& o) const;
+
+private:
+  /** The methods of klass, in vtable order */
+  const std::vector<FuncSymbol*>& methodsOf(ClassSymbol* klass);
+
+  typedef std::map<ClassSymbol*, std::vector<ClassSymbol*> > SubclassMap;
+  SubclassMap subclasses; // direct subclasses only
+
+  typedef std::map<ClassSymbol*, std::vector<FuncSymbol*> > MethodMap;
+  MethodMap methods;
+
+  size_t numSites;
+  size_t numDevirtualized;
+};
+
+}
+}
+
+#endif /* VENOM_ANALYSIS_CLASSHIERARCHY_H */
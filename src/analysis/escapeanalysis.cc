@@ -0,0 +1,251 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cassert>
+
+#include <analysis/escapeanalysis.h>
+#include <analysis/semanticcontext.h>
+#include <analysis/symbol.h>
+#include <analysis/symboltable.h>
+#include <analysis/type.h>
+
+#include <ast/expression/attraccess.h>
+#include <ast/expression/functioncall.h>
+#include <ast/expression/variable.h>
+
+#include <ast/statement/assign.h>
+#include <ast/statement/classdecl.h>
+#include <ast/statement/funcdecl.h>
+#include <ast/statement/stmtlist.h>
+
+using namespace std;
+using namespace venom::ast;
+
+namespace venom {
+namespace analysis {
+
+/** Returns the symbol of node, if it is a local variable holding objects */
+static Symbol* LocalObjectOf(ASTNode* node) {
+  if (dynamic_cast<VariableSelfNode*>(node) ||
+      dynamic_cast<VariableSuperNode*>(node)) return NULL;
+  VariableNode* var = dynamic_cast<VariableNode*>(node);
+  if (!var) return NULL;
+  Symbol* sym = dynamic_cast<Symbol*>(var->getSymbol());
+  if (!sym || sym->isModuleLevelSymbol() || sym->isObjectField()) {
+    return NULL;
+  }
+  InstantiatedType* type = sym->getInstantiatedType();
+  return type && type->isRefCounted() && !type->isAny() ? sym : NULL;
+}
+
+/** Returns the class node constructs, if it is a constructor call */
+static ClassSymbol* ConstructedClassOf(ASTNode* node) {
+  FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(node);
+  if (!call) return NULL;
+  InstantiatedType* funcType = call->getPrimary()->getStaticType();
+  if (!funcType->isClassType()) return NULL;
+  return funcType->getParams().at(0)->findCodeGeneratableClassSymbol();
+}
+
+static bool IsField(AttrAccessNode* attr) {
+  Symbol* sym = dynamic_cast<Symbol*>(attr->getSymbol());
+  return sym && sym->isObjectField();
+}
+
+/** Is call super.<ctor>(), which every constructor starts with? */
+static bool IsSuperCtorCall(FunctionCallNode* call) {
+  AttrAccessNode* attr = dynamic_cast<AttrAccessNode*>(call->getPrimary());
+  return attr && attr->getName() == "<ctor>" &&
+         dynamic_cast<VariableSuperNode*>(attr->getPrimary()) &&
+         call->getNumKids() == 1;
+}
+
+/**
+ * Does the tree rooted at node only use self to read and write fields? A
+ * constructor may also call the constructor of object, which does nothing
+ */
+static bool UsesSelfForFieldsOnly(ASTNode* node, bool ctor) {
+  if (dynamic_cast<FuncDeclNode*>(node) ||
+      dynamic_cast<ClassDeclNode*>(node)) return false;
+  if (FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(node)) {
+    if (ctor && IsSuperCtorCall(call)) return true;
+  } else if (AttrAccessNode* attr = dynamic_cast<AttrAccessNode*>(node)) {
+    if (dynamic_cast<VariableSelfNode*>(attr->getPrimary())) {
+      return IsField(attr);
+    }
+  } else if (dynamic_cast<VariableSelfNode*>(node) ||
+             dynamic_cast<VariableSuperNode*>(node)) {
+    return false;
+  } else if (VariableNode* var = dynamic_cast<VariableNode*>(node)) {
+    // a field referenced without self
+    Symbol* sym = dynamic_cast<Symbol*>(var->getSymbol());
+    return !sym || !sym->isObjectField();
+  }
+  for (size_t i = 0; i < node->getNumKids(); i++) {
+    ASTNode* kid = node->getNthKid(i);
+    if (kid && !UsesSelfForFieldsOnly(kid, ctor)) return false;
+  }
+  return true;
+}
+
+/** Is fdn (which may be NULL) one of bodies? */
+static bool IsBody(FuncDeclNode* fdn,
+                   const vector<const FuncSymbol*>& bodies) {
+  return fdn &&
+    find(bodies.begin(), bodies.end(), fdn->getSymbol()) != bodies.end();
+}
+
+EscapeAnalysis::EscapeAnalysis(SemanticContext* ctx, FuncDeclNode* func,
+                               bool inlining,
+                               const vector<const FuncSymbol*>& bodies) {
+  if (!inlining) return;
+  StmtListNode* body = func->getStmts();
+
+  // the parameters are given their objects by the caller. every other
+  // variable which is not given its objects by an assignment (such as the
+  // variable of a for loop) is a kid of the statement which does, so it
+  // escapes when visited
+  ExprNodeVec& params = func->getParams();
+  for (ExprNodeVec::iterator it = params.begin();
+       it != params.end(); ++it) {
+    VENOM_ASSERT_TYPEOF_PTR(VariableNode, *it);
+    TypeTranslator t;
+    Symbol* psym = body->getSymbolTable()->findSymbol(
+        static_cast<VariableNode*>(*it)->getName(),
+        SymbolTable::NoRecurse, t);
+    assert(psym);
+    objects[psym].escapes = true;
+  }
+
+  visit(body);
+  for (ObjectMap::iterator it = objects.begin();
+       it != objects.end(); ++it) {
+    Symbol* object = it->first;
+    ObjectInfo& info = it->second;
+    if (info.escapes || !info.klass) continue;
+    // the fields are looked up in the static type of the variable, which
+    // must then be the class itself
+    if (object->getInstantiatedType()->findCodeGeneratableClassSymbol() !=
+        info.klass) continue;
+    // a body being generated already can't be inlined again (its copy
+    // would share its local variable slots)
+    FuncDeclNode* ctor = FindScalarCtor(ctx, info.klass);
+    if (!ctor || IsBody(ctor, bodies)) continue;
+    bool ok = true;
+    for (vector<size_t>::iterator mit = info.methods.begin();
+         ok && mit != info.methods.end(); ++mit) {
+      FuncDeclNode* method = FindScalarMethod(ctx, info.klass, *mit);
+      ok = method && !IsBody(method, bodies);
+    }
+    if (ok) scalarObjects.push_back(object);
+  }
+}
+
+void
+EscapeAnalysis::visit(ASTNode* node) {
+  // nested functions and classes are generated on their own
+  if (dynamic_cast<FuncDeclNode*>(node) ||
+      dynamic_cast<ClassDeclNode*>(node)) return;
+
+  if (AssignNode* assign = dynamic_cast<AssignNode*>(node)) {
+    // object = C(...)
+    Symbol* object = LocalObjectOf(assign->getVariable());
+    ClassSymbol* klass = ConstructedClassOf(assign->getValue());
+    if (object && klass) {
+      ObjectInfo& info = objects[object];
+      if (info.klass && info.klass != klass) info.escapes = true;
+      info.klass = klass;
+      visit(assign->getValue());
+      return;
+    }
+  } else if (FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(node)) {
+    // object.method(...)
+    AttrAccessNode* attr = dynamic_cast<AttrAccessNode*>(call->getPrimary());
+    Symbol* object = attr ? LocalObjectOf(attr->getPrimary()) : NULL;
+    MethodSymbol* ms = attr ?
+      dynamic_cast<MethodSymbol*>(attr->getSymbol()) : NULL;
+    if (object && ms && !ms->isConstructor()) {
+      objects[object].methods.push_back(ms->getFieldIndex());
+      for (size_t i = 1; i < call->getNumKids(); i++) {
+        visit(call->getNthKid(i));
+      }
+      return;
+    }
+  } else if (AttrAccessNode* attr = dynamic_cast<AttrAccessNode*>(node)) {
+    // object.field
+    if (LocalObjectOf(attr->getPrimary()) && IsField(attr)) return;
+  } else if (Symbol* object = LocalObjectOf(node)) {
+    // any other use lets the object escape
+    objects[object].escapes = true;
+    return;
+  }
+
+  for (size_t i = 0; i < node->getNumKids(); i++) {
+    ASTNode* kid = node->getNthKid(i);
+    if (kid) visit(kid);
+  }
+}
+
+FuncDeclNode*
+EscapeAnalysis::FindScalarCtor(SemanticContext* ctx, ClassSymbol* klass) {
+  // the constructor of object does nothing, so it can be left out
+  InstantiatedType* parent = klass->getType()->getParent();
+  if (!parent || !parent->equals(*InstantiatedType::ObjectType)) return NULL;
+  TypeTranslator t;
+  FuncSymbol* ctor = klass->getClassSymbolTable()->findFuncSymbol(
+      "<ctor>", SymbolTable::NoRecurse, t);
+  return ctor ? FindScalarBody(ctx, ctor, true) : NULL;
+}
+
+FuncDeclNode*
+EscapeAnalysis::FindScalarMethod(SemanticContext* ctx, ClassSymbol* klass,
+                                 size_t slot) {
+  vector<Symbol*> attributes;
+  vector<FuncSymbol*> methods;
+  klass->linearizedOrder(attributes, methods);
+  if (slot >= methods.size()) return NULL;
+  return FindScalarBody(ctx, methods[slot], false);
+}
+
+FuncDeclNode*
+EscapeAnalysis::FindScalarBody(SemanticContext* ctx, FuncSymbol* fs,
+                               bool ctor) {
+  // only the functions of the module being generated can be inlined
+  if (fs->isNative() ||
+      !fs->getDefinedSymbolTable()->belongsTo(
+        ctx->getModuleRoot()->getSymbolTable())) return NULL;
+  FuncDeclNode* fdn =
+    dynamic_cast<FuncDeclNode*>(fs->getFunctionSymbolTable()->getOwner());
+  if (!fdn || !fdn->isInlinable()) return NULL;
+  return UsesSelfForFieldsOnly(fdn->getStmts(), ctor) ? fdn : NULL;
+}
+
+}
+}
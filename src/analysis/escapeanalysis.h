@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_ANALYSIS_ESCAPEANALYSIS_H
+#define VENOM_ANALYSIS_ESCAPEANALYSIS_H
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+namespace venom {
+
+namespace ast {
+  /** Forward decls */
+  class ASTNode;
+  class FuncDeclNode;
+}
+
+namespace analysis {
+
+/** Forward decls */
+class ClassSymbol;
+class FuncSymbol;
+class SemanticContext;
+class Symbol;
+
+/**
+ * EscapeAnalysis finds the local variables of a function body which only
+ * ever hold objects that never escape the body: each object is constructed
+ * by an assignment to the variable, and otherwise the variable is only used
+ * to read and write fields, and to call methods.
+ *
+ * The code generator replaces such an object by scalars, one local variable
+ * slot per field. The constructor and the methods are generated inline on
+ * the scalars, so only classes whose parent is object, and whose constructor
+ * and methods use self for nothing but fields, qualify
+ */
+class EscapeAnalysis {
+public:
+  /** Analyzes the body of func. ctx is the module being generated. Nothing
+   * is replaced unless calls can be inlined, and no object of a class whose
+   * constructor or methods are among bodies (the functions being generated,
+   * see backend::CodeGenerator::enterBody()) */
+  EscapeAnalysis(SemanticContext* ctx, ast::FuncDeclNode* func,
+                 bool inlining, const std::vector<const FuncSymbol*>& bodies);
+
+  /** The variables whose objects can be replaced by scalars */
+  inline const std::vector<Symbol*>& getScalarObjects() const
+    { return scalarObjects; }
+
+  /** The declaration of the constructor of klass, if it can be generated
+   * inline on scalars. NULL otherwise */
+  static ast::FuncDeclNode* FindScalarCtor(SemanticContext* ctx,
+                                           ClassSymbol* klass);
+
+  /** The declaration of the method in vtable slot of klass, if it can be
+   * generated inline on scalars. NULL otherwise */
+  static ast::FuncDeclNode* FindScalarMethod(SemanticContext* ctx,
+                                             ClassSymbol* klass,
+                                             size_t slot);
+
+private:
+  static ast::FuncDeclNode* FindScalarBody(SemanticContext* ctx,
+                                           FuncSymbol* fs, bool ctor);
+
+  void visit(ast::ASTNode* node);
+
+  struct ObjectInfo {
+    ObjectInfo() : klass(NULL), escapes(false) {}
+    ClassSymbol* klass; // the class every assignment constructs
+    bool escapes;
+    std::vector<size_t> methods; // vtable slots of the methods called
+  };
+
+  typedef std::map<Symbol*, ObjectInfo> ObjectMap;
+  ObjectMap objects;
+
+  std::vector<Symbol*> scalarObjects;
+};
+
+}
+}
+
+#endif /* VENOM_ANALYSIS_ESCAPEANALYSIS_H */
@@ -293,6 +293,15 @@ SymbolTable::getClassSymbols(vector<ClassSymbol*>& symbols) {
   classContainer.getAll(symbols);
 }
 
+void
+SymbolTable::getAllClassSymbols(vector<ClassSymbol*>& symbols) {
+  getClassSymbols(symbols);
+  for (vector<SymbolTable*>::iterator it = children.begin();
+       it != children.end(); ++it) {
+    (*it)->getAllClassSymbols(symbols);
+  }
+}
+
 ModuleSymbol*
 SymbolTable::findModuleSymbol(const string& name, RecurseMode mode) {
   ModuleSymbol *ret = NULL;
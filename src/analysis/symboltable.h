@@ -260,6 +260,10 @@ public:
 
   void getClassSymbols(std::vector<ClassSymbol*>& symbols);
 
+  /** Like getClassSymbols(), but also includes the classes defined in every
+   * table below this one */
+  void getAllClassSymbols(std::vector<ClassSymbol*>& symbols);
+
   ModuleSymbol*
   findModuleSymbol(const std::string& name, RecurseMode mode);
 
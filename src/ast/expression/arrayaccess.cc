@@ -84,10 +84,14 @@ ArrayAccessNode::codeGen(CodeGenerator& cg) {
     assert(index->getStaticType()->isInt());
     primary->codeGen(cg);
     index->codeGen(cg);
-    cg.emitInst(
-        primary->getStaticType()->getParams()[0]->isRefCounted() ?
-          Instruction::GET_ARRAY_ACCESS_REF:
-          Instruction::GET_ARRAY_ACCESS);
+    bool ref = primary->getStaticType()->getParams()[0]->isRefCounted();
+    if (indexInRange) {
+      cg.emitInst(ref ? Instruction::GET_ARRAY_ACCESS_REF_UNCHECKED :
+                        Instruction::GET_ARRAY_ACCESS_UNCHECKED);
+    } else {
+      cg.emitInst(ref ? Instruction::GET_ARRAY_ACCESS_REF :
+                        Instruction::GET_ARRAY_ACCESS);
+    }
   } else VENOM_UNIMPLEMENTED;
 }
 
@@ -101,10 +105,14 @@ ArrayAccessNode::codeGenAssignLHS(CodeGenerator& cg, ASTExpressionNode* value) {
     primary->codeGen(cg);
     index->codeGen(cg);
     value->codeGen(cg);
-    cg.emitInst(
-        primary->getStaticType()->getParams()[0]->isRefCounted() ?
-          Instruction::SET_ARRAY_ACCESS_REF:
-          Instruction::SET_ARRAY_ACCESS);
+    bool ref = primary->getStaticType()->getParams()[0]->isRefCounted();
+    if (indexInRange) {
+      cg.emitInst(ref ? Instruction::SET_ARRAY_ACCESS_REF_UNCHECKED :
+                        Instruction::SET_ARRAY_ACCESS_UNCHECKED);
+    } else {
+      cg.emitInst(ref ? Instruction::SET_ARRAY_ACCESS_REF :
+                        Instruction::SET_ARRAY_ACCESS);
+    }
   } else VENOM_UNIMPLEMENTED;
 }
 
@@ -42,7 +42,7 @@ class ArrayAccessNode : public ASTExpressionNode {
 public:
   /** Takes ownership of primary and index */
   ArrayAccessNode(ASTExpressionNode* primary, ASTExpressionNode* index)
-    : primary(primary), index(index) {}
+    : primary(primary), index(index), indexInRange(false) {}
 
   ~ArrayAccessNode() {
     delete primary;
@@ -66,6 +66,13 @@ public:
     return false;
   }
 
+  inline ASTExpressionNode* getPrimary() { return primary; }
+  inline ASTExpressionNode* getIndex() { return index; }
+
+  /** Called (during code generation) once the index is known to be within
+   * the bounds of the list, so the access can skip its range check */
+  inline void markIndexInRange() { indexInRange = true; }
+
   virtual void codeGen(backend::CodeGenerator& cg);
 
   void codeGenAssignLHS(backend::CodeGenerator& cg, ASTExpressionNode* value);
@@ -90,6 +97,8 @@ public:
 private:
   ASTExpressionNode* primary;
   ASTExpressionNode* index;
+
+  bool indexInRange;
 };
 
 }
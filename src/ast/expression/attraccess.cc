@@ -28,6 +28,7 @@
  */
 
 #include <ast/expression/attraccess.h>
+#include <ast/expression/variable.h>
 
 #include <analysis/semanticcontext.h>
 #include <analysis/symbol.h>
@@ -73,8 +74,33 @@ AttrAccessNode::typeCheckImpl(SemanticContext* ctx,
   return attrSym->bind(ctx, t, typeParamArgs);
 }
 
+Symbol*
+AttrAccessNode::getScalarObject(CodeGenerator& cg) {
+  // super is self as well, for the call to the ctor of object
+  if (dynamic_cast<VariableSelfNode*>(primary) ||
+      dynamic_cast<VariableSuperNode*>(primary)) return cg.getScalarSelf();
+  VariableNode* var = dynamic_cast<VariableNode*>(primary);
+  if (!var) return NULL;
+  Symbol* sym = dynamic_cast<Symbol*>(var->getSymbol());
+  return sym && cg.isScalarObject(sym) ? sym : NULL;
+}
+
 void
 AttrAccessNode::codeGen(CodeGenerator& cg) {
+  if (Symbol* object = getScalarObject(cg)) {
+    // AssignNode takes care of the assignment
+    if (hasLocationContext(AssignmentLHS)) return;
+    assert(!hasLocationContext(FunctionCall));
+    BaseSymbol* bs = getSymbol();
+    VENOM_ASSERT_TYPEOF_PTR(Symbol, bs);
+    cg.emitInstU32(
+        getStaticType()->isRefCounted() ?
+          Instruction::LOAD_LOCAL_VAR_REF : Instruction::LOAD_LOCAL_VAR,
+        cg.getScalarFieldSlot(
+          object, static_cast<Symbol*>(bs)->getFieldIndex()));
+    return;
+  }
+
   primary->codeGen(cg);
 
   if (hasLocationContext(AssignmentLHS) ||
@@ -92,11 +118,7 @@ AttrAccessNode::codeGen(CodeGenerator& cg) {
   assert(sym->isModuleLevelSymbol() || sym->isObjectField());
 
   size_t slotIdx = sym->getFieldIndex();
-  if (getStaticType()->isRefCounted()) {
-    cg.emitInstU32(Instruction::GET_ATTR_OBJ_REF, slotIdx);
-  } else {
-    cg.emitInstU32(Instruction::GET_ATTR_OBJ, slotIdx);
-  }
+  cg.emitInstField(slotIdx, getStaticType()->isRefCounted());
 }
 
 AttrAccessNode*
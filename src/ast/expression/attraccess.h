@@ -73,6 +73,10 @@ public:
 
   virtual analysis::BaseSymbol* getSymbol();
 
+  /** Returns the object replaced by scalars (see CodeGenerator) whose
+   * field this accesses, or NULL */
+  analysis::Symbol* getScalarObject(backend::CodeGenerator& cg);
+
   virtual void codeGen(backend::CodeGenerator& cg);
 
   VENOM_AST_TYPED_CLONE_WITH_IMPL_DECL_EXPR(AttrAccessNode)
@@ -27,8 +27,14 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <limits>
+
 #include <ast/expression/attraccess.h>
 #include <ast/expression/binop.h>
+#include <ast/expression/boolliteral.h>
+#include <ast/expression/doubleliteral.h>
+#include <ast/expression/intliteral.h>
+#include <ast/expression/stringliteral.h>
 #include <ast/expression/synthetic/functioncall.h>
 
 #include <analysis/semanticcontext.h>
@@ -184,10 +190,174 @@ BinopNode::typeCheckImpl(SemanticContext* ctx,
   return NULL;
 }
 
+// Constant folding. Each of these computes exactly what the instruction
+// the operator would compile to computes at run time (int arithmetic wraps),
+// or returns NULL to leave the operator alone: there is no point folding an
+// int division by zero, which has to throw when (if ever) it runs.
+
+static ASTExpressionNode* FoldInt(BinopNode::Type type, int64_t a, int64_t b) {
+  switch (type) {
+  case BinopNode::ADD:  return new IntLiteralNode(uint64_t(a) + uint64_t(b));
+  case BinopNode::SUB:  return new IntLiteralNode(uint64_t(a) - uint64_t(b));
+  case BinopNode::MULT: return new IntLiteralNode(uint64_t(a) * uint64_t(b));
+  case BinopNode::DIV:
+  case BinopNode::MOD:
+    if (b == 0 || (a == numeric_limits<int64_t>::min() && b == -1)) {
+      return NULL;
+    }
+    return new IntLiteralNode(type == BinopNode::DIV ? a / b : a % b);
+  case BinopNode::CMP_LT:  return new BoolLiteralNode(a < b);
+  case BinopNode::CMP_LE:  return new BoolLiteralNode(a <= b);
+  case BinopNode::CMP_GT:  return new BoolLiteralNode(a > b);
+  case BinopNode::CMP_GE:  return new BoolLiteralNode(a >= b);
+  case BinopNode::CMP_EQ:  return new BoolLiteralNode(a == b);
+  case BinopNode::CMP_NEQ: return new BoolLiteralNode(a != b);
+  case BinopNode::BIT_AND: return new IntLiteralNode(a & b);
+  case BinopNode::BIT_OR:  return new IntLiteralNode(a | b);
+  case BinopNode::BIT_XOR: return new IntLiteralNode(a ^ b);
+  case BinopNode::BIT_LSHIFT:
+  case BinopNode::BIT_RSHIFT:
+    if (b < 0 || b > 63) return NULL;
+    return new IntLiteralNode(type == BinopNode::BIT_LSHIFT ?
+        int64_t(uint64_t(a) << b) : a >> b);
+  default: return NULL;
+  }
+}
+
+static ASTExpressionNode* FoldFloat(BinopNode::Type type, double a, double b) {
+  switch (type) {
+  case BinopNode::ADD:  return new DoubleLiteralNode(a + b);
+  case BinopNode::SUB:  return new DoubleLiteralNode(a - b);
+  case BinopNode::MULT: return new DoubleLiteralNode(a * b);
+  case BinopNode::DIV:  return new DoubleLiteralNode(a / b);
+  default: return NULL;
+  }
+}
+
+static ASTExpressionNode* FoldBool(BinopNode::Type type, bool a, bool b) {
+  switch (type) {
+  case BinopNode::CMP_AND: return new BoolLiteralNode(a && b);
+  case BinopNode::CMP_OR:  return new BoolLiteralNode(a || b);
+  case BinopNode::CMP_EQ:  return new BoolLiteralNode(a == b);
+  case BinopNode::CMP_NEQ: return new BoolLiteralNode(a != b);
+  case BinopNode::BIT_AND: return new BoolLiteralNode(a & b);
+  case BinopNode::BIT_OR:  return new BoolLiteralNode(a | b);
+  case BinopNode::BIT_XOR: return new BoolLiteralNode(a ^ b);
+  default: return NULL;
+  }
+}
+
+/** If node is a numeric literal, sets value (promoting ints) */
+static bool IsNumericLiteral(ASTExpressionNode* node, double& value) {
+  if (IntLiteralNode* i = dynamic_cast<IntLiteralNode*>(node)) {
+    value = double(i->getValue());
+    return true;
+  }
+  if (DoubleLiteralNode* d = dynamic_cast<DoubleLiteralNode*>(node)) {
+    value = d->getValue();
+    return true;
+  }
+  return false;
+}
+
+/** If node is an int literal which is a power of two, sets log2 */
+static bool IsPowerOfTwo(ASTExpressionNode* node, int64_t& log2) {
+  IntLiteralNode* i = dynamic_cast<IntLiteralNode*>(node);
+  if (!i || i->getValue() <= 0 || (i->getValue() & (i->getValue() - 1))) {
+    return false;
+  }
+  log2 = 0;
+  while ((int64_t(1) << log2) != i->getValue()) log2++;
+  return true;
+}
+
+static inline bool IsIntLiteral(ASTExpressionNode* node, int64_t value) {
+  IntLiteralNode* i = dynamic_cast<IntLiteralNode*>(node);
+  return i && i->getValue() == value;
+}
+
+ASTExpressionNode*
+BinopNode::fold() {
+  IntLiteralNode* li = dynamic_cast<IntLiteralNode*>(left);
+  IntLiteralNode* ri = dynamic_cast<IntLiteralNode*>(right);
+  if (li && ri) return FoldInt(type, li->getValue(), ri->getValue());
+
+  double ld, rd;
+  if (IsNumericLiteral(left, ld) && IsNumericLiteral(right, rd)) {
+    // at least one side is a float, so the int side is promoted (the
+    // comparisons require equal types, so they cannot be mixed)
+    if (!left->getStaticType()->equals(*right->getStaticType()) &&
+        type != ADD && type != SUB && type != MULT && type != DIV) {
+      return NULL;
+    }
+    switch (type) {
+    case CMP_LT:  return new BoolLiteralNode(ld < rd);
+    case CMP_LE:  return new BoolLiteralNode(ld <= rd);
+    case CMP_GT:  return new BoolLiteralNode(ld > rd);
+    case CMP_GE:  return new BoolLiteralNode(ld >= rd);
+    case CMP_EQ:  return new BoolLiteralNode(ld == rd);
+    case CMP_NEQ: return new BoolLiteralNode(ld != rd);
+    default: return FoldFloat(type, ld, rd);
+    }
+  }
+
+  BoolLiteralNode* lb = dynamic_cast<BoolLiteralNode*>(left);
+  BoolLiteralNode* rb = dynamic_cast<BoolLiteralNode*>(right);
+  if (lb && rb) return FoldBool(type, lb->getValue(), rb->getValue());
+
+  StringLiteralNode* ls = dynamic_cast<StringLiteralNode*>(left);
+  StringLiteralNode* rs = dynamic_cast<StringLiteralNode*>(right);
+  if (ls && rs && type == ADD) {
+    return new StringLiteralNode(ls->getValue() + rs->getValue());
+  }
+  return NULL;
+}
+
+ASTExpressionNode*
+BinopNode::strengthReduce() {
+  // only int arithmetic: x + 0 is not x for floats (x = -0.0)
+  if (!left->getStaticType()->isInt() || !right->getStaticType()->isInt()) {
+    return NULL;
+  }
+  int64_t log2;
+  switch (type) {
+  case ADD:
+    if (IsIntLiteral(right, 0)) return left->clone(CloneMode::Semantic);
+    if (IsIntLiteral(left, 0)) return right->clone(CloneMode::Semantic);
+    break;
+  case SUB:
+    if (IsIntLiteral(right, 0)) return left->clone(CloneMode::Semantic);
+    break;
+  case MULT:
+    if (IsIntLiteral(right, 1)) return left->clone(CloneMode::Semantic);
+    if (IsIntLiteral(left, 1)) return right->clone(CloneMode::Semantic);
+    if (IsPowerOfTwo(right, log2)) {
+      return new BinopNode(left->clone(CloneMode::Semantic),
+                           new IntLiteralNode(log2), BIT_LSHIFT);
+    }
+    if (IsPowerOfTwo(left, log2)) {
+      return new BinopNode(right->clone(CloneMode::Semantic),
+                           new IntLiteralNode(log2), BIT_LSHIFT);
+    }
+    break;
+  case DIV:
+    if (IsIntLiteral(right, 1)) return left->clone(CloneMode::Semantic);
+    break;
+  default: break;
+  }
+  return NULL;
+}
+
 ASTNode*
 BinopNode::rewriteLocal(SemanticContext* ctx,
                         RewriteMode mode) {
   ASTNode* ret = ASTExpressionNode::rewriteLocal(ctx, mode);
+  if (mode == Optimize) {
+    assert(!ret);
+    ASTExpressionNode* rep = fold();
+    if (!rep) rep = strengthReduce();
+    return rep ? replace(ctx, rep) : NULL;
+  }
   if (mode != DeSugar) return ret;
   assert(!ret);
 
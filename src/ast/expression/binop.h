@@ -79,6 +79,10 @@ public:
 
   bool isShortCircuitOp() const;
 
+  inline ASTExpressionNode* getLeft() { return left; }
+  inline ASTExpressionNode* getRight() { return right; }
+  inline Type getType() const { return type; }
+
   virtual size_t getNumKids() const { return 2; }
 
   virtual ASTNode* getNthKid(size_t kid) {
@@ -99,6 +103,16 @@ public:
   virtual ASTNode* rewriteLocal(analysis::SemanticContext* ctx,
                                 RewriteMode mode);
 
+private:
+  /** The literal this operator evaluates to, if both operands are literals
+   * (and it can be evaluated now), or NULL */
+  ASTExpressionNode* fold();
+
+  /** A cheaper expression computing the same int, or NULL */
+  ASTExpressionNode* strengthReduce();
+
+public:
+
   VENOM_AST_TYPED_CLONE_WITH_IMPL_DECL_EXPR(BinopNode)
 
 protected:
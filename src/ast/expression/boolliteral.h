@@ -41,6 +41,8 @@ class BoolLiteralNode : public ASTExpressionNode {
 public:
   BoolLiteralNode(bool value) : value(value) {}
 
+  inline bool getValue() const { return value; }
+
   virtual size_t getNumKids() const { return 0; }
 
   virtual ASTNode* getNthKid(size_t kid) {
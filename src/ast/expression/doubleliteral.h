@@ -40,6 +40,8 @@ class DoubleLiteralNode : public ASTExpressionNode {
 public:
   DoubleLiteralNode(double value) : value(value) {}
 
+  inline double getValue() const { return value; }
+
   virtual size_t getNumKids() const { return 0; }
 
   virtual ASTNode* getNthKid(size_t kid) {
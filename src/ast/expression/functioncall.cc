@@ -43,6 +43,8 @@
 #include <ast/statement/synthetic/funcdecl.h>
 
 #include <analysis/boundfunction.h>
+#include <analysis/classhierarchy.h>
+#include <analysis/escapeanalysis.h>
 #include <analysis/semanticcontext.h>
 #include <analysis/symbol.h>
 #include <analysis/symboltable.h>
@@ -311,6 +313,33 @@ FunctionCallNode::rewriteAfterLift(
 
 void
 FunctionCallNode::codeGen(CodeGenerator& cg) {
+  codeGenCall(cg, false);
+}
+
+bool
+FunctionCallNode::codeGenTailCall(CodeGenerator& cg) {
+  return codeGenCall(cg, true);
+}
+
+/**
+ * Returns the method a virtual call of the method in vtable slot on the
+ * receiver of primary always runs, if the class hierarchy shows there is
+ * only one
+ */
+static FuncSymbol* FindUniqueTarget(CodeGenerator& cg,
+                                    ASTExpressionNode* primary,
+                                    size_t slot) {
+  ClassHierarchy* hierarchy = cg.getClassHierarchy();
+  AttrAccessNode* attrAccess = dynamic_cast<AttrAccessNode*>(primary);
+  if (!hierarchy || !attrAccess) return NULL;
+  InstantiatedType* type = attrAccess->getPrimary()->getStaticType();
+  if (type->isAny() || type->isPrimitive()) return NULL;
+  return hierarchy->findUniqueMethod(
+      type->findCodeGeneratableClassSymbol(), slot);
+}
+
+bool
+FunctionCallNode::codeGenCall(CodeGenerator& cg, bool tail) {
   InstantiatedType *funcType = primary->getStaticType();
   if (funcType->getType()->isClassType()) {
     // new object
@@ -344,12 +373,7 @@ FunctionCallNode::codeGen(CodeGenerator& cg) {
     cg.emitInstU32(Instruction::LOAD_LOCAL_VAR_REF, tempIdx);
 
     // call the ctor (directly, not as a virtual method)
-    size_t refIdx = cg.enterFunction(ctorSym, create);
-    cg.emitInstU32(
-        ctorSym->isNative() ?
-          Instruction::CALL_NATIVE :
-          Instruction::CALL,
-        refIdx);
+    emitCall(cg, ctorSym, false);
 
     // ctors return void, so we need to pop off the null cell
     cg.emitInst(Instruction::POP_CELL_REF);
@@ -364,6 +388,10 @@ FunctionCallNode::codeGen(CodeGenerator& cg) {
     // return the temp location, to be re-used
     cg.returnTemporaryVariable(tempSym);
 
+    // the constructed obj is not the result of a call, so this is never a
+    // tail call
+    return false;
+
   } else {
     // push arguments onto stack in reverse order
     for (ExprNodeVec::reverse_iterator it = args.rbegin();
@@ -379,13 +407,26 @@ FunctionCallNode::codeGen(CodeGenerator& cg) {
     VENOM_ASSERT_TYPEOF_PTR(FuncSymbol, bs);
     FuncSymbol *fs = static_cast<FuncSymbol*>(bs);
     if (fs->isMethod()) {
-      // emit the "this" pointer
-      primary->codeGen(cg);
-
       // lookup the method index in the vtable
       VENOM_ASSERT_TYPEOF_PTR(MethodSymbol, fs);
       MethodSymbol* ms = static_cast<MethodSymbol*>(fs);
 
+      // an object replaced by scalars has no "this" pointer
+      AttrAccessNode* attr = dynamic_cast<AttrAccessNode*>(primary);
+      if (Symbol* object = attr ? attr->getScalarObject(cg) : NULL) {
+        if (ms->isConstructor()) {
+          // super.<ctor>() in the ctor of a class whose parent is object,
+          // which does nothing (see EscapeAnalysis)
+          cg.emitInst(Instruction::PUSH_CELL_NIL);
+        } else {
+          codeGenScalarCall(cg, object, ms->getFieldIndex());
+        }
+        return false;
+      }
+
+      // emit the "this" pointer
+      primary->codeGen(cg);
+
       // pattern match to see if we are dealing with
       // super.meth( ). this case + ctors are the only case
       // where we don't use virtual dispatch for methods
@@ -419,29 +460,93 @@ FunctionCallNode::codeGen(CodeGenerator& cg) {
         ms = static_cast<MethodSymbol*>(fs);
 
         // ctors are not invoked virtually
-        bool create;
-        size_t fidx = cg.enterFunction(ms, create);
-        cg.emitInstU32(
-            !ms->isNative() ? Instruction::CALL : Instruction::CALL_NATIVE,
-            fidx);
+        return emitCall(cg, ms, tail);
       } else {
         assert(!ms->isConstructor());
         size_t slotIdx = ms->getFieldIndex();
-        cg.emitInstU32(Instruction::CALL_VIRTUAL, slotIdx);
+        if (FuncSymbol* target = FindUniqueTarget(cg, primary, slotIdx)) {
+          // a CALL does not look at the receiver, so check it here (self
+          // is never nil)
+          if (!dynamic_cast<VariableSelfNode*>(
+                static_cast<AttrAccessNode*>(primary)->getPrimary())) {
+            cg.emitInst(Instruction::CHECK_NULL_REF);
+          }
+          return emitCall(cg, target, tail);
+        }
+        // the callee could still turn out to be native, in which case
+        // TAIL_CALL_VIRTUAL continues on to the RET the caller emits
+        cg.emitInstCallVirtual(slotIdx, args.size(), tail);
+        return false;
       }
     } else {
       vector<InstantiatedType*> typeParams = getTypeParams();
       BoundFunction bf(fs, typeParams);
       fs = bf.findSpecializedFuncSymbol();
-      bool create;
-      size_t fidx = cg.enterFunction(fs, create);
-      cg.emitInstU32(
-          !fs->isNative() ? Instruction::CALL : Instruction::CALL_NATIVE,
-          fidx);
+      return emitCall(cg, fs, tail);
     }
   }
 }
 
+void
+FunctionCallNode::codeGenScalarCall(CodeGenerator& cg, Symbol* object,
+                                    size_t slot) {
+  FuncDeclNode* fdn = EscapeAnalysis::FindScalarMethod(
+      symbols->getSemanticContext(),
+      object->getInstantiatedType()->findCodeGeneratableClassSymbol(),
+      slot);
+  VENOM_ASSERT_NOT_NULL(fdn);
+  fdn->codeGenInline(cg, object);
+}
+
+void
+FunctionCallNode::codeGenScalarCtor(CodeGenerator& cg, Symbol* object) {
+  // push arguments to ctor onto stack in reverse order
+  for (ExprNodeVec::reverse_iterator it = args.rbegin();
+       it != args.rend(); ++it) {
+    (*it)->codeGen(cg);
+  }
+  FuncDeclNode* fdn = EscapeAnalysis::FindScalarCtor(
+      symbols->getSemanticContext(),
+      object->getInstantiatedType()->findCodeGeneratableClassSymbol());
+  VENOM_ASSERT_NOT_NULL(fdn);
+  fdn->codeGenInline(cg, object);
+
+  // ctors return void, so we need to pop off the null cell
+  cg.emitInst(Instruction::POP_CELL_REF);
+}
+
+/**
+ * Returns the declaration of fs, if calls to it can be generated inline.
+ * Only functions defined in the module being generated qualify, since the
+ * others are linked in, and only those whose body is not being generated
+ * already: mutually recursive functions would otherwise inline each other
+ */
+static FuncDeclNode* FindInlinable(CodeGenerator& cg, FuncSymbol* fs) {
+  if (!cg.canInline() || fs->isNative() || !cg.isLocalFunction(fs) ||
+      cg.isInBody(fs)) {
+    return NULL;
+  }
+  FuncDeclNode* fdn =
+    dynamic_cast<FuncDeclNode*>(fs->getFunctionSymbolTable()->getOwner());
+  return fdn && fdn->isInlinable() ? fdn : NULL;
+}
+
+bool
+FunctionCallNode::emitCall(CodeGenerator& cg, FuncSymbol* fs, bool tail) {
+  if (FuncDeclNode* fdn = FindInlinable(cg, fs)) {
+    fdn->codeGenInline(cg);
+    return false;
+  }
+  bool create;
+  size_t fidx = cg.enterFunction(fs, create);
+  if (fs->isNative()) {
+    cg.emitInstU32(Instruction::CALL_NATIVE, fidx);
+    return false;
+  }
+  cg.emitInstU32(tail ? Instruction::TAIL_CALL : Instruction::CALL, fidx);
+  return tail;
+}
+
 static ASTExpressionNode* createChainOfOuters(size_t n) {
   assert(n > 0);
   if (n == 1) return new VariableNodeParser("<outer>", NULL);
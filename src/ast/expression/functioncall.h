@@ -36,6 +36,13 @@
 #include <util/stl.h>
 
 namespace venom {
+
+namespace analysis {
+  /** forward decls */
+  class FuncSymbol;
+  class Symbol;
+}
+
 namespace ast {
 
 class FunctionCallNode : public ASTExpressionNode {
@@ -99,6 +106,11 @@ public:
       const LiftContext::LiftMap& liftMap,
       const std::set<analysis::BaseSymbol*>& refs);
 
+  /** Generates this constructor call inline, on object which is replaced
+   * by scalars (see CodeGenerator::addScalarObject()) */
+  void codeGenScalarCtor(backend::CodeGenerator& cg,
+                         analysis::Symbol* object);
+
   VENOM_AST_TYPED_CLONE_EXPR(FunctionCallNode)
 
 protected:
@@ -110,9 +122,30 @@ protected:
 public:
   virtual void codeGen(backend::CodeGenerator& cg);
 
+  /**
+   * Generates the call as the expression of a return statement (ie in tail
+   * position). Returns true if the call replaces the caller's frame, in
+   * which case it does not come back and no RET is needed after it
+   */
+  bool codeGenTailCall(backend::CodeGenerator& cg);
+
 protected:
   virtual void checkAndInitTypeParams(analysis::SemanticContext* ctx) = 0;
 
+  bool codeGenCall(backend::CodeGenerator& cg, bool tail);
+
+  /** Emits a direct call to fs (a CALL, CALL_NATIVE, or TAIL_CALL), or the
+   * body of fs if it can be inlined, and returns true if it was a
+   * TAIL_CALL */
+  static bool emitCall(backend::CodeGenerator& cg, analysis::FuncSymbol* fs,
+                       bool tail);
+
+  /** Generates the call of the method in vtable slot inline, on object
+   * which is replaced by scalars */
+  void codeGenScalarCall(backend::CodeGenerator& cg,
+                         analysis::Symbol* object,
+                         size_t slot);
+
   ASTExpressionNode* cloneForLiftImplHelper(LiftContext& ctx);
 
   ASTExpressionNode* primary;
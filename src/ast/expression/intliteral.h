@@ -41,6 +41,8 @@ class IntLiteralNode : public ASTExpressionNode {
 public:
   IntLiteralNode(int64_t value) : value(value) {}
 
+  inline int64_t getValue() const { return value; }
+
   virtual size_t getNumKids() const { return 0; }
 
   virtual ASTNode* getNthKid(size_t kid) {
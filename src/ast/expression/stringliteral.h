@@ -42,6 +42,8 @@ class StringLiteralNode : public ASTExpressionNode {
 public:
   StringLiteralNode(const std::string& value) : value(value) {}
 
+  inline const std::string& getValue() const { return value; }
+
   virtual size_t getNumKids() const { return 0; }
 
   virtual ASTNode* getNthKid(size_t kid) {
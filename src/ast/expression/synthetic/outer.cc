@@ -63,7 +63,7 @@ OuterNode::codeGen(CodeGenerator& cg) {
 
   // code-gen the <outer> attribute
   size_t slotIdx = outerSym->getFieldIndex();
-  cg.emitInstU32(Instruction::GET_ATTR_OBJ_REF, slotIdx);
+  cg.emitInstField(slotIdx, true);
 }
 
 OuterNode*
@@ -27,14 +27,20 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <ast/expression/boolliteral.h>
+#include <ast/expression/doubleliteral.h>
+#include <ast/expression/intliteral.h>
 #include <ast/expression/unop.h>
 
 #include <analysis/semanticcontext.h>
 #include <analysis/symbol.h>
 #include <analysis/symboltable.h>
 
+#include <backend/codegenerator.h>
+
 using namespace std;
 using namespace venom::analysis;
+using namespace venom::backend;
 
 namespace venom {
 namespace ast {
@@ -85,6 +91,69 @@ UnopNode::typeCheckImpl(SemanticContext* ctx,
   return NULL;
 }
 
+ASTNode*
+UnopNode::rewriteLocal(SemanticContext* ctx, RewriteMode mode) {
+  ASTNode* ret = ASTExpressionNode::rewriteLocal(ctx, mode);
+  if (mode != Optimize) return ret;
+  assert(!ret);
+
+  // fold the operator over a literal (see BinopNode::fold())
+  ASTExpressionNode* rep = NULL;
+  if (IntLiteralNode* i = dynamic_cast<IntLiteralNode*>(kid)) {
+    switch (type) {
+    case PLUS:    rep = new IntLiteralNode(i->getValue()); break;
+    case MINUS:   rep = new IntLiteralNode(-uint64_t(i->getValue())); break;
+    case CMP_NOT: rep = new BoolLiteralNode(!i->getValue()); break;
+    case BIT_NOT: rep = new IntLiteralNode(~i->getValue()); break;
+    default: assert(false);
+    }
+  } else if (DoubleLiteralNode* d = dynamic_cast<DoubleLiteralNode*>(kid)) {
+    switch (type) {
+    case PLUS:    rep = new DoubleLiteralNode(d->getValue()); break;
+    case MINUS:   rep = new DoubleLiteralNode(-d->getValue()); break;
+    case CMP_NOT: rep = new BoolLiteralNode(!d->getValue()); break;
+    default: assert(false);
+    }
+  } else if (BoolLiteralNode* b = dynamic_cast<BoolLiteralNode*>(kid)) {
+    if (type == CMP_NOT) rep = new BoolLiteralNode(!b->getValue());
+  }
+  return rep ? replace(ctx, rep) : NULL;
+}
+
+void
+UnopNode::codeGen(CodeGenerator& cg) {
+  kid->codeGen(cg);
+  InstantiatedType* kidType = kid->getStaticType();
+  Instruction::Opcode op;
+  switch (type) {
+  case PLUS:
+    op = kidType->isInt() ? Instruction::UNOP_PLUS_INT :
+                            Instruction::UNOP_PLUS_FLOAT;
+    break;
+  case MINUS:
+    op = kidType->isInt() ? Instruction::UNOP_MINUS_INT :
+                            Instruction::UNOP_MINUS_FLOAT;
+    break;
+  case CMP_NOT:
+    if (kidType->isInt()) {
+      op = Instruction::UNOP_CMP_NOT_INT;
+    } else if (kidType->isFloat()) {
+      op = Instruction::UNOP_CMP_NOT_FLOAT;
+    } else if (kidType->isBool()) {
+      op = Instruction::UNOP_CMP_NOT_BOOL;
+    } else {
+      op = Instruction::UNOP_CMP_NOT_REF;
+    }
+    break;
+  case BIT_NOT:
+    assert(kidType->isInt());
+    op = Instruction::UNOP_BIT_NOT_INT;
+    break;
+  default: VENOM_NOT_REACHED;
+  }
+  cg.emitInst(op);
+}
+
 UnopNode*
 UnopNode::cloneImpl(CloneMode::Type t) {
   return new UnopNode(kid->clone(t), type);
@@ -79,6 +79,11 @@ public:
     return false;
   }
 
+  virtual ASTNode* rewriteLocal(analysis::SemanticContext* ctx,
+                                RewriteMode mode);
+
+  virtual void codeGen(backend::CodeGenerator& cg);
+
   VENOM_AST_TYPED_CLONE_WITH_IMPL_DECL_EXPR(UnopNode)
 
 protected:
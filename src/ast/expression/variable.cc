@@ -331,8 +331,8 @@ VariableSelfNode::typeCheckImpl(SemanticContext* ctx,
 
 void
 VariableSelfNode::codeGen(CodeGenerator& cg) {
-  // self is always slot 0
-  cg.emitInstU32(Instruction::LOAD_LOCAL_VAR_REF, 0);
+  // self is slot 0, unless this is the body of an inlined method
+  cg.emitInstU32(Instruction::LOAD_LOCAL_VAR_REF, cg.getSelfSlot());
 }
 
 VariableSelfNode*
@@ -375,8 +375,8 @@ VariableSuperNode::typeCheckImpl(SemanticContext* ctx,
 
 void
 VariableSuperNode::codeGen(CodeGenerator& cg) {
-  // super (self) is always slot 0
-  cg.emitInstU32(Instruction::LOAD_LOCAL_VAR_REF, 0);
+  // super (self) is slot 0, unless this is the body of an inlined method
+  cg.emitInstU32(Instruction::LOAD_LOCAL_VAR_REF, cg.getSelfSlot());
 }
 
 VariableSuperNode*
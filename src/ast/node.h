@@ -286,6 +286,10 @@ public:
    * macro in parser/driver.cc
    */
   enum RewriteMode {
+    Optimize,      // fold operators over literals (before string + turns
+                   // into concat), strength reduce int arithmetic, and
+                   // drop if branches which cannot be taken. skipped at -O0
+
     DeSugar,       // rewrite list/dict literals into lower-level ops
                    // rewrite + -> concat for strings
                    // rewrite initialization statements into ctor body
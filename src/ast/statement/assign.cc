@@ -304,15 +304,24 @@ AssignNode::CodeGenAssignment(CodeGenerator& cg,
   Symbol* sym = static_cast<Symbol*>(bs);
 
   bool refCnt = variable->getStaticType()->isRefCounted();
-  if (sym->isModuleLevelSymbol() || sym->isObjectField()) {
-    variable->codeGen(cg);
+  AttrAccessNode* attr = dynamic_cast<AttrAccessNode*>(variable);
+  if (Symbol* object = attr ? attr->getScalarObject(cg) : NULL) {
+    // the field of an object replaced by scalars
     value->codeGen(cg);
-    size_t slotIdx = sym->getFieldIndex();
     cg.emitInstU32(
         refCnt ?
-          Instruction::SET_ATTR_OBJ_REF :
-          Instruction::SET_ATTR_OBJ,
-        slotIdx);
+          Instruction::STORE_LOCAL_VAR_REF :
+          Instruction::STORE_LOCAL_VAR,
+        cg.getScalarFieldSlot(object, sym->getFieldIndex()));
+  } else if (cg.isScalarObject(sym)) {
+    // the object is constructed in place, by the assignment
+    VENOM_ASSERT_TYPEOF_PTR(FunctionCallNode, value);
+    static_cast<FunctionCallNode*>(value)->codeGenScalarCtor(cg, sym);
+  } else if (sym->isModuleLevelSymbol() || sym->isObjectField()) {
+    variable->codeGen(cg);
+    value->codeGen(cg);
+    size_t slotIdx = sym->getFieldIndex();
+    cg.emitInstField(slotIdx, refCnt, true);
   } else {
     value->codeGen(cg);
     // no codegen for variable, since we can just store directly
@@ -65,6 +65,9 @@ public:
     delete value;
   }
 
+  inline ASTExpressionNode* getVariable() { return variable; }
+  inline ASTExpressionNode* getValue() { return value; }
+
   virtual size_t getNumKids() const { return 2; }
 
   virtual ASTNode* getNthKid(size_t kid) {
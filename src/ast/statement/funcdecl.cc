@@ -31,6 +31,7 @@
 #include <set>
 
 #include <analysis/boundfunction.h>
+#include <analysis/escapeanalysis.h>
 #include <analysis/semanticcontext.h>
 #include <analysis/symbol.h>
 #include <analysis/symboltable.h>
@@ -52,6 +53,8 @@
 
 #include <backend/codegenerator.h>
 
+#include <util/stl.h>
+
 using namespace std;
 using namespace venom::analysis;
 using namespace venom::backend;
@@ -120,6 +123,15 @@ void FuncDeclNode::registerSymbol(SemanticContext* ctx) {
     throw SemanticViolationException("Duplicate parameter names");
   }
 
+  // there is only a function type for up to FuncTypes.size() - 1
+  // parameters. this also keeps every function, with its self, within
+  // backend::FunctionDescriptor::MaxNumArgs arguments
+  if (params.size() >= Type::FuncTypes.size()) {
+    throw SemanticViolationException(
+        "Function " + name + " has too many parameters (at most " +
+        stringify(Type::FuncTypes.size() - 1) + " are allowed)");
+  }
+
   // type params
   checkAndInitTypeParams(ctx);
   vector<InstantiatedType*> typeParamTypes = getTypeParams();
@@ -292,7 +304,16 @@ FuncDeclNode::codeGen(CodeGenerator& cg) {
     assert(idx == 0);
     cg.emitInstU32(Instruction::STORE_LOCAL_VAR_REF, idx);
   }
+  cg.setSelfSlot(0);
 
+  cg.enterBody(static_cast<FuncSymbol*>(bs));
+  codeGenStoreParams(cg);
+  codeGenBody(cg);
+  cg.leaveBody();
+}
+
+void
+FuncDeclNode::codeGenStoreParams(CodeGenerator& cg) {
   for (ExprNodeVec::iterator it = params.begin();
        it != params.end(); ++it) {
     VENOM_ASSERT_TYPEOF_PTR(VariableNode, *it);
@@ -302,18 +323,149 @@ FuncDeclNode::codeGen(CodeGenerator& cg) {
       stmts->getSymbolTable()->findSymbol(
           vn->getName(), SymbolTable::NoRecurse, t);
     assert(psym);
-    // store symbol from stack into local variable slot
+    // store symbol from stack into local variable slot. an inlined function
+    // reuses its slots when it is inlined more than once into a caller
     bool create;
     size_t idx = cg.createLocalVariable(psym, create);
-    assert(create);
+    assert(create || cg.getInlineExitLabel());
     cg.emitInstU32(
         psym->getInstantiatedType()->isPrimitive() ?
           Instruction::STORE_LOCAL_VAR : Instruction::STORE_LOCAL_VAR_REF,
         idx);
   }
+}
+
+/**
+ * Counts the nodes of the tree rooted at node into n, giving up (and
+ * returning false) once there are more than limit of them, or if the tree
+ * contains a call to fs
+ */
+static bool CountInlineCost(ASTNode* node, FuncSymbol* fs,
+                            size_t limit, size_t& n) {
+  if (++n > limit) return false;
+  if (FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(node)) {
+    if (call->getPrimary()->getSymbol() == fs) return false;
+  }
+  for (size_t i = 0; i < node->getNumKids(); i++) {
+    ASTNode* kid = node->getNthKid(i);
+    if (kid && !CountInlineCost(kid, fs, limit, n)) return false;
+  }
+  return true;
+}
+
+void
+FuncDeclNode::codeGenBody(CodeGenerator& cg) {
+  EscapeAnalysis escapes(symbols->getSemanticContext(), this,
+                         cg.canInline(), cg.getBodies());
+  const vector<Symbol*>& objects = escapes.getScalarObjects();
+  for (vector<Symbol*>::const_iterator it = objects.begin();
+       it != objects.end(); ++it) {
+    cg.addScalarObject(*it);
+  }
   stmts->codeGen(cg);
 }
 
+static bool MentionsSelf(ASTNode* node) {
+  if (dynamic_cast<VariableSelfNode*>(node) ||
+      dynamic_cast<VariableSuperNode*>(node)) return true;
+  for (size_t i = 0; i < node->getNumKids(); i++) {
+    ASTNode* kid = node->getNthKid(i);
+    if (kid && MentionsSelf(kid)) return true;
+  }
+  return false;
+}
+
+void
+FuncDeclNode::codeGenScalarFields(CodeGenerator& cg, Symbol* scalarSelf) {
+  assert(isCtor());
+
+  // the fields the ctor starts out assigning (after the call to the ctor of
+  // object), before it reads any field, need no initial value
+  set<size_t> assigned;
+  StmtListNode* body = getStmts();
+  for (size_t i = 1; i < body->getNumKids(); i++) {
+    AssignNode* assign = dynamic_cast<AssignNode*>(body->getNthKid(i));
+    AttrAccessNode* attr =
+      assign ? dynamic_cast<AttrAccessNode*>(assign->getVariable()) : NULL;
+    if (!attr || !dynamic_cast<VariableSelfNode*>(attr->getPrimary()) ||
+        MentionsSelf(assign->getValue())) break;
+    BaseSymbol* bs = attr->getSymbol();
+    VENOM_ASSERT_TYPEOF_PTR(Symbol, bs);
+    assigned.insert(static_cast<Symbol*>(bs)->getFieldIndex());
+  }
+
+  vector<Symbol*> attributes;
+  vector<FuncSymbol*> methods;
+  scalarSelf->getInstantiatedType()->findCodeGeneratableClassSymbol()
+    ->linearizedOrder(attributes, methods);
+  for (vector<Symbol*>::iterator it = attributes.begin();
+       it != attributes.end(); ++it) {
+    if (assigned.count((*it)->getFieldIndex())) continue;
+    InstantiatedType* type = (*it)->getInstantiatedType();
+    size_t idx = cg.getScalarFieldSlot(scalarSelf, (*it)->getFieldIndex());
+    if (type->isInt()) {
+      cg.emitInstI64(Instruction::PUSH_CELL_INT, 0);
+    } else if (type->isFloat()) {
+      cg.emitInstDouble(Instruction::PUSH_CELL_FLOAT, 0.0);
+    } else if (type->isBool()) {
+      cg.emitInstBool(Instruction::PUSH_CELL_BOOL, false);
+    } else {
+      cg.emitInst(Instruction::PUSH_CELL_NIL);
+    }
+    cg.emitInstU32(
+        type->isPrimitive() ?
+          Instruction::STORE_LOCAL_VAR : Instruction::STORE_LOCAL_VAR_REF,
+        idx);
+  }
+}
+
+bool
+FuncDeclNode::isInlinable() {
+  if (isTypeParameterized()) return false;
+  BaseSymbol *bs = getSymbol();
+  VENOM_ASSERT_TYPEOF_PTR(FuncSymbol, bs);
+  size_t n = 0;
+  return CountInlineCost(stmts, static_cast<FuncSymbol*>(bs),
+                         InlineBudget, n);
+}
+
+void
+FuncDeclNode::codeGenInline(CodeGenerator& cg, Symbol* scalarSelf) {
+  assert(!isTypeParameterized());
+  BaseSymbol *bs = getSymbol();
+  VENOM_ASSERT_TYPEOF_PTR(FuncSymbol, bs);
+  assert(!cg.isInBody(static_cast<FuncSymbol*>(bs)));
+  Label* exit = cg.newLabel();
+  Label* prevExit = cg.enterInline(exit);
+  cg.enterBody(static_cast<FuncSymbol*>(bs));
+
+  // the arguments are stored into slots of the caller's frame, which
+  // releases whatever references are left in them when it returns, just
+  // as our own frame would have
+  uint32_t prevSelf = cg.getSelfSlot();
+  Symbol* prevScalarSelf = cg.getScalarSelf();
+  cg.setScalarSelf(scalarSelf);
+  Symbol* self = NULL;
+  if (hasLocationContext(TopLevelClassBody) && !scalarSelf) {
+    self = cg.createTemporaryVariable();
+    bool create;
+    size_t idx = cg.createLocalVariable(self, create);
+    cg.emitInstU32(Instruction::STORE_LOCAL_VAR_REF, idx);
+    cg.setSelfSlot(idx);
+  }
+
+  codeGenStoreParams(cg);
+  if (scalarSelf && isCtor()) codeGenScalarFields(cg, scalarSelf);
+  codeGenBody(cg);
+  cg.bindLabel(exit);
+
+  if (self) cg.returnTemporaryVariable(self);
+  cg.setSelfSlot(prevSelf);
+  cg.setScalarSelf(prevScalarSelf);
+  cg.leaveBody();
+  cg.leaveInline(prevExit);
+}
+
 FuncDeclNode*
 FuncDeclNode::newFuncDeclNodeForLift(
       LiftContext& ctx,
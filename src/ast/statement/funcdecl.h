@@ -124,9 +124,37 @@ public:
 
   virtual void codeGen(backend::CodeGenerator& cg);
 
+  /** Can a call to this function be generated inline? Only if the body is
+   * small and does not call this function again */
+  bool isInlinable();
+
+  /** Generates the body of this function in place of a call to it, which
+   * has already pushed the arguments (and the "this" pointer for methods).
+   * Leaves the return value on the stack, as the call would.
+   *
+   * If scalarSelf is set, this is a constructor or method of an object
+   * replaced by scalars (see analysis::EscapeAnalysis), and there is no
+   * "this" pointer */
+  void codeGenInline(backend::CodeGenerator& cg,
+                     analysis::Symbol* scalarSelf = NULL);
+
   VENOM_AST_TYPED_CLONE_STMT(FuncDeclNode)
 
 protected:
+  /** Max number of AST nodes in the body of an inlinable function */
+  static const size_t InlineBudget = 32;
+
+  /** Stores the arguments from the stack into local variable slots */
+  void codeGenStoreParams(backend::CodeGenerator& cg);
+
+  /** Generates the statements, replacing the objects which do not escape
+   * them by scalars */
+  void codeGenBody(backend::CodeGenerator& cg);
+
+  /** Gives the fields of scalarSelf the values ALLOC_OBJ would have */
+  void codeGenScalarFields(backend::CodeGenerator& cg,
+                           analysis::Symbol* scalarSelf);
+
   virtual void checkAndInitTypeParams(analysis::SemanticContext* ctx) = 0;
 
   virtual void checkAndInitReturnType(analysis::SemanticContext* ctx) = 0;
@@ -34,6 +34,8 @@
 #include <analysis/symboltable.h>
 #include <analysis/type.h>
 
+#include <ast/expression/boolliteral.h>
+#include <ast/expression/intliteral.h>
 #include <ast/statement/ifstmt.h>
 
 #include <backend/bytecode.h>
@@ -52,6 +54,30 @@ void IfStmtNode::typeCheck(SemanticContext* ctx, InstantiatedType* expected) {
   false_branch->typeCheck(ctx, expected);
 }
 
+ASTNode*
+IfStmtNode::rewriteLocal(SemanticContext* ctx, RewriteMode mode) {
+  ASTNode* ret = ASTNode::rewriteLocal(ctx, mode);
+  VENOM_ASSERT_NULL(ret);
+  if (mode != Optimize) return NULL;
+
+  // the condition may have been folded into a literal
+  bool taken;
+  if (BoolLiteralNode* b = dynamic_cast<BoolLiteralNode*>(cond)) {
+    taken = b->getValue();
+  } else if (IntLiteralNode* i = dynamic_cast<IntLiteralNode*>(cond)) {
+    taken = i->getValue();
+  } else {
+    return NULL;
+  }
+
+  // the branch which is taken replaces this statement. it is moved (not
+  // cloned and re-checked), so that it keeps the scope it was checked in
+  ASTStatementNode*& branch = taken ? true_branch : false_branch;
+  ASTStatementNode* rep = branch;
+  branch = NULL;
+  return rep;
+}
+
 ASTNode*
 IfStmtNode::rewriteReturn(SemanticContext* ctx) {
   ASTNode *trueRep = true_branch->rewriteReturn(ctx);
@@ -75,6 +75,9 @@ public:
   virtual void typeCheck(analysis::SemanticContext* ctx,
                          analysis::InstantiatedType* expected = NULL);
 
+  virtual ASTNode* rewriteLocal(analysis::SemanticContext* ctx,
+                                RewriteMode mode);
+
   virtual ASTNode* rewriteReturn(analysis::SemanticContext* ctx);
 
   virtual void codeGen(backend::CodeGenerator& cg);
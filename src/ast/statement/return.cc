@@ -34,6 +34,8 @@
 #include <analysis/symboltable.h>
 #include <analysis/type.h>
 
+#include <ast/expression/functioncall.h>
+
 #include <ast/statement/funcdecl.h>
 #include <ast/statement/return.h>
 
@@ -79,8 +81,19 @@ void ReturnNode::typeCheck(SemanticContext* ctx, InstantiatedType* expected) {
 
 void
 ReturnNode::codeGen(CodeGenerator& cg) {
+  if (Label* exit = cg.getInlineExitLabel()) {
+    // returning from an inlined function: the result stays on the stack for
+    // the caller, and no call can reuse the caller's frame
+    if (expr) expr->codeGen(cg);
+    else cg.emitInst(Instruction::PUSH_CELL_NIL);
+    cg.emitInstLabel(Instruction::JUMP, exit);
+    return;
+  }
   if (!expr) {
     cg.emitInst(Instruction::PUSH_CELL_NIL);
+  } else if (FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(expr)) {
+    // the call is in tail position, so it can reuse our frame
+    if (call->codeGenTailCall(cg)) return;
   } else {
     expr->codeGen(cg);
   }
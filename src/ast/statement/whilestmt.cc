@@ -33,6 +33,16 @@
 #include <analysis/symbol.h>
 #include <analysis/symboltable.h>
 
+#include <ast/expression/arrayaccess.h>
+#include <ast/expression/assignexpr.h>
+#include <ast/expression/attraccess.h>
+#include <ast/expression/binop.h>
+#include <ast/expression/dictliteral.h>
+#include <ast/expression/functioncall.h>
+#include <ast/expression/intliteral.h>
+#include <ast/expression/variable.h>
+#include <ast/statement/assign.h>
+#include <ast/statement/stmtlist.h>
 #include <ast/statement/whilestmt.h>
 
 #include <backend/bytecode.h>
@@ -45,8 +55,170 @@ using namespace venom::backend;
 namespace venom {
 namespace ast {
 
+// Bounds check elimination. In a loop of the form
+//
+//   while i < l.size() do
+//     ...
+//     i = i + 1;
+//   end
+//
+// l[i] is in range anywhere in the body (before the increment), as long as
+//   (1) i is never negative: it is a local which is only ever assigned a
+//       non-negative int literal or i + 1 (which cannot overflow in practice),
+//   (2) the body assigns to i only in its last statement, and never to l,
+//   (3) nothing in the body can shrink (or grow) l. Only append() changes the
+//       size of a list, but any user code could reach l through an alias, so
+//       the body may only call the (native) methods of lists and strings.
+// Loops which do not fit keep their (cheap) range checks.
+
+/** The local variable node refers to, or NULL if node is anything else */
+static Symbol* LocalSymbolOf(ASTNode* node) {
+  VariableNode* vn = dynamic_cast<VariableNode*>(node);
+  if (!vn) return NULL;
+  Symbol* sym = dynamic_cast<Symbol*>(vn->getSymbol());
+  if (!sym || sym->isPromoteToRef() || sym->isObjectField() ||
+      sym->isModuleLevelSymbol()) return NULL;
+  return sym;
+}
+
+/** If node is an assignment, sets variable and value */
+static bool IsAssignment(ASTNode* node,
+                         ASTExpressionNode*& variable,
+                         ASTExpressionNode*& value) {
+  if (AssignNode* an = dynamic_cast<AssignNode*>(node)) {
+    variable = an->getVariable();
+    value = an->getValue();
+    return true;
+  }
+  if (AssignExprNode* aen = dynamic_cast<AssignExprNode*>(node)) {
+    variable = aen->getVariable();
+    value = aen->getValue();
+    return true;
+  }
+  return false;
+}
+
+/** Is value sym + 1? */
+static bool IsIncrementOf(ASTExpressionNode* value, Symbol* sym) {
+  BinopNode* bn = dynamic_cast<BinopNode*>(value);
+  if (!bn || bn->getType() != BinopNode::ADD) return false;
+  IntLiteralNode* one = dynamic_cast<IntLiteralNode*>(bn->getRight());
+  return LocalSymbolOf(bn->getLeft()) == sym && one && one->getValue() == 1;
+}
+
+/** Does node (or anything below it) assign to sym? */
+static bool AssignsTo(ASTNode* node, Symbol* sym) {
+  ASTExpressionNode *variable, *value;
+  if (IsAssignment(node, variable, value) &&
+      LocalSymbolOf(variable) == sym) return true;
+  for (size_t i = 0; i < node->getNumKids(); i++) {
+    ASTNode* kid = node->getNthKid(i);
+    if (kid && AssignsTo(kid, sym)) return true;
+  }
+  return false;
+}
+
+/** Checks condition (1) for every assignment to sym below node, and sets
+ * found if loop is below node */
+static bool NeverNegative(ASTNode* node, Symbol* sym,
+                          WhileStmtNode* loop, bool& found) {
+  if (node == loop) found = true;
+  ASTExpressionNode *variable, *value;
+  if (IsAssignment(node, variable, value) &&
+      LocalSymbolOf(variable) == sym) {
+    IntLiteralNode* lit = dynamic_cast<IntLiteralNode*>(value);
+    if (!(lit && lit->getValue() >= 0) && !IsIncrementOf(value, sym)) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < node->getNumKids(); i++) {
+    ASTNode* kid = node->getNthKid(i);
+    if (kid && !NeverNegative(kid, sym, loop, found)) return false;
+  }
+  return true;
+}
+
+/** Checks condition (3) for node and everything below it */
+static bool CannotResizeLists(ASTNode* node) {
+  if (dynamic_cast<DictLiteralNode*>(node)) {
+    // hashes its keys, which can call user code
+    return false;
+  }
+  if (FunctionCallNode* fcn = dynamic_cast<FunctionCallNode*>(node)) {
+    AttrAccessNode* meth = dynamic_cast<AttrAccessNode*>(fcn->getPrimary());
+    if (!meth) return false;
+    InstantiatedType* recv = meth->getPrimary()->getStaticType();
+    bool native = recv && (recv->isString() ||
+        (recv->getType()->isListType() && meth->getName() != "append"));
+    if (!native) return false;
+  }
+  for (size_t i = 0; i < node->getNumKids(); i++) {
+    ASTNode* kid = node->getNthKid(i);
+    if (kid && !CannotResizeLists(kid)) return false;
+  }
+  return true;
+}
+
+static void MarkAccesses(ASTNode* node, Symbol* list, Symbol* index) {
+  if (ArrayAccessNode* aan = dynamic_cast<ArrayAccessNode*>(node)) {
+    if (LocalSymbolOf(aan->getPrimary()) == list &&
+        LocalSymbolOf(aan->getIndex()) == index) {
+      aan->markIndexInRange();
+    }
+  }
+  for (size_t i = 0; i < node->getNumKids(); i++) {
+    ASTNode* kid = node->getNthKid(i);
+    if (kid) MarkAccesses(kid, list, index);
+  }
+}
+
+void
+WhileStmtNode::markInRangeListAccesses() {
+  // match i < l.size()
+  BinopNode* bn = dynamic_cast<BinopNode*>(cond);
+  if (!bn || bn->getType() != BinopNode::CMP_LT) return;
+  Symbol* index = LocalSymbolOf(bn->getLeft());
+  if (!index || !bn->getLeft()->getStaticType()->isInt()) return;
+  FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(bn->getRight());
+  if (!call || call->getNumKids() != 1) return;
+  AttrAccessNode* size = dynamic_cast<AttrAccessNode*>(call->getPrimary());
+  if (!size || size->getName() != "size") return;
+  Symbol* list = LocalSymbolOf(size->getPrimary());
+  if (!list ||
+      !size->getPrimary()->getStaticType()->getType()->isListType()) return;
+
+  // (1): i must be declared by an assignment (not as a parameter), and every
+  // assignment in its scope (which must contain this loop) keeps it >= 0
+  ASTNode* decl = index->getDecl();
+  if (!dynamic_cast<AssignNode*>(decl) &&
+      !dynamic_cast<AssignExprNode*>(decl)) return;
+  ASTNode* scope = index->getDefinedSymbolTable()->getOwner();
+  bool found = false;
+  if (!scope || !NeverNegative(scope, index, this, found) || !found) return;
+
+  // (2)
+  StmtListNode* body = dynamic_cast<StmtListNode*>(stmts);
+  if (!body || !body->getNumKids()) return;
+  for (size_t i = 0; i < body->getNumKids(); i++) {
+    ASTNode* stmt = body->getNthKid(i);
+    if (AssignsTo(stmt, list)) return;
+    if (!AssignsTo(stmt, index)) continue;
+    ASTExpressionNode *variable, *value;
+    bool last = i + 1 == body->getNumKids();
+    if (!last || !IsAssignment(stmt, variable, value) ||
+        !IsIncrementOf(value, index)) return;
+  }
+
+  // (3)
+  if (!CannotResizeLists(body)) return;
+
+  MarkAccesses(body, list, index);
+}
+
 void
 WhileStmtNode::codeGen(CodeGenerator& cg) {
+  markInRangeListAccesses();
+
   Label *loop = cg.newBoundLabel();
   Label *done = cg.newLabel();
   cond->codeGen(cg);
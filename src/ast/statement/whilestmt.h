@@ -74,6 +74,13 @@ public:
 
   VENOM_AST_TYPED_CLONE_WITH_IMPL_DECL_STMT(WhileStmtNode)
 
+private:
+  /** Marks the list accesses in stmts whose index is known to be in range
+   * (see the comment in whilestmt.cc) */
+  void markInRangeListAccesses();
+
+public:
+
   virtual void print(std::ostream& o, size_t indent = 0) {
     o << "(while ";
     cond->print(o, indent);
@@ -0,0 +1,295 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef VENOM_BACKEND_AOTRUNTIME_H
+#define VENOM_BACKEND_AOTRUNTIME_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <backend/linker.h>
+#include <backend/vm.h>
+
+#include <runtime/box.h>
+#include <runtime/builtin.h>
+#include <runtime/venomdict.h>
+#include <runtime/venomlist.h>
+#include <runtime/venomobject.h>
+#include <runtime/venomref.h>
+#include <runtime/venomstring.h>
+
+#include <util/macros.h>
+
+namespace venom {
+namespace backend {
+
+/**
+ * AotRuntime is what the C++ programs written by CppEmitter are compiled
+ * against. Each Venom function becomes a CompiledFunction, which keeps the
+ * operand stack and frame of the bytecode function it was compiled from,
+ * and does whatever an instruction's handler would do in a few lines of
+ * C++ (or by calling one of the helpers below, which mirror the handlers in
+ * bytecode.cc). Instead of dispatching on the next instruction, control
+ * simply falls through, or jumps to a label.
+ */
+class AotRuntime {
+public:
+  typedef runtime::venom_cell venom_cell;
+
+  /** Runs the program exec, whose functions are all compiled, printing any
+   * uncaught exception as venom does. Returns the exit status of the
+   * program. Takes ownership of exec */
+  static int Run(Executable* exec);
+
+  /** A double from its bit pattern, so that every value round trips */
+  static inline double Float(uint64_t bits) {
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+  }
+
+  /** Pushes the frame of desc, whose arguments are below sp. Returns the
+   * local variables of the frame */
+  static inline venom_cell* Enter(ExecutionContext* ctx, venom_cell* sp,
+                                  FunctionDescriptor* desc) {
+    ctx->program_stack.checkHeadroom(sp, desc->getMaxStackDepth());
+    ctx->new_frame(NULL, desc);
+    return ctx->frame->locals();
+  }
+
+  /** Pops the current frame (as RET, or a tail call, does) */
+  static inline void Leave(ExecutionContext* ctx, venom_cell* sp) {
+    ctx->program_stack.setTop(sp);
+    ctx->pop_frame();
+  }
+
+  /** Calls desc, whose arguments are on top of the stack */
+  static inline venom_cell* Call(ExecutionContext* ctx, venom_cell* sp,
+                                 FunctionDescriptor* desc) {
+    if (desc->isCompiled()) return desc->getCompiledFunction()(ctx, sp);
+    ctx->program_stack.setTop(sp);
+    desc->dispatch(ctx);
+    return ctx->program_stack.getTop();
+  }
+
+  /** The method in the slot of the vtable of the receiver on top of the
+   * stack */
+  static inline FunctionDescriptor* Lookup(venom_cell* sp, uint32_t slot) {
+    CheckNullPointer(sp[-1]);
+    venom_cell::AssertNonZeroRefCount(sp[-1]);
+    return sp[-1].asRawObject()->getClassObj()->vtable[slot];
+  }
+
+  static inline void CheckNullPointer(const venom_cell& cell) {
+    if (VENOM_UNLIKELY(!cell.asRawObject())) {
+      throw VenomRuntimeException("Null pointer dereferenced");
+    }
+  }
+
+  /** Releases a reference popped off of the stack */
+  static inline void Release(ExecutionContext* ctx, venom_cell* sp,
+                             venom_cell& cell) {
+    venom_cell::AssertNonZeroRefCount(cell);
+    ctx->program_stack.setTop(sp);
+    cell.decRef();
+  }
+
+  static inline venom_cell& Const(ExecutionContext* ctx, uint32_t n) {
+    return ctx->constant_pool[n];
+  }
+
+  /** The helpers below each do the same as the handler of the instruction
+   * they are named after (see bytecode.cc) */
+
+  static inline void PushConst(ExecutionContext* ctx, venom_cell*& sp,
+                               uint32_t n) {
+    venom_cell& konst = Const(ctx, n);
+    konst.incRef();
+    *sp++ = konst;
+  }
+
+  /** PUSH_CONST_BORROW and LOAD_LOCAL_VAR_BORROW */
+  static inline void PushBorrowed(venom_cell*& sp, venom_cell& cell) {
+    venom_cell::BeginBorrow(cell);
+    *sp++ = cell;
+  }
+
+  static inline void AllocObj(ExecutionContext* ctx, venom_cell*& sp,
+                              runtime::venom_class_object* class_obj) {
+    ctx->program_stack.setTop(sp);
+    ctx->allocationSafepoint();
+    runtime::venom_object* obj = runtime::venom_object::allocObj(class_obj);
+    obj->incRef();
+    *sp++ = venom_cell(obj);
+  }
+
+  static inline void StoreLocalRef(ExecutionContext* ctx, venom_cell*& sp,
+                                   venom_cell& local) {
+    venom_cell opnd0 = *--sp;
+    venom_cell::AssertNonZeroRefCount(opnd0);
+    if (VENOM_UNLIKELY(ctx->defersRefCounts())) {
+      local = opnd0;
+      Release(ctx, sp, opnd0);
+      ctx->safepoint();
+      return;
+    }
+    if (local.asRawObject()) Release(ctx, sp, local);
+    local = opnd0;
+  }
+
+  /** STORE_LOCAL_VAR_REF_BORROW */
+  static inline void StoreLocalBorrowed(ExecutionContext* ctx,
+                                        venom_cell*& sp, venom_cell& local) {
+    venom_cell opnd0 = *--sp;
+    venom_cell::AssertNonZeroRefCount(opnd0);
+    if (VENOM_LIKELY(!ctx->defersRefCounts())) {
+      opnd0.incRef();
+      if (local.asRawObject()) Release(ctx, sp, local);
+    }
+    local = opnd0;
+    venom_cell::EndBorrow(opnd0);
+  }
+
+  static inline void Dup(venom_cell*& sp, uint32_t n) {
+    venom_cell opnd0 = sp[-1];
+    for (uint32_t i = 0; i < n; i++) *sp++ = opnd0;
+  }
+
+  static inline void DupRef(venom_cell*& sp, uint32_t n) {
+    venom_cell opnd0 = sp[-1];
+    venom_cell::AssertNonZeroRefCount(opnd0);
+    for (uint32_t i = 0; i < n; i++) {
+      opnd0.incRef();
+      *sp++ = opnd0;
+    }
+  }
+
+  /** The object is borrowed for the *_BORROW variants */
+  static inline void GetField(ExecutionContext* ctx, venom_cell*& sp,
+                              uint32_t offset, bool ref, bool borrowed) {
+    venom_cell opnd0 = *--sp;
+    GetAttrOf(sp, opnd0, offset, ref);
+    if (borrowed) venom_cell::EndBorrow(opnd0);
+    else Release(ctx, sp, opnd0);
+  }
+
+  static inline void SetField(ExecutionContext* ctx, venom_cell*& sp,
+                              uint32_t offset, bool ref, bool borrowed) {
+    venom_cell opnd1 = *--sp;
+    venom_cell opnd0 = *--sp;
+    CheckNullPointer(opnd0);
+    venom_cell::AssertNonZeroRefCount(opnd0);
+    venom_cell& cell = opnd0.asRawObject()->cellAt(offset);
+    if (ref) {
+      venom_cell::AssertNonZeroRefCount(opnd1);
+      Release(ctx, sp, cell);
+    }
+    cell = opnd1;
+    if (borrowed) venom_cell::EndBorrow(opnd0);
+    else Release(ctx, sp, opnd0);
+  }
+
+  static inline void GetAttrOf(venom_cell*& sp, venom_cell& obj,
+                               uint32_t offset, bool ref) {
+    CheckNullPointer(obj);
+    venom_cell::AssertNonZeroRefCount(obj);
+    venom_cell& cell = obj.asRawObject()->cellAt(offset);
+    if (ref) {
+      venom_cell::AssertNonZeroRefCount(cell);
+      cell.incRef();
+    }
+    *sp++ = cell;
+  }
+
+  /** MOVE_ATTR_OF_LOCAL_REF and MOVE_ATTR_OF_CONST_REF */
+  static inline void MoveAttrOf(ExecutionContext* ctx, venom_cell*& sp,
+                                venom_cell& obj, uint32_t offset,
+                                venom_cell& local) {
+    CheckNullPointer(obj);
+    venom_cell::AssertNonZeroRefCount(obj);
+    venom_cell cell = obj.asRawObject()->cellAt(offset);
+    venom_cell::AssertNonZeroRefCount(cell);
+    if (VENOM_LIKELY(!ctx->defersRefCounts())) {
+      cell.incRef();
+      if (local.asRawObject()) Release(ctx, sp, local);
+    }
+    local = cell;
+  }
+
+  /** Element idx of the list in cell (see GET_ARRAY_ACCESS_impl()). The
+   * index is only range checked if checked is set */
+  static inline venom_cell& ElemAt(venom_cell& cell, int64_t idx, bool ref,
+                                   bool checked) {
+    using runtime::venom_list;
+    if (ref) {
+      venom_list::ref_list_type* l =
+        static_cast<venom_list::ref_list_type*>(cell.asRawObject());
+      return checked ? l->elemAt(idx) : l->elemAtUnchecked(idx);
+    }
+    venom_list::int_list_type* l =
+      static_cast<venom_list::int_list_type*>(cell.asRawObject());
+    return checked ? l->elemAt(idx) : l->elemAtUnchecked(idx);
+  }
+
+  static inline void GetArrayAccess(ExecutionContext* ctx, venom_cell*& sp,
+                                    bool ref, bool checked) {
+    venom_cell opnd1 = *--sp;
+    venom_cell opnd0 = *--sp;
+    CheckNullPointer(opnd0);
+    venom_cell::AssertNonZeroRefCount(opnd0);
+    venom_cell cell = ElemAt(opnd0, opnd1.asInt(), ref, checked);
+    if (ref) {
+      venom_cell::AssertNonZeroRefCount(cell);
+      cell.incRef();
+    }
+    *sp++ = cell;
+    Release(ctx, sp, opnd0);
+  }
+
+  static inline void SetArrayAccess(ExecutionContext* ctx, venom_cell*& sp,
+                                    bool ref, bool checked) {
+    venom_cell opnd2 = *--sp;
+    venom_cell opnd1 = *--sp;
+    venom_cell opnd0 = *--sp;
+    CheckNullPointer(opnd0);
+    venom_cell::AssertNonZeroRefCount(opnd0);
+    venom_cell& elem = ElemAt(opnd0, opnd1.asInt(), ref, checked);
+    if (ref) {
+      venom_cell::AssertNonZeroRefCount(opnd2);
+      Release(ctx, sp, elem);
+    }
+    elem = opnd2;
+    Release(ctx, sp, opnd0);
+  }
+};
+
+}
+}
+
+#endif /* VENOM_BACKEND_AOTRUNTIME_H */
@@ -27,7 +27,17 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef VENOM_IMPLICIT_NULL_CHECKS
+#include <cstring>
+#include <stdexcept>
+
+#include <signal.h>
+#include <ucontext.h>
+#endif
+
 #include <backend/bytecode.h>
+#include <backend/inlinecache.h>
+#include <backend/jit.h>
 #include <backend/vm.h>
 #include <runtime/venomlist.h>
 #include <util/macros.h>
@@ -44,6 +54,66 @@ static inline void CheckNullPointer(const venom_cell& cell) {
   }
 }
 
+#ifdef VENOM_IMPLICIT_NULL_CHECKS
+
+// The hot handlers leave the check to the hardware. Each of them
+// dereferences cell before it has any side effect, so the fault leaves
+// things just as the explicit check would have
+#define IMPLICIT_NULL_CHECK(cell) ((void) 0)
+
+// Bounds of VENOM_INTERP_SECTION, defined by the linker
+extern "C" char __start_venom_interp[];
+extern "C" char __stop_venom_interp[];
+
+// The handlers only dereference NULL at small offsets: a cell of an object
+// (at most venom_object::UserCellOffset(63)), or its class
+static const uintptr_t NullPageSize = 4096;
+
+static struct sigaction PrevSegvAction;
+
+static void NullPointerHandler(int sig, siginfo_t* info, void* uctx) {
+  uintptr_t pc = static_cast<ucontext_t*>(uctx)->uc_mcontext.gregs[REG_RIP];
+  if (uintptr_t(info->si_addr) < NullPageSize &&
+      pc >= uintptr_t(__start_venom_interp) &&
+      pc < uintptr_t(__stop_venom_interp)) {
+    // the interpreter is compiled with -fnon-call-exceptions, so this
+    // unwinds out of the faulting handler
+    throw VenomRuntimeException("Null pointer dereferenced");
+  }
+  // a real crash. put the previous action back, and let the instruction
+  // fault again
+  sigaction(SIGSEGV, &PrevSegvAction, NULL);
+}
+
+void Instruction::InstallNullPointerHandler() {
+  static bool installed = false;
+  if (installed) return;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = NullPointerHandler;
+  // the handler does not return when it throws, so it must not leave
+  // SIGSEGV blocked
+  sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGSEGV, &sa, &PrevSegvAction)) {
+    throw runtime_error("Could not install the SIGSEGV handler");
+  }
+  installed = true;
+}
+
+#else
+
+#define IMPLICIT_NULL_CHECK(cell) CheckNullPointer(cell)
+
+#endif /* VENOM_IMPLICIT_NULL_CHECKS */
+
+// The handlers keep the top of the operand stack in the local sp, which is
+// only written back to ctx before calling out to anything which can use the
+// stack itself: native functions, allocations (which run the init method),
+// and decRef() (which can free an object, running its release method).
+#define SYNC_SP()   ctx.program_stack.setTop(sp)
+#define RELOAD_SP() (sp = ctx.program_stack.getTop())
+
 // Don't be tempted to rewrite execute to use function pointers-
 // I tried it and it runs a bit slower
 
@@ -97,42 +167,33 @@ bool Instruction::execute(ExecutionContext& ctx) {
 }
 */
 
-bool Instruction::execute(ExecutionContext& ctx) {
-  VENOM_TRACE(stringify(opcode));
+bool Instruction::execute(ExecutionContext& ctx, venom_cell*& sp) {
+  VENOM_TRACE(stringify(getOpcode()));
 
-  switch (opcode) {
+  switch (getOpcode()) {
 
 #define HANDLE_ZERO(a) \
-    case a: return a ## _impl(ctx);
+    case a: return a ## _impl(ctx, sp);
 
 #define HANDLE_ONE(a) \
     case a: { \
-      ExecutionContext::program_stack_type& pstack = ctx.program_stack; \
-      venom_cell opnd0 = pstack.top(); \
-      pstack.pop(); \
-      return a ## _impl(ctx, opnd0); \
+      venom_cell opnd0 = *--sp; \
+      return a ## _impl(ctx, sp, opnd0); \
     }
 
 #define HANDLE_TWO(a) \
     case a: { \
-      ExecutionContext::program_stack_type& pstack = ctx.program_stack; \
-      venom_cell opnd1 = pstack.top(); \
-      pstack.pop(); \
-      venom_cell opnd0 = pstack.top(); \
-      pstack.pop(); \
-      return a ## _impl(ctx, opnd0, opnd1); \
+      venom_cell opnd1 = *--sp; \
+      venom_cell opnd0 = *--sp; \
+      return a ## _impl(ctx, sp, opnd0, opnd1); \
     }
 
 #define HANDLE_THREE(a) \
     case a: { \
-      ExecutionContext::program_stack_type& pstack = ctx.program_stack; \
-      venom_cell opnd2 = pstack.top(); \
-      pstack.pop(); \
-      venom_cell opnd1 = pstack.top(); \
-      pstack.pop(); \
-      venom_cell opnd0 = pstack.top(); \
-      pstack.pop(); \
-      return a ## _impl(ctx, opnd0, opnd1, opnd2); \
+      venom_cell opnd2 = *--sp; \
+      venom_cell opnd1 = *--sp; \
+      venom_cell opnd0 = *--sp; \
+      return a ## _impl(ctx, sp, opnd0, opnd1, opnd2); \
     }
 
     OPCODE_DEFINER_ZERO(HANDLE_ZERO)
@@ -150,6 +211,111 @@ bool Instruction::execute(ExecutionContext& ctx) {
   return false;
 }
 
+#ifdef VENOM_THREADED_DISPATCH
+
+void* Instruction::HandlerFor(Opcode opcode) {
+  static void* const* handlers = ThreadedLoop(NULL, NULL);
+  return handlers[opcode];
+}
+
+void* const* Instruction::ThreadedLoop(ExecutionContext* ctxp,
+                                       Frame* stop_frame) {
+#define OP_LABEL(a) &&L_ ## a,
+  static void* const Handlers[] = {
+    OPCODE_DEFINER(OP_LABEL)
+  };
+#undef OP_LABEL
+
+  if (VENOM_UNLIKELY(!ctxp)) return Handlers;
+
+  ExecutionContext& ctx = *ctxp;
+  venom_cell* sp = ctx.program_stack.getTop();
+  Instruction* inst;
+
+#define DISPATCH() \
+  do { \
+    inst = ctx.program_counter; \
+    VENOM_TRACE(stringify(inst->getOpcode())); \
+    goto *inst->handler; \
+  } while (0)
+
+  // only RET (or a JUMP which hands the rest of the function to the Jit) can
+  // bring the frame stack back down to stop_frame, and both write sp back to
+  // ctx. Since a is a constant, the check disappears from the other handlers
+#define NEXT(a, expr) \
+  do { \
+    if (VENOM_LIKELY(expr)) ctx.program_counter = inst->next(); \
+    else if ((a == RET || a == JUMP) && \
+             VENOM_UNLIKELY(ctx.frame == stop_frame)) { \
+      return NULL; \
+    } \
+    DISPATCH(); \
+  } while (0)
+
+#define THREADED_ZERO(a) \
+  L_ ## a: \
+    NEXT(a, inst->a ## _impl(ctx, sp));
+
+#define THREADED_ONE(a) \
+  L_ ## a: { \
+    venom_cell opnd0 = *--sp; \
+    NEXT(a, inst->a ## _impl(ctx, sp, opnd0)); \
+  }
+
+#define THREADED_TWO(a) \
+  L_ ## a: { \
+    venom_cell opnd1 = *--sp; \
+    venom_cell opnd0 = *--sp; \
+    NEXT(a, inst->a ## _impl(ctx, sp, opnd0, opnd1)); \
+  }
+
+#define THREADED_THREE(a) \
+  L_ ## a: { \
+    venom_cell opnd2 = *--sp; \
+    venom_cell opnd1 = *--sp; \
+    venom_cell opnd0 = *--sp; \
+    NEXT(a, inst->a ## _impl(ctx, sp, opnd0, opnd1, opnd2)); \
+  }
+
+  DISPATCH();
+
+  OPCODE_DEFINER_ZERO(THREADED_ZERO)
+  OPCODE_DEFINER_ONE(THREADED_ONE)
+  OPCODE_DEFINER_TWO(THREADED_TWO)
+  OPCODE_DEFINER_THREE(THREADED_THREE)
+
+#undef THREADED_ZERO
+#undef THREADED_ONE
+#undef THREADED_TWO
+#undef THREADED_THREE
+#undef NEXT
+#undef DISPATCH
+
+  VENOM_NOT_REACHED;
+}
+
+void Instruction::ExecuteStream(ExecutionContext& ctx, Frame* stop_frame) {
+  assert(ctx.frame != stop_frame);
+  ThreadedLoop(&ctx, stop_frame);
+}
+
+#else
+
+void Instruction::ExecuteStream(ExecutionContext& ctx, Frame* stop_frame) {
+  assert(ctx.frame != stop_frame);
+  venom_cell* sp = ctx.program_stack.getTop();
+  while (true) {
+    Instruction* inst = ctx.program_counter;
+    if (VENOM_LIKELY(inst->execute(ctx, sp))) {
+      ctx.program_counter = inst->next();
+    }
+    else if ((inst->opcode == RET || inst->opcode == JUMP) &&
+             VENOM_UNLIKELY(ctx.frame == stop_frame)) break;
+  }
+}
+
+#endif /* VENOM_THREADED_DISPATCH */
+
 template <typename Inst>
 static inline Inst* asFormatInst(Instruction* i) { return static_cast<Inst*>(i); }
 
@@ -162,175 +328,256 @@ Instruction::asFormatI32() { return asFormatInst<InstFormatI32>(this); }
 inline InstFormatIPtr*
 Instruction::asFormatIPtr() { return asFormatInst<InstFormatIPtr>(this); }
 
-//inline InstFormatU32U32*
-//Instruction::asFormatU32U32() { return asFormatInst<InstFormatU32U32>(this); }
+inline InstFormatCall*
+Instruction::asFormatCall() { return asFormatInst<InstFormatCall>(this); }
+
+inline InstFormatU32U32*
+Instruction::asFormatU32U32() { return asFormatInst<InstFormatU32U32>(this); }
+
+inline InstFormatU32U32U32*
+Instruction::asFormatU32U32U32() {
+  return asFormatInst<InstFormatU32U32U32>(this);
+}
 
 inline InstFormatC*
 Instruction::asFormatC() { return asFormatInst<InstFormatC>(this); }
 
-bool Instruction::PUSH_CELL_INT_impl(ExecutionContext& ctx) {
+void Instruction::link(Executable* code) {
+  // where a call lands only depends on the Executable, so every context
+  // shares the resolved instruction
+  if (getOpcode() != CALL && getOpcode() != TAIL_CALL) return;
+  InstFormatCall *self = asFormatCall();
+  FunctionDescriptor *desc = reinterpret_cast<FunctionDescriptor*>(self->N0);
+  self->code = code->instructionAt(intptr_t(desc->getFunctionPtr()));
+}
+
+bool Instruction::PUSH_CELL_INT_impl(ExecutionContext& ctx, venom_cell*& sp) {
   InstFormatC *self = asFormatC();
-  ctx.program_stack.push(venom_cell(self->data.int_value));
+  *sp++ = venom_cell(self->data.int_value);
   return true;
 }
 
-bool Instruction::PUSH_CELL_FLOAT_impl(ExecutionContext& ctx) {
+bool Instruction::PUSH_CELL_FLOAT_impl(ExecutionContext& ctx, venom_cell*& sp) {
   InstFormatC *self = asFormatC();
-  ctx.program_stack.push(venom_cell(self->data.double_value));
+  *sp++ = venom_cell(self->data.double_value);
   return true;
 }
 
-bool Instruction::PUSH_CELL_BOOL_impl(ExecutionContext& ctx) {
+bool Instruction::PUSH_CELL_BOOL_impl(ExecutionContext& ctx, venom_cell*& sp) {
   InstFormatC *self = asFormatC();
-  ctx.program_stack.push(venom_cell(self->data.bool_value));
+  *sp++ = venom_cell(self->data.bool_value);
   return true;
 }
 
-bool Instruction::PUSH_CELL_NIL_impl(ExecutionContext& ctx) {
-  ctx.program_stack.push(venom_cell(venom_object::Nil));
+bool Instruction::PUSH_CELL_NIL_impl(ExecutionContext& ctx, venom_cell*& sp) {
+  *sp++ = venom_cell(venom_object::Nil);
   return true;
 }
 
-bool Instruction::PUSH_CONST_impl(ExecutionContext& ctx) {
-  // TODO: consider storing the pointer in the inst...
+bool Instruction::PUSH_CONST_impl(ExecutionContext& ctx, venom_cell*& sp) {
+  // the constant itself cannot be stored in the instruction, since each
+  // context running the stream has a pool of its own
   InstFormatU32 *self = asFormatU32();
-  venom_cell* konst = ctx.constant_pool[self->N0];
-  assert(konst);
-  konst->incRef();
-  ctx.program_stack.push(*konst);
+  venom_cell& konst = ctx.constant_pool[self->N0];
+  konst.incRef();
+  *sp++ = konst;
   return true;
 }
 
-bool Instruction::LOAD_LOCAL_VAR_impl(ExecutionContext& ctx) {
+bool Instruction::LOAD_LOCAL_VAR_impl(ExecutionContext& ctx, venom_cell*& sp) {
   InstFormatU32 *self = asFormatU32();
-  ctx.program_stack.push(ctx.local_variable(self->N0));
+  *sp++ = ctx.local_variable(self->N0);
   return true;
 }
 
-bool Instruction::LOAD_LOCAL_VAR_REF_impl(ExecutionContext& ctx) {
+bool Instruction::LOAD_LOCAL_VAR_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
   InstFormatU32 *self = asFormatU32();
   venom_cell &cell = ctx.local_variable(self->N0);
   venom_cell::AssertNonZeroRefCount(cell);
   cell.incRef();
-  ctx.program_stack.push(cell);
+  *sp++ = cell;
+  return true;
+}
+
+bool Instruction::PUSH_CONST_BORROW_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
+  InstFormatU32 *self = asFormatU32();
+  venom_cell& konst = ctx.constant_pool[self->N0];
+  venom_cell::BeginBorrow(konst);
+  *sp++ = konst;
+  return true;
+}
+
+bool Instruction::LOAD_LOCAL_VAR_BORROW_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
+  InstFormatU32 *self = asFormatU32();
+  venom_cell &cell = ctx.local_variable(self->N0);
+  venom_cell::BeginBorrow(cell);
+  *sp++ = cell;
   return true;
 }
 
-bool Instruction::ALLOC_OBJ_impl(ExecutionContext& ctx) {
+bool Instruction::ALLOC_OBJ_impl(ExecutionContext& ctx, venom_cell*& sp) {
   InstFormatIPtr *self = asFormatIPtr();
   venom_class_object* class_obj =
     reinterpret_cast<venom_class_object*>(self->N0);
+  SYNC_SP();
+  ctx.allocationSafepoint();
   venom_object* obj = venom_object::allocObj(class_obj);
   obj->incRef();
-  ctx.program_stack.push(venom_cell(obj));
+  *sp++ = venom_cell(obj);
   return true;
 }
 
-bool Instruction::CALL_impl(ExecutionContext& ctx) {
-  InstFormatIPtr *self = asFormatIPtr();
+bool Instruction::CALL_impl(ExecutionContext& ctx, venom_cell*& sp) {
+  InstFormatCall *self = asFormatCall();
+  FunctionDescriptor *desc = reinterpret_cast<FunctionDescriptor*>(self->N0);
+  ctx.program_stack.checkHeadroom(sp, desc->getMaxStackDepth());
   // create new local variable frame
-  ctx.new_frame(ctx.program_counter + 1);
+  ctx.new_frame(next(), desc);
+  if (VENOM_UNLIKELY(desc->jitReady(&ctx))) {
+    SYNC_SP();
+    Jit::Run(ctx);
+    RELOAD_SP();
+    return true;
+  }
   // set PC
-  FunctionDescriptor *desc = reinterpret_cast<FunctionDescriptor*>(self->N0);
-  ctx.program_counter =
-    ctx.code->instructions.begin() + int64_t(desc->getFunctionPtr());
+  ctx.program_counter = self->code;
   return false;
 }
 
-bool Instruction::CALL_NATIVE_impl(ExecutionContext& ctx) {
+bool Instruction::CALL_NATIVE_impl(ExecutionContext& ctx, venom_cell*& sp) {
   InstFormatIPtr *self = asFormatIPtr();
   FunctionDescriptor *desc = reinterpret_cast<FunctionDescriptor*>(self->N0);
   assert(desc->isNative());
+  SYNC_SP();
   desc->dispatch(&ctx);
+  RELOAD_SP();
   return true;
 }
 
-bool Instruction::RET_impl(ExecutionContext& ctx) {
-  Instruction** ret_addr = ctx.pop_frame();
+bool Instruction::RET_impl(ExecutionContext& ctx, venom_cell*& sp) {
+  SYNC_SP();
+  Instruction* ret_addr = ctx.pop_frame();
   ctx.program_counter = ret_addr;
   return false;
 }
 
-bool Instruction::JUMP_impl(ExecutionContext& ctx) {
+bool Instruction::TAIL_CALL_impl(ExecutionContext& ctx, venom_cell*& sp) {
+  InstFormatCall *self = asFormatCall();
+  FunctionDescriptor *desc = reinterpret_cast<FunctionDescriptor*>(self->N0);
+  assert(!desc->isNative());
+  ctx.program_stack.checkHeadroom(sp, desc->getMaxStackDepth());
+  SYNC_SP();
+  ctx.replace_frame(desc);
+  // set PC
+  ctx.program_counter = self->code;
+  return false;
+}
+
+bool Instruction::JUMP_impl(ExecutionContext& ctx, venom_cell*& sp) {
   InstFormatI32 *self = asFormatI32();
+  // a backwards jump closes a loop, which is where a function that is only
+  // called once spends its time
+  if (VENOM_UNLIKELY(self->N0 < 0) && ctx.frame->desc->jitReady(&ctx)) {
+    SYNC_SP();
+    ctx.program_counter = Jit::RunFrom(ctx, offsetBy(self->N0));
+    RELOAD_SP();
+    return false;
+  }
   // set PC
-  ctx.program_counter = ctx.program_counter + 1 + self->N0;
+  ctx.program_counter = offsetBy(self->N0);
   return false;
 }
 
-bool Instruction::POP_CELL_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::POP_CELL_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   return true;
 }
 
-bool Instruction::POP_CELL_REF_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::POP_CELL_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   venom_cell::AssertNonZeroRefCount(opnd0);
+  SYNC_SP();
   opnd0.decRef();
   return true;
 }
 
-bool Instruction::STORE_LOCAL_VAR_impl(ExecutionContext& ctx, venom_cell& opnd0) {
-  assert(ctx.local_variables_stack.size() ==
-         ctx.local_variables_ref_info_stack.size());
-
+bool Instruction::STORE_LOCAL_VAR_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   InstFormatU32 *self = asFormatU32();
-  size_t last_offset = ctx.frame_offset.top();
-  if (VENOM_UNLIKELY(last_offset + self->N0 >=
-                     ctx.local_variables_stack.size())) {
-    ctx.local_variables_stack.resize(
-        last_offset + self->N0 + 1);
-    ctx.local_variables_ref_info_stack.resize(
-        last_offset + self->N0 + 1, false);
-  }
-
-  assert(!ctx.local_variable_ref_info(self->N0));
   ctx.local_variable(self->N0) = opnd0;
   return true;
 }
 
-bool Instruction::STORE_LOCAL_VAR_REF_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::STORE_LOCAL_VAR_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   venom_cell::AssertNonZeroRefCount(opnd0);
-  assert(ctx.local_variables_stack.size() ==
-         ctx.local_variables_ref_info_stack.size());
-
   InstFormatU32 *self = asFormatU32();
-  size_t last_offset = ctx.frame_offset.top();
-  if (VENOM_UNLIKELY(last_offset + self->N0 >=
-                     ctx.local_variables_stack.size())) {
-    ctx.local_variables_stack.resize(
-        last_offset + self->N0 + 1);
-    ctx.local_variables_ref_info_stack.resize(
-        last_offset + self->N0 + 1, false);
-  }
-
+  // the linker has verified that this slot only ever holds references, so
+  // old is either a reference or still nil
   venom_cell& old = ctx.local_variable(self->N0);
-  if (ctx.local_variable_ref_info(self->N0)) {
+  if (VENOM_UNLIKELY(ctx.defersRefCounts())) {
+    // the slot does not count, so the reference of the stack is dropped
+    // instead of the one of the old value (see
+    // ExecutionContext::reconcile())
+    old = opnd0;
+    SYNC_SP();
+    opnd0.decRef();
+    ctx.safepoint();
+    return true;
+  }
+  if (old.asRawObject()) {
 #ifndef NDEBUG
     if (old.asRawObject() == opnd0.asRawObject()) {
       // self assignment should *not* be a problem
       assert(!opnd0.asRawObject() || opnd0.asRawObject()->getCount() > 1);
     }
 #endif
+    SYNC_SP();
     old.decRef();
   }
   old = opnd0;
-  ctx.local_variables_ref_info_stack[last_offset + self->N0] = true;
   return true;
 }
 
-bool Instruction::INT_TO_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
-  ctx.program_stack.push(venom_cell(double(opnd0.asInt())));
+bool Instruction::STORE_LOCAL_VAR_REF_BORROW_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  venom_cell::AssertNonZeroRefCount(opnd0);
+  InstFormatU32 *self = asFormatU32();
+  venom_cell& old = ctx.local_variable(self->N0);
+  // when ref counts are deferred, neither the slot nor the borrowed
+  // reference counts. otherwise the slot takes its own reference before it
+  // lets go of the old one, which may be the same object
+  if (VENOM_LIKELY(!ctx.defersRefCounts())) {
+    opnd0.incRef();
+    if (old.asRawObject()) {
+      SYNC_SP();
+      old.decRef();
+    }
+  }
+  old = opnd0;
+  venom_cell::EndBorrow(opnd0);
+  return true;
+}
+
+bool Instruction::INT_TO_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  *sp++ = venom_cell(double(opnd0.asInt()));
   return true;
 }
 
-bool Instruction::FLOAT_TO_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
-  ctx.program_stack.push(venom_cell(int64_t(opnd0.asDouble())));
+bool Instruction::FLOAT_TO_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  *sp++ = venom_cell(int64_t(opnd0.asDouble()));
   return true;
 }
 
 #define IMPL_UNOP_1(transform, op) \
-  ctx.program_stack.push(venom_cell(op(opnd0 transform)))
+  *sp++ = venom_cell(op(opnd0 transform))
 #define IMPL_UNOP_2(transform, op0, op1) \
-  ctx.program_stack.push(venom_cell(op1(op0(opnd0 transform))))
+  *sp++ = venom_cell(op1(op0(opnd0 transform)))
 
 #define IMPL_UNOP_INT_1(op)   IMPL_UNOP_1(.asInt(),       op)
 #define IMPL_UNOP_FLOAT_1(op) IMPL_UNOP_1(.asDouble(),    op)
@@ -339,6 +586,7 @@ bool Instruction::FLOAT_TO_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
   do { \
     venom_cell::AssertNonZeroRefCount(opnd0); \
     IMPL_UNOP_1(.asRawObject(), op); \
+    SYNC_SP(); \
     opnd0.decRef(); \
   } while (0);
 
@@ -349,50 +597,60 @@ bool Instruction::FLOAT_TO_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
   do { \
     venom_cell::AssertNonZeroRefCount(opnd0); \
     IMPL_UNOP_2(.asRawObject(), op0, op1); \
+    SYNC_SP(); \
     opnd0.decRef(); \
   } while (0);
 
-bool Instruction::UNOP_PLUS_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::UNOP_PLUS_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_INT_1(+);
   return true;
 }
 
-bool Instruction::UNOP_PLUS_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::UNOP_PLUS_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_FLOAT_1(+);
   return true;
 }
 
-bool Instruction::UNOP_MINUS_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::UNOP_MINUS_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_INT_1(-);
   return true;
 }
 
-bool Instruction::UNOP_MINUS_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::UNOP_MINUS_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_FLOAT_1(-);
   return true;
 }
 
-bool Instruction::UNOP_CMP_NOT_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::UNOP_CMP_NOT_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_INT_2(!, bool);
   return true;
 }
 
-bool Instruction::UNOP_CMP_NOT_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::UNOP_CMP_NOT_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_FLOAT_2(!, bool);
   return true;
 }
 
-bool Instruction::UNOP_CMP_NOT_BOOL_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::UNOP_CMP_NOT_BOOL_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_BOOL_2(!, bool);
   return true;
 }
 
-bool Instruction::UNOP_CMP_NOT_REF_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::UNOP_CMP_NOT_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_REF_2(!, bool);
   return true;
 }
 
-bool Instruction::UNOP_BIT_NOT_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::UNOP_BIT_NOT_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_INT_1(~);
   return true;
 }
@@ -401,7 +659,7 @@ bool Instruction::UNOP_BIT_NOT_INT_impl(ExecutionContext& ctx, venom_cell& opnd0
   do { \
     if (op(opnd0.as ## transform ())) { \
       InstFormatI32 *self = asFormatI32(); \
-      ctx.program_counter = ctx.program_counter + 1 + self->N0; \
+      ctx.program_counter = offsetBy(self->N0); \
       action; \
       return false; \
     } \
@@ -415,38 +673,46 @@ bool Instruction::UNOP_BIT_NOT_INT_impl(ExecutionContext& ctx, venom_cell& opnd0
 #define IMPL_BRANCH_Z_ACT(transform, act)  IMPL_BRANCH(transform, !, act)
 #define IMPL_BRANCH_NZ_ACT(transform, act) IMPL_BRANCH(transform,  , act)
 
-bool Instruction::BRANCH_Z_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::BRANCH_Z_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_BRANCH_Z(Int);
 }
 
-bool Instruction::BRANCH_Z_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::BRANCH_Z_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_BRANCH_Z(Double);
 }
 
-bool Instruction::BRANCH_Z_BOOL_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::BRANCH_Z_BOOL_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_BRANCH_Z(Bool);
 }
 
-bool Instruction::BRANCH_Z_REF_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::BRANCH_Z_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   venom_cell::AssertNonZeroRefCount(opnd0);
-  IMPL_BRANCH_Z_ACT(RawObject, opnd0.decRef());
+  IMPL_BRANCH_Z_ACT(RawObject, (SYNC_SP(), opnd0.decRef()));
 }
 
-bool Instruction::BRANCH_NZ_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::BRANCH_NZ_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_BRANCH_NZ(Int);
 }
 
-bool Instruction::BRANCH_NZ_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::BRANCH_NZ_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_BRANCH_NZ(Double);
 }
 
-bool Instruction::BRANCH_NZ_BOOL_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::BRANCH_NZ_BOOL_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_BRANCH_NZ(Bool);
 }
 
-bool Instruction::BRANCH_NZ_REF_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::BRANCH_NZ_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   venom_cell::AssertNonZeroRefCount(opnd0);
-  IMPL_BRANCH_NZ_ACT(RawObject, opnd0.decRef());
+  IMPL_BRANCH_NZ_ACT(RawObject, (SYNC_SP(), opnd0.decRef()));
 }
 
 #undef IMPL_BRANCH
@@ -455,85 +721,164 @@ bool Instruction::BRANCH_NZ_REF_impl(ExecutionContext& ctx, venom_cell& opnd0) {
 #undef IMPL_BRANCH_Z_ACT
 #undef IMPL_BRANCH_NZ_ACT
 
-bool Instruction::TEST_INT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::TEST_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_INT_1(bool);
   return true;
 }
 
-bool Instruction::TEST_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::TEST_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_FLOAT_1(bool);
   return true;
 }
 
-bool Instruction::TEST_REF_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::TEST_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   IMPL_UNOP_REF_1(bool);
   return true;
 }
 
-bool Instruction::GET_ATTR_OBJ_impl(ExecutionContext& ctx, venom_cell& opnd0) {
-  CheckNullPointer(opnd0);
+bool Instruction::GET_FIELD_OFF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  IMPLICIT_NULL_CHECK(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd0);
   InstFormatU32 *self = asFormatU32();
 
-  ctx.program_stack.push(opnd0.asRawObject()->cell(self->N0));
+  *sp++ = opnd0.asRawObject()->cellAt(self->N0);
 
+  SYNC_SP();
   opnd0.decRef();
   return true;
 }
 
-bool Instruction::GET_ATTR_OBJ_REF_impl(ExecutionContext& ctx, venom_cell& opnd0) {
-  CheckNullPointer(opnd0);
+bool Instruction::GET_FIELD_OFF_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  IMPLICIT_NULL_CHECK(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd0);
   InstFormatU32 *self = asFormatU32();
 
-  venom_cell& cell = opnd0.asRawObject()->cell(self->N0);
+  venom_cell& cell = opnd0.asRawObject()->cellAt(self->N0);
   venom_cell::AssertNonZeroRefCount(cell);
   cell.incRef();
-  ctx.program_stack.push(cell);
+  *sp++ = cell;
 
+  SYNC_SP();
   opnd0.decRef();
   return true;
 }
 
-bool Instruction::DUP_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::GET_FIELD_OFF_BORROW_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  IMPLICIT_NULL_CHECK(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd0);
+  InstFormatU32 *self = asFormatU32();
+  *sp++ = opnd0.asRawObject()->cellAt(self->N0);
+  venom_cell::EndBorrow(opnd0);
+  return true;
+}
+
+bool Instruction::GET_FIELD_OFF_REF_BORROW_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  IMPLICIT_NULL_CHECK(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd0);
+  InstFormatU32 *self = asFormatU32();
+
+  venom_cell& cell = opnd0.asRawObject()->cellAt(self->N0);
+  venom_cell::AssertNonZeroRefCount(cell);
+  cell.incRef();
+  *sp++ = cell;
+  venom_cell::EndBorrow(opnd0);
+  return true;
+}
+
+bool Instruction::DUP_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   InstFormatU32 *self = asFormatU32();
   for (size_t i = 0; i < self->N0 + 1; i++) {
-    ctx.program_stack.push(opnd0);
+    *sp++ = opnd0;
   }
   return true;
 }
 
-bool Instruction::DUP_REF_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::DUP_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   venom_cell::AssertNonZeroRefCount(opnd0);
   InstFormatU32 *self = asFormatU32();
   for (size_t i = 0; i < self->N0 + 1; i++) {
-    ctx.program_stack.push(opnd0);
+    *sp++ = opnd0;
     if (i < self->N0) opnd0.incRef();
   }
   return true;
 }
 
-bool Instruction::CALL_VIRTUAL_impl(ExecutionContext& ctx, venom_cell& opnd0) {
+bool Instruction::CHECK_NULL_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
   CheckNullPointer(opnd0);
+  *sp++ = opnd0;
+  return true;
+}
+
+bool Instruction::CALL_VIRTUAL_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  IMPLICIT_NULL_CHECK(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd0);
-  InstFormatU32 *self = asFormatU32();
-  FunctionDescriptor *desc =
-    opnd0.asRawObject()->getClassObj()->vtable.at(self->N0);
-  assert(desc);
+  InstFormatIPtr *self = asFormatIPtr();
+  InlineCache* cache = reinterpret_cast<InlineCache*>(self->N0);
+  const InlineCache::Target& target =
+    cache->lookup(opnd0.asRawObject()->getClassObj(), ctx.code);
+  FunctionDescriptor *desc = target.desc;
 
   // push "this" pointer
-  ctx.program_stack.push(opnd0);
+  *sp++ = opnd0;
 
-  if (desc->isNative()) {
+  if (!target.code) {
     // use native dispatch
+    SYNC_SP();
     desc->dispatch(&ctx);
+    RELOAD_SP();
     return true;
   } else {
+    ctx.program_stack.checkHeadroom(sp, desc->getMaxStackDepth());
     // create new local variable frame
-    ctx.new_frame(ctx.program_counter + 1);
+    ctx.new_frame(next(), desc);
+    if (VENOM_UNLIKELY(desc->jitReady(&ctx))) {
+      SYNC_SP();
+      Jit::Run(ctx);
+      RELOAD_SP();
+      return true;
+    }
+    // set PC
+    ctx.program_counter = target.code;
+    return false;
+  }
+}
+
+bool Instruction::TAIL_CALL_VIRTUAL_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  IMPLICIT_NULL_CHECK(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd0);
+  InstFormatIPtr *self = asFormatIPtr();
+  InlineCache* cache = reinterpret_cast<InlineCache*>(self->N0);
+  const InlineCache::Target& target =
+    cache->lookup(opnd0.asRawObject()->getClassObj(), ctx.code);
+  FunctionDescriptor *desc = target.desc;
+
+  // push "this" pointer
+  *sp++ = opnd0;
+
+  if (!target.code) {
+    // use native dispatch, and let the RET which follows return the result
+    SYNC_SP();
+    desc->dispatch(&ctx);
+    RELOAD_SP();
+    return true;
+  } else {
+    ctx.program_stack.checkHeadroom(sp, desc->getMaxStackDepth());
+    SYNC_SP();
+    ctx.replace_frame(desc);
     // set PC
-    ctx.program_counter =
-      ctx.code->instructions.begin() + int64_t(desc->getFunctionPtr());
+    ctx.program_counter = target.code;
     return false;
   }
 }
@@ -546,7 +891,7 @@ bool Instruction::CALL_VIRTUAL_impl(ExecutionContext& ctx, venom_cell& opnd0) {
 #undef IMPL_UNOP_REF_1
 
 #define IMPL_BINOP0(transform, op) \
-  ctx.program_stack.push(venom_cell(opnd0 transform op opnd1 transform))
+  *sp++ = venom_cell(opnd0 transform op opnd1 transform)
 #define IMPL_BINOP_INT(op)   IMPL_BINOP0(.asInt(),       op)
 #define IMPL_BINOP_FLOAT(op) IMPL_BINOP0(.asDouble(),    op)
 #define IMPL_BINOP_BOOL(op)  IMPL_BINOP0(.asBool(),      op)
@@ -555,51 +900,70 @@ bool Instruction::CALL_VIRTUAL_impl(ExecutionContext& ctx, venom_cell& opnd0) {
     venom_cell::AssertNonZeroRefCount(opnd0); \
     venom_cell::AssertNonZeroRefCount(opnd1); \
     IMPL_BINOP0(.asRawObject(), op); \
+    SYNC_SP(); \
     opnd0.decRef(); \
     opnd1.decRef(); \
   } while (0)
 
-bool Instruction::BINOP_ADD_INT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_ADD_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_INT(+);
   return true;
 }
 
-bool Instruction::BINOP_ADD_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_ADD_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_FLOAT(+);
   return true;
 }
 
-bool Instruction::BINOP_SUB_INT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_SUB_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_INT(-);
   return true;
 }
 
-bool Instruction::BINOP_SUB_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_SUB_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_FLOAT(-);
   return true;
 }
 
-bool Instruction::BINOP_MULT_INT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_MULT_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_INT(*);
   return true;
 }
 
-bool Instruction::BINOP_MULT_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_MULT_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_FLOAT(*);
   return true;
 }
 
-bool Instruction::BINOP_DIV_INT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_DIV_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_INT(/);
   return true;
 }
 
-bool Instruction::BINOP_DIV_FLOAT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_DIV_FLOAT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_FLOAT(/);
   return true;
 }
 
-bool Instruction::BINOP_MOD_INT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_MOD_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_INT(%);
   return true;
 }
@@ -620,7 +984,7 @@ bool Instruction::BINOP_MOD_INT_impl(ExecutionContext& ctx, venom_cell& opnd0, v
   x(BOOL) \
 
 #define OP_BINOP(type, fname, name, op) \
-  bool Instruction::BINOP_##fname##_##name##_##type##_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) { \
+  bool Instruction::BINOP_##fname##_##name##_##type##_impl(ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0, venom_cell& opnd1) { \
     IMPL_BINOP_##type(op); \
     return true; \
   } \
@@ -670,12 +1034,16 @@ IMPL_BINOP_BIT(OP_BIT_XOR)
 #undef OP_BIT_OR
 #undef OP_BIT_XOR
 
-bool Instruction::BINOP_BIT_LSHIFT_INT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_BIT_LSHIFT_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_INT(<<);
   return true;
 }
 
-bool Instruction::BINOP_BIT_RSHIFT_INT_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::BINOP_BIT_RSHIFT_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   IMPL_BINOP_INT(>>);
   return true;
 }
@@ -686,40 +1054,88 @@ bool Instruction::BINOP_BIT_RSHIFT_INT_impl(ExecutionContext& ctx, venom_cell& o
 #undef IMPL_BINOP_BOOL
 #undef IMPL_BINOP_REF
 
-bool Instruction::SET_ATTR_OBJ_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
-  CheckNullPointer(opnd0);
+/** Is the cell offset bytes into obj meant for references? */
+static inline bool IsRefCellAt(const venom_cell& obj, size_t offset) {
+  size_t n = (offset - venom_object::UserCellOffset(0)) / sizeof(venom_cell);
+  return obj.asRawObject()->getClassObj()->ref_cell_bitmap & (0x1UL << n);
+}
+
+bool Instruction::SET_FIELD_OFF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPLICIT_NULL_CHECK(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd0);
   InstFormatU32 *self = asFormatU32();
-  // make sure the obj's cell is actually meant for primitives
-  assert(!(opnd0.asRawObject()->getClassObj()->ref_cell_bitmap
-        & (0x1 << self->N0)));
-  opnd0.asRawObject()->cell(self->N0) = opnd1;
+  assert(!IsRefCellAt(opnd0, self->N0));
+  opnd0.asRawObject()->cellAt(self->N0) = opnd1;
+  SYNC_SP();
   opnd0.decRef();
   return true;
 }
 
-bool Instruction::SET_ATTR_OBJ_REF_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
-  CheckNullPointer(opnd0);
+bool Instruction::SET_FIELD_OFF_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPLICIT_NULL_CHECK(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd1);
   InstFormatU32 *self = asFormatU32();
-  // make sure the obj's cell is actually meant for references
-  assert(opnd0.asRawObject()->getClassObj()->ref_cell_bitmap
-        & (0x1 << self->N0));
-  venom_cell& old = opnd0.asRawObject()->cell(self->N0);
+  assert(IsRefCellAt(opnd0, self->N0));
+  venom_cell& old = opnd0.asRawObject()->cellAt(self->N0);
 #ifndef NDEBUG
   if (old.asRawObject() == opnd1.asRawObject()) {
     // self assignment should *not* be a problem
     assert(!opnd1.asRawObject() || opnd1.asRawObject()->getCount() > 1);
   }
 #endif
+  SYNC_SP();
   old.decRef();
   old = opnd1;
   opnd0.decRef();
   return true;
 }
 
-bool Instruction::GET_ARRAY_ACCESS_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::SET_FIELD_OFF_BORROW_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPLICIT_NULL_CHECK(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd0);
+  InstFormatU32 *self = asFormatU32();
+  assert(!IsRefCellAt(opnd0, self->N0));
+  opnd0.asRawObject()->cellAt(self->N0) = opnd1;
+  venom_cell::EndBorrow(opnd0);
+  return true;
+}
+
+bool Instruction::SET_FIELD_OFF_REF_BORROW_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPLICIT_NULL_CHECK(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd1);
+  InstFormatU32 *self = asFormatU32();
+  assert(IsRefCellAt(opnd0, self->N0));
+  venom_cell& old = opnd0.asRawObject()->cellAt(self->N0);
+#ifndef NDEBUG
+  if (old.asRawObject() == opnd1.asRawObject()) {
+    // self assignment should *not* be a problem
+    assert(!opnd1.asRawObject() || opnd1.asRawObject()->getCount() > 1);
+  }
+#endif
+  SYNC_SP();
+  old.decRef();
+  old = opnd1;
+  venom_cell::EndBorrow(opnd0);
+  return true;
+}
+
+bool Instruction::GET_ARRAY_ACCESS_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  // the array handlers keep an explicit null check, even with
+  // VENOM_IMPLICIT_NULL_CHECKS. their first load of the list happens
+  // inside of venom_list_impl, and GCC assumes loads through this cannot
+  // trap, so nothing could unwind out of a fault there
   CheckNullPointer(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd0);
 
@@ -748,29 +1164,69 @@ bool Instruction::GET_ARRAY_ACCESS_impl(ExecutionContext& ctx, venom_cell& opnd0
   // this is OK b/c of the compile-time checks
   venom_list::int_list_type* l =
     static_cast<venom_list::int_list_type*>(opnd0.asRawObject());
-  ctx.program_stack.push(l->elems.at(opnd1.asInt()));
+  *sp++ = l->elemAt(opnd1.asInt());
+
+  SYNC_SP();
+  opnd0.decRef();
+  return true;
+}
+
+bool Instruction::GET_ARRAY_ACCESS_UNCHECKED_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  CheckNullPointer(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd0);
+
+  // see the compile time asserts in GET_ARRAY_ACCESS_impl()
+  venom_list::int_list_type* l =
+    static_cast<venom_list::int_list_type*>(opnd0.asRawObject());
+  *sp++ = l->elemAtUnchecked(opnd1.asInt());
 
+  SYNC_SP();
   opnd0.decRef();
   return true;
 }
 
-bool Instruction::GET_ARRAY_ACCESS_REF_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1) {
+bool Instruction::GET_ARRAY_ACCESS_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
   CheckNullPointer(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd0);
 
   // directly access the array instead of calling the virtual method get()
   venom_list::ref_list_type* l =
     static_cast<venom_list::ref_list_type*>(opnd0.asRawObject());
-  venom_cell cell = l->elems.at(opnd1.asInt());
+  venom_cell cell = l->elemAt(opnd1.asInt());
+  venom_cell::AssertNonZeroRefCount(cell);
+  cell.incRef();
+  *sp++ = cell;
+
+  SYNC_SP();
+  opnd0.decRef();
+  return true;
+}
+
+bool Instruction::GET_ARRAY_ACCESS_REF_UNCHECKED_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  CheckNullPointer(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd0);
+
+  venom_list::ref_list_type* l =
+    static_cast<venom_list::ref_list_type*>(opnd0.asRawObject());
+  venom_cell cell = l->elemAtUnchecked(opnd1.asInt());
   venom_cell::AssertNonZeroRefCount(cell);
   cell.incRef();
-  ctx.program_stack.push(cell);
+  *sp++ = cell;
 
+  SYNC_SP();
   opnd0.decRef();
   return true;
 }
 
-bool Instruction::SET_ARRAY_ACCESS_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1, venom_cell& opnd2) {
+bool Instruction::SET_ARRAY_ACCESS_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1, venom_cell& opnd2) {
   CheckNullPointer(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd0);
   // directly access the array instead of calling the virtual method set()
@@ -778,24 +1234,209 @@ bool Instruction::SET_ARRAY_ACCESS_impl(ExecutionContext& ctx, venom_cell& opnd0
   // see the compile time asserts in GET_ARRAY_ACCESS_impl()
   venom_list::int_list_type* l =
     static_cast<venom_list::int_list_type*>(opnd0.asRawObject());
-  l->elems.at(opnd1.asInt()) = opnd2;
+  l->elemAt(opnd1.asInt()) = opnd2;
+  SYNC_SP();
   opnd0.decRef();
   return true;
 }
 
-bool Instruction::SET_ARRAY_ACCESS_REF_impl(ExecutionContext& ctx, venom_cell& opnd0, venom_cell& opnd1, venom_cell& opnd2) {
+bool Instruction::SET_ARRAY_ACCESS_UNCHECKED_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1, venom_cell& opnd2) {
+  CheckNullPointer(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd0);
+  venom_list::int_list_type* l =
+    static_cast<venom_list::int_list_type*>(opnd0.asRawObject());
+  l->elemAtUnchecked(opnd1.asInt()) = opnd2;
+  SYNC_SP();
+  opnd0.decRef();
+  return true;
+}
+
+bool Instruction::SET_ARRAY_ACCESS_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1, venom_cell& opnd2) {
   CheckNullPointer(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd0);
   venom_cell::AssertNonZeroRefCount(opnd2);
   // directly access the array instead of calling the virtual method set()
   venom_list::ref_list_type* l =
     static_cast<venom_list::ref_list_type*>(opnd0.asRawObject());
-  venom_cell &old = l->elems.at(opnd1.asInt());
+  venom_cell &old = l->elemAt(opnd1.asInt());
+  SYNC_SP();
+  old.decRef();
+  old = opnd2;
+  opnd0.decRef();
+  return true;
+}
+
+bool Instruction::SET_ARRAY_ACCESS_REF_UNCHECKED_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1, venom_cell& opnd2) {
+  CheckNullPointer(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd0);
+  venom_cell::AssertNonZeroRefCount(opnd2);
+  venom_list::ref_list_type* l =
+    static_cast<venom_list::ref_list_type*>(opnd0.asRawObject());
+  venom_cell &old = l->elemAtUnchecked(opnd1.asInt());
+  SYNC_SP();
   old.decRef();
   old = opnd2;
   opnd0.decRef();
   return true;
 }
 
+// Superinstructions. These must behave exactly as the sequences they replace
+// (see Fuser), but can skip the stack traffic in between. In particular,
+// an object read out of a local or the constant pool is kept alive by it, so
+// the GET_ATTR_OF_* handlers do not touch its ref count.
+
+bool Instruction::ADD_INT_LOCAL_LOCAL_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
+  InstFormatU32U32 *self = asFormatU32U32();
+  *sp++ = venom_cell(ctx.local_variable(self->N0).asInt() +
+                     ctx.local_variable(self->N1).asInt());
+  return true;
+}
+
+#define IMPL_GET_ATTR_OF(cell_expr) \
+  do { \
+    InstFormatU32U32 *self = asFormatU32U32(); \
+    venom_cell& obj = (cell_expr); \
+    IMPLICIT_NULL_CHECK(obj); \
+    venom_cell::AssertNonZeroRefCount(obj); \
+    *sp++ = obj.asRawObject()->cellAt(self->N1); \
+  } while (0)
+
+#define IMPL_GET_ATTR_OF_REF(cell_expr) \
+  do { \
+    IMPL_GET_ATTR_OF(cell_expr); \
+    venom_cell::AssertNonZeroRefCount(sp[-1]); \
+    sp[-1].incRef(); \
+  } while (0)
+
+bool Instruction::GET_ATTR_OF_LOCAL_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
+  IMPL_GET_ATTR_OF(ctx.local_variable(self->N0));
+  return true;
+}
+
+bool Instruction::GET_ATTR_OF_LOCAL_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
+  IMPL_GET_ATTR_OF_REF(ctx.local_variable(self->N0));
+  return true;
+}
+
+bool Instruction::GET_ATTR_OF_CONST_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
+  IMPL_GET_ATTR_OF(ctx.constant_pool[self->N0]);
+  return true;
+}
+
+bool Instruction::GET_ATTR_OF_CONST_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
+  IMPL_GET_ATTR_OF_REF(ctx.constant_pool[self->N0]);
+  return true;
+}
+
+// the field is read before the slot is written, since N0 and N2 may be the
+// same slot (c = c.next)
+#define IMPL_MOVE_ATTR_OF_REF(cell_expr) \
+  do { \
+    InstFormatU32U32U32 *self = asFormatU32U32U32(); \
+    venom_cell& obj = (cell_expr); \
+    IMPLICIT_NULL_CHECK(obj); \
+    venom_cell::AssertNonZeroRefCount(obj); \
+    venom_cell attr = obj.asRawObject()->cellAt(self->N1); \
+    venom_cell::AssertNonZeroRefCount(attr); \
+    venom_cell& old = ctx.local_variable(self->N2); \
+    if (VENOM_LIKELY(!ctx.defersRefCounts())) { \
+      attr.incRef(); \
+      if (old.asRawObject()) { \
+        SYNC_SP(); \
+        old.decRef(); \
+      } \
+    } \
+    old = attr; \
+  } while (0)
+
+bool Instruction::MOVE_ATTR_OF_LOCAL_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
+  IMPL_MOVE_ATTR_OF_REF(ctx.local_variable(self->N0));
+  return true;
+}
+
+bool Instruction::MOVE_ATTR_OF_CONST_REF_impl(
+    ExecutionContext& ctx, venom_cell*& sp) {
+  IMPL_MOVE_ATTR_OF_REF(ctx.constant_pool[self->N0]);
+  return true;
+}
+
+#undef IMPL_MOVE_ATTR_OF_REF
+#undef IMPL_GET_ATTR_OF_REF
+#undef IMPL_GET_ATTR_OF
+
+bool Instruction::ADD_INT_CONST_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  InstFormatC *self = asFormatC();
+  *sp++ = venom_cell(opnd0.asInt() + self->data.int_value);
+  return true;
+}
+
+bool Instruction::SUB_INT_CONST_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0) {
+  InstFormatC *self = asFormatC();
+  *sp++ = venom_cell(opnd0.asInt() - self->data.int_value);
+  return true;
+}
+
+#define IMPL_BRANCH_IF_INT(op) \
+  do { \
+    if (opnd0.asInt() op opnd1.asInt()) { \
+      InstFormatI32 *self = asFormatI32(); \
+      ctx.program_counter = offsetBy(self->N0); \
+      return false; \
+    } \
+    return true; \
+  } while (0)
+
+bool Instruction::BRANCH_IF_EQ_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPL_BRANCH_IF_INT(==);
+}
+
+bool Instruction::BRANCH_IF_NEQ_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPL_BRANCH_IF_INT(!=);
+}
+
+bool Instruction::BRANCH_IF_LT_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPL_BRANCH_IF_INT(<);
+}
+
+bool Instruction::BRANCH_IF_LE_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPL_BRANCH_IF_INT(<=);
+}
+
+bool Instruction::BRANCH_IF_GT_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPL_BRANCH_IF_INT(>);
+}
+
+bool Instruction::BRANCH_IF_GE_INT_impl(
+    ExecutionContext& ctx, venom_cell*& sp, venom_cell& opnd0,
+    venom_cell& opnd1) {
+  IMPL_BRANCH_IF_INT(>=);
+}
+
+#undef IMPL_BRANCH_IF_INT
+
 }
 }
@@ -36,15 +36,56 @@
 #include <runtime/venomobject.h>
 #include <util/macros.h>
 
+/**
+ * By default the interpreter is direct threaded: each Instruction holds the
+ * address of its handler (using the labels-as-values extension of GCC), and
+ * each handler jumps straight to the handler of the next instruction instead
+ * of going back through a central dispatch loop.
+ *
+ * Define VENOM_SWITCH_DISPATCH at build time (make SWITCH_DISPATCH=1) to use
+ * the portable switch based interpreter loop instead.
+ */
+#if defined(__GNUC__) && !defined(VENOM_SWITCH_DISPATCH)
+  #define VENOM_THREADED_DISPATCH
+#endif
+
+/**
+ * Define VENOM_IMPLICIT_NULL_CHECKS at build time (make
+ * IMPLICIT_NULL_CHECKS=1) to have the hot handlers skip testing their
+ * receiver against NULL. Dereferencing it faults instead, and the SIGSEGV
+ * handler (see InstallNullPointerHandler()) turns a fault at a low address
+ * inside of the interpreter into the same VenomRuntimeException. The array
+ * handlers still test their list (see GET_ARRAY_ACCESS_impl()).
+ *
+ * The interpreter is told apart by placing all of it in its own section
+ * (VENOM_INTERP_SECTION), which only works if the accessors the handlers use
+ * are inlined into them, so this needs an optimized build. The faulting
+ * instruction can only throw if it is compiled with -fnon-call-exceptions,
+ * which the Makefile adds.
+ */
+#ifdef VENOM_IMPLICIT_NULL_CHECKS
+  #if !defined(__GNUC__) || !defined(__linux__) || !defined(__x86_64__) || \
+      !defined(__OPTIMIZE__)
+    #error "VENOM_IMPLICIT_NULL_CHECKS needs an optimized GCC build for x86-64 Linux"
+  #endif
+  #define VENOM_INTERP_SECTION __attribute__((section("venom_interp")))
+#else
+  #define VENOM_INTERP_SECTION
+#endif
+
 namespace venom {
 namespace backend {
 
 /** Forward decl */
+class Executable;
 class ExecutionContext;
+struct Frame;
 class InstFormatU32;
 class InstFormatI32;
 class InstFormatIPtr;
-//class InstFormatU32U32;
+class InstFormatCall;
+class InstFormatU32U32;
+class InstFormatU32U32U32;
 class InstFormatC;
 
 /**
@@ -56,6 +97,12 @@ class InstFormatC;
  * phase.  The reason for this is mainly a time/space efficiency concern;
  * Instruction instances are more compact than their symbolic counterparts and
  * have all references resolved (avoiding un-necessary runtime symbol lookups).
+ *
+ * The linker packs the instructions back to back into one contiguous buffer.
+ * Instructions are variable width (operands are stored inline, after the
+ * opcode), and each instruction records its own width, so the next
+ * instruction is found with next(). Every width is a multiple of Alignment,
+ * so the operands of each instruction stay naturally aligned.
  */
 class Instruction {
 public:
@@ -97,19 +144,34 @@ public:
    *   LOAD_LOCAL_VAR_REF N0
    *      -> variables[N0] ; incRef(variables[N0])
    *
+   *   PUSH_CONST_BORROW N0
+   *      -> const[N0]
+   *   LOAD_LOCAL_VAR_BORROW N0
+   *      -> variables[N0]
+   *      (a reference which is only borrowed from the constant pool or the
+   *      local, which keeps the object alive until one of the *_BORROW
+   *      instructions below consumes it. See RefCountElider)
+   *
    *   ALLOC_OBJ N0
    *      -> obj ; incRef(obj)
    *
    *   CALL N0
-   *      -> ; pc = N0
+   *      -> ; pc = N0.code
    *   CALL_NATIVE N0
    *      [aN, aN-1, ..., a1, a0] -> ret_value ; N0(a0, a1, ..., aN-1, aN)
    *
    *   RET
    *      -> ; pc = ret_addr
    *
+   *   TAIL_CALL N0
+   *      -> ; pop frame ; pc = N0.code
+   *      (a CALL in tail position. The current frame is released and the
+   *      callee's frame takes its place, returning to the caller's ret_addr.
+   *      Only the arguments of the call may be left on the stack, and N0 is
+   *      never native)
+   *
    *   JUMP N0
-   *      -> ; pc = next_pc + N0
+   *      -> ; pc = pc + N0
    *
    * One operand instructions:
    *
@@ -122,6 +184,10 @@ public:
    *     opnd0 -> ; variables[N0] = opnd0
    *   STORE_LOCAL_VAR_REF N0
    *     opnd0 -> ; decRef(variables[N0]), variables[N0] = opnd0
+   *   STORE_LOCAL_VAR_REF_BORROW N0
+   *     opnd0 -> ; incRef(opnd0), decRef(variables[N0]), variables[N0] = opnd0
+   *     (opnd0 is borrowed, see PUSH_CONST_BORROW. When ref counts are
+   *     deferred the slot does not count, so neither count is touched)
    *
    *   INT_TO_FLOAT
    *     opnd0 -> float(opnd0)
@@ -151,22 +217,22 @@ public:
    *     opnd0 -> ~opnd0
    *
    *   BRANCH_Z_INT N0
-   *     opnd0 -> ; if (opnd0) pc = next_pc + N0 else pc = next_pc
+   *     opnd0 -> ; if (opnd0) pc = pc + N0 else pc = next_pc
    *   BRANCH_Z_FLOAT N0
-   *     opnd0 -> ; if (opnd0) pc = next_pc + N0 else pc = next_pc
+   *     opnd0 -> ; if (opnd0) pc = pc + N0 else pc = next_pc
    *   BRANCH_Z_BOOL N0
-   *     opnd0 -> ; if (opnd0) pc = next_pc + N0 else pc = next_pc
+   *     opnd0 -> ; if (opnd0) pc = pc + N0 else pc = next_pc
    *   BRANCH_Z_REF N0
-   *     opnd0 -> ; if (opnd0) pc = next_pc + N0 else pc = next_pc, decRef(opnd0)
+   *     opnd0 -> ; if (opnd0) pc = pc + N0 else pc = next_pc, decRef(opnd0)
    *
    *   BRANCH_NZ_INT N0
-   *     opnd0 -> ; if (!opnd0) pc = next_pc + N0 else pc = next_pc
+   *     opnd0 -> ; if (!opnd0) pc = pc + N0 else pc = next_pc
    *   BRANCH_NZ_FLOAT N0
-   *     opnd0 -> ; if (!opnd0) pc = next_pc + N0 else pc = next_pc
+   *     opnd0 -> ; if (!opnd0) pc = pc + N0 else pc = next_pc
    *   BRANCH_NZ_BOOL N0
-   *     opnd0 -> ; if (!opnd0) pc = next_pc + N0 else pc = next_pc
+   *     opnd0 -> ; if (!opnd0) pc = pc + N0 else pc = next_pc
    *   BRANCH_NZ_REF N0
-   *     opnd0 -> ; if (!opnd0) pc = next_pc + N0 else pc = next_pc, decRef(opnd0)
+   *     opnd0 -> ; if (!opnd0) pc = pc + N0 else pc = next_pc, decRef(opnd0)
    *
    *   TEST_INT
    *     opnd0 -> bool(opnd0)
@@ -175,18 +241,37 @@ public:
    *   TEST_REF
    *     opnd0 -> bool(opnd0) ; decRef(opnd0)
    *
-   *   GET_ATTR_OBJ N0
-   *     opnd0 -> opnd0.attr[N0] ; decRef(opnd0)
-   *   GET_ATTR_OBJ_REF N0
-   *     opnd0 -> opnd0.attr[N0] ; incRef(opnd0.attr[N0]), decRef(opnd0)
+   *   GET_FIELD_OFF N0
+   *     opnd0 -> opnd0.attr@N0 ; decRef(opnd0)
+   *   GET_FIELD_OFF_REF N0
+   *     opnd0 -> opnd0.attr@N0 ; incRef(opnd0.attr@N0), decRef(opnd0)
+   *     (attr@N0 is the cell N0 bytes into the object, which must have the
+   *     layout of a user object. See venom_object::cellAt(). The code
+   *     generator emits these with the cell index, and the linker encodes
+   *     the byte offset)
+   *   GET_FIELD_OFF_BORROW N0
+   *   GET_FIELD_OFF_REF_BORROW N0
+   *     same as above, but opnd0 is borrowed, so it is not decRef-ed
    *
    *   DUP N0
    *     opnd0 -> opnd0, opnd0, ..., opnd0 (N0 + 1 instances)
    *   DUP_REF N0
    *     opnd0 -> opnd0, opnd0, ..., opnd0 (N0 + 1 instances) ; incRef(opnd0) (N0 times)
    *
+   *   CHECK_NULL_REF
+   *     opnd0 -> opnd0 ; throw if opnd0 is nil
+   *     (the null check of a method call which was devirtualized into a
+   *     CALL, which does not look at its receiver)
+   *
    *   CALL_VIRTUAL N0
    *     obj -> ret_value ; PC = obj.vtable[N0] ; decRef(obj)
+   *     (once linked, N0 is the InlineCache of the call site, which holds
+   *     the vtable slot)
+   *   TAIL_CALL_VIRTUAL N0
+   *     obj -> ret_value ; pop frame ; PC = obj.vtable[N0] ; decRef(obj)
+   *     (a CALL_VIRTUAL in tail position, which replaces the current frame
+   *     like TAIL_CALL. Only a native callee returns to the next
+   *     instruction, so it is always followed by a RET)
    *
    * Two operand instructions:
    *
@@ -298,16 +383,23 @@ public:
    *   BINOP_BIT_RSHIFT_INT
    *     opnd0, opnd1 -> opnd0 >> opnd1
    *
-   *   SET_ATTR_OBJ N0
-   *     opnd0, opnd1 -> ; opnd0.attr[N0] = opnd1, decRef(opnd0)
-   *   SET_ATTR_OBJ_REF N0
-   *     opnd0, opnd1 -> ; decRef(opnd0.attr[N0]),
-   *                       opnd0.attr[N0] = opnd1, decRef(opnd0)
+   *   SET_FIELD_OFF N0
+   *     opnd0, opnd1 -> ; opnd0.attr@N0 = opnd1, decRef(opnd0)
+   *   SET_FIELD_OFF_REF N0
+   *     opnd0, opnd1 -> ; decRef(opnd0.attr@N0),
+   *                       opnd0.attr@N0 = opnd1, decRef(opnd0)
+   *   SET_FIELD_OFF_BORROW N0
+   *   SET_FIELD_OFF_REF_BORROW N0
+   *     same as above, but opnd0 is borrowed, so it is not decRef-ed
    *
    *   GET_ARRAY_ACCESS
    *     opnd0, opnd1 -> opnd0[opnd1] ; decRef(opnd0)
    *   GET_ARRAY_ACCESS_REF
    *     opnd0, opnd1 -> opnd0[opnd1] ; incRef(opnd0[opnd1]), decRef(opnd0)
+   *   GET_ARRAY_ACCESS_UNCHECKED
+   *   GET_ARRAY_ACCESS_REF_UNCHECKED
+   *     same as above, but opnd1 is known to be in range (see
+   *     WhileStmtNode), so it is not checked
    *
    * Three operand instructions:
    *
@@ -318,6 +410,53 @@ public:
    *     opnd0, opnd1, opnd2 ->
    *        ; incRef(opnd2), decRef(opnd0[opnd1]),
    *          opnd0[opnd1] = opnd2, decRef(opnd0)
+   *   SET_ARRAY_ACCESS_UNCHECKED
+   *   SET_ARRAY_ACCESS_REF_UNCHECKED
+   *     same as above, but opnd1 is known to be in range
+   *
+   * Superinstructions, which the code generator never emits. The linker
+   * fuses common sequences of the instructions above into these (see
+   * Fuser):
+   *
+   *   ADD_INT_LOCAL_LOCAL N0 N1
+   *     -> variables[N0] + variables[N1]
+   *   GET_ATTR_OF_LOCAL N0 N1
+   *     -> variables[N0].attr@N1
+   *   GET_ATTR_OF_LOCAL_REF N0 N1
+   *     -> variables[N0].attr@N1 ; incRef(variables[N0].attr@N1)
+   *   GET_ATTR_OF_CONST N0 N1
+   *     -> const[N0].attr@N1
+   *   GET_ATTR_OF_CONST_REF N0 N1
+   *     -> const[N0].attr@N1 ; incRef(const[N0].attr@N1)
+   *   MOVE_ATTR_OF_LOCAL_REF N0 N1 N2
+   *     -> ; incRef(variables[N0].attr@N1), decRef(variables[N2]),
+   *          variables[N2] = variables[N0].attr@N1
+   *   MOVE_ATTR_OF_CONST_REF N0 N1 N2
+   *     -> ; incRef(const[N0].attr@N1), decRef(variables[N2]),
+   *          variables[N2] = const[N0].attr@N1
+   *     (x = y.attr. When ref counts are deferred the slot does not count,
+   *     so neither count is touched)
+   *
+   *   ADD_INT_CONST i64
+   *     opnd0 -> opnd0 + i64
+   *   SUB_INT_CONST i64
+   *     opnd0 -> opnd0 - i64
+   *
+   *   BRANCH_IF_EQ_INT N0
+   *     opnd0, opnd1 -> ; if (opnd0 == opnd1) pc = pc + N0 else pc = next_pc
+   *   BRANCH_IF_NEQ_INT N0
+   *     opnd0, opnd1 -> ; if (opnd0 != opnd1) pc = pc + N0 else pc = next_pc
+   *   BRANCH_IF_LT_INT N0
+   *     opnd0, opnd1 -> ; if (opnd0 < opnd1) pc = pc + N0 else pc = next_pc
+   *   BRANCH_IF_LE_INT N0
+   *     opnd0, opnd1 -> ; if (opnd0 <= opnd1) pc = pc + N0 else pc = next_pc
+   *   BRANCH_IF_GT_INT N0
+   *     opnd0, opnd1 -> ; if (opnd0 > opnd1) pc = pc + N0 else pc = next_pc
+   *   BRANCH_IF_GE_INT N0
+   *     opnd0, opnd1 -> ; if (opnd0 >= opnd1) pc = pc + N0 else pc = next_pc
+   *
+   * Jump offsets (N0 of JUMP, BRANCH_* and BRANCH_IF_*) are in bytes,
+   * relative to the start of the jumping instruction.
    *
    */
 
@@ -329,17 +468,28 @@ public:
     x(PUSH_CONST) \
     x(LOAD_LOCAL_VAR) \
     x(LOAD_LOCAL_VAR_REF) \
+    x(PUSH_CONST_BORROW) \
+    x(LOAD_LOCAL_VAR_BORROW) \
     x(ALLOC_OBJ) \
     x(CALL) \
     x(CALL_NATIVE) \
     x(RET) \
+    x(TAIL_CALL) \
     x(JUMP) \
+    x(ADD_INT_LOCAL_LOCAL) \
+    x(GET_ATTR_OF_LOCAL) \
+    x(GET_ATTR_OF_LOCAL_REF) \
+    x(GET_ATTR_OF_CONST) \
+    x(GET_ATTR_OF_CONST_REF) \
+    x(MOVE_ATTR_OF_LOCAL_REF) \
+    x(MOVE_ATTR_OF_CONST_REF) \
 
 #define OPCODE_DEFINER_ONE(x) \
     x(POP_CELL) \
     x(POP_CELL_REF) \
     x(STORE_LOCAL_VAR) \
     x(STORE_LOCAL_VAR_REF) \
+    x(STORE_LOCAL_VAR_REF_BORROW) \
     x(INT_TO_FLOAT) \
     x(FLOAT_TO_INT) \
     x(UNOP_PLUS_INT) \
@@ -362,11 +512,17 @@ public:
     x(TEST_INT) \
     x(TEST_FLOAT) \
     x(TEST_REF) \
-    x(GET_ATTR_OBJ) \
-    x(GET_ATTR_OBJ_REF) \
+    x(GET_FIELD_OFF) \
+    x(GET_FIELD_OFF_REF) \
+    x(GET_FIELD_OFF_BORROW) \
+    x(GET_FIELD_OFF_REF_BORROW) \
     x(DUP) \
     x(DUP_REF) \
+    x(CHECK_NULL_REF) \
     x(CALL_VIRTUAL) \
+    x(TAIL_CALL_VIRTUAL) \
+    x(ADD_INT_CONST) \
+    x(SUB_INT_CONST) \
 
 #define OPCODE_DEFINER_TWO(x) \
     x(BINOP_ADD_INT) \
@@ -414,14 +570,26 @@ public:
     x(BINOP_BIT_XOR_BOOL) \
     x(BINOP_BIT_LSHIFT_INT) \
     x(BINOP_BIT_RSHIFT_INT) \
-    x(SET_ATTR_OBJ) \
-    x(SET_ATTR_OBJ_REF) \
+    x(SET_FIELD_OFF) \
+    x(SET_FIELD_OFF_REF) \
+    x(SET_FIELD_OFF_BORROW) \
+    x(SET_FIELD_OFF_REF_BORROW) \
     x(GET_ARRAY_ACCESS) \
     x(GET_ARRAY_ACCESS_REF) \
+    x(GET_ARRAY_ACCESS_UNCHECKED) \
+    x(GET_ARRAY_ACCESS_REF_UNCHECKED) \
+    x(BRANCH_IF_EQ_INT) \
+    x(BRANCH_IF_NEQ_INT) \
+    x(BRANCH_IF_LT_INT) \
+    x(BRANCH_IF_LE_INT) \
+    x(BRANCH_IF_GT_INT) \
+    x(BRANCH_IF_GE_INT) \
 
 #define OPCODE_DEFINER_THREE(x) \
     x(SET_ARRAY_ACCESS) \
     x(SET_ARRAY_ACCESS_REF) \
+    x(SET_ARRAY_ACCESS_UNCHECKED) \
+    x(SET_ARRAY_ACCESS_REF_UNCHECKED) \
 
 #define OPCODE_DEFINER(x) \
     OPCODE_DEFINER_ZERO(x) \
@@ -456,7 +624,83 @@ public:
     VENOM_NOT_REACHED;
   }
 
-  Instruction(Opcode opcode) : opcode(opcode) {}
+  /** The number of operands opcode pops off the stack (before any arguments
+   * to a call) */
+  static size_t NumOperands(Opcode opcode) {
+    switch (opcode) {
+#define CASE_ZERO(a)  case a: return 0;
+#define CASE_ONE(a)   case a: return 1;
+#define CASE_TWO(a)   case a: return 2;
+#define CASE_THREE(a) case a: return 3;
+    OPCODE_DEFINER_ZERO(CASE_ZERO)
+    OPCODE_DEFINER_ONE(CASE_ONE)
+    OPCODE_DEFINER_TWO(CASE_TWO)
+    OPCODE_DEFINER_THREE(CASE_THREE)
+#undef CASE_ZERO
+#undef CASE_ONE
+#undef CASE_TWO
+#undef CASE_THREE
+    default: break;
+    }
+    VENOM_NOT_REACHED;
+  }
+
+  /** Does opcode take a jump offset (JUMP and BRANCH_*)? Superinstructions
+   * are not included, since only the linker creates them */
+  static inline bool IsJump(Opcode opcode) {
+    switch (opcode) {
+    case JUMP:
+    case BRANCH_Z_INT:
+    case BRANCH_Z_FLOAT:
+    case BRANCH_Z_BOOL:
+    case BRANCH_Z_REF:
+    case BRANCH_NZ_INT:
+    case BRANCH_NZ_FLOAT:
+    case BRANCH_NZ_BOOL:
+    case BRANCH_NZ_REF:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  /** Does control never continue to the next instruction after opcode? */
+  static inline bool IsTerminator(Opcode opcode) {
+    return opcode == JUMP || opcode == RET || opcode == TAIL_CALL;
+  }
+
+  /** All instruction widths are a multiple of this many bytes */
+  static const size_t Alignment = 8;
+
+  /** The number of bytes an instruction of type Inst takes up in an
+   * instruction stream */
+  template <typename Inst>
+  static inline size_t WidthOf() {
+    return (sizeof(Inst) + Alignment - 1) & ~(Alignment - 1);
+  }
+
+  Instruction(Opcode opcode) { init(opcode, WidthOf<Instruction>()); }
+
+  inline Opcode getOpcode() const { return static_cast<Opcode>(opcode); }
+
+  /** Size of this instruction in the stream, in bytes */
+  inline size_t getWidth() const { return width; }
+
+  /** The instruction which follows this one in the stream */
+  inline Instruction* next() {
+    return reinterpret_cast<Instruction*>(
+        reinterpret_cast<char*>(this) + width);
+  }
+
+  /** The instruction offset bytes away from the start of this one */
+  inline Instruction* offsetBy(int64_t offset) {
+    return reinterpret_cast<Instruction*>(
+        reinterpret_cast<char*>(this) + offset);
+  }
+
+  /** Resolves what this instruction refers to in code, once the stream has
+   * been copied into it (see Executable) */
+  void link(Executable* code);
 
   /** NOTE: we do *not* need a virtual destructor here,
    * even though we will delete Instruction* pointers which
@@ -467,30 +711,84 @@ public:
    */
   ~Instruction() {}
 
-  /** Execute this instruction given the execution context.  Returns true if
-   * the ExecutionContext can simply move on to the next bytecode instruction
-   * after execution, or false if this instruction's execution modifies the
-   * program_counter */
-  bool execute(ExecutionContext& ctx);
+  /** Execute this instruction given the execution context, and sp, the
+   * (cached) top of its operand stack.  Returns true if the ExecutionContext
+   * can simply move on to the next bytecode instruction after execution, or
+   * false if this instruction's execution modifies the program_counter */
+  bool execute(ExecutionContext& ctx, runtime::venom_cell*& sp)
+    VENOM_INTERP_SECTION;
+
+  /**
+   * Runs the instruction stream starting at ctx.program_counter, until a RET
+   * pops the frame stack of ctx back down to stop_frame (which is NULL when
+   * the outermost frame returns). This is the main interpreter loop.
+   */
+  static void ExecuteStream(ExecutionContext& ctx, Frame* stop_frame)
+    VENOM_INTERP_SECTION;
+
+#ifdef VENOM_IMPLICIT_NULL_CHECKS
+  /** Installs the SIGSEGV handler which implements the null checks the
+   * handlers skip. Only the first call does anything */
+  static void InstallNullPointerHandler();
+#endif
+
+protected:
+  Instruction(Opcode opcode, size_t width) { init(opcode, width); }
 
 private:
-  Opcode opcode;
+  inline void init(Opcode opcode, size_t width) {
+    assert(width % Alignment == 0);
+    assert(width <= 0xFF);
+#ifdef VENOM_THREADED_DISPATCH
+    this->handler = HandlerFor(opcode);
+#endif
+    this->opcode = opcode;
+    this->width = width;
+  }
+
+
+#ifdef VENOM_THREADED_DISPATCH
+  /** Address of the handler label for opcode, inside ThreadedLoop() */
+  void* handler;
+
+  static void* HandlerFor(Opcode opcode);
+
+  /**
+   * The direct threaded interpreter. Calling it with a NULL ctx returns the
+   * table of handler addresses (indexed by opcode), which is the only way to
+   * get at the labels from outside of the function.
+   */
+  static void* const* ThreadedLoop(ExecutionContext* ctx, Frame* stop_frame)
+    VENOM_INTERP_SECTION;
+#endif
+
+  /** Stored as bytes to keep the encoded instructions small. The opcode
+   * fits (see CompileTimeAsserts()), and so does the widest format. */
+  uint8_t opcode;
+  uint8_t width;
 
   /** TODO: pass venom_cell by reference or value? Need to benchmark */
 
+  /** The operands have already been popped off of the stack when a handler
+   * is invoked, and sp points past the new top of the stack */
+
 #define DECL_ZERO(a) \
-  bool a ## _impl(ExecutionContext& ctx);
+  bool a ## _impl(ExecutionContext& ctx, runtime::venom_cell*& sp) \
+    VENOM_INTERP_SECTION;
 
 #define DECL_ONE(a) \
-  bool a ## _impl(ExecutionContext& ctx, runtime::venom_cell& opnd0);
+  bool a ## _impl(ExecutionContext& ctx, runtime::venom_cell*& sp, \
+      runtime::venom_cell& opnd0) VENOM_INTERP_SECTION;
 
 #define DECL_TWO(a) \
-  bool a ## _impl(ExecutionContext& ctx, runtime::venom_cell& opnd0, \
-      runtime::venom_cell& opnd1);
+  bool a ## _impl(ExecutionContext& ctx, runtime::venom_cell*& sp, \
+      runtime::venom_cell& opnd0, runtime::venom_cell& opnd1) \
+    VENOM_INTERP_SECTION;
 
 #define DECL_THREE(a) \
-  bool a ## _impl(ExecutionContext& ctx, runtime::venom_cell& opnd0, \
-      runtime::venom_cell& opnd1, runtime::venom_cell& opnd2);
+  bool a ## _impl(ExecutionContext& ctx, runtime::venom_cell*& sp, \
+      runtime::venom_cell& opnd0, runtime::venom_cell& opnd1, \
+      runtime::venom_cell& opnd2) VENOM_INTERP_SECTION;
 
   OPCODE_DEFINER_ZERO(DECL_ZERO)
   OPCODE_DEFINER_ONE(DECL_ONE)
@@ -505,7 +803,9 @@ private:
  InstFormatU32* asFormatU32();
  InstFormatI32* asFormatI32();
  InstFormatIPtr* asFormatIPtr();
- //InstFormatU32U32* asFormatU32U32();
+ InstFormatCall* asFormatCall();
+ InstFormatU32U32* asFormatU32U32();
+ InstFormatU32U32U32* asFormatU32U32U32();
  InstFormatC* asFormatC();
 
 };
@@ -513,7 +813,8 @@ private:
 /**
  * WARNING: Subclasses *cannot* contain non-primitive data (anything with
  * a destructor), since we do not have a virtual destructor for
- * Instruction
+ * Instruction. Instructions are also placement constructed into the
+ * linked instruction stream, and are never destructed individually.
  *
  * TODO: can we assert this at compile time somehow?
  */
@@ -525,10 +826,12 @@ private:
  * Where N0 is an unsigned int type
  */
 class InstFormatU32 : public Instruction {
+  friend class CppEmitter;
   friend class Instruction;
+  friend class Jit;
 public:
   InstFormatU32(Opcode opcode, uint32_t N0) :
-    Instruction(opcode), N0(N0) {}
+    Instruction(opcode, WidthOf<InstFormatU32>()), N0(N0) {}
 private:
   unsigned int N0;
 };
@@ -540,10 +843,12 @@ private:
  * Where N0 is an int type
  */
 class InstFormatI32 : public Instruction {
+  friend class CppEmitter;
   friend class Instruction;
+  friend class Jit;
 public:
   InstFormatI32(Opcode opcode, int32_t N0) :
-    Instruction(opcode), N0(N0) {}
+    Instruction(opcode, WidthOf<InstFormatI32>()), N0(N0) {}
 private:
   int32_t N0;
 };
@@ -555,47 +860,94 @@ private:
  * Where N0 is a ptr type
  */
 class InstFormatIPtr : public Instruction {
+  friend class CppEmitter;
   friend class Instruction;
+  friend class Jit;
 public:
   InstFormatIPtr(Opcode opcode, intptr_t N0) :
-    Instruction(opcode), N0(N0) {}
+    Instruction(opcode, WidthOf<InstFormatIPtr>()), N0(N0) {}
+protected:
+  InstFormatIPtr(Opcode opcode, intptr_t N0, size_t width) :
+    Instruction(opcode, width), N0(N0) {}
 private:
   intptr_t N0;
 };
 
+/**
+ * A CALL or TAIL_CALL, which contains
+ *   opcode N0 code
+ *
+ * Where N0 is the FunctionDescriptor called, as in InstFormatIPtr, and code
+ * is the first instruction of N0. The stream is copied into the Executable
+ * after it is linked, so the linker leaves code NULL, and the Executable
+ * fills it in (see link()) before any context runs the stream
+ */
+class InstFormatCall : public InstFormatIPtr {
+  friend class Instruction;
+public:
+  InstFormatCall(Opcode opcode, intptr_t N0) :
+    InstFormatIPtr(opcode, N0, WidthOf<InstFormatCall>()), code(NULL) {}
+private:
+  Instruction* code;
+};
+
 /**
  * An instruction which contains
  *   opcode N0 N1
  *
  * Where N0 and N1 are unsigned int types
  */
-//class InstFormatU32U32 : public Instruction {
-//  friend class Instruction;
-//public:
-//  InstFormatU32U32(Opcode opcode, uint32_t N0, uint32_t N1) :
-//    Instruction(opcode), N0(N0), N1(N1) {}
-//private:
-//  uint32_t N0;
-//  uint32_t N1;
-//};
+class InstFormatU32U32 : public Instruction {
+  friend class CppEmitter;
+  friend class Instruction;
+  friend class Jit;
+public:
+  InstFormatU32U32(Opcode opcode, uint32_t N0, uint32_t N1) :
+    Instruction(opcode, WidthOf<InstFormatU32U32>()), N0(N0), N1(N1) {}
+private:
+  uint32_t N0;
+  uint32_t N1;
+};
+
+/**
+ * An instruction which contains
+ *   opcode N0 N1 N2
+ *
+ * Where N0, N1 and N2 are unsigned int types
+ */
+class InstFormatU32U32U32 : public Instruction {
+  friend class CppEmitter;
+  friend class Instruction;
+  friend class Jit;
+public:
+  InstFormatU32U32U32(Opcode opcode, uint32_t N0, uint32_t N1, uint32_t N2) :
+    Instruction(opcode, WidthOf<InstFormatU32U32U32>()),
+    N0(N0), N1(N1), N2(N2) {}
+private:
+  uint32_t N0;
+  uint32_t N1;
+  uint32_t N2;
+};
 
 /**
  * An instruct which contains
  *   opcode [i64|double|bool]
  */
 class InstFormatC : public Instruction {
+  friend class CppEmitter;
   friend class Instruction;
+  friend class Jit;
 public:
   InstFormatC(Opcode opcode, int64_t int_value) :
-    Instruction(opcode), data(int_value) {}
+    Instruction(opcode, WidthOf<InstFormatC>()), data(int_value) {}
   InstFormatC(Opcode opcode, int int_value) :
-    Instruction(opcode), data(int_value) {}
+    Instruction(opcode, WidthOf<InstFormatC>()), data(int_value) {}
   InstFormatC(Opcode opcode, double double_value) :
-    Instruction(opcode), data(double_value) {}
+    Instruction(opcode, WidthOf<InstFormatC>()), data(double_value) {}
   InstFormatC(Opcode opcode, float double_value) :
-    Instruction(opcode), data(double_value) {}
+    Instruction(opcode, WidthOf<InstFormatC>()), data(double_value) {}
   InstFormatC(Opcode opcode, bool bool_value) :
-    Instruction(opcode), data(bool_value) {}
+    Instruction(opcode, WidthOf<InstFormatC>()), data(bool_value) {}
 private:
   union types {
     /** Primitives */
@@ -27,6 +27,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <ast/statement/node.h>
@@ -36,6 +37,7 @@
 #include <backend/vm.h>
 
 #include <runtime/venomobject.h>
+#include <runtime/venomref.h>
 
 using namespace std;
 using namespace venom::analysis;
@@ -45,7 +47,7 @@ namespace venom {
 namespace backend {
 
 FunctionDescriptor*
-FunctionSignature::createFuncDescriptor(uint64_t globalOffset) {
+FunctionSignature::createFuncDescriptor(uint64_t streamOffset) {
   // construct the argument ref count bitmap
   uint64_t arg_ref_cell_bitmap = 0;
   for (size_t i = 0; i < parameters.size(); i++) {
@@ -61,10 +63,11 @@ FunctionSignature::createFuncDescriptor(uint64_t globalOffset) {
   }
 
   return new FunctionDescriptor(
-      (void*) (codeOffset + globalOffset),
-      isMethod() ? parameters.size() + 1 : parameters.size(),
+      (void*) streamOffset,
+      getNumArgs(),
       arg_ref_cell_bitmap,
-      false);
+      numLocals,
+      refLocals);
 }
 
 venom_class_object*
@@ -117,7 +120,11 @@ CodeGenerator::bindLabel(Label* label) {
 
 size_t
 CodeGenerator::createLocalVariable(Symbol* symbol, bool& create) {
-  return local_variable_pool.create(symbol, create);
+  size_t idx = local_variable_pool.create(symbol, create);
+  // the function's frame must have room for this slot
+  size_t& numLocals = funcIdxToNumLocals[current_func_idx];
+  numLocals = max(numLocals, idx + 1);
+  return idx;
 }
 
 Symbol*
@@ -134,6 +141,20 @@ CodeGenerator::createTemporaryVariable() {
   }
 }
 
+size_t
+CodeGenerator::getScalarFieldSlot(Symbol* object, size_t slot) {
+  ScalarObjectMap::iterator it = scalar_objects.find(object);
+  assert(it != scalar_objects.end());
+  vector<Symbol*>& fields = it->second;
+  if (fields.size() <= slot) fields.resize(slot + 1);
+  if (!fields[slot]) {
+    fields[slot] = new Symbol("", NULL, NULL, NULL);
+    temporary_symbols.insert(fields[slot]);
+  }
+  bool create;
+  return createLocalVariable(fields[slot], create);
+}
+
 void
 CodeGenerator::returnTemporaryVariable(Symbol* symbol) {
   // must have created a temp variable using
@@ -208,7 +229,8 @@ CodeGenerator::enterLocalFunction(FuncSymbol* symbol,
 
     // map func-ref-index to func-pool-index
     assert(func_reference_table.vec.at(idx).isLocal());
-    funcIdxToLabels[func_reference_table.vec[idx].getLocalIndex()] = start;
+    current_func_idx = func_reference_table.vec[idx].getLocalIndex();
+    funcIdxToLabels[current_func_idx] = start;
   }
 
   return idx;
@@ -239,10 +261,47 @@ CodeGenerator::emitInst(SymbolicInstruction::Opcode opcode) {
 
 void
 CodeGenerator::emitInstU32(SymbolicInstruction::Opcode opcode, uint32_t n0) {
+  if (opcode == Instruction::STORE_LOCAL_VAR_REF ||
+      opcode == Instruction::LOAD_LOCAL_VAR_REF) {
+    // the frame must release this slot when the function returns. a slot
+    // which is only ever loaded as a reference is still nil
+    funcIdxToRefLocals[current_func_idx].insert(n0);
+  }
   SInstU32 *inst = new SInstU32(opcode, n0);
   instructions.push_back(inst);
 }
 
+void
+CodeGenerator::emitInstCallVirtual(uint32_t slot, uint32_t numArgs,
+                                   bool tail) {
+  SInstCallVirtual *inst = new SInstCallVirtual(
+      tail ? Instruction::TAIL_CALL_VIRTUAL : Instruction::CALL_VIRTUAL,
+      slot, numArgs);
+  instructions.push_back(inst);
+}
+
+void
+CodeGenerator::emitInstField(uint32_t slot, bool ref, bool store) {
+  // every class with cells lays them out right after the venom_object part:
+  // modules and user classes get their class objects from
+  // ClassSignature::createClassObject(), and the only builtin class with an
+  // attribute is <ref>, which adds no members. so the static type of the
+  // object always says where the cell is, and the linker can encode its
+  // byte offset. every field access is emitted this way
+  VENOM_COMPILE_TIME_ASSERT(
+      sizeof(venom_ref_impl<true>) == sizeof(venom_object));
+  VENOM_COMPILE_TIME_ASSERT(
+      sizeof(venom_ref_impl<false>) == sizeof(venom_object));
+  Instruction::Opcode opcode;
+  if (store) {
+    opcode = ref ? Instruction::SET_FIELD_OFF_REF : Instruction::SET_FIELD_OFF;
+  } else {
+    opcode = ref ? Instruction::GET_FIELD_OFF_REF : Instruction::GET_FIELD_OFF;
+  }
+  SInstU32 *inst = new SInstU32(opcode, slot);
+  instructions.push_back(inst);
+}
+
 void
 CodeGenerator::emitInstLabel(SymbolicInstruction::Opcode opcode, Label* label) {
   SInstLabel *inst = new SInstLabel(opcode, label);
@@ -289,6 +348,12 @@ CodeGenerator::getClassRefIndexFromType(InstantiatedType* type, bool& create) {
   }
 }
 
+bool
+CodeGenerator::isLocalFunction(const FuncSymbol* symbol) const {
+  return symbol->getDefinedSymbolTable()->belongsTo(
+      ctx->getModuleRoot()->getSymbolTable());
+}
+
 bool
 CodeGenerator::isLocalSymbol(const BaseSymbol* symbol) const {
   return (symbol->getDefinedSymbolTable()->belongsTo(
@@ -437,6 +502,9 @@ CodeGenerator::createObjectCode() {
       assert(!create);
     }
 
+    set<uint32_t>& refLocalSet = funcIdxToRefLocals[idx];
+    vector<uint32_t> refLocals(refLocalSet.begin(), refLocalSet.end());
+
     if (MethodSymbol* ms = dynamic_cast<MethodSymbol*>(fsym)) {
       bool create;
       funcSigs.push_back(
@@ -445,7 +513,9 @@ CodeGenerator::createObjectCode() {
             fsym->getName(),
             paramVec,
             getClassRefIndexFromType(fsym->getReturnType(), create),
-            funcIdxToLabels[idx]->index));
+            funcIdxToLabels[idx]->index,
+            funcIdxToNumLocals[idx],
+            refLocals));
       assert(!create);
     } else {
       bool create;
@@ -454,7 +524,9 @@ CodeGenerator::createObjectCode() {
             fsym->getName(),
             paramVec,
             getClassRefIndexFromType(fsym->getReturnType(), create),
-            funcIdxToLabels[idx]->index));
+            funcIdxToLabels[idx]->index,
+            funcIdxToNumLocals[idx],
+            refLocals));
       assert(!create);
     }
   }
@@ -478,6 +550,14 @@ CodeGenerator::createObjectCode() {
       labels);
 }
 
+string
+CodeGenerator::FunctionName(BaseSymbol* symbol) {
+  if (MethodSymbol* ms = dynamic_cast<MethodSymbol*>(symbol)) {
+    return ms->getClassSymbol()->getName() + "." + ms->getName();
+  }
+  return symbol->getName();
+}
+
 void
 CodeGenerator::printDebugStream() {
   cerr << "; venom bytecode v0.1" << endl;
@@ -522,13 +602,7 @@ CodeGenerator::printDebugStream() {
        it != instructions.end(); ++it, ++index) {
     InstLabelSymbolPairMap::iterator iit = instToFuncLabels.find(index);
     if (iit != instToFuncLabels.end()) {
-      BaseSymbol* bs = iit->second.second;
-      if (MethodSymbol* ms = dynamic_cast<MethodSymbol*>(bs)) {
-        cerr << ms->getClassSymbol()->getName() << "."
-             << ms->getName() << ":" << endl;
-      } else {
-        cerr << bs->getName() << ":" << endl;
-      }
+      cerr << FunctionName(iit->second.second) << ":" << endl;
     } else {
       InstLabelMap::iterator iit = instToLabels.find(index);
       if (iit != instToLabels.end()) {
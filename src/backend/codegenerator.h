@@ -30,13 +30,16 @@
 #ifndef VENOM_BACKEND_CODE_GENERATOR_H
 #define VENOM_BACKEND_CODE_GENERATOR_H
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <utility>
 
+#include <analysis/classhierarchy.h>
 #include <analysis/semanticcontext.h>
 #include <analysis/symbol.h>
 #include <analysis/symboltable.h>
@@ -63,6 +66,7 @@ class FunctionDescriptor;
 
 class Label {
   friend class CodeGenerator;
+  friend class PeepholeOptimizer;
 protected:
   Label() : index(-1) {}
   Label(int64_t index) : index(index) {}
@@ -141,9 +145,12 @@ public:
       const std::string& name,
       const std::vector<uint32_t>& parameters,
       uint32_t returnType,
-      uint64_t codeOffset) :
+      uint64_t codeOffset,
+      uint32_t numLocals,
+      const std::vector<uint32_t>& refLocals) :
     name(name), parameters(parameters),
-    returnType(returnType), codeOffset(codeOffset) {}
+    returnType(returnType), codeOffset(codeOffset),
+    numLocals(numLocals), refLocals(refLocals) {}
 
   // method constructor
   FunctionSignature(
@@ -151,25 +158,37 @@ public:
       const std::string& name,
       const std::vector<uint32_t>& parameters,
       uint32_t returnType,
-      uint64_t codeOffset) :
+      uint64_t codeOffset,
+      uint32_t numLocals,
+      const std::vector<uint32_t>& refLocals) :
     className(className), name(name), parameters(parameters),
-    returnType(returnType), codeOffset(codeOffset) {}
+    returnType(returnType), codeOffset(codeOffset),
+    numLocals(numLocals), refLocals(refLocals) {}
 
   inline bool isMethod() const { return !className.empty(); }
 
+  /** Number of arguments, including the "this" pointer for methods */
+  inline size_t getNumArgs() const {
+    return isMethod() ? parameters.size() + 1 : parameters.size();
+  }
+
   inline std::string getFullName(const std::string& moduleName) const {
     return isMethod() ?
       moduleName + "." + className + "." + name :
       moduleName + "." + name;
   }
 
-  FunctionDescriptor* createFuncDescriptor(uint64_t globalOffset);
+  /** streamOffset is where the linker placed the first instruction of this
+   * function, in bytes from the start of the instruction stream */
+  FunctionDescriptor* createFuncDescriptor(uint64_t streamOffset);
 
   std::string className;
   std::string name;
   std::vector<uint32_t> parameters;
   uint32_t returnType;
   uint64_t codeOffset;
+  uint32_t numLocals; // number of local variable slots used by the function
+  std::vector<uint32_t> refLocals; // the local slots which hold references
 };
 
 class ClassSignature {
@@ -216,11 +235,20 @@ public:
  * file corresponding to one input source file.
  */
 class CodeGenerator {
+  friend class PeepholeOptimizer;
+  friend class RefCountElider;
 public:
   /** does not take ownership of ctx */
   CodeGenerator(analysis::SemanticContext* ctx) :
     ctx(ctx),
+    current_func_idx(0),
     ownership(true),
+    inlining(true),
+    inline_depth(0),
+    inline_exit(NULL),
+    self_slot(0),
+    class_hierarchy(NULL),
+    scalar_self(NULL),
     class_reference_table(&class_pool),
     func_reference_table(&func_pool) {}
 
@@ -250,6 +278,8 @@ public:
     temporary_symbols.clear();
     available_temporary_symbols.clear();
     local_variable_pool.reset();
+    scalar_objects.clear();
+    scalar_self = NULL;
   }
 
   /** Symbol returned has no symbol table and no type */
@@ -290,8 +320,17 @@ public:
 
   void emitInstU32(Instruction::Opcode opcode, uint32_t n0);
 
+  /** CALL_VIRTUAL on vtable slot, passing numArgs arguments (not counting
+   * the "this" pointer). TAIL_CALL_VIRTUAL if tail is set */
+  void emitInstCallVirtual(uint32_t slot, uint32_t numArgs, bool tail = false);
+
   void emitInstLabel(Instruction::Opcode opcode, Label* label);
 
+  /** Reads the cell slot of the object on top of the stack, or if store is
+   * set, writes the value on top of the stack into the cell slot of the
+   * object below it. ref is set if the cell holds a reference */
+  void emitInstField(uint32_t slot, bool ref, bool store = false);
+
   void emitInstI64(Instruction::Opcode opcode, int64_t n0);
 
   void emitInstDouble(Instruction::Opcode opcode, double n0);
@@ -300,9 +339,101 @@ public:
 
   void createObjectCodeAndSet(analysis::SemanticContext* ctx);
 
+  /** Is symbol defined in the module this instance is generating code for? */
+  bool isLocalFunction(const analysis::FuncSymbol* symbol) const;
+
+  /** Inlining of calls to small functions (see FunctionCallNode) */
+  static const size_t MaxInlineDepth = 2;
+
+  inline void setInlining(bool inlining) { this->inlining = inlining; }
+
+  /** Can the call currently being generated be inlined? Calls made by the
+   * body of an inlined function can be too, up to MaxInlineDepth levels */
+  inline bool canInline() const {
+    return inlining && inline_depth < MaxInlineDepth;
+  }
+
+  /** While the body of an inlined function is being generated, a return
+   * jumps to this label (with its value on the stack) instead of emitting
+   * RET. NULL otherwise */
+  inline Label* getInlineExitLabel() { return inline_exit; }
+
+  /** Enters the body of an inlined function, returning the exit label of
+   * the enclosing one */
+  inline Label* enterInline(Label* exit) {
+    assert(canInline());
+    inline_depth++;
+    Label* prev = inline_exit;
+    inline_exit = exit;
+    return prev;
+  }
+
+  inline void leaveInline(Label* prev) {
+    assert(inline_depth);
+    inline_depth--;
+    inline_exit = prev;
+  }
+
+  /** The function whose body is being generated, and the ones inlined into
+   * it. Local variable slots are keyed by symbol, so an inlined copy of a
+   * function in here would share the slots of the one still running, and
+   * is never generated (see FunctionCallNode) */
+  inline void enterBody(const analysis::FuncSymbol* symbol) {
+    bodies.push_back(symbol);
+  }
+  inline void leaveBody() {
+    assert(!bodies.empty());
+    bodies.pop_back();
+  }
+  inline bool isInBody(const analysis::FuncSymbol* symbol) const {
+    return std::find(bodies.begin(), bodies.end(), symbol) != bodies.end();
+  }
+  inline const std::vector<const analysis::FuncSymbol*>& getBodies() const {
+    return bodies;
+  }
+
+  /** The local slot holding the "this" pointer of the method being
+   * generated. Slot 0, unless an inlined method stored it elsewhere */
+  inline uint32_t getSelfSlot() const { return self_slot; }
+  inline void setSelfSlot(uint32_t self_slot) { this->self_slot = self_slot; }
+
+  /** Virtual calls are devirtualized against this, if set. Does not take
+   * ownership */
+  inline analysis::ClassHierarchy* getClassHierarchy() {
+    return class_hierarchy;
+  }
+  inline void setClassHierarchy(analysis::ClassHierarchy* class_hierarchy) {
+    this->class_hierarchy = class_hierarchy;
+  }
+
+  /** Scalar replacement of objects which never escape the function being
+   * generated (see analysis::EscapeAnalysis). Each field of such an object
+   * lives in a local variable slot of its own */
+  inline void addScalarObject(analysis::Symbol* object) {
+    scalar_objects[object];
+  }
+
+  inline bool isScalarObject(analysis::Symbol* object) const {
+    return scalar_objects.find(object) != scalar_objects.end();
+  }
+
+  /** Returns the local variable slot holding the field in cell slot of
+   * object */
+  size_t getScalarFieldSlot(analysis::Symbol* object, size_t slot);
+
+  /** The object replaced by scalars whose constructor or method is being
+   * generated inline, or NULL */
+  inline analysis::Symbol* getScalarSelf() { return scalar_self; }
+  inline void setScalarSelf(analysis::Symbol* scalar_self) {
+    this->scalar_self = scalar_self;
+  }
+
   /** Debug helpers */
   void printDebugStream();
 
+  /** The name a function is listed under by printDebugStream() */
+  static std::string FunctionName(analysis::BaseSymbol* symbol);
+
 private:
   size_t enterLocalClass(analysis::ClassSymbol* symbol, bool& create);
 
@@ -349,12 +480,42 @@ private:
   typedef std::map<size_t, Label*> FuncIdxLabelMap;
   FuncIdxLabelMap funcIdxToLabels;
 
+  /** Map function pool ref number to the number of local variable slots
+   * the function uses */
+  typedef std::map<size_t, size_t> FuncIdxCountMap;
+  FuncIdxCountMap funcIdxToNumLocals;
+
+  /** Map function pool ref number to the local variable slots the function
+   * uses to hold references */
+  typedef std::map<size_t, std::set<uint32_t> > FuncIdxSlotsMap;
+  FuncIdxSlotsMap funcIdxToRefLocals;
+
+  /** Function pool ref number of the function currently being generated */
+  size_t current_func_idx;
+
   /** Instruction stream */
   std::vector<SymbolicInstruction*> instructions;
 
   /** Does this CodeGenerator own the labels/instructions? */
   bool ownership;
 
+  /** State for inlining, see canInline() */
+  bool inlining;
+  size_t inline_depth;
+  Label* inline_exit;
+  std::vector<const analysis::FuncSymbol*> bodies;
+  uint32_t self_slot;
+
+  analysis::ClassHierarchy* class_hierarchy;
+
+  /** State for scalar replacement, see addScalarObject(). The symbols of
+   * the field slots are owned by temporary_symbols, but are never made
+   * available for reuse: a slot must always hold a reference or never */
+  typedef std::map< analysis::Symbol*, std::vector<analysis::Symbol*> >
+          ScalarObjectMap;
+  ScalarObjectMap scalar_objects;
+  analysis::Symbol* scalar_self;
+
   template <typename SearchType>
   struct container_table_local_functor {
     container_table_local_functor(util::container_pool<SearchType>* pool)
@@ -0,0 +1,681 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <backend/bytecode.h>
+#include <backend/cppemitter.h>
+#include <backend/inlinecache.h>
+#include <backend/linker.h>
+#include <backend/vm.h>
+
+#include <runtime/box.h>
+#include <runtime/builtin.h>
+#include <runtime/venomdict.h>
+#include <runtime/venomlist.h>
+#include <runtime/venomref.h>
+#include <runtime/venomstring.h>
+
+#include <util/stl.h>
+
+using namespace std;
+using namespace venom::runtime;
+
+namespace venom {
+namespace backend {
+
+static const venom_cell::CellType CellTypes[] = {
+  venom_cell::IntType,
+  venom_cell::FloatType,
+  venom_cell::BoolType,
+  venom_cell::RefType,
+};
+
+static const char* const CellTypeNames[] = {
+  "venom_cell::IntType",
+  "venom_cell::FloatType",
+  "venom_cell::BoolType",
+  "venom_cell::RefType",
+};
+
+/** Does inst take a jump offset (including the fused branches)? */
+static inline bool IsBranch(Instruction::Opcode opcode) {
+  switch (opcode) {
+  case Instruction::BRANCH_IF_EQ_INT:
+  case Instruction::BRANCH_IF_NEQ_INT:
+  case Instruction::BRANCH_IF_LT_INT:
+  case Instruction::BRANCH_IF_LE_INT:
+  case Instruction::BRANCH_IF_GT_INT:
+  case Instruction::BRANCH_IF_GE_INT:
+    return true;
+  default:
+    return Instruction::IsJump(opcode);
+  }
+}
+
+/**
+ * How the instructions which compute a value from their operands (and
+ * nothing else) are written in C++: the accessor applied to each operand,
+ * the operator, and the type of the result. Returns false for any other
+ * instruction. The conditional branches use the same table, for the
+ * condition which makes them jump
+ */
+static bool OperatorOf(Instruction::Opcode opcode, size_t& n_opnds,
+                       const char*& as, const char*& op, const char*& type) {
+#define _UNOP(opc, a, o, t) \
+  case Instruction::opc: n_opnds = 1; as = a; op = o; type = t; return true;
+#define _BINOP(opc, a, o, t) \
+  case Instruction::opc: n_opnds = 2; as = a; op = o; type = t; return true;
+
+  switch (opcode) {
+  _UNOP(INT_TO_FLOAT, "asInt", "", "double")
+  _UNOP(FLOAT_TO_INT, "asDouble", "", "int64_t")
+  _UNOP(UNOP_PLUS_INT, "asInt", "+", "int64_t")
+  _UNOP(UNOP_PLUS_FLOAT, "asDouble", "+", "double")
+  _UNOP(UNOP_MINUS_INT, "asInt", "-", "int64_t")
+  _UNOP(UNOP_MINUS_FLOAT, "asDouble", "-", "double")
+  _UNOP(UNOP_CMP_NOT_INT, "asInt", "!", "bool")
+  _UNOP(UNOP_CMP_NOT_FLOAT, "asDouble", "!", "bool")
+  _UNOP(UNOP_CMP_NOT_BOOL, "asBool", "!", "bool")
+  _UNOP(UNOP_CMP_NOT_REF, "asRawObject", "!", "bool")
+  _UNOP(UNOP_BIT_NOT_INT, "asInt", "~", "int64_t")
+  _UNOP(TEST_INT, "asInt", "", "bool")
+  _UNOP(TEST_FLOAT, "asDouble", "", "bool")
+  _UNOP(TEST_REF, "asRawObject", "", "bool")
+
+  _UNOP(BRANCH_Z_INT, "asInt", "!", "bool")
+  _UNOP(BRANCH_Z_FLOAT, "asDouble", "!", "bool")
+  _UNOP(BRANCH_Z_BOOL, "asBool", "!", "bool")
+  _UNOP(BRANCH_Z_REF, "asRawObject", "!", "bool")
+  _UNOP(BRANCH_NZ_INT, "asInt", "", "bool")
+  _UNOP(BRANCH_NZ_FLOAT, "asDouble", "", "bool")
+  _UNOP(BRANCH_NZ_BOOL, "asBool", "", "bool")
+  _UNOP(BRANCH_NZ_REF, "asRawObject", "", "bool")
+
+  _BINOP(BINOP_ADD_INT, "asInt", "+", "int64_t")
+  _BINOP(BINOP_ADD_FLOAT, "asDouble", "+", "double")
+  _BINOP(BINOP_SUB_INT, "asInt", "-", "int64_t")
+  _BINOP(BINOP_SUB_FLOAT, "asDouble", "-", "double")
+  _BINOP(BINOP_MULT_INT, "asInt", "*", "int64_t")
+  _BINOP(BINOP_MULT_FLOAT, "asDouble", "*", "double")
+  _BINOP(BINOP_DIV_INT, "asInt", "/", "int64_t")
+  _BINOP(BINOP_DIV_FLOAT, "asDouble", "/", "double")
+  _BINOP(BINOP_MOD_INT, "asInt", "%", "int64_t")
+  _BINOP(BINOP_CMP_AND_INT, "asInt", "&&", "bool")
+  _BINOP(BINOP_CMP_AND_FLOAT, "asDouble", "&&", "bool")
+  _BINOP(BINOP_CMP_AND_BOOL, "asBool", "&&", "bool")
+  _BINOP(BINOP_CMP_AND_REF, "asRawObject", "&&", "bool")
+  _BINOP(BINOP_CMP_OR_INT, "asInt", "||", "bool")
+  _BINOP(BINOP_CMP_OR_FLOAT, "asDouble", "||", "bool")
+  _BINOP(BINOP_CMP_OR_BOOL, "asBool", "||", "bool")
+  _BINOP(BINOP_CMP_OR_REF, "asRawObject", "||", "bool")
+  _BINOP(BINOP_CMP_LT_INT, "asInt", "<", "bool")
+  _BINOP(BINOP_CMP_LT_FLOAT, "asDouble", "<", "bool")
+  _BINOP(BINOP_CMP_LT_BOOL, "asBool", "<", "bool")
+  _BINOP(BINOP_CMP_LE_INT, "asInt", "<=", "bool")
+  _BINOP(BINOP_CMP_LE_FLOAT, "asDouble", "<=", "bool")
+  _BINOP(BINOP_CMP_LE_BOOL, "asBool", "<=", "bool")
+  _BINOP(BINOP_CMP_GT_INT, "asInt", ">", "bool")
+  _BINOP(BINOP_CMP_GT_FLOAT, "asDouble", ">", "bool")
+  _BINOP(BINOP_CMP_GT_BOOL, "asBool", ">", "bool")
+  _BINOP(BINOP_CMP_GE_INT, "asInt", ">=", "bool")
+  _BINOP(BINOP_CMP_GE_FLOAT, "asDouble", ">=", "bool")
+  _BINOP(BINOP_CMP_GE_BOOL, "asBool", ">=", "bool")
+  _BINOP(BINOP_CMP_EQ_INT, "asInt", "==", "bool")
+  _BINOP(BINOP_CMP_EQ_FLOAT, "asDouble", "==", "bool")
+  _BINOP(BINOP_CMP_EQ_BOOL, "asBool", "==", "bool")
+  _BINOP(BINOP_CMP_EQ_REF, "asRawObject", "==", "bool")
+  _BINOP(BINOP_CMP_NEQ_INT, "asInt", "!=", "bool")
+  _BINOP(BINOP_CMP_NEQ_FLOAT, "asDouble", "!=", "bool")
+  _BINOP(BINOP_CMP_NEQ_BOOL, "asBool", "!=", "bool")
+  _BINOP(BINOP_CMP_NEQ_REF, "asRawObject", "!=", "bool")
+  _BINOP(BINOP_BIT_AND_INT, "asInt", "&", "int64_t")
+  _BINOP(BINOP_BIT_AND_BOOL, "asBool", "&", "bool")
+  _BINOP(BINOP_BIT_OR_INT, "asInt", "|", "int64_t")
+  _BINOP(BINOP_BIT_OR_BOOL, "asBool", "|", "bool")
+  _BINOP(BINOP_BIT_XOR_INT, "asInt", "^", "int64_t")
+  _BINOP(BINOP_BIT_XOR_BOOL, "asBool", "^", "bool")
+  _BINOP(BINOP_BIT_LSHIFT_INT, "asInt", "<<", "int64_t")
+  _BINOP(BINOP_BIT_RSHIFT_INT, "asInt", ">>", "int64_t")
+
+  _BINOP(BRANCH_IF_EQ_INT, "asInt", "==", "bool")
+  _BINOP(BRANCH_IF_NEQ_INT, "asInt", "!=", "bool")
+  _BINOP(BRANCH_IF_LT_INT, "asInt", "<", "bool")
+  _BINOP(BRANCH_IF_LE_INT, "asInt", "<=", "bool")
+  _BINOP(BRANCH_IF_GT_INT, "asInt", ">", "bool")
+  _BINOP(BRANCH_IF_GE_INT, "asInt", ">=", "bool")
+
+  default: return false;
+  }
+
+#undef _UNOP
+#undef _BINOP
+}
+
+static string IntLiteral(int64_t value) {
+  // the most negative value has no literal (only the negation of a literal
+  // which is out of range)
+  if (value == numeric_limits<int64_t>::min()) {
+    return "int64_t(-9223372036854775807LL - 1)";
+  }
+  return "int64_t(" + util::stringify(value) + "LL)";
+}
+
+static string StringLiteral(const string& s) {
+  stringstream buf;
+  buf << "std::string(\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\' || c == '?') {
+      buf << '\\' << c;
+    } else if (c < 0x20 || c >= 0x7F) {
+      // always three digits, so a digit after it is not taken as part of it
+      buf << '\\' << char('0' + (c >> 6)) << char('0' + ((c >> 3) & 0x7))
+          << char('0' + (c & 0x7));
+    } else {
+      buf << c;
+    }
+  }
+  buf << "\", " << s.size() << ")";
+  return buf.str();
+}
+
+CppEmitter::CppEmitter(Executable* exec) : exec(exec) {
+  for (size_t i = 0; i < exec->user_func_descs.size(); i++) {
+    funcIndex[exec->user_func_descs[i]] = i;
+    names[exec->user_func_descs[i]] = "funcs[" + util::stringify(i) + "]";
+  }
+  for (size_t i = 0; i < exec->user_class_objs.size(); i++) {
+    names[exec->user_class_objs[i]] = "classes[" + util::stringify(i) + "]";
+  }
+  nameBuiltins();
+}
+
+void CppEmitter::nameBuiltins() {
+  // these are the builtins which the linker is given (see
+  // bootstrap/analysis.cc). object comes first, so a method inherited from
+  // it keeps the name it gets there
+  names.insert(make_pair(&BuiltinPrintDescriptor(),
+                         string("&BuiltinPrintDescriptor()")));
+  nameBuiltinClass("&venom_object::ObjClassTable()",
+                   &venom_object::ObjClassTable());
+  nameBuiltinClass("&venom_string::StringClassTable()",
+                   &venom_string::StringClassTable());
+  nameBuiltinClass("&venom_integer::IntegerClassTable()",
+                   &venom_integer::IntegerClassTable());
+  nameBuiltinClass("&venom_double::DoubleClassTable()",
+                   &venom_double::DoubleClassTable());
+  nameBuiltinClass("&venom_boolean::BooleanClassTable()",
+                   &venom_boolean::BooleanClassTable());
+  for (size_t i = 0; i < VENOM_NELEMS(CellTypes); i++) {
+    nameBuiltinClass(
+        string("venom_list::GetListClassTable(") + CellTypeNames[i] + ")",
+        venom_list::GetListClassTable(CellTypes[i]));
+    for (size_t j = 0; j < VENOM_NELEMS(CellTypes); j++) {
+      nameBuiltinClass(
+          string("venom_dict::GetDictClassTable(") + CellTypeNames[i] +
+            ", " + CellTypeNames[j] + ")",
+          venom_dict::GetDictClassTable(CellTypes[i], CellTypes[j]));
+    }
+  }
+  nameBuiltinClass("venom_ref::GetRefClassTable(false)",
+                   venom_ref::GetRefClassTable(false));
+  nameBuiltinClass("venom_ref::GetRefClassTable(true)",
+                   venom_ref::GetRefClassTable(true));
+}
+
+void CppEmitter::nameBuiltinClass(const string& expr,
+                                  venom_class_object* class_obj) {
+  names.insert(make_pair(class_obj, expr));
+  string prefix = "(" + expr + ")->";
+  names.insert(make_pair(class_obj->cppInit, prefix + "cppInit"));
+  names.insert(make_pair(class_obj->cppRelease, prefix + "cppRelease"));
+  names.insert(make_pair(class_obj->ctor, prefix + "ctor"));
+  for (size_t i = 0; i < class_obj->vtable.size(); i++) {
+    names.insert(make_pair(class_obj->vtable[i],
+                           prefix + "vtable[" + util::stringify(i) + "]"));
+  }
+}
+
+const string& CppEmitter::nameOf(const void* p) const {
+  map<const void*, string>::const_iterator it = names.find(p);
+  if (it == names.end()) {
+    throw runtime_error("Cannot emit a reference to an unknown builtin");
+  }
+  return it->second;
+}
+
+string CppEmitter::target(Instruction* inst) const {
+  Instruction* dest = inst->offsetBy(static_cast<InstFormatI32*>(inst)->N0);
+  return "L" + util::stringify(
+      reinterpret_cast<char*>(dest) - exec->instructions.begin());
+}
+
+void CppEmitter::emit(ostream& o) {
+  o << "// Generated by venom --emit-cpp. Build with (from the src directory"
+    << endl
+    << "// of venom, once libvenom.a is built):" << endl
+    << "//" << endl
+    << "//   g++ -O2 -DNDEBUG -I. prog.cc libvenom.a -o prog" << endl
+    << endl
+    << "#include <backend/aotruntime.h>" << endl
+    << endl
+    << "using namespace venom::backend;" << endl
+    << "using namespace venom::runtime;" << endl
+    << endl
+    << "static FunctionDescriptor* funcs["
+    << exec->user_func_descs.size() << "];" << endl;
+  if (!exec->user_class_objs.empty()) {
+    o << "static venom_class_object* classes["
+      << exec->user_class_objs.size() << "];" << endl;
+  }
+  o << endl;
+  for (size_t i = 0; i < exec->user_func_descs.size(); i++) {
+    o << "static venom_cell* f" << i
+      << "(ExecutionContext* ctx, venom_cell* sp);" << endl;
+  }
+  o << endl;
+  for (size_t i = 0; i < exec->user_func_descs.size(); i++) {
+    emitFunction(o, i);
+  }
+  emitMain(o);
+}
+
+void CppEmitter::emitFunction(ostream& o, size_t idx) {
+  FunctionDescriptor* desc = exec->user_func_descs[idx];
+
+  // find the instructions of the function (in address order, which is the
+  // order control falls through them in) and the jump targets, the same way
+  // the Jit does
+  set<Instruction*> insts;
+  set<Instruction*> targets;
+  bool loops = false;
+  bool usesLocals = false;
+  vector<Instruction*> work;
+  work.push_back(exec->instructionAt(intptr_t(desc->getFunctionPtr())));
+  while (!work.empty()) {
+    Instruction* inst = work.back();
+    work.pop_back();
+    if (!insts.insert(inst).second) continue;
+    Instruction::Opcode opcode = inst->getOpcode();
+    switch (opcode) {
+    case Instruction::LOAD_LOCAL_VAR:
+    case Instruction::LOAD_LOCAL_VAR_REF:
+    case Instruction::LOAD_LOCAL_VAR_BORROW:
+    case Instruction::STORE_LOCAL_VAR:
+    case Instruction::STORE_LOCAL_VAR_REF:
+    case Instruction::STORE_LOCAL_VAR_REF_BORROW:
+    case Instruction::ADD_INT_LOCAL_LOCAL:
+    case Instruction::GET_ATTR_OF_LOCAL:
+    case Instruction::GET_ATTR_OF_LOCAL_REF:
+    case Instruction::MOVE_ATTR_OF_LOCAL_REF:
+    case Instruction::MOVE_ATTR_OF_CONST_REF:
+      usesLocals = true;
+      break;
+    case Instruction::TAIL_CALL:
+      if (reinterpret_cast<FunctionDescriptor*>(
+            static_cast<InstFormatIPtr*>(inst)->N0) == desc) loops = true;
+      break;
+    default: break;
+    }
+    if (IsBranch(opcode)) {
+      Instruction* dest =
+        inst->offsetBy(static_cast<InstFormatI32*>(inst)->N0);
+      targets.insert(dest);
+      work.push_back(dest);
+    }
+    if (!Instruction::IsTerminator(opcode)) work.push_back(inst->next());
+  }
+
+  o << "static venom_cell* f" << idx
+    << "(ExecutionContext* ctx, venom_cell* sp) {" << endl;
+  if (loops) o << "entry:" << endl;
+  o << "  ";
+  if (usesLocals) o << "venom_cell* locals = ";
+  o << "AotRuntime::Enter(ctx, sp, funcs[" << idx << "]);" << endl;
+  for (set<Instruction*>::iterator it = insts.begin();
+       it != insts.end(); ++it) {
+    if (targets.count(*it)) {
+      o << "L" << (reinterpret_cast<char*>(*it) - exec->instructions.begin())
+        << ":" << endl;
+    }
+    emitInst(o, idx, *it);
+  }
+  o << "}" << endl << endl;
+}
+
+void CppEmitter::emitInst(ostream& o, size_t idx, Instruction* inst) {
+  Instruction::Opcode opcode = inst->getOpcode();
+  InstFormatU32* u32 = static_cast<InstFormatU32*>(inst);
+  InstFormatU32U32* u32u32 = static_cast<InstFormatU32U32*>(inst);
+  InstFormatU32U32U32* u32u32u32 = static_cast<InstFormatU32U32U32*>(inst);
+  InstFormatIPtr* iptr = static_cast<InstFormatIPtr*>(inst);
+  InstFormatC* c = static_cast<InstFormatC*>(inst);
+
+  o << "  ";
+
+  size_t n_opnds;
+  const char* as;
+  const char* op;
+  const char* type;
+  if (OperatorOf(opcode, n_opnds, as, op, type)) {
+    bool ref = strcmp(as, "asRawObject") == 0;
+    o << "{ ";
+    if (n_opnds == 2) o << "venom_cell b = *--sp; ";
+    o << "venom_cell a = *--sp; ";
+    string value = n_opnds == 1 ?
+      string(type) + "(" + op + "a." + as + "())" :
+      string(type) + "(a." + as + "() " + op + " b." + as + "())";
+    if (IsBranch(opcode)) {
+      if (ref) {
+        o << "bool taken = " << value << "; "
+          << "AotRuntime::Release(ctx, sp, a); "
+          << "if (taken) goto " << target(inst) << "; }";
+      } else {
+        o << "if (" << value << ") goto " << target(inst) << "; }";
+      }
+    } else {
+      o << "*sp++ = venom_cell(" << value << ");";
+      if (ref) {
+        o << " AotRuntime::Release(ctx, sp, a);";
+        if (n_opnds == 2) o << " AotRuntime::Release(ctx, sp, b);";
+      }
+      o << " }";
+    }
+    o << endl;
+    return;
+  }
+
+  switch (opcode) {
+  case Instruction::PUSH_CELL_INT:
+    o << "*sp++ = venom_cell(" << IntLiteral(c->data.int_value) << ");";
+    break;
+  case Instruction::PUSH_CELL_FLOAT: {
+    uint64_t bits;
+    memcpy(&bits, &c->data.double_value, sizeof(bits));
+    o << "*sp++ = venom_cell(AotRuntime::Float(0x" << hex << bits << dec
+      << "ULL));";
+    break;
+  }
+  case Instruction::PUSH_CELL_BOOL:
+    o << "*sp++ = venom_cell(" << (c->data.bool_value ? "true" : "false")
+      << ");";
+    break;
+  case Instruction::PUSH_CELL_NIL:
+    o << "*sp++ = venom_cell(venom_object::Nil);";
+    break;
+  case Instruction::PUSH_CONST:
+    o << "AotRuntime::PushConst(ctx, sp, " << u32->N0 << ");";
+    break;
+  case Instruction::LOAD_LOCAL_VAR:
+    o << "*sp++ = locals[" << u32->N0 << "];";
+    break;
+  case Instruction::LOAD_LOCAL_VAR_REF:
+    o << "locals[" << u32->N0 << "].incRef(); *sp++ = locals["
+      << u32->N0 << "];";
+    break;
+  case Instruction::PUSH_CONST_BORROW:
+    o << "AotRuntime::PushBorrowed(sp, AotRuntime::Const(ctx, " << u32->N0
+      << "));";
+    break;
+  case Instruction::LOAD_LOCAL_VAR_BORROW:
+    o << "AotRuntime::PushBorrowed(sp, locals[" << u32->N0 << "]);";
+    break;
+  case Instruction::ALLOC_OBJ:
+    o << "AotRuntime::AllocObj(ctx, sp, "
+      << nameOf(reinterpret_cast<void*>(iptr->N0)) << ");";
+    break;
+
+  case Instruction::CALL:
+  case Instruction::CALL_NATIVE: {
+    FunctionDescriptor* desc = reinterpret_cast<FunctionDescriptor*>(iptr->N0);
+    map<const FunctionDescriptor*, size_t>::iterator it = funcIndex.find(desc);
+    if (it != funcIndex.end()) {
+      o << "sp = f" << it->second << "(ctx, sp);";
+    } else {
+      o << "sp = AotRuntime::Call(ctx, sp, " << nameOf(desc) << ");";
+    }
+    break;
+  }
+  case Instruction::RET:
+    o << "AotRuntime::Leave(ctx, sp); return sp;";
+    break;
+  case Instruction::TAIL_CALL: {
+    FunctionDescriptor* desc = reinterpret_cast<FunctionDescriptor*>(iptr->N0);
+    assert(funcIndex.count(desc));
+    size_t callee = funcIndex[desc];
+    o << "AotRuntime::Leave(ctx, sp); ";
+    if (callee == idx) o << "goto entry;";
+    else o << "return f" << callee << "(ctx, sp);";
+    break;
+  }
+  case Instruction::JUMP:
+    o << "goto " << target(inst) << ";";
+    break;
+  case Instruction::CALL_VIRTUAL:
+    o << "sp = AotRuntime::Call(ctx, sp, AotRuntime::Lookup(sp, "
+      << reinterpret_cast<InlineCache*>(iptr->N0)->getSlot() << "));";
+    break;
+  case Instruction::TAIL_CALL_VIRTUAL:
+    // only a native callee comes back, to the RET which follows
+    o << "{ FunctionDescriptor* desc = AotRuntime::Lookup(sp, "
+      << reinterpret_cast<InlineCache*>(iptr->N0)->getSlot() << "); "
+      << "if (desc->isCompiled()) { AotRuntime::Leave(ctx, sp); "
+      << "return desc->getCompiledFunction()(ctx, sp); } "
+      << "sp = AotRuntime::Call(ctx, sp, desc); }";
+    break;
+
+  case Instruction::POP_CELL:
+    o << "sp--;";
+    break;
+  case Instruction::POP_CELL_REF:
+    o << "{ venom_cell a = *--sp; AotRuntime::Release(ctx, sp, a); }";
+    break;
+  case Instruction::STORE_LOCAL_VAR:
+    o << "locals[" << u32->N0 << "] = *--sp;";
+    break;
+  case Instruction::STORE_LOCAL_VAR_REF:
+    o << "AotRuntime::StoreLocalRef(ctx, sp, locals[" << u32->N0 << "]);";
+    break;
+  case Instruction::STORE_LOCAL_VAR_REF_BORROW:
+    o << "AotRuntime::StoreLocalBorrowed(ctx, sp, locals[" << u32->N0
+      << "]);";
+    break;
+  case Instruction::DUP:
+    o << "AotRuntime::Dup(sp, " << u32->N0 << ");";
+    break;
+  case Instruction::DUP_REF:
+    o << "AotRuntime::DupRef(sp, " << u32->N0 << ");";
+    break;
+  case Instruction::CHECK_NULL_REF:
+    o << "AotRuntime::CheckNullPointer(sp[-1]);";
+    break;
+
+  case Instruction::GET_FIELD_OFF:
+  case Instruction::GET_FIELD_OFF_REF:
+  case Instruction::GET_FIELD_OFF_BORROW:
+  case Instruction::GET_FIELD_OFF_REF_BORROW:
+    o << "AotRuntime::GetField(ctx, sp, " << u32->N0 << ", "
+      << (opcode == Instruction::GET_FIELD_OFF_REF ||
+          opcode == Instruction::GET_FIELD_OFF_REF_BORROW ? "true" : "false")
+      << ", "
+      << (opcode == Instruction::GET_FIELD_OFF_BORROW ||
+          opcode == Instruction::GET_FIELD_OFF_REF_BORROW ? "true" : "false")
+      << ");";
+    break;
+  case Instruction::SET_FIELD_OFF:
+  case Instruction::SET_FIELD_OFF_REF:
+  case Instruction::SET_FIELD_OFF_BORROW:
+  case Instruction::SET_FIELD_OFF_REF_BORROW:
+    o << "AotRuntime::SetField(ctx, sp, " << u32->N0 << ", "
+      << (opcode == Instruction::SET_FIELD_OFF_REF ||
+          opcode == Instruction::SET_FIELD_OFF_REF_BORROW ? "true" : "false")
+      << ", "
+      << (opcode == Instruction::SET_FIELD_OFF_BORROW ||
+          opcode == Instruction::SET_FIELD_OFF_REF_BORROW ? "true" : "false")
+      << ");";
+    break;
+  case Instruction::GET_ARRAY_ACCESS:
+  case Instruction::GET_ARRAY_ACCESS_REF:
+  case Instruction::GET_ARRAY_ACCESS_UNCHECKED:
+  case Instruction::GET_ARRAY_ACCESS_REF_UNCHECKED:
+    o << "AotRuntime::GetArrayAccess(ctx, sp, "
+      << (opcode == Instruction::GET_ARRAY_ACCESS_REF ||
+          opcode == Instruction::GET_ARRAY_ACCESS_REF_UNCHECKED ?
+            "true" : "false")
+      << ", "
+      << (opcode == Instruction::GET_ARRAY_ACCESS ||
+          opcode == Instruction::GET_ARRAY_ACCESS_REF ? "true" : "false")
+      << ");";
+    break;
+  case Instruction::SET_ARRAY_ACCESS:
+  case Instruction::SET_ARRAY_ACCESS_REF:
+  case Instruction::SET_ARRAY_ACCESS_UNCHECKED:
+  case Instruction::SET_ARRAY_ACCESS_REF_UNCHECKED:
+    o << "AotRuntime::SetArrayAccess(ctx, sp, "
+      << (opcode == Instruction::SET_ARRAY_ACCESS_REF ||
+          opcode == Instruction::SET_ARRAY_ACCESS_REF_UNCHECKED ?
+            "true" : "false")
+      << ", "
+      << (opcode == Instruction::SET_ARRAY_ACCESS ||
+          opcode == Instruction::SET_ARRAY_ACCESS_REF ? "true" : "false")
+      << ");";
+    break;
+
+  case Instruction::ADD_INT_LOCAL_LOCAL:
+    o << "*sp++ = venom_cell(int64_t(locals[" << u32u32->N0
+      << "].asInt() + locals[" << u32u32->N1 << "].asInt()));";
+    break;
+  case Instruction::GET_ATTR_OF_LOCAL:
+  case Instruction::GET_ATTR_OF_LOCAL_REF:
+    o << "AotRuntime::GetAttrOf(sp, locals[" << u32u32->N0 << "], "
+      << u32u32->N1 << ", "
+      << (opcode == Instruction::GET_ATTR_OF_LOCAL_REF ? "true" : "false")
+      << ");";
+    break;
+  case Instruction::GET_ATTR_OF_CONST:
+  case Instruction::GET_ATTR_OF_CONST_REF:
+    o << "AotRuntime::GetAttrOf(sp, AotRuntime::Const(ctx, " << u32u32->N0
+      << "), " << u32u32->N1 << ", "
+      << (opcode == Instruction::GET_ATTR_OF_CONST_REF ? "true" : "false")
+      << ");";
+    break;
+  case Instruction::MOVE_ATTR_OF_LOCAL_REF:
+    o << "AotRuntime::MoveAttrOf(ctx, sp, locals[" << u32u32u32->N0 << "], "
+      << u32u32u32->N1 << ", locals[" << u32u32u32->N2 << "]);";
+    break;
+  case Instruction::MOVE_ATTR_OF_CONST_REF:
+    o << "AotRuntime::MoveAttrOf(ctx, sp, AotRuntime::Const(ctx, "
+      << u32u32u32->N0 << "), " << u32u32u32->N1 << ", locals["
+      << u32u32u32->N2 << "]);";
+    break;
+  case Instruction::ADD_INT_CONST:
+  case Instruction::SUB_INT_CONST:
+    o << "sp[-1] = venom_cell(int64_t(sp[-1].asInt() "
+      << (opcode == Instruction::ADD_INT_CONST ? "+" : "-") << " "
+      << IntLiteral(c->data.int_value) << "));";
+    break;
+
+  default:
+    throw runtime_error(
+        "Cannot emit instruction: " + Instruction::stringify(opcode));
+  }
+  o << endl;
+}
+
+void CppEmitter::emitMain(ostream& o) {
+  o << "int main() {" << endl;
+
+  // the descriptors come first, since the classes refer to them
+  for (size_t i = 0; i < exec->user_func_descs.size(); i++) {
+    FunctionDescriptor* desc = exec->user_func_descs[i];
+    const FunctionDescriptor::SlotVec& refs = desc->getRefLocals();
+    o << "  {" << endl
+      << "    FunctionDescriptor::SlotVec refs;" << endl;
+    for (size_t j = 0; j < refs.size(); j++) {
+      o << "    refs.push_back(" << refs[j] << ");" << endl;
+    }
+    o << "    funcs[" << i << "] = new FunctionDescriptor(&f" << i << ", "
+      << desc->getNumArgs() << ", 0x" << hex << desc->argRefCellBitmap()
+      << dec << "ULL, " << desc->getNumLocals() << ", refs, "
+      << desc->getMaxStackDepth() << ");" << endl
+      << "  }" << endl;
+  }
+
+  for (size_t i = 0; i < exec->user_class_objs.size(); i++) {
+    venom_class_object* class_obj = exec->user_class_objs[i];
+    assert(class_obj->sizeof_obj_base == sizeof(venom_object));
+    o << "  {" << endl
+      << "    std::vector<FunctionDescriptor*> vtable;" << endl;
+    for (size_t j = 0; j < class_obj->vtable.size(); j++) {
+      o << "    vtable.push_back(" << nameOf(class_obj->vtable[j]) << ");"
+        << endl;
+    }
+    o << "    classes[" << i << "] = new venom_class_object(" << endl
+      << "        " << StringLiteral(class_obj->name)
+      << ", sizeof(venom_object), " << class_obj->n_cells << ", 0x" << hex
+      << class_obj->ref_cell_bitmap << dec << "ULL," << endl
+      << "        " << nameOf(class_obj->cppInit) << "," << endl
+      << "        " << nameOf(class_obj->cppRelease) << "," << endl
+      << "        " << nameOf(class_obj->ctor) << "," << endl
+      << "        vtable);" << endl
+      << "  }" << endl;
+  }
+
+  o << "  Executable::ConstPool consts;" << endl;
+  for (size_t i = 0; i < exec->constant_pool.size(); i++) {
+    const ExecConstant& konst = exec->constant_pool[i];
+    o << "  consts.push_back(ExecConstant(";
+    if (konst.isLeft()) o << StringLiteral(konst.left());
+    else o << nameOf(konst.right());
+    o << "));" << endl;
+  }
+
+  assert(funcIndex.count(exec->mainFunc));
+  o << "  return AotRuntime::Run(new Executable(" << endl
+    << "      consts, Executable::IStream(), funcs["
+    << funcIndex[exec->mainFunc] << "]," << endl
+    << "      Executable::FuncDescVec(funcs, funcs + "
+    << exec->user_func_descs.size() << ")," << endl;
+  if (exec->user_class_objs.empty()) {
+    o << "      Executable::ClassObjVec()," << endl;
+  } else {
+    o << "      Executable::ClassObjVec(classes, classes + "
+      << exec->user_class_objs.size() << ")," << endl;
+  }
+  o << "      Executable::InlineCacheVec()));" << endl
+    << "}" << endl;
+}
+
+}
+}
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef VENOM_BACKEND_CPPEMITTER_H
+#define VENOM_BACKEND_CPPEMITTER_H
+
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <runtime/venomobject.h>
+
+namespace venom {
+namespace backend {
+
+/** Forward decl */
+class Executable;
+class FunctionDescriptor;
+class Instruction;
+
+/**
+ * CppEmitter writes out a linked program as a C++ translation unit, which
+ * is compiled (against AotRuntime, in libvenom.a) into a standalone
+ * executable that runs without the interpreter.
+ *
+ * Each user function becomes a CompiledFunction, with one short piece of
+ * code for each of its instructions, in the same order as the instruction
+ * stream. The operand stack and the frames stay where they were, so the
+ * compiled code, the builtin natives, and anything they call back into
+ * all still agree on them. What goes away is the dispatch: control falls
+ * through to the next instruction, jumps become gotos, and calls between
+ * user functions become direct C++ calls, which the C++ compiler is free
+ * to optimize across.
+ *
+ * The emitted main() rebuilds the Executable (function descriptors, user
+ * classes, and constant pool) with the compiled functions in place of the
+ * bytecode ones. Builtin classes and functions are referred to by the C++
+ * expression which returns them (see nameBuiltins()).
+ */
+class CppEmitter {
+public:
+  /** Does NOT take ownership of exec */
+  explicit CppEmitter(Executable* exec);
+
+  /** Throws std::runtime_error if the program refers to a builtin which
+   * has no C++ name */
+  void emit(std::ostream& o);
+
+private:
+  void nameBuiltins();
+  void nameBuiltinClass(const std::string& expr,
+                        runtime::venom_class_object* class_obj);
+
+  const std::string& nameOf(const void* p) const;
+
+  void emitFunction(std::ostream& o, size_t idx);
+  void emitInst(std::ostream& o, size_t idx, Instruction* inst);
+  void emitMain(std::ostream& o);
+
+  /** The label of the jump target of inst */
+  std::string target(Instruction* inst) const;
+
+  Executable* exec;
+
+  /** The C++ expression for each function descriptor and class object the
+   * program uses */
+  std::map<const void*, std::string> names;
+
+  /** Position of each user function in the executable */
+  std::map<const FunctionDescriptor*, size_t> funcIndex;
+};
+
+}
+}
+
+#endif /* VENOM_BACKEND_CPPEMITTER_H */
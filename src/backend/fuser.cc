@@ -0,0 +1,244 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cassert>
+#include <new>
+
+#include <backend/codegenerator.h>
+#include <backend/symbolicbytecode.h>
+#include <backend/fuser.h>
+#include <backend/vm.h>
+
+#include <util/macros.h>
+
+using namespace std;
+
+namespace venom {
+namespace backend {
+
+/** The opcodes of a sequence of instructions to fuse */
+struct Pattern {
+  Instruction::Opcode fused;
+  size_t length;
+  Instruction::Opcode opcodes[3];
+};
+
+// BINOP_CMP_cmp_INT followed by BRANCH_NZ_BOOL branches if cmp holds, and
+// followed by BRANCH_Z_BOOL branches if it does not (if negated holds)
+#define CMP_BRANCH(cmp, negated) \
+  { Instruction::BRANCH_IF_ ## cmp ## _INT, 2, \
+    { Instruction::BINOP_CMP_ ## cmp ## _INT, Instruction::BRANCH_NZ_BOOL } }, \
+  { Instruction::BRANCH_IF_ ## negated ## _INT, 2, \
+    { Instruction::BINOP_CMP_ ## cmp ## _INT, Instruction::BRANCH_Z_BOOL } },
+
+/** Tried in order, so longer patterns must come first */
+static const Pattern Patterns[] = {
+  { Instruction::ADD_INT_LOCAL_LOCAL, 3,
+    { Instruction::LOAD_LOCAL_VAR, Instruction::LOAD_LOCAL_VAR,
+      Instruction::BINOP_ADD_INT } },
+  { Instruction::MOVE_ATTR_OF_LOCAL_REF, 3,
+    { Instruction::LOAD_LOCAL_VAR_REF, Instruction::GET_FIELD_OFF_REF,
+      Instruction::STORE_LOCAL_VAR_REF } },
+  { Instruction::MOVE_ATTR_OF_CONST_REF, 3,
+    { Instruction::PUSH_CONST, Instruction::GET_FIELD_OFF_REF,
+      Instruction::STORE_LOCAL_VAR_REF } },
+  { Instruction::MOVE_ATTR_OF_LOCAL_REF, 3,
+    { Instruction::LOAD_LOCAL_VAR_BORROW,
+      Instruction::GET_FIELD_OFF_REF_BORROW,
+      Instruction::STORE_LOCAL_VAR_REF } },
+  { Instruction::MOVE_ATTR_OF_CONST_REF, 3,
+    { Instruction::PUSH_CONST_BORROW, Instruction::GET_FIELD_OFF_REF_BORROW,
+      Instruction::STORE_LOCAL_VAR_REF } },
+  { Instruction::ADD_INT_CONST, 2,
+    { Instruction::PUSH_CELL_INT, Instruction::BINOP_ADD_INT } },
+  { Instruction::SUB_INT_CONST, 2,
+    { Instruction::PUSH_CELL_INT, Instruction::BINOP_SUB_INT } },
+  CMP_BRANCH(EQ, NEQ)
+  CMP_BRANCH(NEQ, EQ)
+  CMP_BRANCH(LT, GE)
+  CMP_BRANCH(LE, GT)
+  CMP_BRANCH(GT, LE)
+  CMP_BRANCH(GE, LT)
+  { Instruction::GET_ATTR_OF_LOCAL, 2,
+    { Instruction::LOAD_LOCAL_VAR_REF, Instruction::GET_FIELD_OFF } },
+  { Instruction::GET_ATTR_OF_LOCAL_REF, 2,
+    { Instruction::LOAD_LOCAL_VAR_REF, Instruction::GET_FIELD_OFF_REF } },
+  { Instruction::GET_ATTR_OF_CONST, 2,
+    { Instruction::PUSH_CONST, Instruction::GET_FIELD_OFF } },
+  { Instruction::GET_ATTR_OF_CONST_REF, 2,
+    { Instruction::PUSH_CONST, Instruction::GET_FIELD_OFF_REF } },
+  { Instruction::GET_ATTR_OF_LOCAL, 2,
+    { Instruction::LOAD_LOCAL_VAR_BORROW, Instruction::GET_FIELD_OFF_BORROW } },
+  { Instruction::GET_ATTR_OF_LOCAL_REF, 2,
+    { Instruction::LOAD_LOCAL_VAR_BORROW,
+      Instruction::GET_FIELD_OFF_REF_BORROW } },
+  { Instruction::GET_ATTR_OF_CONST, 2,
+    { Instruction::PUSH_CONST_BORROW, Instruction::GET_FIELD_OFF_BORROW } },
+  { Instruction::GET_ATTR_OF_CONST_REF, 2,
+    { Instruction::PUSH_CONST_BORROW,
+      Instruction::GET_FIELD_OFF_REF_BORROW } },
+};
+
+#undef CMP_BRANCH
+
+static inline uint32_t U32Value(SymbolicInstruction* inst) {
+  VENOM_ASSERT_TYPEOF_PTR(SInstU32, inst);
+  return static_cast<SInstU32*>(inst)->getValue();
+}
+
+static inline Label* LabelValue(SymbolicInstruction* inst) {
+  VENOM_ASSERT_TYPEOF_PTR(SInstLabel, inst);
+  return static_cast<SInstLabel*>(inst)->getValue();
+}
+
+Fuser::Fuser(ObjectCode* obj) : obj(obj) {
+  ObjectCode::IStream& insts = obj->getInstructions();
+  plan.resize(insts.size(), NotFused);
+
+  // control can only enter the code at the start of a function, or at the
+  // target of a jump
+  vector<bool> entries(insts.size() + 1, false);
+  vector<FunctionSignature>& funcPool = obj->getFuncPool();
+  for (vector<FunctionSignature>::iterator it = funcPool.begin();
+       it != funcPool.end(); ++it) {
+    VENOM_CHECK_RANGE(it->codeOffset, entries.size());
+    entries[it->codeOffset] = true;
+  }
+  for (size_t pos = 0; pos < insts.size(); pos++) {
+    if (!Instruction::IsJump(insts[pos]->getOpcode())) continue;
+    Label* label = LabelValue(insts[pos]);
+    assert(label->isBound());
+    VENOM_CHECK_RANGE(size_t(label->getIndex()), entries.size());
+    entries[label->getIndex()] = true;
+  }
+
+  size_t pos = 0;
+  while (pos < insts.size()) {
+    const Pattern* match = NULL;
+    for (size_t i = 0; i < VENOM_NELEMS(Patterns) && !match; i++) {
+      const Pattern& p = Patterns[i];
+      if (pos + p.length > insts.size()) continue;
+      bool ok = true;
+      for (size_t j = 0; j < p.length && ok; j++) {
+        ok = insts[pos + j]->getOpcode() == p.opcodes[j] &&
+             (j == 0 || !entries[pos + j]);
+      }
+      if (ok) match = &p;
+    }
+    if (!match) {
+      pos++;
+      continue;
+    }
+    plan[pos] = match->fused;
+    for (size_t j = 1; j < match->length; j++) plan[pos + j] = FusedAway;
+    pos += match->length;
+  }
+}
+
+size_t Fuser::encodedWidth(size_t pos) const {
+  VENOM_CHECK_RANGE(pos, plan.size());
+  switch (plan[pos]) {
+  case NotFused:
+    return obj->getInstructions()[pos]->encodedWidth();
+  case FusedAway:
+    return 0;
+  case Instruction::ADD_INT_CONST:
+  case Instruction::SUB_INT_CONST:
+    return Instruction::WidthOf<InstFormatC>();
+  case Instruction::BRANCH_IF_EQ_INT:
+  case Instruction::BRANCH_IF_NEQ_INT:
+  case Instruction::BRANCH_IF_LT_INT:
+  case Instruction::BRANCH_IF_LE_INT:
+  case Instruction::BRANCH_IF_GT_INT:
+  case Instruction::BRANCH_IF_GE_INT:
+    return Instruction::WidthOf<InstFormatI32>();
+  case Instruction::MOVE_ATTR_OF_LOCAL_REF:
+  case Instruction::MOVE_ATTR_OF_CONST_REF:
+    return Instruction::WidthOf<InstFormatU32U32U32>();
+  default:
+    return Instruction::WidthOf<InstFormatU32U32>();
+  }
+}
+
+Instruction* Fuser::resolve(
+    char* dest, size_t pos, ResolutionTable& resTable) {
+  VENOM_CHECK_RANGE(pos, plan.size());
+  assert(plan[pos] != FusedAway);
+  ObjectCode::IStream& insts = obj->getInstructions();
+  if (plan[pos] == NotFused) return insts[pos]->resolve(dest, pos, resTable);
+
+  Instruction::Opcode opcode = static_cast<Instruction::Opcode>(plan[pos]);
+  switch (opcode) {
+  case Instruction::ADD_INT_LOCAL_LOCAL:
+    return new (dest) InstFormatU32U32(opcode,
+        U32Value(insts[pos]), U32Value(insts[pos + 1]));
+  case Instruction::GET_ATTR_OF_LOCAL:
+  case Instruction::GET_ATTR_OF_LOCAL_REF:
+    return new (dest) InstFormatU32U32(opcode,
+        U32Value(insts[pos]),
+        runtime::venom_object::UserCellOffset(U32Value(insts[pos + 1])));
+  case Instruction::GET_ATTR_OF_CONST:
+  case Instruction::GET_ATTR_OF_CONST_REF:
+    return new (dest) InstFormatU32U32(opcode,
+        resTable.getConstantTable()[U32Value(insts[pos])],
+        runtime::venom_object::UserCellOffset(U32Value(insts[pos + 1])));
+  case Instruction::MOVE_ATTR_OF_LOCAL_REF:
+    return new (dest) InstFormatU32U32U32(opcode,
+        U32Value(insts[pos]),
+        runtime::venom_object::UserCellOffset(U32Value(insts[pos + 1])),
+        U32Value(insts[pos + 2]));
+  case Instruction::MOVE_ATTR_OF_CONST_REF:
+    return new (dest) InstFormatU32U32U32(opcode,
+        resTable.getConstantTable()[U32Value(insts[pos])],
+        runtime::venom_object::UserCellOffset(U32Value(insts[pos + 1])),
+        U32Value(insts[pos + 2]));
+  case Instruction::ADD_INT_CONST:
+  case Instruction::SUB_INT_CONST:
+    VENOM_ASSERT_TYPEOF_PTR(SInstI64, insts[pos]);
+    return new (dest) InstFormatC(opcode,
+        static_cast<SInstI64*>(insts[pos])->getValue());
+  case Instruction::BRANCH_IF_EQ_INT:
+  case Instruction::BRANCH_IF_NEQ_INT:
+  case Instruction::BRANCH_IF_LT_INT:
+  case Instruction::BRANCH_IF_LE_INT:
+  case Instruction::BRANCH_IF_GT_INT:
+  case Instruction::BRANCH_IF_GE_INT: {
+    // the branch is taken from the start of the superinstruction
+    ResolutionTable::InstOffsetTbl& offsets = resTable.getInstOffsetTable();
+    Label* label = LabelValue(insts[pos + 1]);
+    return new (dest) InstFormatI32(opcode,
+        int64_t(offsets[label->getIndex()]) - int64_t(offsets[pos]));
+  }
+  default: assert(false);
+  }
+  VENOM_NOT_REACHED;
+}
+
+}
+}
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_BACKEND_FUSER_H
+#define VENOM_BACKEND_FUSER_H
+
+#include <vector>
+
+#include <backend/linker.h>
+
+namespace venom {
+namespace backend {
+
+/** Forward decl */
+class Instruction;
+class ResolutionTable;
+
+/**
+ * Fuser picks out common sequences of instructions in an ObjectCode which
+ * the linker should encode as a single superinstruction, saving a dispatch
+ * (and usually some operand stack traffic) for each instruction fused away.
+ *
+ * The sequences fused were chosen by counting opcode pairs executed by the
+ * benchmark programs and the test suite:
+ *
+ *   LOAD_LOCAL_VAR a; LOAD_LOCAL_VAR b; BINOP_ADD_INT -> ADD_INT_LOCAL_LOCAL
+ *   PUSH_CELL_INT k; BINOP_ADD_INT                    -> ADD_INT_CONST
+ *   PUSH_CELL_INT k; BINOP_SUB_INT                    -> SUB_INT_CONST
+ *   BINOP_CMP_xx_INT; BRANCH_[N]Z_BOOL                -> BRANCH_IF_xx_INT
+ *   LOAD_LOCAL_VAR_REF a; GET_FIELD_OFF[_REF] n       -> GET_ATTR_OF_LOCAL[_REF]
+ *   PUSH_CONST c; GET_FIELD_OFF[_REF] n               -> GET_ATTR_OF_CONST[_REF]
+ *   LOAD_LOCAL_VAR_REF a; GET_FIELD_OFF_REF n;
+ *     STORE_LOCAL_VAR_REF b                           -> MOVE_ATTR_OF_LOCAL_REF
+ *   PUSH_CONST c; GET_FIELD_OFF_REF n;
+ *     STORE_LOCAL_VAR_REF b                           -> MOVE_ATTR_OF_CONST_REF
+ *
+ * The last four are also fused when the loads and GET_FIELD_OFF[_REF] are
+ * the *_BORROW variants (see RefCountElider), since the superinstructions
+ * do not count the reference to the object either. The MOVE_ATTR_OF_*
+ * superinstructions hand the field straight to the slot, so they do not
+ * count anything when ref counts are deferred.
+ *
+ * Only the first instruction of a sequence is encoded; the rest take up no
+ * space in the instruction stream. So no instruction other than the first
+ * may be the target of a jump or the start of a function, since control
+ * could otherwise land in the middle of a superinstruction. Sequences which
+ * would cover one are left alone.
+ *
+ * This works on the symbolic instructions, so fusion does not change what
+ * the Verifier sees.
+ */
+class Fuser {
+public:
+  /** Does NOT take ownership of obj */
+  Fuser(ObjectCode* obj);
+
+  /** The number of bytes resolve() will write for the instruction at pos,
+   * which is 0 if the instruction is fused into the one before it */
+  size_t encodedWidth(size_t pos) const;
+
+  /** Constructs the instruction at pos (which is either a plain instruction
+   * or the start of a superinstruction) at dest */
+  Instruction* resolve(char* dest, size_t pos, ResolutionTable& resTable);
+
+private:
+  /** Entries of plan, other than the opcode of a superinstruction */
+  enum { NotFused = -1, FusedAway = -2 };
+
+  ObjectCode* obj;
+
+  /** For each instruction in obj, what to encode it as */
+  std::vector<int> plan;
+};
+
+}
+}
+
+#endif /* VENOM_BACKEND_FUSER_H */
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+
+#include <backend/inlinecache.h>
+
+using namespace std;
+using namespace venom::runtime;
+
+namespace venom {
+namespace backend {
+
+const InlineCache::Target&
+InlineCache::lookupSlow(venom_class_object* class_obj, Executable* exec) {
+  assert(class_obj);
+
+  // the class was seen recently, so make it the monomorphic entry again
+  for (size_t i = 0; i < NumPolymorphicEntries; i++) {
+    if (poly[i].class_obj == class_obj) {
+      polyHits++;
+      swap(mono, poly[i]);
+      return mono;
+    }
+  }
+
+  misses++;
+  VENOM_CHECK_RANGE(slot, class_obj->vtable.size());
+  FunctionDescriptor* desc = class_obj->vtable[slot];
+  assert(desc);
+
+  // keep the monomorphic entry around as a polymorphic one, replacing the
+  // polymorphic entries round robin
+  if (mono.class_obj) {
+    poly[nextVictim] = mono;
+    nextVictim = (nextVictim + 1) % NumPolymorphicEntries;
+  }
+  mono.class_obj = class_obj;
+  mono.desc = desc;
+  mono.code = desc->isNative() ?
+    NULL : exec->instructionAt(intptr_t(desc->getFunctionPtr()));
+  return mono;
+}
+
+void InlineCache::printStats(ostream& o) const {
+  o << site << ": CALL_VIRTUAL " << slot << ": "
+    << monoHits << " monomorphic hits, "
+    << polyHits << " polymorphic hits, "
+    << misses << " misses" << endl;
+}
+
+}
+}
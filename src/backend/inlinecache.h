@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_BACKEND_INLINE_CACHE_H
+#define VENOM_BACKEND_INLINE_CACHE_H
+
+#include <iostream>
+#include <string>
+
+#include <backend/vm.h>
+
+#include <runtime/venomobject.h>
+
+#include <util/macros.h>
+
+namespace venom {
+namespace backend {
+
+/**
+ * An InlineCache belongs to a single CALL_VIRTUAL call site, and remembers
+ * what the vtable lookup found for the classes of the receivers seen there.
+ *
+ * Most sites only ever see one class, so the last class seen is checked
+ * first (the monomorphic entry). Failing that, a few more recently seen
+ * classes are checked (the polymorphic entries), and only then is the
+ * vtable consulted. The cache also counts its hits and misses, which can be
+ * dumped with --print-ic-stats.
+ */
+class InlineCache {
+public:
+  /** The number of classes remembered besides the last one seen */
+  static const size_t NumPolymorphicEntries = 4;
+
+  /** What a call to a method of class_obj resolves to */
+  struct Target {
+    Target() : class_obj(NULL), desc(NULL), code(NULL) {}
+    runtime::venom_class_object* class_obj;
+    FunctionDescriptor* desc;
+    /** The first instruction of desc, or NULL if desc is native */
+    Instruction* code;
+  };
+
+  /** slot is the vtable slot called at the site, and site describes where
+   * the site is, for printStats() */
+  InlineCache(uint32_t slot, const std::string& site)
+    : slot(slot), site(site), nextVictim(0),
+      monoHits(0), polyHits(0), misses(0) {}
+
+  /** Finds the method in this site's vtable slot of class_obj, which is
+   * part of the code of exec */
+  inline const Target& lookup(runtime::venom_class_object* class_obj,
+                              Executable* exec) {
+    if (VENOM_LIKELY(class_obj == mono.class_obj)) {
+      monoHits++;
+      return mono;
+    }
+    return lookupSlow(class_obj, exec);
+  }
+
+  /** The vtable slot called at the site */
+  inline uint32_t getSlot() const { return slot; }
+
+  void printStats(std::ostream& o) const;
+
+private:
+  const Target& lookupSlow(runtime::venom_class_object* class_obj,
+                           Executable* exec);
+
+  uint32_t slot;
+  std::string site;
+
+  Target mono;
+  Target poly[NumPolymorphicEntries];
+
+  /** The polymorphic entry to replace on the next miss */
+  size_t nextVictim;
+
+  uint64_t monoHits;
+  uint64_t polyHits;
+  uint64_t misses;
+};
+
+}
+}
+
+#endif /* VENOM_BACKEND_INLINE_CACHE_H */
@@ -0,0 +1,912 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <backend/bytecode.h>
+#include <backend/inlinecache.h>
+#include <backend/jit.h>
+#include <backend/linker.h>
+#include <backend/vm.h>
+
+
+using namespace std;
+using namespace venom::runtime;
+
+namespace venom {
+namespace backend {
+
+bool Jit::ParseMode(const string& s, Mode& mode) {
+  if (s == "off") mode = Off;
+  else if (s == "on") mode = On;
+  else if (s == "eager") mode = Eager;
+  else return false;
+  return true;
+}
+
+Jit::~Jit() {
+  for (vector<Region>::iterator it = regions.begin();
+       it != regions.end(); ++it) {
+    munmap(it->base, it->size);
+  }
+}
+
+void Jit::add(FunctionDescriptor* desc, Mode mode) {
+  assert(!desc->isNative());
+  switch (mode) {
+  case Off: break;
+  case On: desc->jit_countdown = HotThreshold; break;
+  case Eager: compile(desc); break;
+  }
+}
+
+#if defined(__x86_64__)
+
+/**
+ * Compiler translates one function. The generated code keeps
+ *
+ *   rbx = ctx
+ *   r12 = sp, the top of the operand stack
+ *   r13 = locals, the local variable slots of the frame
+ *
+ * which are all callee saved, so they survive calls to the helpers. To save
+ * bumping r12 for every push and pop, the code generator tracks how many
+ * cells have been pushed (or popped, if negative) since r12 was last
+ * updated, and only writes r12 back before anything which needs the real
+ * top of the stack: a helper call, a branch, or a jump target.
+ */
+class Jit::Compiler {
+public:
+  Compiler(Executable* code, FunctionDescriptor* desc)
+    : code(code), desc(desc), delta(0) {}
+
+  /** Generates the code into out, and the offset in out of the code of
+   * each jump target into entries */
+  void compile(vector<uint8_t>& out, map<Instruction*, size_t>& entries);
+
+private:
+  enum Reg {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R12 = 12, R13 = 13,
+  };
+
+  /** Condition codes, as encoded in jcc and setcc */
+  enum Cond {
+    CondE = 0x4, CondNE = 0x5,
+    CondL = 0xC, CondGE = 0xD, CondLE = 0xE, CondG = 0xF,
+  };
+
+  /** Labels other than the jump targets of the function */
+  enum { EntryLabel, ExitLabel, EpilogueLabel, ErrorLabel, NumFixedLabels };
+
+  typedef runtime::venom_cell* (*Helper)(ExecutionContext*,
+                                         runtime::venom_cell*,
+                                         Instruction*);
+
+  /** Raw bytes */
+  inline void emit(uint8_t b) { buf.push_back(b); }
+  void emit32(int32_t v);
+  void emit64(int64_t v);
+
+  /** REX prefix for the registers in the reg and rm fields. wide selects a
+   * 64-bit operand size */
+  void rex(bool wide, int reg, int rm, bool force = false);
+
+  /** op reg, [base + disp] (or the other way around, depending on op) */
+  void mem(bool wide, uint8_t op, int reg, int base, int32_t disp);
+  /** Two byte (0F prefixed) version of mem() */
+  void mem0F(bool wide, uint8_t op, int reg, int base, int32_t disp);
+  void modrm(int reg, int base, int32_t disp);
+
+  /** op rm, reg */
+  void regreg(bool wide, uint8_t op, int reg, int rm);
+
+  inline void load(int reg, int base, int32_t disp) {
+    mem(true, 0x8B, reg, base, disp);
+  }
+  inline void store(int base, int32_t disp, int reg) {
+    mem(true, 0x89, reg, base, disp);
+  }
+  inline void movzxByte(int reg, int base, int32_t disp) {
+    mem0F(false, 0xB6, reg, base, disp);
+  }
+  void movImm(int reg, int64_t v);
+
+  /** Stores v into the cell at [base + disp] */
+  void storeImm(int base, int32_t disp, int64_t v);
+
+  /** Stores the flag cond as a bool cell at [base + disp] */
+  void storeCond(Cond cond, int base, int32_t disp);
+
+  /** Offset from r12 of the n-th cell from the top (the top is 1) */
+  inline int32_t cell(int n) const {
+    return int32_t((delta - n) * sizeof(venom_cell));
+  }
+  inline int32_t local(uint32_t n) const {
+    return int32_t(n * sizeof(venom_cell));
+  }
+
+  /** Writes delta back to r12 */
+  void flush();
+
+  size_t newLabel();
+  void bind(size_t label);
+  void jump(size_t label);
+  void jumpIf(Cond cond, size_t label);
+
+  /** Calls helper(ctx, sp, inst), leaving the result in rax and r12 (minus
+   * the flag bit). Bails out to the error label if it returns NULL */
+  void callHelper(Helper helper, Instruction* inst);
+
+  /** Tests the flag bit of the last helper result */
+  void testFlag();
+
+  /** Emits the template of inst */
+  void emitInst(Instruction* inst);
+
+  void emitBinopInt(uint8_t op);
+  void emitCmpInt(Cond cond);
+  void emitBinopBool(uint8_t op);
+  void emitCmpBool(Cond cond);
+  void emitBranchIf(Cond cond, Instruction* inst);
+
+  /** Finds every instruction of the function, and every jump target */
+  void scan(Instruction* entry);
+
+  static inline Instruction* JumpTarget(Instruction* inst) {
+    return inst->offsetBy(static_cast<InstFormatI32*>(inst)->N0);
+  }
+
+  Executable* code;
+  FunctionDescriptor* desc;
+
+  vector<uint8_t> buf;
+
+  /** Cells pushed since r12 was last written back */
+  int delta;
+
+  /** Instructions of the function, ordered by address */
+  set<Instruction*> insts;
+
+  /** The label of each jump target */
+  map<Instruction*, size_t> targets;
+
+  /** Position of each label in buf, once bound */
+  vector<size_t> labels;
+
+  /** (position of a rel32, label it refers to) */
+  vector<pair<size_t, size_t> > fixups;
+};
+
+static const size_t Unbound = size_t(-1);
+
+void Jit::Compiler::emit32(int32_t v) {
+  for (size_t i = 0; i < 4; i++) emit(uint8_t(v >> (8 * i)));
+}
+
+void Jit::Compiler::emit64(int64_t v) {
+  for (size_t i = 0; i < 8; i++) emit(uint8_t(v >> (8 * i)));
+}
+
+void Jit::Compiler::rex(bool wide, int reg, int rm, bool force) {
+  uint8_t b = 0x40 | (wide ? 0x8 : 0) | ((reg & 8) ? 0x4 : 0) |
+              ((rm & 8) ? 0x1 : 0);
+  if (b != 0x40 || force) emit(b);
+}
+
+void Jit::Compiler::modrm(int reg, int base, int32_t disp) {
+  // rbp/r13 as a base always need a displacement
+  if (disp == 0 && (base & 7) != RBP) {
+    emit(((reg & 7) << 3) | (base & 7));
+  } else if (disp >= -128 && disp < 128) {
+    emit(0x40 | ((reg & 7) << 3) | (base & 7));
+  } else {
+    emit(0x80 | ((reg & 7) << 3) | (base & 7));
+  }
+  // rsp/r12 as a base need a SIB byte
+  if ((base & 7) == RSP) emit(0x24);
+  if (disp == 0 && (base & 7) != RBP) return;
+  if (disp >= -128 && disp < 128) emit(uint8_t(disp));
+  else emit32(disp);
+}
+
+void Jit::Compiler::mem(bool wide, uint8_t op, int reg, int base,
+                        int32_t disp) {
+  rex(wide, reg, base);
+  emit(op);
+  modrm(reg, base, disp);
+}
+
+void Jit::Compiler::mem0F(bool wide, uint8_t op, int reg, int base,
+                          int32_t disp) {
+  rex(wide, reg, base);
+  emit(0x0F);
+  emit(op);
+  modrm(reg, base, disp);
+}
+
+void Jit::Compiler::regreg(bool wide, uint8_t op, int reg, int rm) {
+  rex(wide, reg, rm);
+  emit(op);
+  emit(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void Jit::Compiler::movImm(int reg, int64_t v) {
+  rex(true, 0, reg);
+  emit(0xB8 | (reg & 7));
+  emit64(v);
+}
+
+void Jit::Compiler::storeImm(int base, int32_t disp, int64_t v) {
+  if (v == int64_t(int32_t(v))) {
+    // mov qword [base + disp], imm32 (sign extended)
+    mem(true, 0xC7, 0, base, disp);
+    emit32(int32_t(v));
+  } else {
+    movImm(RAX, v);
+    store(base, disp, RAX);
+  }
+}
+
+void Jit::Compiler::storeCond(Cond cond, int base, int32_t disp) {
+  // setcc al; movzx eax, al
+  emit(0x0F); emit(0x90 | cond); emit(0xC0);
+  emit(0x0F); emit(0xB6); emit(0xC0);
+  store(base, disp, RAX);
+}
+
+void Jit::Compiler::flush() {
+  if (!delta) return;
+  // lea r12, [r12 + delta * sizeof(venom_cell)]
+  mem(true, 0x8D, R12, R12, cell(0));
+  delta = 0;
+}
+
+size_t Jit::Compiler::newLabel() {
+  labels.push_back(Unbound);
+  return labels.size() - 1;
+}
+
+void Jit::Compiler::bind(size_t label) {
+  assert(!delta);
+  assert(labels[label] == Unbound);
+  labels[label] = buf.size();
+}
+
+void Jit::Compiler::jump(size_t label) {
+  emit(0xE9);
+  fixups.push_back(make_pair(buf.size(), label));
+  emit32(0);
+}
+
+void Jit::Compiler::jumpIf(Cond cond, size_t label) {
+  emit(0x0F);
+  emit(0x80 | cond);
+  fixups.push_back(make_pair(buf.size(), label));
+  emit32(0);
+}
+
+void Jit::Compiler::callHelper(Helper helper, Instruction* inst) {
+  flush();
+  regreg(true, 0x89, RBX, RDI);                       // mov rdi, rbx
+  regreg(true, 0x89, R12, RSI);                       // mov rsi, r12
+  movImm(RDX, reinterpret_cast<intptr_t>(inst));
+  movImm(RAX, reinterpret_cast<intptr_t>(helper));
+  emit(0xFF); emit(0xD0);                             // call rax
+  regreg(true, 0x85, RAX, RAX);                       // test rax, rax
+  jumpIf(CondE, ErrorLabel);
+  regreg(true, 0x89, RAX, R12);                       // mov r12, rax
+  // and r12, ~1
+  rex(true, 0, R12); emit(0x83); emit(0xE0 | (R12 & 7)); emit(0xFE);
+}
+
+void Jit::Compiler::testFlag() {
+  emit(0xA8); emit(0x01);                             // test al, 1
+}
+
+void Jit::Compiler::emitBinopInt(uint8_t op) {
+  load(RAX, R12, cell(2));
+  mem(true, op, RAX, R12, cell(1));
+  store(R12, cell(2), RAX);
+  delta--;
+}
+
+void Jit::Compiler::emitCmpInt(Cond cond) {
+  load(RAX, R12, cell(2));
+  mem(true, 0x3B, RAX, R12, cell(1));                 // cmp rax, [opnd1]
+  storeCond(cond, R12, cell(2));
+  delta--;
+}
+
+// bool cells only have their first byte set, which is always 0 or 1
+
+void Jit::Compiler::emitBinopBool(uint8_t op) {
+  movzxByte(RAX, R12, cell(2));
+  movzxByte(RCX, R12, cell(1));
+  regreg(false, op, RCX, RAX);                        // op eax, ecx
+  store(R12, cell(2), RAX);
+  delta--;
+}
+
+void Jit::Compiler::emitCmpBool(Cond cond) {
+  movzxByte(RAX, R12, cell(2));
+  movzxByte(RCX, R12, cell(1));
+  regreg(false, 0x39, RCX, RAX);                      // cmp eax, ecx
+  storeCond(cond, R12, cell(2));
+  delta--;
+}
+
+void Jit::Compiler::emitBranchIf(Cond cond, Instruction* inst) {
+  load(RAX, R12, cell(2));
+  mem(true, 0x3B, RAX, R12, cell(1));                 // cmp rax, [opnd1]
+  delta -= 2;
+  flush();                                            // lea keeps the flags
+  jumpIf(cond, targets[JumpTarget(inst)]);
+}
+
+void Jit::Compiler::emitInst(Instruction* inst) {
+  switch (inst->getOpcode()) {
+
+  // pushes and moves
+
+  case Instruction::PUSH_CELL_INT:
+  case Instruction::PUSH_CELL_FLOAT: {
+    int64_t bits;
+    memcpy(&bits, &static_cast<InstFormatC*>(inst)->data, sizeof(bits));
+    storeImm(R12, cell(0), bits);
+    delta++;
+    break;
+  }
+  case Instruction::PUSH_CELL_BOOL:
+    storeImm(R12, cell(0), static_cast<InstFormatC*>(inst)->data.bool_value);
+    delta++;
+    break;
+  case Instruction::PUSH_CELL_NIL:
+    storeImm(R12, cell(0), 0);
+    delta++;
+    break;
+  case Instruction::LOAD_LOCAL_VAR:
+    load(RAX, R13, local(static_cast<InstFormatU32*>(inst)->N0));
+    store(R12, cell(0), RAX);
+    delta++;
+    break;
+  case Instruction::STORE_LOCAL_VAR:
+    load(RAX, R12, cell(1));
+    store(R13, local(static_cast<InstFormatU32*>(inst)->N0), RAX);
+    delta--;
+    break;
+  case Instruction::POP_CELL:
+    delta--;
+    break;
+  case Instruction::DUP: {
+    uint32_t n = static_cast<InstFormatU32*>(inst)->N0;
+    load(RAX, R12, cell(1));
+    for (uint32_t i = 0; i < n; i++, delta++) store(R12, cell(0), RAX);
+    break;
+  }
+
+  // int arithmetic
+
+  case Instruction::BINOP_ADD_INT:     emitBinopInt(0x03); break;
+  case Instruction::BINOP_SUB_INT:     emitBinopInt(0x2B); break;
+  case Instruction::BINOP_BIT_AND_INT: emitBinopInt(0x23); break;
+  case Instruction::BINOP_BIT_OR_INT:  emitBinopInt(0x0B); break;
+  case Instruction::BINOP_BIT_XOR_INT: emitBinopInt(0x33); break;
+  case Instruction::BINOP_MULT_INT:
+    load(RAX, R12, cell(2));
+    mem0F(true, 0xAF, RAX, R12, cell(1));             // imul rax, [opnd1]
+    store(R12, cell(2), RAX);
+    delta--;
+    break;
+  case Instruction::BINOP_DIV_INT:
+  case Instruction::BINOP_MOD_INT:
+    load(RAX, R12, cell(2));
+    emit(0x48); emit(0x99);                           // cqo
+    mem(true, 0xF7, 7, R12, cell(1));                 // idiv [opnd1]
+    store(R12, cell(2),
+          inst->getOpcode() == Instruction::BINOP_DIV_INT ? RAX : RDX);
+    delta--;
+    break;
+  case Instruction::BINOP_BIT_LSHIFT_INT:
+  case Instruction::BINOP_BIT_RSHIFT_INT:
+    load(RCX, R12, cell(1));
+    load(RAX, R12, cell(2));
+    // shl rax, cl / sar rax, cl
+    regreg(true, 0xD3,
+           inst->getOpcode() == Instruction::BINOP_BIT_LSHIFT_INT ? 4 : 7,
+           RAX);
+    store(R12, cell(2), RAX);
+    delta--;
+    break;
+  case Instruction::UNOP_PLUS_INT:
+    break;
+  case Instruction::UNOP_MINUS_INT:
+    mem(true, 0xF7, 3, R12, cell(1));                 // neg [opnd0]
+    break;
+  case Instruction::UNOP_BIT_NOT_INT:
+    mem(true, 0xF7, 2, R12, cell(1));                 // not [opnd0]
+    break;
+  case Instruction::UNOP_CMP_NOT_INT:
+  case Instruction::TEST_INT:
+    load(RAX, R12, cell(1));
+    regreg(true, 0x85, RAX, RAX);                     // test rax, rax
+    storeCond(inst->getOpcode() == Instruction::TEST_INT ? CondNE : CondE,
+              R12, cell(1));
+    break;
+  case Instruction::ADD_INT_LOCAL_LOCAL: {
+    InstFormatU32U32* self = static_cast<InstFormatU32U32*>(inst);
+    load(RAX, R13, local(self->N0));
+    mem(true, 0x03, RAX, R13, local(self->N1));       // add rax, [local]
+    store(R12, cell(0), RAX);
+    delta++;
+    break;
+  }
+  case Instruction::ADD_INT_CONST:
+  case Instruction::SUB_INT_CONST: {
+    int64_t v = static_cast<InstFormatC*>(inst)->data.int_value;
+    bool add = inst->getOpcode() == Instruction::ADD_INT_CONST;
+    if (v == int64_t(int32_t(v))) {
+      // add/sub qword [opnd0], imm32
+      mem(true, 0x81, add ? 0 : 5, R12, cell(1));
+      emit32(int32_t(v));
+    } else {
+      movImm(RCX, v);
+      mem(true, add ? 0x01 : 0x29, RCX, R12, cell(1));
+    }
+    break;
+  }
+
+  // comparisons
+
+  case Instruction::BINOP_CMP_LT_INT:  emitCmpInt(CondL);  break;
+  case Instruction::BINOP_CMP_LE_INT:  emitCmpInt(CondLE); break;
+  case Instruction::BINOP_CMP_GT_INT:  emitCmpInt(CondG);  break;
+  case Instruction::BINOP_CMP_GE_INT:  emitCmpInt(CondGE); break;
+  case Instruction::BINOP_CMP_EQ_INT:  emitCmpInt(CondE);  break;
+  case Instruction::BINOP_CMP_NEQ_INT: emitCmpInt(CondNE); break;
+
+  case Instruction::BINOP_CMP_LT_BOOL:  emitCmpBool(CondL);  break;
+  case Instruction::BINOP_CMP_LE_BOOL:  emitCmpBool(CondLE); break;
+  case Instruction::BINOP_CMP_GT_BOOL:  emitCmpBool(CondG);  break;
+  case Instruction::BINOP_CMP_GE_BOOL:  emitCmpBool(CondGE); break;
+  case Instruction::BINOP_CMP_EQ_BOOL:  emitCmpBool(CondE);  break;
+  case Instruction::BINOP_CMP_NEQ_BOOL: emitCmpBool(CondNE); break;
+
+  case Instruction::BINOP_CMP_AND_BOOL:
+  case Instruction::BINOP_BIT_AND_BOOL: emitBinopBool(0x21); break;
+  case Instruction::BINOP_CMP_OR_BOOL:
+  case Instruction::BINOP_BIT_OR_BOOL:  emitBinopBool(0x09); break;
+  case Instruction::BINOP_BIT_XOR_BOOL: emitBinopBool(0x31); break;
+
+  case Instruction::UNOP_CMP_NOT_BOOL:
+    movzxByte(RAX, R12, cell(1));
+    regreg(false, 0x85, RAX, RAX);                    // test eax, eax
+    storeCond(CondE, R12, cell(1));
+    break;
+
+  // control flow
+
+  case Instruction::JUMP:
+    flush();
+    jump(targets[JumpTarget(inst)]);
+    break;
+  case Instruction::BRANCH_Z_INT:
+  case Instruction::BRANCH_NZ_INT:
+    load(RAX, R12, cell(1));
+    delta--;
+    flush();
+    regreg(true, 0x85, RAX, RAX);                     // test rax, rax
+    jumpIf(inst->getOpcode() == Instruction::BRANCH_Z_INT ? CondE : CondNE,
+           targets[JumpTarget(inst)]);
+    break;
+  case Instruction::BRANCH_Z_BOOL:
+  case Instruction::BRANCH_NZ_BOOL:
+    movzxByte(RAX, R12, cell(1));
+    delta--;
+    flush();
+    regreg(false, 0x85, RAX, RAX);                    // test eax, eax
+    jumpIf(inst->getOpcode() == Instruction::BRANCH_Z_BOOL ? CondE : CondNE,
+           targets[JumpTarget(inst)]);
+    break;
+  case Instruction::BRANCH_Z_FLOAT:
+  case Instruction::BRANCH_Z_REF:
+  case Instruction::BRANCH_NZ_FLOAT:
+  case Instruction::BRANCH_NZ_REF:
+    callHelper(&Jit::Branch, inst);
+    testFlag();
+    jumpIf(CondNE, targets[JumpTarget(inst)]);
+    break;
+  case Instruction::BRANCH_IF_EQ_INT:  emitBranchIf(CondE, inst);  break;
+  case Instruction::BRANCH_IF_NEQ_INT: emitBranchIf(CondNE, inst); break;
+  case Instruction::BRANCH_IF_LT_INT:  emitBranchIf(CondL, inst);  break;
+  case Instruction::BRANCH_IF_LE_INT:  emitBranchIf(CondLE, inst); break;
+  case Instruction::BRANCH_IF_GT_INT:  emitBranchIf(CondG, inst);  break;
+  case Instruction::BRANCH_IF_GE_INT:  emitBranchIf(CondGE, inst); break;
+
+  case Instruction::CALL:
+    callHelper(&Jit::Invoke, inst);
+    break;
+  case Instruction::CALL_VIRTUAL:
+    callHelper(&Jit::InvokeVirtual, inst);
+    break;
+  case Instruction::TAIL_CALL:
+    if (reinterpret_cast<FunctionDescriptor*>(
+          static_cast<InstFormatIPtr*>(inst)->N0) == desc) {
+      callHelper(&Jit::Loop, inst);
+      jump(EntryLabel);
+    } else {
+      callHelper(&Jit::TailCall, inst);
+      jump(ExitLabel);
+    }
+    break;
+  case Instruction::TAIL_CALL_VIRTUAL:
+    callHelper(&Jit::TailCall, inst);
+    testFlag();
+    jumpIf(CondNE, ExitLabel);
+    break;
+  case Instruction::RET:
+    callHelper(&Jit::Ret, inst);
+    jump(ExitLabel);
+    break;
+
+  default:
+    // everything else runs the interpreter handler
+    callHelper(&Jit::Execute, inst);
+    break;
+  }
+}
+
+void Jit::Compiler::scan(Instruction* entry) {
+  vector<Instruction*> work;
+  work.push_back(entry);
+  while (!work.empty()) {
+    Instruction* inst = work.back();
+    work.pop_back();
+    if (!insts.insert(inst).second) continue;
+    Instruction::Opcode opcode = inst->getOpcode();
+    bool jumps;
+    switch (opcode) {
+    case Instruction::BRANCH_IF_EQ_INT:
+    case Instruction::BRANCH_IF_NEQ_INT:
+    case Instruction::BRANCH_IF_LT_INT:
+    case Instruction::BRANCH_IF_LE_INT:
+    case Instruction::BRANCH_IF_GT_INT:
+    case Instruction::BRANCH_IF_GE_INT:
+      jumps = true;
+      break;
+    default:
+      jumps = Instruction::IsJump(opcode);
+      break;
+    }
+    if (jumps) {
+      Instruction* target = JumpTarget(inst);
+      if (targets.find(target) == targets.end()) {
+        targets[target] = newLabel();
+      }
+      work.push_back(target);
+    }
+    if (!Instruction::IsTerminator(opcode)) work.push_back(inst->next());
+  }
+}
+
+void Jit::Compiler::compile(vector<uint8_t>& out,
+                            map<Instruction*, size_t>& entries) {
+  for (size_t i = 0; i < NumFixedLabels; i++) newLabel();
+  scan(code->instructionAt(intptr_t(desc->getFunctionPtr())));
+
+  // prologue. three pushes (plus the return address) keep the stack 16 byte
+  // aligned for the helper calls
+  emit(0x53);                                         // push rbx
+  emit(0x41); emit(0x54);                             // push r12
+  emit(0x41); emit(0x55);                             // push r13
+  regreg(true, 0x89, RDI, RBX);                       // mov rbx, rdi
+  regreg(true, 0x89, RSI, R12);                       // mov r12, rsi
+  regreg(true, 0x89, RDX, R13);                       // mov r13, rdx
+  regreg(true, 0x85, RCX, RCX);                       // test rcx, rcx
+  jumpIf(CondE, EntryLabel);
+  emit(0xFF); emit(0xE1);                             // jmp rcx
+  bind(EntryLabel);
+
+  for (set<Instruction*>::iterator it = insts.begin();
+       it != insts.end(); ++it) {
+    map<Instruction*, size_t>::iterator target = targets.find(*it);
+    if (target != targets.end()) {
+      flush();
+      bind(target->second);
+    }
+    emitInst(*it);
+    if (Instruction::IsTerminator((*it)->getOpcode())) assert(!delta);
+  }
+  // the last instruction of a function never falls through
+  assert(!delta);
+
+  bind(ExitLabel);
+  regreg(true, 0x89, R12, RAX);                       // mov rax, r12
+  bind(EpilogueLabel);
+  emit(0x41); emit(0x5D);                             // pop r13
+  emit(0x41); emit(0x5C);                             // pop r12
+  emit(0x5B);                                         // pop rbx
+  emit(0xC3);                                         // ret
+  bind(ErrorLabel);
+  regreg(false, 0x31, RAX, RAX);                      // xor eax, eax
+  jump(EpilogueLabel);
+
+  for (vector<pair<size_t, size_t> >::iterator it = fixups.begin();
+       it != fixups.end(); ++it) {
+    assert(labels[it->second] != Unbound);
+    int32_t rel = int32_t(labels[it->second] - (it->first + 4));
+    memcpy(&buf[it->first], &rel, sizeof(rel));
+  }
+  out.swap(buf);
+  for (map<Instruction*, size_t>::iterator it = targets.begin();
+       it != targets.end(); ++it) {
+    entries[it->first] = labels[it->second];
+  }
+}
+
+bool Jit::compile(FunctionDescriptor* desc) {
+  assert(!desc->isNative());
+  if (desc->jit_code) return true;
+  vector<uint8_t> bytes;
+  map<Instruction*, size_t> offsets;
+  Compiler(code, desc).compile(bytes, offsets);
+  desc->jit_code = install(bytes);
+  if (!desc->jit_code) return false;
+  for (map<Instruction*, size_t>::iterator it = offsets.begin();
+       it != offsets.end(); ++it) {
+    entries[it->first] =
+      reinterpret_cast<const char*>(desc->jit_code) + it->second;
+  }
+  return true;
+}
+
+#else
+
+// there is only an x86-64 backend, so everything stays interpreted elsewhere
+bool Jit::compile(FunctionDescriptor* desc) { return false; }
+
+#endif /* __x86_64__ */
+
+Jit::Code Jit::install(const vector<uint8_t>& bytes) {
+  size_t n = (bytes.size() + 15) & ~size_t(15);
+  if (regions.empty() || regions.back().size - regions.back().used < n) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    Region r;
+    r.size = (max(n, size_t(RegionSize)) + page - 1) & ~(page - 1);
+    r.used = 0;
+    void* p = mmap(NULL, r.size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    r.base = static_cast<char*>(p);
+    regions.push_back(r);
+  }
+  // the region is only ever writable while code is being copied into it
+  Region& r = regions.back();
+  if (mprotect(r.base, r.size, PROT_READ | PROT_WRITE)) return NULL;
+  char* dest = r.base + r.used;
+  memcpy(dest, &bytes[0], bytes.size());
+  r.used += n;
+  if (mprotect(r.base, r.size, PROT_READ | PROT_EXEC)) return NULL;
+  return reinterpret_cast<Code>(dest);
+}
+
+// Exceptions cannot unwind through compiled code, so the helpers (and
+// Enter()) stash them in the State for Run() to rethrow
+#define CATCH_FOR_JIT(ctx) \
+  catch (VenomRuntimeException& e) { \
+    ctx->jit_state.error_is_venom = true; \
+    ctx->jit_state.error = e.what(); \
+  } catch (exception& e) { \
+    ctx->jit_state.error_is_venom = false; \
+    ctx->jit_state.error = e.what(); \
+  } \
+  return NULL;
+
+void Jit::Run(ExecutionContext& ctx) {
+  Instruction* pc = ctx.program_counter;
+  venom_cell* sp =
+    Enter(&ctx, ctx.frame->desc, ctx.program_stack.getTop());
+  if (VENOM_UNLIKELY(!sp)) Rethrow(ctx.jit_state);
+  ctx.program_stack.setTop(sp);
+  ctx.program_counter = pc;
+}
+
+Instruction* Jit::RunFrom(ExecutionContext& ctx, Instruction* target) {
+  // tail calls keep the ret_addr of the frame they replace
+  Instruction* ret_addr = ctx.frame->ret_addr;
+  venom_cell* sp =
+    Enter(&ctx, ctx.frame->desc, ctx.program_stack.getTop(),
+          ctx.code->getJit()->entryFor(target));
+  if (VENOM_UNLIKELY(!sp)) Rethrow(ctx.jit_state);
+  ctx.program_stack.setTop(sp);
+  return ret_addr;
+}
+
+void Jit::Rethrow(State& state) {
+  string msg;
+  msg.swap(state.error);
+  if (state.error_is_venom) throw VenomRuntimeException(msg);
+  throw runtime_error(msg);
+}
+
+venom_cell* Jit::Enter(ExecutionContext* ctx, FunctionDescriptor* desc,
+                       venom_cell* sp, const void* entry) {
+  assert(desc->jit_code);
+  assert(ctx->frame->desc == desc);
+  Frame* return_frame = ctx->frame->prev;
+  State& state = ctx->jit_state;
+  state.depth++;
+  while (true) {
+    sp = desc->jit_code(ctx, sp, ctx->frame->locals(), entry);
+    if (VENOM_UNLIKELY(!sp)) break;
+    entry = NULL;
+    desc = state.tail_callee;
+    if (VENOM_LIKELY(!desc)) break;
+    // the callee has already taken over the frame
+    state.tail_callee = NULL;
+    if (!desc->jitReady(ctx)) {
+      sp = Interpret(ctx, desc, sp, return_frame);
+      break;
+    }
+  }
+  state.depth--;
+  assert(!sp || ctx->frame == return_frame);
+  return sp;
+}
+
+venom_cell* Jit::Interpret(ExecutionContext* ctx, FunctionDescriptor* desc,
+                           venom_cell* sp, Frame* return_frame) {
+  try {
+    ctx->program_stack.setTop(sp);
+    ctx->program_counter =
+      ctx->code->instructionAt(intptr_t(desc->getFunctionPtr()));
+    Instruction::ExecuteStream(*ctx, return_frame);
+    return ctx->program_stack.getTop();
+  } CATCH_FOR_JIT(ctx)
+}
+
+static inline venom_cell* Flag(venom_cell* sp) {
+  return reinterpret_cast<venom_cell*>(intptr_t(sp) | 1);
+}
+
+venom_cell* Jit::Execute(
+    ExecutionContext* ctx, venom_cell* sp, Instruction* inst) {
+  try {
+    bool next = inst->execute(*ctx, sp);
+    assert(next);
+    (void) next;
+    return sp;
+  } CATCH_FOR_JIT(ctx)
+}
+
+venom_cell* Jit::Branch(
+    ExecutionContext* ctx, venom_cell* sp, Instruction* inst) {
+  try {
+    return inst->execute(*ctx, sp) ? sp : Flag(sp);
+  } CATCH_FOR_JIT(ctx)
+}
+
+venom_cell* Jit::Call(
+    ExecutionContext* ctx, venom_cell* sp, Instruction* inst) {
+  try {
+    // the interpreter handler runs the callee itself if it is native or
+    // compiled, and otherwise pushes a frame for it to be interpreted in
+    Frame* return_frame = ctx->frame;
+    if (!inst->execute(*ctx, sp)) {
+      ctx->program_stack.setTop(sp);
+      Instruction::ExecuteStream(*ctx, return_frame);
+      sp = ctx->program_stack.getTop();
+    }
+    return sp;
+  } CATCH_FOR_JIT(ctx)
+}
+
+venom_cell* Jit::Invoke(
+    ExecutionContext* ctx, venom_cell* sp, Instruction* inst) {
+  FunctionDescriptor* desc = reinterpret_cast<FunctionDescriptor*>(
+      static_cast<InstFormatIPtr*>(inst)->N0);
+  // anything but a compiled callee (including one which is about to be
+  // compiled) takes the interpreter's route, which counts the call
+  if (!desc->jit_code || ctx->jit_state.depth >= MaxDepth) {
+    return Call(ctx, sp, inst);
+  }
+  try {
+    ctx->program_stack.checkHeadroom(sp, desc->getMaxStackDepth());
+    ctx->new_frame(inst->next(), desc);
+    return Enter(ctx, desc, sp);
+  } CATCH_FOR_JIT(ctx)
+}
+
+venom_cell* Jit::InvokeVirtual(
+    ExecutionContext* ctx, venom_cell* sp, Instruction* inst) {
+  // the receiver stays on the stack as the "this" argument. A NULL receiver
+  // takes the interpreter's route, which throws
+  venom_object* obj = sp[-1].asRawObject();
+  if (!obj || ctx->jit_state.depth >= MaxDepth) {
+    return Call(ctx, sp, inst);
+  }
+  try {
+    InlineCache* cache = reinterpret_cast<InlineCache*>(
+        static_cast<InstFormatIPtr*>(inst)->N0);
+    const InlineCache::Target& target =
+      cache->lookup(obj->getClassObj(), ctx->code);
+    FunctionDescriptor* desc = target.desc;
+    if (!target.code || !desc->jit_code) return Call(ctx, sp, inst);
+    ctx->program_stack.checkHeadroom(sp, desc->getMaxStackDepth());
+    ctx->new_frame(inst->next(), desc);
+    return Enter(ctx, desc, sp);
+  } CATCH_FOR_JIT(ctx)
+}
+
+venom_cell* Jit::TailCall(
+    ExecutionContext* ctx, venom_cell* sp, Instruction* inst) {
+  try {
+    if (inst->execute(*ctx, sp)) return sp;
+    // Run() takes it from here
+    ctx->jit_state.tail_callee = ctx->frame->desc;
+    return Flag(sp);
+  } CATCH_FOR_JIT(ctx)
+}
+
+venom_cell* Jit::Loop(
+    ExecutionContext* ctx, venom_cell* sp, Instruction* inst) {
+  try {
+    // the new frame is where the old one was, so the compiled code can keep
+    // its locals pointer
+    venom_cell* locals = ctx->frame->locals();
+    bool next = inst->execute(*ctx, sp);
+    assert(!next);
+    assert(ctx->frame->locals() == locals);
+    (void) next;
+    (void) locals;
+    return sp;
+  } CATCH_FOR_JIT(ctx)
+}
+
+venom_cell* Jit::Ret(
+    ExecutionContext* ctx, venom_cell* sp, Instruction* inst) {
+  try {
+    ctx->program_stack.setTop(sp);
+    ctx->pop_frame();
+    return sp;
+  } CATCH_FOR_JIT(ctx)
+}
+
+#undef CATCH_FOR_JIT
+
+}
+}
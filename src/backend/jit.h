@@ -0,0 +1,262 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_BACKEND_JIT_H
+#define VENOM_BACKEND_JIT_H
+
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <runtime/venomobject.h>
+
+#include <util/noncopyable.h>
+
+namespace venom {
+namespace backend {
+
+/** Forward decl */
+class Executable;
+class ExecutionContext;
+class FunctionDescriptor;
+class Instruction;
+struct Frame;
+
+/**
+ * Jit is a baseline template compiler from bytecode functions to x86-64
+ * machine code. Each instruction of a function is translated on its own, by
+ * stitching together a fixed sequence of machine instructions for its
+ * opcode, with its operands inlined as immediates. No register allocation
+ * is done across instructions; the operand stack stays in memory, exactly
+ * where the interpreter would have it, and only the cells pushed since the
+ * last jump target are addressed relative to a stack pointer which has not
+ * been bumped yet.
+ *
+ * Only instructions which never touch a ref count (int and bool arithmetic,
+ * comparisons, branches, and moves between locals and the stack) get a
+ * template of their own. Every other instruction is run by calling back into
+ * its interpreter handler, so ref counting and VenomRuntimeException behave
+ * exactly as they do when interpreting. Calls go through the interpreter's
+ * call handlers too, which run the callee's compiled code if it has any.
+ *
+ * In On mode, a function is compiled once it has been called (or has run
+ * the back edge of a loop) HotThreshold times. In Eager mode, every function
+ * is compiled before the program starts (which is mostly useful for testing
+ * the Jit). Since the compiled code keeps the operand stack and the locals
+ * where the interpreter keeps them, an interpreted call can switch over to
+ * the compiled code at any jump target, so a function which is only called
+ * once does not have to spin in the interpreter for the rest of its loop.
+ */
+class Jit : private util::noncopyable {
+  friend class ExecutionContext;
+  friend class FunctionDescriptor;
+public:
+  enum Mode {
+    Off,
+    On,
+    Eager,
+  };
+
+  /** Parses "off", "on" or "eager" into mode. Returns false for anything
+   * else */
+  static bool ParseMode(const std::string& s, Mode& mode);
+
+  /** Number of calls and loop iterations after which a function is
+   * compiled, in On mode */
+  static const uint32_t HotThreshold = 1000;
+
+  /** Compiled code runs on the C stack, one native frame (and a few helper
+   * frames) per call. Calls nested deeper than this are interpreted, so deep
+   * recursion cannot overflow the C stack */
+  static const size_t MaxDepth = 1024;
+
+  /**
+   * The code compiled for a function. Runs the function in the current frame
+   * of ctx (whose local variables are at locals), with sp the top of the
+   * operand stack, from its start (or from entry, the compiled code of one of
+   * its jump targets, see entryFor()). Returns the top of the stack once the
+   * function has returned, or has tail called another function (see State).
+   * Returns NULL if an exception was thrown (see State), since exceptions
+   * cannot unwind through compiled code
+   */
+  typedef runtime::venom_cell* (*Code)(ExecutionContext* ctx,
+                                       runtime::venom_cell* sp,
+                                       runtime::venom_cell* locals,
+                                       const void* entry);
+
+  /** The Jit state kept per ExecutionContext */
+  struct State {
+    State() : depth(0), tail_callee(NULL), error_is_venom(false) {}
+
+    /** Number of compiled functions currently on the C stack */
+    size_t depth;
+
+    /** Set when compiled code returns because it tail called (and replaced
+     * its frame with a frame for) another function */
+    FunctionDescriptor* tail_callee;
+
+    /** The exception which compiled code returned NULL for, to be rethrown
+     * once control is out of compiled code */
+    bool error_is_venom;
+    std::string error;
+  };
+
+  /** Does *not* take ownership of code */
+  explicit Jit(Executable* code) : code(code) {}
+  ~Jit();
+
+  /** Takes charge of desc, a bytecode function of code, which is compiled
+   * right away in Eager mode, and once it gets hot in On mode */
+  void add(FunctionDescriptor* desc, Mode mode);
+
+  /** Compiles desc, which is a bytecode function of code. Returns false if
+   * desc cannot be compiled, in which case it stays interpreted */
+  bool compile(FunctionDescriptor* desc);
+
+  /**
+   * Runs the compiled code of the function in the current frame of ctx,
+   * until that frame has been popped. The arguments are expected on the
+   * stack, just as the function would find them if it were interpreted, and
+   * the return value is left on the stack. The program_counter is not
+   * changed
+   */
+  static void Run(ExecutionContext& ctx);
+
+  /**
+   * Switches the function in the current frame of ctx, which is being
+   * interpreted and is about to jump to target, over to its compiled code.
+   * Runs until the frame has been popped, as if by a RET, and returns the
+   * instruction the RET would have returned to
+   */
+  static Instruction* RunFrom(ExecutionContext& ctx, Instruction* target);
+
+private:
+  class Compiler;
+
+  /** Copies the machine code into executable memory */
+  Code install(const std::vector<uint8_t>& bytes);
+
+  /** The compiled code of target, a jump target of a compiled function */
+  inline const void* entryFor(Instruction* target) const {
+    std::map<Instruction*, const void*>::const_iterator it =
+      entries.find(target);
+    assert(it != entries.end());
+    return it->second;
+  }
+
+  static void Rethrow(State& state);
+
+  /** Runs the compiled code of desc in the current frame of ctx (and
+   * whatever it tail calls), until the frame is popped. Returns the new top
+   * of the stack, or NULL if an exception was thrown */
+  static runtime::venom_cell* Enter(ExecutionContext* ctx,
+                                    FunctionDescriptor* desc,
+                                    runtime::venom_cell* sp,
+                                    const void* entry = NULL);
+
+  /** Interprets desc in the current frame of ctx, until the frame is popped
+   * back down to return_frame. Returns like Enter() */
+  static runtime::venom_cell* Interpret(ExecutionContext* ctx,
+                                        FunctionDescriptor* desc,
+                                        runtime::venom_cell* sp,
+                                        Frame* return_frame);
+
+  /**
+   * Helpers which compiled code calls, with the top of the stack in sp. Each
+   * returns the new top of the stack, or NULL if an exception was thrown.
+   * The ones which can jump set the low bit of the returned pointer to
+   * signal that they did (cells are aligned, so the bit is otherwise clear)
+   */
+
+  /** Runs a non control flow instruction */
+  static runtime::venom_cell* Execute(ExecutionContext* ctx,
+                                      runtime::venom_cell* sp,
+                                      Instruction* inst);
+
+  /** Runs a branch, and flags if it is taken */
+  static runtime::venom_cell* Branch(ExecutionContext* ctx,
+                                     runtime::venom_cell* sp,
+                                     Instruction* inst);
+
+  /** Runs a CALL, skipping the interpreter handler if the callee has been
+   * compiled */
+  static runtime::venom_cell* Invoke(ExecutionContext* ctx,
+                                     runtime::venom_cell* sp,
+                                     Instruction* inst);
+
+  /** Runs a CALL_VIRTUAL, skipping the interpreter handler if the inline
+   * cache resolves the callee to a compiled function */
+  static runtime::venom_cell* InvokeVirtual(ExecutionContext* ctx,
+                                            runtime::venom_cell* sp,
+                                            Instruction* inst);
+
+  /** Runs a CALL or CALL_VIRTUAL until the callee returns */
+  static runtime::venom_cell* Call(ExecutionContext* ctx,
+                                   runtime::venom_cell* sp,
+                                   Instruction* inst);
+
+  /** Runs a TAIL_CALL or TAIL_CALL_VIRTUAL, and flags if the frame was
+   * replaced (a native callee returns to the next instruction instead) */
+  static runtime::venom_cell* TailCall(ExecutionContext* ctx,
+                                       runtime::venom_cell* sp,
+                                       Instruction* inst);
+
+  /** Runs a TAIL_CALL from a function to itself, after which the compiled
+   * code jumps back to its own start */
+  static runtime::venom_cell* Loop(ExecutionContext* ctx,
+                                   runtime::venom_cell* sp,
+                                   Instruction* inst);
+
+  /** Runs a RET */
+  static runtime::venom_cell* Ret(ExecutionContext* ctx,
+                                  runtime::venom_cell* sp,
+                                  Instruction* inst);
+
+  /** Executable memory is handed out from regions mapped with mmap() */
+  struct Region {
+    char* base;
+    size_t size;
+    size_t used;
+  };
+
+  /** Size of a region, unless a function needs more */
+  static const size_t RegionSize = 1 << 16;
+
+  Executable* code;
+  std::vector<Region> regions;
+
+  /** The compiled code of every jump target of the compiled functions */
+  std::map<Instruction*, const void*> entries;
+};
+
+}
+}
+
+#endif /* VENOM_BACKEND_JIT_H */
@@ -28,8 +28,12 @@
  */
 
 #include <algorithm>
+#include <sstream>
 
+#include <backend/fuser.h>
+#include <backend/inlinecache.h>
 #include <backend/linker.h>
+#include <backend/verifier.h>
 #include <backend/vm.h>
 
 #include <util/container.h>
@@ -43,9 +47,43 @@ namespace venom {
 namespace backend {
 
 Executable::~Executable() {
-  util::delete_pointers(instructions.begin(), instructions.end());
+  // the instructions live in the stream buffer, and have trivial destructors
   util::delete_pointers(user_func_descs.begin(), user_func_descs.end());
   util::delete_pointers(user_class_objs.begin(), user_class_objs.end());
+  util::delete_pointers(inline_caches.begin(), inline_caches.end());
+  delete jit;
+}
+
+void Executable::printInlineCacheStats(ostream& o) const {
+  o << "; inline caches" << endl;
+  for (InlineCacheVec::const_iterator it = inline_caches.begin();
+       it != inline_caches.end(); ++it) {
+    (*it)->printStats(o);
+  }
+}
+
+void Executable::enableJit(Jit::Mode mode) {
+  assert(!jit);
+  if (mode == Jit::Off) return;
+  jit = new Jit(this);
+  for (FuncDescVec::iterator it = user_func_descs.begin();
+       it != user_func_descs.end(); ++it) {
+    jit->add(*it, mode);
+  }
+}
+
+void Executable::link() {
+  for (char* p = instructions.begin(); p != instructions.end(); ) {
+    Instruction* inst = reinterpret_cast<Instruction*>(p);
+    inst->link(this);
+    p += inst->getWidth();
+  }
+}
+
+Instruction* Executable::startingInst() {
+  // a compiled program has no instructions to start at
+  if (mainFunc->isCompiled()) return NULL;
+  return instructionAt(intptr_t(mainFunc->getFunctionPtr()));
 }
 
 struct constant_table_functor {
@@ -64,26 +102,36 @@ struct constant_table_functor {
   util::container_pool<ExecConstant>* exec_const_pool;
 };
 
-struct inst_resolver_functor {
-  inst_resolver_functor(ResolutionTable* resTable)
-    : resTable(resTable), pos(0) {}
-  inline Instruction* operator()(SymbolicInstruction* i) {
-    return i->resolve(pos++, *resTable);
-  }
-  ResolutionTable* resTable;
-  size_t pos;
-};
-
-struct inst_sum_functor {
-  inline size_t operator()(size_t accum, ObjectCode* obj) {
-    return accum + obj->getInstructions().size();
-  }
-};
-
 Executable* Linker::link(const ObjCodeVec& objs, size_t mainIdx) {
   assert(!objs.empty());
   VENOM_CHECK_RANGE(mainIdx, objs.size());
 
+  // pick the instruction sequences in each obj to encode as
+  // superinstructions
+  vector<Fuser> fusers;
+  fusers.reserve(objs.size());
+  for (size_t i = 0; i < objs.size(); i++) {
+    fusers.push_back(Fuser(objs[i]));
+  }
+
+  // lay out the executable instruction stream: each obj's instructions are
+  // placed one after another, so record the byte offset (in the stream) of
+  // every symbolic instruction in each obj, plus one entry for the end. An
+  // instruction fused into a superinstruction takes up no space, so it gets
+  // the offset of the instruction after it
+  vector<ResolutionTable::InstOffsetTbl> inst_offset_tables(objs.size());
+  size_t n_bytes = 0;
+  for (size_t i = 0; i < objs.size(); i++) {
+    size_t n_insts = objs[i]->getInstructions().size();
+    ResolutionTable::InstOffsetTbl& offsets = inst_offset_tables[i];
+    offsets.reserve(n_insts + 1);
+    for (size_t pos = 0; pos < n_insts; pos++) {
+      offsets.push_back(n_bytes);
+      n_bytes += fusers[i].encodedWidth(pos);
+    }
+    offsets.push_back(n_bytes);
+  }
+
   // go through each local function in each obj (in order),
   // and create FunctionDescriptors, which point to the
   // global offset in the executable instruction stream
@@ -91,20 +139,20 @@ Executable* Linker::link(const ObjCodeVec& objs, size_t mainIdx) {
   // local func descs, for each obj
   vector<FuncDescVec> localFuncDescriptors(objs.size());
   FuncDescMap funcDescMap; // for external user symbols
-  size_t acc = 0;
   for (size_t i = 0; i < objs.size(); i++) {
     ObjectCode* obj = objs[i];
-    ObjectCode::IStream& insts = obj->getInstructions();
+    ResolutionTable::InstOffsetTbl& offsets = inst_offset_tables[i];
     FuncDescVec& objFuncDescVec = localFuncDescriptors[i];
     objFuncDescVec.reserve(obj->getFuncPool().size());
     for (vector<FunctionSignature>::iterator it = obj->getFuncPool().begin();
          it != obj->getFuncPool().end(); ++it) {
-      FunctionDescriptor *desc = it->createFuncDescriptor(acc);
+      VENOM_CHECK_RANGE(it->codeOffset, offsets.size() - 1);
+      FunctionDescriptor *desc =
+        it->createFuncDescriptor(offsets[it->codeOffset]);
       objFuncDescVec.push_back(desc);
       // TODO: assert that this is a *new* entry
       funcDescMap[it->getFullName(obj->getModuleName())] = desc;
     }
-    acc += insts.size();
   }
 
   // merge the builtin symbols into the user symbols
@@ -136,6 +184,52 @@ Executable* Linker::link(const ObjCodeVec& objs, size_t mainIdx) {
     }
   }
 
+  // verify the code of each local function in each obj, which also gives
+  // the max stack depth the VM checks for when calling the function. also
+  // create an inline cache for each CALL_VIRTUAL (and TAIL_CALL_VIRTUAL)
+  // call site in the function
+  vector<ResolutionTable::InlineCacheTbl> inline_cache_tables(objs.size());
+  Executable::InlineCacheVec inline_caches;
+  for (size_t i = 0; i < objs.size(); i++) {
+    ObjectCode* obj = objs[i];
+    ObjectCode::IStream& insts = obj->getInstructions();
+    vector<FunctionSignature>& funcPool = obj->getFuncPool();
+    inline_cache_tables[i].resize(insts.size(), NULL);
+
+    // functions are laid out one after another, so each one ends where the
+    // next one begins
+    vector<size_t> starts;
+    starts.reserve(funcPool.size() + 1);
+    for (vector<FunctionSignature>::iterator it = funcPool.begin();
+         it != funcPool.end(); ++it) {
+      starts.push_back(it->codeOffset);
+    }
+    starts.push_back(insts.size());
+    sort(starts.begin(), starts.end());
+
+    Verifier verifier(obj, func_map_tables[i]);
+    for (size_t j = 0; j < funcPool.size(); j++) {
+      size_t end =
+        *upper_bound(starts.begin(), starts.end(), funcPool[j].codeOffset);
+      localFuncDescriptors[i][j]->max_stack_depth =
+        verifier.verifyFunction(funcPool[j], end);
+
+      string name = funcPool[j].getFullName(obj->getModuleName());
+      for (size_t pos = funcPool[j].codeOffset; pos < end; pos++) {
+        Instruction::Opcode opcode = insts[pos]->getOpcode();
+        if (opcode != Instruction::CALL_VIRTUAL &&
+            opcode != Instruction::TAIL_CALL_VIRTUAL) continue;
+        VENOM_ASSERT_TYPEOF_PTR(SInstU32, insts[pos]);
+        stringstream site;
+        site << name << " (instruction " << pos << ")";
+        InlineCache* cache = new InlineCache(
+            static_cast<SInstU32*>(insts[pos])->getValue(), site.str());
+        inline_cache_tables[i][pos] = cache;
+        inline_caches.push_back(cache);
+      }
+    }
+  }
+
   // go through each local class in each obj,
   // and create class objs
   vector<Executable::ClassObjVec> localClassObjs(objs.size());
@@ -208,36 +302,46 @@ Executable* Linker::link(const ObjCodeVec& objs, size_t mainIdx) {
             const_map_tables.begin(),
             constant_table_functor(&exec_const_pool));
 
-  // calculate total # of instructions
-  size_t n_insts = util::foldl(objs.begin(), objs.end(),
-                               0, inst_sum_functor());
-  // TODO: allocate the entire stream as a contiguous memory array
-  // (not just have the pointers being contiguous)
-  vector<Instruction*> execInsts(n_insts);
-
-  // resolve instructions into one single stream
-  acc = 0;
+  // resolve instructions into one single contiguous stream, constructing
+  // each instruction in place at the offset computed above
+  vector<char> execInsts(n_bytes);
   for (size_t i = 0; i < objs.size(); i++) {
     ResolutionTable resTbl(&const_map_tables[i],
                            &class_map_tables[i],
-                           &func_map_tables[i]);
-    ObjectCode::IStream& insts = objs[i]->getInstructions();
-    transform(insts.begin(), insts.end(), execInsts.begin() + acc,
-              inst_resolver_functor(&resTbl));
-    acc += insts.size();
+                           &func_map_tables[i],
+                           &inst_offset_tables[i],
+                           &inline_cache_tables[i]);
+    size_t n_insts = objs[i]->getInstructions().size();
+    ResolutionTable::InstOffsetTbl& offsets = inst_offset_tables[i];
+    for (size_t pos = 0; pos < n_insts; pos++) {
+      if (offsets[pos + 1] == offsets[pos]) continue; // fused away
+      Instruction* inst ATTRIBUTE_UNUSED =
+        fusers[i].resolve(&execInsts[offsets[pos]], pos, resTbl);
+      assert(inst->getWidth() == offsets[pos + 1] - offsets[pos]);
+    }
   }
 
-  // grab main address out
+  // grab main function out
   ObjectCode::NameOffsetMap::iterator it =
     objs[mainIdx]->getNameOffsetMap().find("<main>");
   assert(it != objs[mainIdx]->getNameOffsetMap().end());
+  FunctionDescriptor* mainFunc = NULL;
+  vector<FunctionSignature>& mainFuncPool = objs[mainIdx]->getFuncPool();
+  for (size_t i = 0; i < mainFuncPool.size(); i++) {
+    if (mainFuncPool[i].codeOffset == it->second) {
+      mainFunc = localFuncDescriptors[mainIdx][i];
+      break;
+    }
+  }
+  assert(mainFunc);
 
   return new Executable(
         exec_const_pool.vec,
         Executable::IStream::BuildFrom(execInsts),
-        it->second,
+        mainFunc,
         util::flatten_vec(localFuncDescriptors),
-        util::flatten_vec(localClassObjs));
+        util::flatten_vec(localClassObjs),
+        inline_caches);
 }
 
 }
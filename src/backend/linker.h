@@ -30,11 +30,13 @@
 #ifndef VENOM_BACKEND_LINKER_H
 #define VENOM_BACKEND_LINKER_H
 
+#include <iostream>
 #include <string>
 #include <vector>
 
 #include <backend/bytecode.h>
 #include <backend/codegenerator.h>
+#include <backend/jit.h>
 #include <backend/symbolicbytecode.h>
 
 #include <runtime/venomobject.h>
@@ -48,6 +50,7 @@ namespace backend {
 
 /** Forward decl */
 class FunctionDescriptor;
+class InlineCache;
 
 // TODO: labels are going to have to go, when we want to
 // serialize an ObjectCode
@@ -142,6 +145,7 @@ public:
 };
 
 class Executable {
+  friend class CppEmitter;
   friend class ExecutionContext;
   friend class FunctionDescriptor;
   friend class Instruction;
@@ -149,40 +153,70 @@ public:
   typedef std::vector<ExecConstant> ConstPool;
   typedef std::vector<FunctionDescriptor*> FuncDescVec;
   typedef std::vector<runtime::venom_class_object*> ClassObjVec;
+  typedef std::vector<InlineCache*> InlineCacheVec;
 
-  typedef util::SizedArray<Instruction*> IStream;
+  /** Instructions encoded back to back in one contiguous buffer (see
+   * Instruction). Offsets into the stream are in bytes. */
+  typedef util::SizedArray<char> IStream;
 
-  Executable( /** Args for execution - takes ownership of instructions */
+  Executable( /** Args for execution */
              const ConstPool& constant_pool,
              const IStream& instructions,
-             uint64_t mainOffset,
+             FunctionDescriptor* mainFunc,
 
              /* Args for mem mgnt- takes ownership of these pointers */
              const FuncDescVec& user_func_descs,
-             const ClassObjVec& user_class_objs) :
+             const ClassObjVec& user_class_objs,
+             const InlineCacheVec& inline_caches) :
     constant_pool(constant_pool),
     instructions(instructions),
-    mainOffset(mainOffset),
+    mainFunc(mainFunc),
     user_func_descs(user_func_descs),
-    user_class_objs(user_class_objs) {
-    assert(mainOffset < instructions.size());
+    user_class_objs(user_class_objs),
+    inline_caches(inline_caches),
+    jit(NULL) {
+    assert(mainFunc);
+    link();
   }
 
   ~Executable();
 
-  inline Instruction** startingInst() {
-    return instructions.begin() + mainOffset;
+  inline FunctionDescriptor* getMainFunc() { return mainFunc; }
+
+  Instruction* startingInst();
+
+  inline Instruction* instructionAt(uint64_t offset) {
+    assert(offset < instructions.size());
+    return reinterpret_cast<Instruction*>(instructions.begin() + offset);
   }
 
+  /** Prints the hit and miss counts of the inline cache of each
+   * CALL_VIRTUAL call site */
+  void printInlineCacheStats(std::ostream& o) const;
+
+  /** Compiles the functions of this executable with a Jit, either right
+   * away (Eager) or once each gets hot (On) */
+  void enableJit(Jit::Mode mode);
+
+  /** NULL unless enableJit() was called */
+  inline Jit* getJit() { return jit; }
+
 protected:
+  /** Resolves the calls of the stream against this executable, before any
+   * context runs it (see Instruction::link()) */
+  void link();
+
   /** un-initialized constant pool (only holds the data) */
   ConstPool constant_pool;
 
   IStream instructions;
-  uint64_t mainOffset; // where is <main> located, offset in the istream
+  FunctionDescriptor* mainFunc; // <main> of the main module
 
   FuncDescVec user_func_descs;
   ClassObjVec user_class_objs;
+  InlineCacheVec inline_caches;
+
+  Jit* jit;
 };
 
 class LinkerException : public std::runtime_error {
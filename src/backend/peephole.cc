@@ -0,0 +1,305 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cassert>
+#include <map>
+
+#include <backend/codegenerator.h>
+#include <backend/peephole.h>
+#include <backend/symbolicbytecode.h>
+
+#include <util/macros.h>
+
+using namespace std;
+
+namespace venom {
+namespace backend {
+
+static inline SInstLabel* AsLabelInst(SymbolicInstruction* inst) {
+  VENOM_ASSERT_TYPEOF_PTR(SInstLabel, inst);
+  return static_cast<SInstLabel*>(inst);
+}
+
+static inline uint32_t U32Value(SymbolicInstruction* inst) {
+  VENOM_ASSERT_TYPEOF_PTR(SInstU32, inst);
+  return static_cast<SInstU32*>(inst)->getValue();
+}
+
+void PeepholeOptimizer::optimize() {
+  sizesBefore = functionSizes();
+  while (true) {
+    vector<bool> dead(cg->instructions.size(), false);
+    bool changed = threadJumps(dead);
+    findEntries(dead);
+    changed = removeUnreachable(dead) || changed;
+    changed = removeDeadPushes(dead) || changed;
+    changed = forwardStores(dead) || changed;
+    if (!changed) break;
+    compact(dead);
+  }
+  sizesAfter = functionSizes();
+}
+
+void PeepholeOptimizer::printStats(ostream& o) const {
+  assert(sizesBefore.size() == sizesAfter.size());
+  o << "; peephole optimizer: instructions per function (before -> after)"
+    << endl;
+  size_t totalBefore = 0, totalAfter = 0;
+  for (size_t i = 0; i < sizesBefore.size(); i++) {
+    o << ";   " << sizesBefore[i].first << ": " << sizesBefore[i].second
+      << " -> " << sizesAfter[i].second << endl;
+    totalBefore += sizesBefore[i].second;
+    totalAfter += sizesAfter[i].second;
+  }
+  o << "; total: " << totalBefore << " -> " << totalAfter << endl;
+}
+
+bool PeepholeOptimizer::threadJumps(vector<bool>& dead) {
+  vector<SymbolicInstruction*>& insts = cg->instructions;
+  bool changed = false;
+  for (size_t pos = 0; pos < insts.size(); pos++) {
+    if (!Instruction::IsJump(insts[pos]->getOpcode())) continue;
+    SInstLabel* inst = AsLabelInst(insts[pos]);
+
+    // follow the chain of JUMPs. the number of hops is bounded, since the
+    // chain can loop back on itself
+    Label* target = inst->value;
+    for (size_t hops = 0; hops < insts.size(); hops++) {
+      assert(target->isBound());
+      size_t t = target->index;
+      if (t >= insts.size() || t == pos ||
+          insts[t]->getOpcode() != Instruction::JUMP) break;
+      Label* next = AsLabelInst(insts[t])->value;
+      if (next == target) break;
+      target = next;
+    }
+    if (target != inst->value) {
+      inst->value = target;
+      changed = true;
+    }
+
+    if (inst->getOpcode() == Instruction::JUMP &&
+        size_t(target->index) == pos + 1) {
+      dead[pos] = true;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void PeepholeOptimizer::findEntries(const vector<bool>& dead) {
+  vector<SymbolicInstruction*>& insts = cg->instructions;
+  starts.clear();
+  entries.assign(insts.size() + 1, false);
+
+  // anything before the first function is treated as a function of its own
+  starts.push_back(0);
+  for (CodeGenerator::InstLabelSymbolPairMap::iterator it =
+         cg->instToFuncLabels.begin();
+       it != cg->instToFuncLabels.end(); ++it) {
+    if (it->first != 0) starts.push_back(it->first);
+  }
+  starts.push_back(insts.size());
+  for (size_t i = 0; i < starts.size(); i++) entries[starts[i]] = true;
+
+  for (size_t pos = 0; pos < insts.size(); pos++) {
+    if (dead[pos] || !Instruction::IsJump(insts[pos]->getOpcode())) continue;
+    Label* label = AsLabelInst(insts[pos])->value;
+    VENOM_CHECK_RANGE(size_t(label->index), entries.size());
+    entries[label->index] = true;
+  }
+}
+
+bool PeepholeOptimizer::removeUnreachable(vector<bool>& dead) {
+  vector<SymbolicInstruction*>& insts = cg->instructions;
+  vector<bool> reached(insts.size(), false);
+  bool changed = false;
+  for (size_t f = 0; f + 1 < starts.size(); f++) {
+    const size_t end = starts[f + 1];
+    vector<size_t> worklist;
+    worklist.push_back(starts[f]);
+    while (!worklist.empty()) {
+      size_t pos = worklist.back();
+      worklist.pop_back();
+      if (pos >= end || reached[pos]) continue;
+      reached[pos] = true;
+
+      Instruction::Opcode opcode = insts[pos]->getOpcode();
+      // a JUMP which is already being removed just falls through
+      if (!dead[pos] && Instruction::IsJump(opcode)) {
+        worklist.push_back(AsLabelInst(insts[pos])->value->index);
+      }
+      if (dead[pos] || !Instruction::IsTerminator(opcode)) {
+        worklist.push_back(pos + 1);
+      }
+    }
+    for (size_t pos = starts[f]; pos < end; pos++) {
+      if (!reached[pos] && !dead[pos]) {
+        dead[pos] = true;
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+bool PeepholeOptimizer::removeDeadPushes(vector<bool>& dead) {
+  vector<SymbolicInstruction*>& insts = cg->instructions;
+  bool changed = false;
+  for (size_t pos = 0; pos + 1 < insts.size(); pos++) {
+    if (dead[pos] || dead[pos + 1] || entries[pos + 1]) continue;
+    Instruction::Opcode pop = insts[pos + 1]->getOpcode();
+    bool removable = false;
+    switch (insts[pos]->getOpcode()) {
+    case Instruction::PUSH_CELL_INT:
+    case Instruction::PUSH_CELL_FLOAT:
+    case Instruction::PUSH_CELL_BOOL:
+    case Instruction::LOAD_LOCAL_VAR:
+      removable = pop == Instruction::POP_CELL;
+      break;
+    case Instruction::PUSH_CELL_NIL:
+      removable =
+        pop == Instruction::POP_CELL || pop == Instruction::POP_CELL_REF;
+      break;
+    case Instruction::PUSH_CONST:
+    case Instruction::LOAD_LOCAL_VAR_REF:
+      // the constant pool (or the local) still holds a reference, so the
+      // decRef of the pop cannot free anything
+      removable = pop == Instruction::POP_CELL_REF;
+      break;
+    default: break;
+    }
+    if (removable) {
+      dead[pos] = dead[pos + 1] = true;
+      changed = true;
+      pos++;
+    }
+  }
+  return changed;
+}
+
+bool PeepholeOptimizer::forwardStores(vector<bool>& dead) {
+  vector<SymbolicInstruction*>& insts = cg->instructions;
+  bool changed = false;
+  for (size_t f = 0; f + 1 < starts.size(); f++) {
+    const size_t start = starts[f], end = starts[f + 1];
+
+    // how many times each local slot is loaded in this function
+    map<uint32_t, size_t> loads;
+    for (size_t pos = start; pos < end; pos++) {
+      Instruction::Opcode opcode = insts[pos]->getOpcode();
+      if (!dead[pos] && (opcode == Instruction::LOAD_LOCAL_VAR ||
+                         opcode == Instruction::LOAD_LOCAL_VAR_REF)) {
+        loads[U32Value(insts[pos])]++;
+      }
+    }
+
+    for (size_t pos = start; pos + 1 < end; pos++) {
+      if (dead[pos] || dead[pos + 1] || entries[pos + 1]) continue;
+      Instruction::Opcode store = insts[pos]->getOpcode();
+      Instruction::Opcode load = insts[pos + 1]->getOpcode();
+      if (!(store == Instruction::STORE_LOCAL_VAR &&
+            load == Instruction::LOAD_LOCAL_VAR) &&
+          !(store == Instruction::STORE_LOCAL_VAR_REF &&
+            load == Instruction::LOAD_LOCAL_VAR_REF)) continue;
+      uint32_t slot = U32Value(insts[pos]);
+      if (U32Value(insts[pos + 1]) != slot || loads[slot] != 1) continue;
+      // the value is only ever read back right away, so leave it on the
+      // stack. for a reference this also saves an incRef, since the stack
+      // takes over the reference the slot would have held
+      dead[pos] = dead[pos + 1] = true;
+      changed = true;
+      pos++;
+    }
+  }
+  return changed;
+}
+
+void PeepholeOptimizer::compact(const vector<bool>& dead) {
+  vector<SymbolicInstruction*>& insts = cg->instructions;
+
+  // the new position of each instruction (plus one past the end). a removed
+  // instruction maps to the instruction after it
+  vector<size_t> newIndex(insts.size() + 1);
+  vector<SymbolicInstruction*> kept;
+  kept.reserve(insts.size());
+  for (size_t pos = 0; pos < insts.size(); pos++) {
+    newIndex[pos] = kept.size();
+    if (dead[pos]) delete insts[pos];
+    else kept.push_back(insts[pos]);
+  }
+  newIndex[insts.size()] = kept.size();
+  insts.swap(kept);
+
+  for (vector<Label*>::iterator it = cg->labels.begin();
+       it != cg->labels.end(); ++it) {
+    if (!(*it)->isBound()) continue;
+    VENOM_CHECK_RANGE(size_t((*it)->index), newIndex.size());
+    (*it)->index = newIndex[(*it)->index];
+  }
+
+  CodeGenerator::InstLabelMap instToLabels;
+  for (CodeGenerator::InstLabelMap::iterator it = cg->instToLabels.begin();
+       it != cg->instToLabels.end(); ++it) {
+    instToLabels[it->second->index] = it->second;
+  }
+  cg->instToLabels.swap(instToLabels);
+
+  CodeGenerator::InstLabelSymbolPairMap instToFuncLabels;
+  for (CodeGenerator::InstLabelSymbolPairMap::iterator it =
+         cg->instToFuncLabels.begin();
+       it != cg->instToFuncLabels.end(); ++it) {
+    // the start of a function is always reached, and the code reached from
+    // it ends in a RET or TAIL_CALL, which is never removed. so functions
+    // cannot end up on top of each other
+    assert(instToFuncLabels.find(it->second.first->index) ==
+           instToFuncLabels.end());
+    instToFuncLabels[it->second.first->index] = it->second;
+  }
+  cg->instToFuncLabels.swap(instToFuncLabels);
+}
+
+PeepholeOptimizer::SizeVec PeepholeOptimizer::functionSizes() const {
+  SizeVec ret;
+  for (CodeGenerator::InstLabelSymbolPairMap::const_iterator it =
+         cg->instToFuncLabels.begin();
+       it != cg->instToFuncLabels.end(); ++it) {
+    CodeGenerator::InstLabelSymbolPairMap::const_iterator next = it;
+    ++next;
+    size_t end = next == cg->instToFuncLabels.end() ?
+      cg->instructions.size() : next->first;
+    ret.push_back(
+        make_pair(CodeGenerator::FunctionName(it->second.second),
+                  end - it->first));
+  }
+  return ret;
+}
+
+}
+}
@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_BACKEND_PEEPHOLE_H
+#define VENOM_BACKEND_PEEPHOLE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace venom {
+namespace backend {
+
+/** Forward decl */
+class CodeGenerator;
+
+/**
+ * PeepholeOptimizer cleans up the instruction stream of a CodeGenerator,
+ * which is emitted naively from the AST, before the object code is created.
+ * It applies the following rules until none of them changes anything:
+ *
+ *   - jumps (and branches) to a JUMP go straight to its target, and a JUMP
+ *     to the very next instruction is removed
+ *   - instructions which cannot be reached from the start of their function
+ *     (usually code after a RET or JUMP) are removed
+ *   - a push followed by a pop (PUSH_CELL_*, PUSH_CONST or LOAD_LOCAL_VAR*
+ *     then POP_CELL*) is removed
+ *   - STORE_LOCAL_VAR t; LOAD_LOCAL_VAR t (or the _REF pair) is removed,
+ *     when nothing else in the function loads t. This is how temporaries
+ *     (and arguments) which are used right away get forwarded on the stack
+ *
+ * The second instruction of a pair is never removed if it is the target of
+ * a jump, since the stack could hold something else when jumped to. Labels
+ * on removed instructions move to the next instruction left.
+ */
+class PeepholeOptimizer {
+public:
+  /** Does NOT take ownership of cg */
+  PeepholeOptimizer(CodeGenerator* cg) : cg(cg) {}
+
+  void optimize();
+
+  /** Prints the number of instructions in each function, before and after
+   * optimize() */
+  void printStats(std::ostream& o) const;
+
+private:
+  /** Each rule marks the instructions it removes in dead, and returns true if
+   * it changed anything */
+  bool threadJumps(std::vector<bool>& dead);
+  bool removeUnreachable(std::vector<bool>& dead);
+  bool removeDeadPushes(std::vector<bool>& dead);
+  bool forwardStores(std::vector<bool>& dead);
+
+  /** Finds the function starts and jump targets in the instruction stream */
+  void findEntries(const std::vector<bool>& dead);
+
+  /** Deletes the dead instructions, and moves the labels to match */
+  void compact(const std::vector<bool>& dead);
+
+  /** The name and number of instructions of each function, in order */
+  typedef std::vector<std::pair<std::string, size_t> > SizeVec;
+  SizeVec functionSizes() const;
+
+  CodeGenerator* cg;
+
+  /** The start of each function, in order, followed by the end of the
+   * stream */
+  std::vector<size_t> starts;
+
+  /** Instructions which control can reach other than by falling through */
+  std::vector<bool> entries;
+
+  SizeVec sizesBefore;
+  SizeVec sizesAfter;
+};
+
+}
+}
+
+#endif /* VENOM_BACKEND_PEEPHOLE_H */
@@ -0,0 +1,228 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cassert>
+#include <map>
+
+#include <analysis/symbol.h>
+
+#include <backend/codegenerator.h>
+#include <backend/refelider.h>
+#include <backend/symbolicbytecode.h>
+
+#include <util/macros.h>
+
+using namespace std;
+using namespace venom::analysis;
+
+namespace venom {
+namespace backend {
+
+static inline uint32_t U32Value(SymbolicInstruction* inst) {
+  VENOM_ASSERT_TYPEOF_PTR(SInstU32, inst);
+  return static_cast<SInstU32*>(inst)->getValue();
+}
+
+/** The variant of opcode which borrows its reference */
+static Instruction::Opcode Borrowed(Instruction::Opcode opcode) {
+  switch (opcode) {
+  case Instruction::PUSH_CONST:
+    return Instruction::PUSH_CONST_BORROW;
+  case Instruction::LOAD_LOCAL_VAR_REF:
+    return Instruction::LOAD_LOCAL_VAR_BORROW;
+  case Instruction::STORE_LOCAL_VAR_REF:
+    return Instruction::STORE_LOCAL_VAR_REF_BORROW;
+  case Instruction::GET_FIELD_OFF:
+    return Instruction::GET_FIELD_OFF_BORROW;
+  case Instruction::GET_FIELD_OFF_REF:
+    return Instruction::GET_FIELD_OFF_REF_BORROW;
+  case Instruction::SET_FIELD_OFF:
+    return Instruction::SET_FIELD_OFF_BORROW;
+  case Instruction::SET_FIELD_OFF_REF:
+    return Instruction::SET_FIELD_OFF_REF_BORROW;
+  default: assert(false);
+  }
+  VENOM_NOT_REACHED;
+}
+
+/** A cell on the abstract operand stack which was not pushed by
+ * PUSH_CONST or LOAD_LOCAL_VAR_REF in the current block */
+static const size_t NotTracked = size_t(-1);
+
+void RefCountElider::optimize() {
+  vector<SymbolicInstruction*>& insts = cg->instructions;
+
+  numArgs.assign(cg->func_reference_table.vec.size(), 0);
+  for (CodeGenerator::container_table<FuncSymbol*>::map_type::iterator it =
+         cg->func_reference_table.map.begin();
+       it != cg->func_reference_table.map.end(); ++it) {
+    VENOM_CHECK_RANGE(it->second, numArgs.size());
+    numArgs[it->second] =
+      it->first->getParams().size() + (it->first->isMethod() ? 1 : 0);
+  }
+
+  // a basic block starts at the start of each function, and at each jump
+  // target
+  vector<bool> entries(insts.size() + 1, false);
+  for (CodeGenerator::InstLabelSymbolPairMap::iterator it =
+         cg->instToFuncLabels.begin();
+       it != cg->instToFuncLabels.end(); ++it) {
+    entries[it->first] = true;
+  }
+  for (size_t pos = 0; pos < insts.size(); pos++) {
+    if (!Instruction::IsJump(insts[pos]->getOpcode())) continue;
+    VENOM_ASSERT_TYPEOF_PTR(SInstLabel, insts[pos]);
+    Label* label = static_cast<SInstLabel*>(insts[pos])->getValue();
+    VENOM_CHECK_RANGE(size_t(label->getIndex()), entries.size());
+    entries[label->getIndex()] = true;
+  }
+
+  // the position of the instruction which pushed each cell on the stack
+  // (top last), or NotTracked. cells pushed before the block are left out
+  vector<size_t> stack;
+
+  // (producer, consumer) pairs to rewrite
+  vector< pair<size_t, size_t> > borrows;
+
+  for (size_t pos = 0; pos < insts.size(); pos++) {
+    if (entries[pos]) stack.clear();
+    SymbolicInstruction* inst = insts[pos];
+    Instruction::Opcode opcode = inst->getOpcode();
+
+    // the operand (counting down from the top of the stack) which the
+    // instruction only looks at, if any
+    size_t borrower = NotTracked;
+    switch (opcode) {
+    case Instruction::PUSH_CONST:
+    case Instruction::LOAD_LOCAL_VAR_REF:
+      numReferences++;
+      break;
+    case Instruction::GET_FIELD_OFF:
+    case Instruction::GET_FIELD_OFF_REF:
+      borrower = 0;
+      break;
+    case Instruction::SET_FIELD_OFF:
+    case Instruction::SET_FIELD_OFF_REF:
+      borrower = 1;
+      break;
+    case Instruction::STORE_LOCAL_VAR_REF: {
+      // the slot lets go of its object, so loads of it can no longer be
+      // borrowed. a reference moved into the slot from another slot or the
+      // constant pool can
+      borrower = 0;
+      uint32_t slot = U32Value(inst);
+      for (vector<size_t>::iterator it = stack.begin();
+           it != stack.end(); ++it) {
+        if (*it != NotTracked &&
+            insts[*it]->getOpcode() == Instruction::LOAD_LOCAL_VAR_REF &&
+            U32Value(insts[*it]) == slot) *it = NotTracked;
+      }
+      break;
+    }
+    default: break;
+    }
+    if (borrower < stack.size() &&
+        stack[stack.size() - 1 - borrower] != NotTracked) {
+      borrows.push_back(
+          make_pair(stack[stack.size() - 1 - borrower], pos));
+    }
+
+    size_t pops, pushes;
+    stackEffect(inst, pops, pushes);
+    stack.resize(pops < stack.size() ? stack.size() - pops : 0);
+    if (opcode == Instruction::PUSH_CONST ||
+        opcode == Instruction::LOAD_LOCAL_VAR_REF) {
+      assert(pushes == 1);
+      stack.push_back(pos);
+    } else {
+      stack.insert(stack.end(), pushes, NotTracked);
+    }
+
+    // whatever is left on the stack may be consumed on another path
+    if (Instruction::IsJump(opcode) || Instruction::IsTerminator(opcode)) {
+      stack.clear();
+    }
+  }
+
+  for (vector< pair<size_t, size_t> >::iterator it = borrows.begin();
+       it != borrows.end(); ++it) {
+    insts[it->first]->opcode = Borrowed(insts[it->first]->opcode);
+    insts[it->second]->opcode = Borrowed(insts[it->second]->opcode);
+  }
+  numBorrowed = borrows.size();
+}
+
+void RefCountElider::printStats(ostream& o) const {
+  o << "; ref count elision: " << numBorrowed << " of " << numReferences
+    << " references borrowed" << endl;
+}
+
+void RefCountElider::stackEffect(SymbolicInstruction* inst,
+                                 size_t& pops, size_t& pushes) const {
+  Instruction::Opcode opcode = inst->getOpcode();
+  pops = Instruction::NumOperands(opcode);
+  pushes = 1;
+  switch (opcode) {
+  case Instruction::CALL:
+  case Instruction::CALL_NATIVE:
+  case Instruction::TAIL_CALL:
+    VENOM_CHECK_RANGE(size_t(U32Value(inst)), numArgs.size());
+    pops = numArgs[U32Value(inst)];
+    if (opcode == Instruction::TAIL_CALL) pushes = 0;
+    break;
+  case Instruction::CALL_VIRTUAL:
+  case Instruction::TAIL_CALL_VIRTUAL:
+    VENOM_ASSERT_TYPEOF_PTR(SInstCallVirtual, inst);
+    pops = 1 + static_cast<SInstCallVirtual*>(inst)->getNumArgs();
+    break;
+  case Instruction::DUP:
+  case Instruction::DUP_REF:
+    pushes = U32Value(inst) + 1;
+    break;
+  case Instruction::RET:
+  case Instruction::STORE_LOCAL_VAR:
+  case Instruction::STORE_LOCAL_VAR_REF:
+  case Instruction::POP_CELL:
+  case Instruction::POP_CELL_REF:
+  case Instruction::SET_FIELD_OFF:
+  case Instruction::SET_FIELD_OFF_REF:
+  case Instruction::SET_ARRAY_ACCESS:
+  case Instruction::SET_ARRAY_ACCESS_REF:
+  case Instruction::SET_ARRAY_ACCESS_UNCHECKED:
+  case Instruction::SET_ARRAY_ACCESS_REF_UNCHECKED:
+    pushes = 0;
+    break;
+  default:
+    if (Instruction::IsJump(opcode)) pushes = 0;
+    break;
+  }
+}
+
+}
+}
@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_BACKEND_REFELIDER_H
+#define VENOM_BACKEND_REFELIDER_H
+
+#include <iostream>
+#include <vector>
+
+namespace venom {
+namespace backend {
+
+/** Forward decl */
+class CodeGenerator;
+class SymbolicInstruction;
+
+/**
+ * RefCountElider removes ref counting which cancels out within a basic
+ * block. Every PUSH_CONST and LOAD_LOCAL_VAR_REF incRefs the object it
+ * pushes, and whichever instruction consumes it decRefs it again. When the
+ * consumer only looks at the object (GET_FIELD_OFF[_REF], or the object of
+ * SET_FIELD_OFF[_REF]), and the constant pool or the local is known to hold
+ * on to the object until then, the reference on the stack can be borrowed
+ * instead: both instructions are replaced by their *_BORROW variants, which
+ * do not touch the ref count at all. A STORE_LOCAL_VAR_REF of such a
+ * reference borrows it too, and only counts the reference of its slot
+ * (which it does not when ref counts are deferred, see ExecutionContext).
+ *
+ * Borrows are found by running each basic block over an abstract operand
+ * stack, which records which instruction pushed each cell. The constant pool
+ * holds on to its objects forever, while a local holds on to its object
+ * until the next STORE_LOCAL_VAR_REF to its slot. A cell which is still on
+ * the stack at the end of a block (at a jump, or at a jump target) is never
+ * borrowed, since it may be consumed on some other path.
+ *
+ * Debug builds still count the borrowed references, and check that every
+ * borrow was safe (see venom_cell::BeginBorrow()), so the test suite
+ * validates this pass.
+ */
+class RefCountElider {
+public:
+  /** Does NOT take ownership of cg */
+  RefCountElider(CodeGenerator* cg)
+    : cg(cg), numReferences(0), numBorrowed(0) {}
+
+  void optimize();
+
+  /** Prints how many references were borrowed by optimize() */
+  void printStats(std::ostream& o) const;
+
+private:
+  /** The number of cells inst pops off the operand stack, and pushes */
+  void stackEffect(SymbolicInstruction* inst,
+                   size_t& pops, size_t& pushes) const;
+
+  CodeGenerator* cg;
+
+  /** The number of arguments of each function reference, counting the
+   * "this" pointer of methods */
+  std::vector<size_t> numArgs;
+
+  size_t numReferences;
+  size_t numBorrowed;
+};
+
+}
+}
+
+#endif /* VENOM_BACKEND_REFELIDER_H */
@@ -28,6 +28,7 @@
  */
 
 #include <cassert>
+#include <new>
 
 #include <backend/codegenerator.h>
 #include <backend/symbolicbytecode.h>
@@ -39,40 +40,83 @@ using namespace std;
 namespace venom {
 namespace backend {
 
-Instruction* SymbolicInstruction::resolve(size_t pos, ResolutionTable& resTable) {
+size_t SymbolicInstruction::encodedWidth() const {
+  return Instruction::WidthOf<Instruction>();
+}
+
+Instruction* SymbolicInstruction::resolve(
+    char* dest, size_t pos, ResolutionTable& resTable) {
   // TODO: assert that the opcode is valid for this type
-  return new Instruction(opcode);
+  return new (dest) Instruction(opcode);
 }
 
-Instruction* SInstU32::resolve(size_t pos, ResolutionTable& resTable) {
+size_t SInstU32::encodedWidth() const {
+  switch (opcode) {
+  case Instruction::CALL:
+  case Instruction::TAIL_CALL:
+    return Instruction::WidthOf<InstFormatCall>();
+  case Instruction::ALLOC_OBJ:
+  case Instruction::CALL_NATIVE:
+  case Instruction::CALL_VIRTUAL:
+  case Instruction::TAIL_CALL_VIRTUAL:
+    return Instruction::WidthOf<InstFormatIPtr>();
+  default:
+    return Instruction::WidthOf<InstFormatU32>();
+  }
+}
+
+Instruction* SInstU32::resolve(
+    char* dest, size_t pos, ResolutionTable& resTable) {
   switch (opcode) {
   case Instruction::PUSH_CONST:
-    return new InstFormatU32(opcode, resTable.getConstantTable()[value]);
+  case Instruction::PUSH_CONST_BORROW:
+    return new (dest)
+      InstFormatU32(opcode, resTable.getConstantTable()[value]);
   case Instruction::ALLOC_OBJ:
-    return new InstFormatIPtr(opcode,
-                              intptr_t(resTable.getClassRefTable()[value]));
+    return new (dest) InstFormatIPtr(opcode,
+        intptr_t(resTable.getClassRefTable()[value]));
   case Instruction::CALL:
+  case Instruction::TAIL_CALL:
+    return new (dest) InstFormatCall(opcode,
+        intptr_t(resTable.getFuncRefTable()[value]));
   case Instruction::CALL_NATIVE:
-    return new InstFormatIPtr(opcode,
-                              intptr_t(resTable.getFuncRefTable()[value]));
+    return new (dest) InstFormatIPtr(opcode,
+        intptr_t(resTable.getFuncRefTable()[value]));
   case Instruction::CALL_VIRTUAL:
+  case Instruction::TAIL_CALL_VIRTUAL:
+    assert(resTable.getInlineCacheTable()[pos]);
+    return new (dest) InstFormatIPtr(opcode,
+        intptr_t(resTable.getInlineCacheTable()[pos]));
   case Instruction::LOAD_LOCAL_VAR:
   case Instruction::LOAD_LOCAL_VAR_REF:
+  case Instruction::LOAD_LOCAL_VAR_BORROW:
   case Instruction::STORE_LOCAL_VAR:
   case Instruction::STORE_LOCAL_VAR_REF:
-  case Instruction::GET_ATTR_OBJ:
-  case Instruction::GET_ATTR_OBJ_REF:
-  case Instruction::SET_ATTR_OBJ:
-  case Instruction::SET_ATTR_OBJ_REF:
+  case Instruction::STORE_LOCAL_VAR_REF_BORROW:
   case Instruction::DUP:
   case Instruction::DUP_REF:
-    return new InstFormatU32(opcode, value);
+    return new (dest) InstFormatU32(opcode, value);
+  case Instruction::GET_FIELD_OFF:
+  case Instruction::GET_FIELD_OFF_REF:
+  case Instruction::SET_FIELD_OFF:
+  case Instruction::SET_FIELD_OFF_REF:
+  case Instruction::GET_FIELD_OFF_BORROW:
+  case Instruction::GET_FIELD_OFF_REF_BORROW:
+  case Instruction::SET_FIELD_OFF_BORROW:
+  case Instruction::SET_FIELD_OFF_REF_BORROW:
+    return new (dest) InstFormatU32(opcode,
+        runtime::venom_object::UserCellOffset(value));
   default: assert(false);
   }
   VENOM_NOT_REACHED;
 }
 
-Instruction* SInstLabel::resolve(size_t pos, ResolutionTable& resTable) {
+size_t SInstLabel::encodedWidth() const {
+  return Instruction::WidthOf<InstFormatI32>();
+}
+
+Instruction* SInstLabel::resolve(
+    char* dest, size_t pos, ResolutionTable& resTable) {
   switch (opcode) {
   case Instruction::JUMP:
   case Instruction::BRANCH_Z_INT:
@@ -82,26 +126,52 @@ Instruction* SInstLabel::resolve(size_t pos, ResolutionTable& resTable) {
   case Instruction::BRANCH_NZ_INT:
   case Instruction::BRANCH_NZ_FLOAT:
   case Instruction::BRANCH_NZ_BOOL:
-  case Instruction::BRANCH_NZ_REF:
-    return new InstFormatI32(opcode, value->calcOffset(pos) - 1);
+  case Instruction::BRANCH_NZ_REF: {
+    // jump offsets are in bytes, relative to this instruction
+    ResolutionTable::InstOffsetTbl& offsets = resTable.getInstOffsetTable();
+    assert(value->isBound());
+    VENOM_CHECK_RANGE(size_t(value->getIndex()), offsets.size());
+    return new (dest) InstFormatI32(opcode,
+        int64_t(offsets[value->getIndex()]) - int64_t(offsets[pos]));
+  }
   default: assert(false);
   }
   VENOM_NOT_REACHED;
 }
 
-Instruction* SInstI64::resolve(size_t pos, ResolutionTable& resTable) {
+size_t SInstI64::encodedWidth() const {
+  return Instruction::WidthOf<InstFormatC>();
+}
+
+Instruction* SInstI64::resolve(
+    char* dest, size_t pos, ResolutionTable& resTable) {
   assert(opcode == Instruction::PUSH_CELL_INT);
-  return new InstFormatC(opcode, value);
+  return new (dest) InstFormatC(opcode, value);
+}
+
+size_t SInstDouble::encodedWidth() const {
+  return Instruction::WidthOf<InstFormatC>();
 }
 
-Instruction* SInstDouble::resolve(size_t pos, ResolutionTable& resTable) {
+Instruction* SInstDouble::resolve(
+    char* dest, size_t pos, ResolutionTable& resTable) {
   assert(opcode == Instruction::PUSH_CELL_FLOAT);
-  return new InstFormatC(opcode, value);
+  return new (dest) InstFormatC(opcode, value);
+}
+
+size_t SInstBool::encodedWidth() const {
+  return Instruction::WidthOf<InstFormatC>();
 }
 
-Instruction* SInstBool::resolve(size_t pos, ResolutionTable& resTable) {
+Instruction* SInstBool::resolve(
+    char* dest, size_t pos, ResolutionTable& resTable) {
   assert(opcode == Instruction::PUSH_CELL_BOOL);
-  return new InstFormatC(opcode, value);
+  return new (dest) InstFormatC(opcode, value);
+}
+
+void SInstCallVirtual::printDebug(ostream& o) {
+  o << Instruction::stringify(opcode) << " " << value
+    << " (" << numArgs << " args)" << endl;
 }
 
 void SInstLabel::printDebug(ostream& o) {
@@ -43,20 +43,27 @@ namespace backend {
 /** Forward decl */
 class Label;
 class FunctionDescriptor;
+class InlineCache;
 
 class ResolutionTable {
 public:
   typedef std::vector<size_t> ConstTbl;
   typedef std::vector<runtime::venom_class_object*> ClassRefTbl;
   typedef std::vector<FunctionDescriptor*> FuncRefTbl;
+  typedef std::vector<size_t> InstOffsetTbl;
+  typedef std::vector<InlineCache*> InlineCacheTbl;
 
   /** Does NOT take ownership of arguments */
   ResolutionTable(ConstTbl* constant_table,
                   ClassRefTbl* class_ref_table,
-                  FuncRefTbl* func_ref_table) :
+                  FuncRefTbl* func_ref_table,
+                  InstOffsetTbl* inst_offset_table,
+                  InlineCacheTbl* inline_cache_table) :
     constant_table(constant_table),
     class_ref_table(class_ref_table),
-    func_ref_table(func_ref_table) {}
+    func_ref_table(func_ref_table),
+    inst_offset_table(inst_offset_table),
+    inline_cache_table(inline_cache_table) {}
 
   inline ConstTbl& getConstantTable() { return *constant_table; }
   inline const ConstTbl& getConstantTable() const { return *constant_table; }
@@ -69,10 +76,26 @@ public:
   inline FuncRefTbl& getFuncRefTable() { return *func_ref_table; }
   inline const FuncRefTbl& getFuncRefTable() const { return *func_ref_table; }
 
+  /** Maps the position of each symbolic instruction (plus one past the end)
+   * to the byte offset of its encoding in the instruction stream */
+  inline InstOffsetTbl& getInstOffsetTable() { return *inst_offset_table; }
+  inline const InstOffsetTbl& getInstOffsetTable() const {
+    return *inst_offset_table;
+  }
+
+  /** Maps the position of each CALL_VIRTUAL instruction to the inline cache
+   * of the call site (and every other position to NULL) */
+  inline InlineCacheTbl& getInlineCacheTable() { return *inline_cache_table; }
+  inline const InlineCacheTbl& getInlineCacheTable() const {
+    return *inline_cache_table;
+  }
+
 private:
   ConstTbl* constant_table;
   ClassRefTbl* class_ref_table;
   FuncRefTbl* func_ref_table;
+  InstOffsetTbl* inst_offset_table;
+  InlineCacheTbl* inline_cache_table;
 };
 
 /**
@@ -83,15 +106,28 @@ private:
  * In order to be executable, multiple streams (files) of
  * SymbolicInstructions must be linked together to produce
  * an Instruction stream.
+ *
+ * The linker first asks each instruction for its encodedWidth() to lay out
+ * the stream, and then has each instruction resolve() itself in place.
  */
 class SymbolicInstruction {
   friend class CodeGenerator;
+  friend class RefCountElider;
 public:
   typedef Instruction::Opcode Opcode;
 
   virtual ~SymbolicInstruction() {}
 
-  virtual Instruction* resolve(size_t pos, ResolutionTable& resTable);
+  inline Opcode getOpcode() const { return opcode; }
+
+  /** The number of bytes resolve() will write into the instruction stream */
+  virtual size_t encodedWidth() const;
+
+  /** Constructs the executable instruction at dest, which has room for
+   * encodedWidth() bytes. pos is the position of this instruction in its
+   * object code */
+  virtual Instruction* resolve(char* dest, size_t pos,
+                               ResolutionTable& resTable);
 
   /** Debug helper */
   virtual void printDebug(std::ostream& o) {
@@ -111,6 +147,8 @@ protected:
   SInstBase(Opcode opcode, T value) :
     SymbolicInstruction(opcode), value(value) {}
 public:
+  inline T getValue() const { return value; }
+
   virtual void printDebug(std::ostream& o) {
     o << Instruction::stringify(opcode) << " " << value << std::endl;
   }
@@ -124,7 +162,27 @@ protected:
   SInstU32(Opcode opcode, uint32_t value) :
     SInstBase<uint32_t>(opcode, value) {}
 public:
-  virtual Instruction* resolve(size_t pos, ResolutionTable& resTable);
+  virtual size_t encodedWidth() const;
+  virtual Instruction* resolve(char* dest, size_t pos,
+                               ResolutionTable& resTable);
+};
+
+/**
+ * CALL_VIRTUAL (or TAIL_CALL_VIRTUAL), which also remembers how many
+ * arguments (not counting the "this" pointer) the call passes. The callee is
+ * not known until run time, so this is the only way the linker can tell how
+ * the call affects the stack. It is encoded the same as any other SInstU32
+ */
+class SInstCallVirtual : public SInstU32 {
+  friend class CodeGenerator;
+protected:
+  SInstCallVirtual(Opcode opcode, uint32_t slot, uint32_t numArgs) :
+    SInstU32(opcode, slot), numArgs(numArgs) {}
+public:
+  inline uint32_t getNumArgs() const { return numArgs; }
+  virtual void printDebug(std::ostream& o);
+protected:
+  uint32_t numArgs;
 };
 
 //class SInstI32 : public SInstBase<int32_t> {
@@ -133,16 +191,21 @@ public:
 //  SInstI32(Opcode opcode, int32_t value) :
 //    SInstBase<int32_t>(opcode, value) {}
 //public:
-//  virtual Instruction* resolve(size_t pos, ResolutionTable& resTable);
+//  virtual size_t encodedWidth() const;
+//  virtual Instruction* resolve(char* dest, size_t pos,
+//                               ResolutionTable& resTable);
 //};
 
 class SInstLabel : public SInstBase<Label*> {
   friend class CodeGenerator;
+  friend class PeepholeOptimizer;
 protected:
   SInstLabel(Opcode opcode, Label* value) :
     SInstBase<Label*>(opcode, value) {}
 public:
-  virtual Instruction* resolve(size_t pos, ResolutionTable& resTable);
+  virtual size_t encodedWidth() const;
+  virtual Instruction* resolve(char* dest, size_t pos,
+                               ResolutionTable& resTable);
   virtual void printDebug(std::ostream& o);
 };
 
@@ -152,7 +215,9 @@ protected:
   SInstI64(Opcode opcode, int64_t value) :
     SInstBase<int64_t>(opcode, value) {}
 public:
-  virtual Instruction* resolve(size_t pos, ResolutionTable& resTable);
+  virtual size_t encodedWidth() const;
+  virtual Instruction* resolve(char* dest, size_t pos,
+                               ResolutionTable& resTable);
 };
 
 class SInstDouble : public SInstBase<double> {
@@ -161,7 +226,9 @@ protected:
   SInstDouble(Opcode opcode, double value) :
     SInstBase<double>(opcode, value) {}
 public:
-  virtual Instruction* resolve(size_t pos, ResolutionTable& resTable);
+  virtual size_t encodedWidth() const;
+  virtual Instruction* resolve(char* dest, size_t pos,
+                               ResolutionTable& resTable);
 };
 
 class SInstBool : public SInstBase<bool> {
@@ -170,7 +237,9 @@ protected:
   SInstBool(Opcode opcode, bool value) :
     SInstBase<bool>(opcode, value) {}
 public:
-  virtual Instruction* resolve(size_t pos, ResolutionTable& resTable);
+  virtual size_t encodedWidth() const;
+  virtual Instruction* resolve(char* dest, size_t pos,
+                               ResolutionTable& resTable);
 };
 
 }
@@ -0,0 +1,234 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+
+#include <backend/codegenerator.h>
+#include <backend/symbolicbytecode.h>
+#include <backend/verifier.h>
+#include <backend/vm.h>
+
+#include <util/macros.h>
+
+using namespace std;
+
+namespace venom {
+namespace backend {
+
+static void Fail(const string& name, SymbolicInstruction* inst, size_t pos,
+                 const string& msg) {
+  stringstream buf;
+  buf << name << ": " << Instruction::stringify(inst->getOpcode())
+      << " (instruction " << pos << "): " << msg;
+  throw LinkerException(buf.str());
+}
+
+static inline uint32_t U32Value(SymbolicInstruction* inst) {
+  VENOM_ASSERT_TYPEOF_PTR(SInstU32, inst);
+  return static_cast<SInstU32*>(inst)->getValue();
+}
+
+size_t Verifier::verifyFunction(const FunctionSignature& sig, size_t end) {
+  ObjectCode::IStream& insts = obj->getInstructions();
+  const size_t start = sig.codeOffset;
+  const string name = sig.getFullName(obj->getModuleName());
+  if (start >= end || end > insts.size()) {
+    throw LinkerException(name + ": function has no code");
+  }
+
+  // the stack depth before each instruction in the function, or -1 if no
+  // path has reached the instruction yet
+  vector<ssize_t> depths(end - start, -1);
+  vector<size_t> worklist;
+
+  // the caller has pushed the arguments
+  size_t maxDepth = sig.getNumArgs();
+  depths[0] = maxDepth;
+  worklist.push_back(start);
+
+  while (!worklist.empty()) {
+    size_t pos = worklist.back();
+    worklist.pop_back();
+
+    SymbolicInstruction* inst = insts[pos];
+    Instruction::Opcode opcode = inst->getOpcode();
+    size_t depth = depths[pos - start];
+
+    size_t pops = Instruction::NumOperands(opcode);
+    size_t pushes = 1;
+    bool fallsThrough = true;
+    bool jumps = false;
+    int64_t target = 0;
+
+    switch (opcode) {
+    case Instruction::LOAD_LOCAL_VAR:
+    case Instruction::LOAD_LOCAL_VAR_REF:
+    case Instruction::LOAD_LOCAL_VAR_BORROW:
+    case Instruction::STORE_LOCAL_VAR:
+    case Instruction::STORE_LOCAL_VAR_REF:
+    case Instruction::STORE_LOCAL_VAR_REF_BORROW: {
+      uint32_t slot = U32Value(inst);
+      if (slot >= sig.numLocals) {
+        Fail(name, inst, pos, "local slot out of range");
+      }
+      bool isRef = binary_search(
+          sig.refLocals.begin(), sig.refLocals.end(), slot);
+      if ((opcode == Instruction::STORE_LOCAL_VAR && isRef) ||
+          ((opcode == Instruction::LOAD_LOCAL_VAR_REF ||
+            opcode == Instruction::LOAD_LOCAL_VAR_BORROW) && !isRef)) {
+        Fail(name, inst, pos, "local slot is not consistently a reference");
+      }
+      if (opcode == Instruction::STORE_LOCAL_VAR ||
+          opcode == Instruction::STORE_LOCAL_VAR_REF ||
+          opcode == Instruction::STORE_LOCAL_VAR_REF_BORROW) pushes = 0;
+      break;
+    }
+
+    case Instruction::CALL:
+    case Instruction::CALL_NATIVE: {
+      uint32_t ref = U32Value(inst);
+      if (ref >= funcRefTable.size()) {
+        Fail(name, inst, pos, "function ref out of range");
+      }
+      pops = funcRefTable[ref]->getNumArgs();
+      break;
+    }
+
+    case Instruction::TAIL_CALL: {
+      uint32_t ref = U32Value(inst);
+      if (ref >= funcRefTable.size()) {
+        Fail(name, inst, pos, "function ref out of range");
+      }
+      if (funcRefTable[ref]->isNative()) {
+        Fail(name, inst, pos, "tail call to a native function");
+      }
+      pops = funcRefTable[ref]->getNumArgs();
+      if (depth != pops) {
+        Fail(name, inst, pos, "must tail call with only the arguments left");
+      }
+      pushes = 0;
+      fallsThrough = false;
+      break;
+    }
+
+    case Instruction::CALL_VIRTUAL:
+    case Instruction::TAIL_CALL_VIRTUAL:
+      VENOM_ASSERT_TYPEOF_PTR(SInstCallVirtual, inst);
+      // the "this" pointer, plus the arguments under it
+      pops = 1 + static_cast<SInstCallVirtual*>(inst)->getNumArgs();
+      if (opcode == Instruction::TAIL_CALL_VIRTUAL) {
+        if (depth != pops) {
+          Fail(name, inst, pos,
+               "must tail call with only the arguments left");
+        }
+        // only a native callee continues on, to the RET
+        if (pos + 1 >= end ||
+            insts[pos + 1]->getOpcode() != Instruction::RET) {
+          Fail(name, inst, pos, "tail call must be followed by RET");
+        }
+      }
+      break;
+
+    case Instruction::DUP:
+    case Instruction::DUP_REF:
+      pushes = U32Value(inst) + 1;
+      break;
+
+    case Instruction::RET:
+      if (depth != 1) {
+        Fail(name, inst, pos, "must return with only the return value left");
+      }
+      pushes = 0;
+      fallsThrough = false;
+      break;
+
+    case Instruction::JUMP:
+    case Instruction::BRANCH_Z_INT:
+    case Instruction::BRANCH_Z_FLOAT:
+    case Instruction::BRANCH_Z_BOOL:
+    case Instruction::BRANCH_Z_REF:
+    case Instruction::BRANCH_NZ_INT:
+    case Instruction::BRANCH_NZ_FLOAT:
+    case Instruction::BRANCH_NZ_BOOL:
+    case Instruction::BRANCH_NZ_REF:
+      VENOM_ASSERT_TYPEOF_PTR(SInstLabel, inst);
+      jumps = true;
+      target = static_cast<SInstLabel*>(inst)->getValue()->getIndex();
+      pushes = 0;
+      fallsThrough = opcode != Instruction::JUMP;
+      break;
+
+    case Instruction::POP_CELL:
+    case Instruction::POP_CELL_REF:
+    case Instruction::SET_FIELD_OFF:
+    case Instruction::SET_FIELD_OFF_REF:
+    case Instruction::SET_FIELD_OFF_BORROW:
+    case Instruction::SET_FIELD_OFF_REF_BORROW:
+    case Instruction::SET_ARRAY_ACCESS:
+    case Instruction::SET_ARRAY_ACCESS_REF:
+    case Instruction::SET_ARRAY_ACCESS_UNCHECKED:
+    case Instruction::SET_ARRAY_ACCESS_REF_UNCHECKED:
+      pushes = 0;
+      break;
+
+    default: break;
+    }
+
+    if (depth < pops) {
+      Fail(name, inst, pos, "operand stack underflow");
+    }
+    depth = depth - pops + pushes;
+    maxDepth = max(maxDepth, depth);
+
+    // propagate the depth to the successors of this instruction
+    int64_t succs[2];
+    size_t nsuccs = 0;
+    if (fallsThrough) succs[nsuccs++] = pos + 1;
+    if (jumps) succs[nsuccs++] = target;
+    for (size_t i = 0; i < nsuccs; i++) {
+      if (succs[i] < int64_t(start) || succs[i] >= int64_t(end)) {
+        Fail(name, inst, pos, "control leaves the function");
+      }
+      ssize_t& succDepth = depths[succs[i] - start];
+      if (succDepth == -1) {
+        succDepth = depth;
+        worklist.push_back(succs[i]);
+      } else if (size_t(succDepth) != depth) {
+        Fail(name, inst, pos, "inconsistent stack depth");
+      }
+    }
+  }
+
+  return maxDepth;
+}
+
+}
+}
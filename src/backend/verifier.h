@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_BACKEND_VERIFIER_H
+#define VENOM_BACKEND_VERIFIER_H
+
+#include <vector>
+
+#include <backend/linker.h>
+
+namespace venom {
+namespace backend {
+
+/** Forward decl */
+class FunctionDescriptor;
+
+/**
+ * Verifier checks the code of the functions in an ObjectCode before they
+ * are linked, and computes the maximum operand stack depth of each one,
+ * which the VM uses to check for stack overflow once per call instead of on
+ * every push.
+ *
+ * The depth is found by abstract interpretation: every path through the
+ * function is followed, tracking only the number of cells on the operand
+ * stack. Paths which merge must agree on the depth, and the function must
+ * return with exactly its return value on the stack. Each local variable
+ * slot must be in range, and must be stored to consistently as a reference
+ * (or not), as recorded in the function's signature.
+ *
+ * Violations are reported as a LinkerException.
+ */
+class Verifier {
+public:
+  /** funcRefTable is obj's function reference table, already resolved by
+   * the linker. Does NOT take ownership of arguments */
+  Verifier(ObjectCode* obj,
+           const std::vector<FunctionDescriptor*>& funcRefTable)
+    : obj(obj), funcRefTable(funcRefTable) {}
+
+  /** Verifies the function sig of obj, whose code ends right before the
+   * instruction at position end. sig.refLocals must be sorted. Returns its
+   * maximum stack depth, counting the arguments it is called with */
+  size_t verifyFunction(const FunctionSignature& sig, size_t end);
+
+private:
+  ObjectCode* obj;
+  const std::vector<FunctionDescriptor*>& funcRefTable;
+};
+
+}
+}
+
+#endif /* VENOM_BACKEND_VERIFIER_H */
@@ -28,7 +28,9 @@
  */
 
 #include <algorithm>
+#include <new>
 
+#include <backend/jit.h>
 #include <backend/vm.h>
 #include <runtime/venomstring.h>
 #include <util/scopehelpers.h>
@@ -39,47 +41,93 @@ using namespace venom::runtime;
 namespace venom {
 namespace backend {
 
+OperandStack::OperandStack(size_t capacity) {
+  base = static_cast<venom_cell*>(malloc(capacity * sizeof(venom_cell)));
+  if (!base) throw bad_alloc();
+  sp = base;
+  limit = base + capacity;
+}
+
+void OperandStack::Overflow() {
+  throw VenomRuntimeException("Stack overflow");
+}
+
+FrameStack::FrameStack(size_t capacity) {
+  base = static_cast<char*>(malloc(capacity));
+  if (!base) throw bad_alloc();
+  top = base;
+  limit = base + capacity;
+}
+
+void FrameStack::Overflow() {
+  throw VenomRuntimeException("Stack overflow");
+}
+
 void ExecutionContext::execute(Callback& callback) {
-  assert(program_counter);
-  assert(*program_counter);
+#ifdef VENOM_IMPLICIT_NULL_CHECKS
+  Instruction::InstallNullPointerHandler();
+#endif
   util::ScopedBoolean sb(is_executing);
   util::ScopedVariable<ExecutionContext*> sv(_current, this);
   scoped_constants sc(this);
 
-  primeStacks();
-  new_frame(NULL); // denotes when <main> returns
-  while (true) {
-    if (VENOM_UNLIKELY((*program_counter)->execute(*this))) program_counter++;
-    if (VENOM_UNLIKELY(program_counter == NULL)) {
-      // end of stream
-      assert(local_variables_stack.empty());
-      assert(local_variables_ref_info_stack.empty());
-      assert(frame_offset.empty());
-      assert(ret_addr_stack.empty());
-      callback.noResult();
-      return;
-    }
+  try {
+    run(callback);
+  } catch (...) {
+    // an uncaught exception ends the program, so the frames it unwound
+    // through are simply abandoned (their locals are leaked)
+    frame = NULL;
+    frame_stack.clear();
+    throw;
   }
 }
 
+void ExecutionContext::run(Callback& callback) {
+  if (code->getMainFunc()->isCompiled()) {
+    // the compiled code pushes (and pops) its own frame
+    program_stack.setTop(code->getMainFunc()->getCompiledFunction()(
+          this, program_stack.getTop()));
+    assert(!frame);
+    callback.noResult();
+    return;
+  }
+
+  assert(program_counter);
+  program_stack.checkHeadroom(
+      program_stack.getTop(), code->getMainFunc()->getMaxStackDepth());
+  new_frame(NULL, code->getMainFunc()); // NULL denotes when <main> returns
+  if (code->getMainFunc()->jitReady(this)) {
+    Jit::Run(*this);
+    program_counter = NULL;
+  } else {
+    Instruction::ExecuteStream(*this, NULL);
+  }
+
+  // end of stream
+  assert(program_counter == NULL);
+  assert(!frame);
+  assert(frame_stack.empty());
+  callback.noResult();
+}
+
 struct const_init_functor {
-  inline venom_cell* operator()(const ExecConstant& konst) const {
+  inline venom_cell operator()(const ExecConstant& konst) const {
     if (konst.isLeft()) {
       venom_string *sptr = new venom_string(konst.left());
       sptr->incRef();
-      return new venom_cell(sptr);
+      return venom_cell(sptr);
     } else {
       venom_class_object* class_obj = konst.right();
       venom_object* obj = venom_object::allocObj(class_obj);
       obj->incRef();
-      return new venom_cell(obj);
+      return venom_cell(obj);
     }
   }
 };
 
 void ExecutionContext::initConstants() {
   assert(!constant_pool);
-  constant_pool = new venom_cell* [code->constant_pool.size()];
+  constant_pool = new venom_cell [code->constant_pool.size()];
   transform(code->constant_pool.begin(), code->constant_pool.end(),
             constant_pool, const_init_functor());
 }
@@ -87,34 +135,104 @@ void ExecutionContext::initConstants() {
 void ExecutionContext::releaseConstants() {
   assert(constant_pool);
   for (size_t i = 0; i < code->constant_pool.size(); i++) {
-    constant_pool[i]->decRef();
+    constant_pool[i].decRef();
   }
-  util::delete_pointers(
-      constant_pool, constant_pool + code->constant_pool.size());
   delete [] constant_pool;
   constant_pool = NULL;
+
+  // no frames are left, so everything in the table goes, and so does every
+  // cycle. freeing either can make more of the other
+  do {
+    if (defer_ref_counts) reconcile();
+    collectCycles(true);
+  } while (cycle_collector.hasRoots() || !zero_count_table.empty());
 }
 
-void ExecutionContext::resumeExecution(Instruction** pc) {
-  assert(pc);
+/** incRef()s (or decRef()s) the reference slots of frame f */
+static void CountFrameRefs(Frame* f, bool count) {
+  venom_cell* locals = f->locals();
+  const FunctionDescriptor::SlotVec& refs = f->desc->getRefLocals();
+  for (FunctionDescriptor::SlotVec::const_iterator it = refs.begin();
+       it != refs.end(); ++it) {
+    if (count) locals[*it].incRef();
+    else locals[*it].decRef();
+  }
+}
+
+void ExecutionContext::reconcile() {
+  assert(defer_ref_counts);
+  // release methods run below can reach a safepoint
+  if (reconciling) return;
+  util::ScopedBoolean sb(reconciling);
+
+  for (Frame* f = frame; f; f = f->prev) CountFrameRefs(f, true);
+
+  // freeing an object can drop the counts of others to zero, which go into
+  // the table again. the frames of release methods are not counted, but
+  // they are all gone by the time the next object is looked at
+  vector<venom_object*> table;
+  while (!zero_count_table.empty()) {
+    table.swap(zero_count_table);
+    for (vector<venom_object*>::iterator it = table.begin();
+         it != table.end(); ++it) {
+      venom_object* obj = *it;
+      assert(obj->in_zero_count_table);
+      obj->in_zero_count_table = false;
+      // an object which something else still refers to may now only be
+      // held by a cycle, since the frame it was put in can be gone
+      if (!obj->getCount()) venom_object::Free(obj);
+      else venom_object::Decremented(obj);
+    }
+    table.clear();
+  }
+
+  // the objects only frames hold go back into the table
+  for (Frame* f = frame; f; f = f->prev) CountFrameRefs(f, false);
+  zero_count_limit =
+    max(size_t(MinZeroCountLimit), 2 * zero_count_table.size());
+}
+
+void ExecutionContext::collectCycles(bool full) {
+  // release methods run below can reach a safepoint
+  if (collecting_cycles) return;
+  util::ScopedBoolean sb(collecting_cycles);
+
+  // the collector tells the objects held from outside of a cycle apart by
+  // their counts, so the frames have to count theirs
+  if (defer_ref_counts) {
+    for (Frame* f = frame; f; f = f->prev) CountFrameRefs(f, true);
+  }
+  cycle_collector.collect(full);
+  if (defer_ref_counts) {
+    for (Frame* f = frame; f; f = f->prev) CountFrameRefs(f, false);
+  }
+}
+
+void ExecutionContext::resumeExecution(FunctionDescriptor* desc) {
+  assert(desc);
   assert(is_executing);
   assert(constant_pool);
 
-  size_t return_size = local_variables_stack.size();
+  if (desc->isCompiled()) {
+    program_stack.setTop(
+        desc->getCompiledFunction()(this, program_stack.getTop()));
+    return;
+  }
+
+  program_stack.checkHeadroom(
+      program_stack.getTop(), desc->getMaxStackDepth());
+
+  Frame* return_frame = frame;
   // push the current pc as the ret addr
-  new_frame(program_counter);
-  // set the pc
-  program_counter = pc;
-  while (true) {
-    if (VENOM_UNLIKELY((*program_counter)->execute(*this))) program_counter++;
-    // check frame size
-    size_t cur_size = local_variables_stack.size();
-    assert(cur_size >= return_size);
-    if (VENOM_UNLIKELY(cur_size == return_size)) {
-      // break execution
-      break;
-    }
+  new_frame(program_counter, desc);
+  if (desc->jitReady(this)) {
+    Jit::Run(*this);
+    return;
   }
+  // set the pc
+  program_counter = code->instructionAt(intptr_t(desc->getFunctionPtr()));
+  // run until the new frame is popped
+  Instruction::ExecuteStream(*this, return_frame);
 }
 
 void ExecutionContext::resumeExecution(venom_object* obj, size_t index) {
@@ -132,27 +250,19 @@ void ExecutionContext::resumeExecution(venom_object* obj,
   desc->dispatch(this);
 }
 
-Instruction** ExecutionContext::pop_frame() {
-  // must decRef() the cells on the stack which need it
-
-  assert(local_variables_stack.size() ==
-         local_variables_ref_info_stack.size());
-
-  size_t last_offset = frame_offset.top();
-  for (size_t i = last_offset; i < local_variables_stack.size(); i++) {
-    if (local_variables_ref_info_stack[i]) {
-      local_variables_stack[i].decRef();
-    }
-  }
-
-  local_variables_stack.resize(last_offset);
-  local_variables_ref_info_stack.resize(last_offset);
+Instruction* ExecutionContext::pop_frame() {
+  assert(frame);
+  Frame* f = frame;
 
-  Instruction** ret_addr = ret_addr_stack.top();
-  ret_addr_stack.pop();
-  frame_offset.pop();
+  // must decRef() the slots which hold references (the others are skipped
+  // entirely), unless they are not counted. this can run release methods,
+  // which push their frames above f
+  if (!defer_ref_counts) CountFrameRefs(f, false);
 
-  AssertProgramFrameSanity();
+  Instruction* ret_addr = f->ret_addr;
+  frame = f->prev;
+  frame_stack.pop(f);
+  if (defer_ref_counts) safepoint();
   return ret_addr;
 }
 
@@ -163,19 +273,21 @@ void FunctionDescriptor::dispatch(ExecutionContext* ctx) {
   assert(ctx);
 
   if (native) {
-    switch (num_args) {
-
-#include <backend/dispatch_cases.inc>
-
-    // TODO: This is quite messy/fragile - we should really replace this with
-    // some inline assembly. Also, right now g++'s limit is a 59-argument
-    // function, so we can't do any more than w/o inline assembly.
-
-    default: VENOM_UNIMPLEMENTED;
+    // the arguments stay where the caller pushed them, so anything the
+    // native pushes while it runs ends up above them
+    venom_cell* args = ctx->program_stack.getTop() - num_args;
+    venom_ret_cell ret = native_function(ctx, args, num_args);
+    // release the reference arguments while they are still on the stack
+    // (a release method can itself use the stack), then replace them with
+    // the return value
+    assert(num_args == MaxNumArgs || !(arg_ref_cell_bitmap >> num_args));
+    for (uint64_t refs = arg_ref_cell_bitmap; refs; refs &= refs - 1) {
+      args[num_args - 1 - __builtin_ctzll(refs)].decRef();
     }
+    ctx->program_stack.setTop(args);
+    ctx->program_stack.push(ret);
   } else {
-    ctx->resumeExecution(
-        ctx->code->instructions.begin() + int64_t(function_ptr));
+    ctx->resumeExecution(this);
   }
 }
 
@@ -31,16 +31,21 @@
 #define VENOM_BACKEND_VM_H
 
 #include <cassert>
-#include <stack>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <vector>
 
 #include <backend/bytecode.h>
+#include <backend/jit.h>
 #include <backend/linker.h>
 
+#include <runtime/cyclecollector.h>
 #include <runtime/venomobject.h>
 
 #include <util/container.h>
+#include <util/macros.h>
+#include <util/noncopyable.h>
 #include <util/stl.h>
 
 namespace venom {
@@ -52,17 +57,154 @@ public:
     : std::runtime_error(msg) {}
 };
 
+/**
+ * OperandStack is the operand stack of an ExecutionContext. It is a single
+ * fixed capacity array of cells, which is never resized, so the interpreter
+ * loop can keep a raw pointer to the top of the stack in a local variable
+ * (and native code can reach the very same cells through push()/top()/pop()).
+ *
+ * Overflow is not checked on every push from the interpreter. Instead, every
+ * bytecode function call checks (via checkHeadroom()) that there is room
+ * left on the stack for the maximum stack depth of the callee.
+ */
+class OperandStack : private util::noncopyable {
+public:
+  /** Total number of cells in the stack. The memory is only touched as the
+   * stack grows, so a large capacity costs (mostly) address space */
+  static const size_t DefaultCapacity = 1 << 20;
+
+  explicit OperandStack(size_t capacity = DefaultCapacity);
+  ~OperandStack() { free(base); }
+
+  inline bool empty() const { return sp == base; }
+  inline size_t size() const { return sp - base; }
+
+  inline runtime::venom_cell& top() {
+    assert(!empty());
+    return *(sp - 1);
+  }
+  inline const runtime::venom_cell& top() const {
+    assert(!empty());
+    return *(sp - 1);
+  }
+
+  inline void push(const runtime::venom_cell& cell) {
+    if (VENOM_UNLIKELY(sp == limit)) Overflow();
+    *sp++ = cell;
+  }
+
+  inline void pop() {
+    assert(!empty());
+    sp--;
+  }
+
+  /** Raw access to the top of the stack (one past the last element), for
+   * the interpreter loop */
+  inline runtime::venom_cell* getTop() const { return sp; }
+  inline void setTop(runtime::venom_cell* top) {
+    assert(top >= base && top <= limit);
+    sp = top;
+  }
+
+  /** Throws if there are less than n free cells above top */
+  inline void checkHeadroom(const runtime::venom_cell* top, size_t n) const {
+    if (VENOM_UNLIKELY(size_t(limit - top) < n)) Overflow();
+  }
+
+private:
+  static void Overflow();
+
+  runtime::venom_cell* base;
+  runtime::venom_cell* sp;
+  runtime::venom_cell* limit;
+};
+
+/**
+ * Frame is the activation record of a bytecode function. Frames are laid out
+ * back to back in the FrameStack of an ExecutionContext: each Frame header is
+ * directly followed by the local variable slots of its function. Which slots
+ * hold references is a property of the function (see FunctionDescriptor).
+ */
+struct Frame {
+  /** Where execution continues once this frame is popped */
+  Instruction* ret_addr;
+
+  /** The frame of the caller (NULL for the outermost frame) */
+  Frame* prev;
+
+  /** The function executing in this frame */
+  FunctionDescriptor* desc;
+
+  /** Number of local variable slots (a copy of desc's, to save a load) */
+  size_t num_locals;
+
+  inline runtime::venom_cell* locals() {
+    return reinterpret_cast<runtime::venom_cell*>(this + 1);
+  }
+
+  /** Size in bytes of a frame with num_locals slots */
+  static inline size_t SizeFor(size_t num_locals) {
+    return sizeof(Frame) + num_locals * sizeof(runtime::venom_cell);
+  }
+};
+
+/**
+ * FrameStack holds the Frames of an ExecutionContext in one fixed capacity
+ * buffer, so a call only has to bump a pointer (and clear the new slots).
+ */
+class FrameStack : private util::noncopyable {
+public:
+  /** Capacity in bytes. Like the OperandStack, the memory is only touched
+   * as the stack grows */
+  static const size_t DefaultCapacity = 1 << 24;
+
+  explicit FrameStack(size_t capacity = DefaultCapacity);
+  ~FrameStack() { free(base); }
+
+  inline bool empty() const { return top == base; }
+
+  /** Allocates a frame with num_locals cleared slots, and fills in
+   * everything but its header. Throws if the stack is exhausted */
+  inline Frame* push(size_t num_locals) {
+    size_t n = Frame::SizeFor(num_locals);
+    if (VENOM_UNLIKELY(size_t(limit - top) < n)) Overflow();
+    Frame* frame = reinterpret_cast<Frame*>(top);
+    frame->num_locals = num_locals;
+    memset(frame + 1, 0, n - sizeof(Frame));
+    top += n;
+    return frame;
+  }
+
+  /** frame must be the most recently pushed frame */
+  inline void pop(Frame* frame) {
+    assert(reinterpret_cast<char*>(frame) < top);
+    top = reinterpret_cast<char*>(frame);
+  }
+
+  /** Discards every frame, without releasing their locals */
+  inline void clear() { top = base; }
+
+private:
+  static void Overflow();
+
+  char* base;
+  char* top;
+  char* limit;
+};
+
 /**
  * ExecutionContext represents a thread of execution in the venom virtual
  * machine.
  */
 class ExecutionContext {
+  friend class AotRuntime;
   friend class FunctionDescriptor;
   friend class Instruction;
+  friend class Jit;
   friend class runtime::venom_object;
 public:
 
-  typedef std::stack<runtime::venom_cell> program_stack_type;
+  typedef OperandStack program_stack_type;
 
   /**
    * Callback class to read a result from execute()
@@ -88,12 +230,51 @@ public:
     : code(code),
       program_counter(code->startingInst()),
       constant_pool(NULL),
-      is_executing(false) {}
-
-  ~ExecutionContext() { assert(!constant_pool); }
+      frame(NULL),
+      is_executing(false),
+      defer_ref_counts(false),
+      reconciling(false),
+      zero_count_limit(MinZeroCountLimit),
+      collecting_cycles(false) {}
+
+  ~ExecutionContext() {
+    assert(!constant_pool);
+    assert(!frame);
+    assert(zero_count_table.empty());
+  }
 
   void execute(Callback& callback);
 
+  /** Turns deferred reference counting (see reconcile()) on or off. Must be
+   * called before execute() */
+  inline void setDeferRefCounts(bool defer) {
+    assert(!is_executing);
+    defer_ref_counts = defer;
+  }
+
+  inline bool defersRefCounts() const { return defer_ref_counts; }
+
+  /** Selects how cycles are collected (see runtime::CycleCollector). Must be
+   * called before execute() */
+  inline void setGcMode(runtime::CycleCollector::Mode mode) {
+    assert(!is_executing);
+    cycle_collector.setMode(mode);
+  }
+
+  /** Enters obj, whose ref count has dropped to zero, into the zero count
+   * table (unless it already is). Only used when ref counts are deferred */
+  inline void deferRelease(runtime::venom_object* obj) {
+    assert(defer_ref_counts);
+    assert(!obj->getCount());
+    if (obj->in_zero_count_table) return;
+    obj->in_zero_count_table = true;
+    zero_count_table.push_back(obj);
+  }
+
+  inline const runtime::CycleCollector& getCycleCollector() const {
+    return cycle_collector;
+  }
+
   /** Returns the currently executing context in the current thread */
   inline static ExecutionContext* current_context() { return _current; }
 
@@ -108,12 +289,68 @@ private:
   void initConstants();
   void releaseConstants();
 
+  /** The zero count table is reconciled once it holds this many objects
+   * (or twice as many as were left in it after the last time) */
+  static const size_t MinZeroCountLimit = 4096;
+
+  /**
+   * Deferred reference counting: when defersRefCounts(), the local variable
+   * slots of frames do not count the references they hold.
+   * STORE_LOCAL_VAR_REF drops the count of the stack instead of decRef-ing
+   * the old value of the slot, and popping a frame does not touch its
+   * slots. A reference moved into a slot from another slot, the constant
+   * pool or a field (STORE_LOCAL_VAR_REF_BORROW and MOVE_ATTR_OF_*) is not
+   * counted at all. Everything else (the operand stack, the constant pool
+   * and the cells of objects) still counts.
+   *
+   * So an object whose count drops to zero may still be in a slot. It is
+   * entered into the zero count table instead of being freed, and freed by
+   * reconcile(), which first counts the references of every live frame,
+   * then frees the objects of the table whose count is still zero, and
+   * finally uncounts the frames again. The objects which only frames hold
+   * go back into the table.
+   *
+   * reconcile() only runs at a safepoint(): right after a
+   * STORE_LOCAL_VAR_REF, or after a frame is popped. Release methods thus
+   * still run, just not as soon as the last reference goes away.
+   */
+  void reconcile();
+
+  /** Runs the cycle collector (a major collection if full is set). If ref
+   * counts are deferred, the references of the frames are counted while it
+   * runs */
+  void collectCycles(bool full);
+
+  /** Reconciles the zero count table if it has grown past its limit, and
+   * collects cycles once enough objects have been allocated */
+  inline void safepoint() {
+    if (VENOM_UNLIKELY(zero_count_table.size() >= zero_count_limit)) {
+      reconcile();
+    }
+    if (VENOM_UNLIKELY(cycle_collector.shouldCollect())) {
+      collectCycles(false);
+    }
+  }
+
+  /** Collects cycles once enough objects have been allocated. Runs right
+   * before an object is allocated, which is the only thing which gets the
+   * collector closer to its threshold, so calls and stores do not pay for
+   * the check */
+  inline void allocationSafepoint() {
+    if (VENOM_UNLIKELY(cycle_collector.shouldCollect())) {
+      collectCycles(false);
+    }
+  }
+
+  /** Runs the main function, on behalf of execute() */
+  void run(Callback& callback);
+
 protected:
 
   /**
    * Can only be called while this context is executing.  This sets the
-   * program_counter to pc and starts executing in a new frame until the new
-   * frame is popped. At that point resumeExecution() returns control to the
+   * program_counter to the start of the (bytecode) function desc, and starts
+   * executing in a new frame until the new frame is popped. At that point resumeExecution() returns control to the
    * caller, restoring the program_counter to what it was before
    * resumeExecution() was called. However, whatever modifications made to the
    * program stack are kept.
@@ -121,13 +358,13 @@ protected:
    * This method is most useful for native functions to call back into the
    * interpreter via a function.  The typical use case is to set up the
    * arguments to a function on the stack, and then call resumeExecution() with
-   * the pc which points to the beginnning of the function. After
+   * the function. After
    * resumeExecution() returns, the arguments passed to the function are popped
    * off the stack and replaced with the return value of the function (at the
    * top of the stack). The pc appears to be un-modified from the point of view
    * of the caller of resumeExecution().
    */
-  void resumeExecution(Instruction** pc);
+  void resumeExecution(FunctionDescriptor* desc);
 
   /**
    * Do virtual method dispatch on the index-th entry of obj's
@@ -141,166 +378,257 @@ protected:
   void resumeExecution(runtime::venom_object* obj, FunctionDescriptor* desc);
 
   inline runtime::venom_cell& local_variable(size_t n) {
-    return local_variables_stack[frame_offset.top() + n];
-  }
-  inline const runtime::venom_cell& local_variable(size_t n) const {
-    return local_variables_stack[frame_offset.top() + n];
+    assert(n < frame->num_locals);
+    return frame->locals()[n];
   }
 
-  inline bool local_variable_ref_info(size_t n) const {
-    return local_variables_ref_info_stack[frame_offset.top() + n];
-  }
-
-  inline void new_frame(Instruction** ret_addr) {
-    AssertProgramFrameSanity();
+  /** Pushes a frame for desc, which returns to ret_addr */
+  inline void new_frame(Instruction* ret_addr, FunctionDescriptor* desc);
 
-    local_variables_stack.reserve(local_variables_stack.size() + 16);
-    local_variables_ref_info_stack.reserve(local_variables_stack.size() + 16);
-
-    frame_offset.push(local_variables_stack.size());
-    ret_addr_stack.push(ret_addr);
-  }
+  Instruction* pop_frame();
 
-  Instruction** pop_frame();
+  /** Releases the current frame, and pushes a frame for desc in its place
+   * (which returns to wherever the released frame would have). Used by tail
+   * calls, so that neither the frame stack nor the operand stack grows */
+  inline void replace_frame(FunctionDescriptor* desc);
 
   /** Linked program */
   Executable* code;
 
-  /** Complete linked program instruction stream */
-  Instruction** program_counter;
+  /** Currently executing instruction, in code's instruction stream */
+  Instruction* program_counter;
 
-  /** Initialized constant pool */
-  runtime::venom_cell** constant_pool;
+  /** Initialized constant pool, one cell per constant of code. This is the
+   * per-context state behind PUSH_CONST, whose instruction is shared by every
+   * context running code */
+  runtime::venom_cell* constant_pool;
 
   /** Program stack - shared per context */
   program_stack_type program_stack;
 
   /** Program frames - created per function invocation */
-  std::vector< runtime::venom_cell > local_variables_stack;
+  FrameStack frame_stack;
 
-  std::vector< bool > local_variables_ref_info_stack;
-
-  std::stack< size_t > frame_offset;
-
-  std::stack< Instruction** > ret_addr_stack;
+  /** The currently executing frame, at the top of frame_stack */
+  Frame* frame;
 
   /** Is this context currently executing? */
   bool is_executing;
 
+  /** State for deferred reference counting, see reconcile() */
+  bool defer_ref_counts;
+  bool reconciling;
+  std::vector<runtime::venom_object*> zero_count_table;
+  size_t zero_count_limit;
+
+  runtime::CycleCollector cycle_collector;
+  bool collecting_cycles;
+
+  /** State of the compiled code running in this context */
+  Jit::State jit_state;
+
   /**
    * The currently executing context in this thread.
    * TODO: make thread local
    */
   static ExecutionContext* _current;
-
-private:
-  inline void AssertProgramFrameSanity() const {
-    assert(local_variables_stack.size() ==
-           local_variables_ref_info_stack.size());
-
-    assert(frame_offset.size() == ret_addr_stack.size());
-  }
-  inline void primeStacks() {
-    // TODO: tune these constants
-    local_variables_stack.reserve(2048);
-    local_variables_ref_info_stack.reserve(2048);
-  }
 };
 
 /**
  * TODO: document FunctionDescriptor
  */
 class FunctionDescriptor {
+  friend class AotRuntime;
   friend class ExecutionContext;
   friend class Instruction;
+  friend class Jit;
+  friend class Linker;
 public:
   typedef runtime::venom_cell vc;
   typedef runtime::venom_ret_cell vr;
   typedef ExecutionContext* ec;
 
-  /** 64 argument functions is the maximum that is supported
-   * by the system */
-  // TODO: implementation limitation
+  /** Argument ref-ness is tracked in a 64-bit bitmap, so 64 arguments is
+   * the maximum that is supported by the system. The semantic checker
+   * rejects functions with more parameters than there are function types
+   * for (see analysis::Type::FuncTypes), which keeps every function, along
+   * with its self, well below this. Natives go through Native(), which
+   * has no overload past three arguments */
   static const uint32_t MaxNumArgs = 64;
 
-  typedef vr(*F0) (ec);
-  typedef vr(*F1) (ec,vc);
-  typedef vr(*F2) (ec,vc,vc);
-  typedef vr(*F3) (ec,vc,vc,vc);
-  typedef vr(*F4) (ec,vc,vc,vc,vc);
-  typedef vr(*F5) (ec,vc,vc,vc,vc,vc);
-  typedef vr(*F6) (ec,vc,vc,vc,vc,vc,vc);
-  typedef vr(*F7) (ec,vc,vc,vc,vc,vc,vc,vc);
-  typedef vr(*F8) (ec,vc,vc,vc,vc,vc,vc,vc,vc);
-  typedef vr(*F9) (ec,vc,vc,vc,vc,vc,vc,vc,vc,vc);
-
-#define _10_VCS vc,vc,vc,vc,vc,vc,vc,vc,vc,vc
-#define _20_VCS _10_VCS,_10_VCS
-#define _30_VCS _20_VCS,_10_VCS
-#define _40_VCS _30_VCS,_10_VCS
-#define _50_VCS _40_VCS,_10_VCS
-#define _60_VCS _50_VCS,_10_VCS
-
-#define _IMPL_FCN_TYPEDEFS(prefix) \
-  typedef vr(*F ## prefix ## 0)(ec,_ ## prefix ## 0_VCS); \
-  typedef vr(*F ## prefix ## 1)(ec,_ ## prefix ## 0_VCS,vc); \
-  typedef vr(*F ## prefix ## 2)(ec,_ ## prefix ## 0_VCS,vc,vc); \
-  typedef vr(*F ## prefix ## 3)(ec,_ ## prefix ## 0_VCS,vc,vc,vc); \
-  typedef vr(*F ## prefix ## 4)(ec,_ ## prefix ## 0_VCS,vc,vc,vc,vc); \
-  typedef vr(*F ## prefix ## 5)(ec,_ ## prefix ## 0_VCS,vc,vc,vc,vc,vc); \
-  typedef vr(*F ## prefix ## 6)(ec,_ ## prefix ## 0_VCS,vc,vc,vc,vc,vc,vc); \
-  typedef vr(*F ## prefix ## 7)(ec,_ ## prefix ## 0_VCS,vc,vc,vc,vc,vc,vc,vc); \
-  typedef vr(*F ## prefix ## 8)(ec,_ ## prefix ## 0_VCS,vc,vc,vc,vc,vc,vc,vc,vc); \
-  typedef vr(*F ## prefix ## 9)(ec,_ ## prefix ## 0_VCS,vc,vc,vc,vc,vc,vc,vc,vc,vc);
-
-  _IMPL_FCN_TYPEDEFS(1);
-  _IMPL_FCN_TYPEDEFS(2);
-  _IMPL_FCN_TYPEDEFS(3);
-  _IMPL_FCN_TYPEDEFS(4);
-  _IMPL_FCN_TYPEDEFS(5);
-
-  typedef vr(*F60) (ec _60_VCS);
-  typedef vr(*F61) (ec,_60_VCS,vc);
-  typedef vr(*F62) (ec,_60_VCS,vc,vc);
-  typedef vr(*F63) (ec,_60_VCS,vc,vc,vc);
-  typedef vr(*F64) (ec,_60_VCS,vc,vc,vc,vc);
-
-#undef _IMPL_FCN_TYPEDEFS
-
-#undef _10_VCS
-#undef _20_VCS
-#undef _30_VCS
-#undef _40_VCS
-#undef _50_VCS
-#undef _60_VCS
+  /**
+   * The calling convention of every native function. args points at the n
+   * argument cells, which are still on the operand stack while the native
+   * runs. Arguments are pushed in reverse order, so argument i is
+   * args[n - 1 - i] (the "this" pointer of a method is args[n - 1]).
+   *
+   * The native only borrows its arguments: dispatch() releases the ones
+   * marked in the arg ref cell bitmap once it returns
+   */
+  typedef vr(*NativeFunction) (ec, vc* args, size_t n);
+
+  /**
+   * Adapts a typed C++ function, which takes its arguments as individual
+   * cells, to the native calling convention, ie:
+   *
+   *   static FunctionDescriptor f(FunctionDescriptor::Native<print>(), 1, 0x1);
+   *
+   * The overload whose template parameter matches the signature of F is the
+   * only one which is viable, so the arity is picked at compile time. There
+   * are overloads for the arities the builtins take (one to three
+   * arguments); a native of another arity needs a Trampoline() and a
+   * Native() of its own
+   */
+#define _ARG(i) args[n - 1 - (i)]
+  template <vr(*F) (ec,vc)>
+  static vr Trampoline(ec ctx, vc* args, size_t n) {
+    assert(n == 1);
+    return F(ctx, _ARG(0));
+  }
+  template <vr(*F) (ec,vc,vc)>
+  static vr Trampoline(ec ctx, vc* args, size_t n) {
+    assert(n == 2);
+    return F(ctx, _ARG(0), _ARG(1));
+  }
+  template <vr(*F) (ec,vc,vc,vc)>
+  static vr Trampoline(ec ctx, vc* args, size_t n) {
+    assert(n == 3);
+    return F(ctx, _ARG(0), _ARG(1), _ARG(2));
+  }
+#undef _ARG
+
+#define _IMPL_NATIVE(sig) \
+  template <vr(*F) sig> \
+  static inline NativeFunction Native() { return &Trampoline<F>; }
+
+  _IMPL_NATIVE((ec,vc))
+  _IMPL_NATIVE((ec,vc,vc))
+  _IMPL_NATIVE((ec,vc,vc,vc))
 
+#undef _IMPL_NATIVE
+
+  /**
+   * A function compiled to C++ ahead of time (see CppEmitter). It is called
+   * with its arguments on top of the operand stack (sp points past them),
+   * runs in a frame of its own, and returns the top of the stack once the
+   * arguments have been replaced by the return value. Unlike a native, it
+   * owns its arguments, just as a bytecode function does
+   */
+  typedef runtime::venom_cell* (*CompiledFunction) (ec, vc* sp);
+
+  typedef std::vector<uint32_t> SlotVec;
+
+  /** A native function, see NativeFunction */
+  FunctionDescriptor(NativeFunction native_function, size_t num_args,
+                     uint64_t arg_ref_cell_bitmap)
+    : function_ptr(NULL), native_function(native_function),
+      num_args(num_args), arg_ref_cell_bitmap(arg_ref_cell_bitmap),
+      native(true), num_locals(0), max_stack_depth(0),
+      compiled_function(NULL), jit_code(NULL), jit_countdown(0) {
+    assert(num_args <= MaxNumArgs);
+  }
+
+  /** A bytecode function, whose frame has num_locals local variable slots,
+   * of which ref_locals hold references. The max stack depth is filled in
+   * by the linker, once it has verified the function */
   FunctionDescriptor(void* function_ptr, size_t num_args,
-                     uint64_t arg_ref_cell_bitmap, bool native)
-    : function_ptr(function_ptr), num_args(num_args),
-      arg_ref_cell_bitmap(arg_ref_cell_bitmap), native(native) {
+                     uint64_t arg_ref_cell_bitmap,
+                     size_t num_locals, const SlotVec& ref_locals)
+    : function_ptr(function_ptr), native_function(NULL), num_args(num_args),
+      arg_ref_cell_bitmap(arg_ref_cell_bitmap), native(false),
+      num_locals(num_locals), ref_locals(ref_locals), max_stack_depth(0),
+      compiled_function(NULL), jit_code(NULL), jit_countdown(0) {
+    assert(num_args <= MaxNumArgs);
+  }
+
+  /** A compiled function, see CompiledFunction. The frame is the same as the
+   * one of the bytecode function it was compiled from */
+  FunctionDescriptor(CompiledFunction compiled_function, size_t num_args,
+                     uint64_t arg_ref_cell_bitmap,
+                     size_t num_locals, const SlotVec& ref_locals,
+                     size_t max_stack_depth)
+    : function_ptr(NULL), native_function(NULL), num_args(num_args),
+      arg_ref_cell_bitmap(arg_ref_cell_bitmap), native(false),
+      num_locals(num_locals), ref_locals(ref_locals),
+      max_stack_depth(max_stack_depth), compiled_function(compiled_function),
+      jit_code(NULL), jit_countdown(0) {
     assert(num_args <= MaxNumArgs);
   }
 
   /** Accessors */
   inline void* getFunctionPtr() const { return function_ptr; }
+  inline NativeFunction getNativeFunction() const { return native_function; }
   inline size_t getNumArgs() const { return num_args; }
   inline uint64_t argRefCellBitmap() const { return arg_ref_cell_bitmap; }
   inline bool isNative() const { return native; }
+  inline bool isCompiled() const { return compiled_function != NULL; }
+  inline CompiledFunction getCompiledFunction() const {
+    return compiled_function;
+  }
+  inline size_t getNumLocals() const { return num_locals; }
+  inline const SlotVec& getRefLocals() const { return ref_locals; }
+
+  /** The most cells the function has on the operand stack at any point,
+   * counting its arguments */
+  inline size_t getMaxStackDepth() const { return max_stack_depth; }
 
 protected:
   /** Assumes stack is properly set up before invocation; has the same
    * semantics as ExecutionContext::resumeExecution() */
   void dispatch(ExecutionContext* ctx);
 
+  /** Counts a call to, or a loop iteration in, this (bytecode) function,
+   * which gets it compiled once it is hot. Returns true if the function
+   * should switch to the compiled code (see Jit::Run() and Jit::RunFrom()) */
+  inline bool jitReady(ExecutionContext* ctx);
+
 private:
   void* function_ptr;
+  NativeFunction native_function;
   size_t num_args;
   uint64_t arg_ref_cell_bitmap;
   bool native;
+  size_t num_locals;
+  SlotVec ref_locals;
+  size_t max_stack_depth;
+  CompiledFunction compiled_function;
+
+  /** The code compiled by the Jit, or NULL */
+  Jit::Code jit_code;
+
+  /** Calls left until the Jit compiles this function, or 0 if the Jit is
+   * not waiting for it to get hot */
+  uint32_t jit_countdown;
 };
 
 typedef std::vector<FunctionDescriptor*> FuncDescVec;
 
+inline void
+ExecutionContext::new_frame(Instruction* ret_addr, FunctionDescriptor* desc) {
+  assert(!desc->isNative());
+  Frame* f = frame_stack.push(desc->getNumLocals());
+  f->ret_addr = ret_addr;
+  f->prev = frame;
+  f->desc = desc;
+  frame = f;
+}
+
+inline void
+ExecutionContext::replace_frame(FunctionDescriptor* desc) {
+  // any release methods run by pop_frame() push above the arguments to desc
+  new_frame(pop_frame(), desc);
+}
+
+inline bool
+FunctionDescriptor::jitReady(ExecutionContext* ctx) {
+  assert(!native && !compiled_function);
+  if (VENOM_UNLIKELY(jit_countdown) && !--jit_countdown) {
+    ctx->code->getJit()->compile(this);
+  }
+  return VENOM_UNLIKELY(jit_code != NULL) &&
+         ctx->jit_state.depth < Jit::MaxDepth;
+}
+
 }
 }
 
@@ -39,11 +39,15 @@
 #include <parser/scanner.h>
 
 #include <analysis/boundfunction.h>
+#include <analysis/classhierarchy.h>
 #include <analysis/semanticcontext.h>
 
 #include <ast/include.h>
 
 #include <backend/codegenerator.h>
+#include <backend/cppemitter.h>
+#include <backend/peephole.h>
+#include <backend/refelider.h>
 #include <backend/vm.h>
 
 #include <bootstrap/analysis.h>
@@ -272,6 +276,7 @@ struct _lift_functor {
 };
 
 #define _REWRITE_LOCAL_STAGES(x) \
+  x(Optimize) \
   x(DeSugar) \
   x(CanonicalRefs) \
   x(ModuleMain) \
@@ -282,6 +287,8 @@ struct _lift_functor {
   struct _rewrite_functor_##stage { \
     inline void operator()(ASTStatementNode* root, \
                            SemanticContext* ctx) const { \
+      if (ASTNode::stage == ASTNode::Optimize && \
+          !global_compile_opts.opt_level) return; \
       root->rewriteLocal(ctx, ASTNode::stage); \
       _IMPL_PRINT_AST(root, "rewriteLocal: " #stage); \
     } \
@@ -292,13 +299,27 @@ _REWRITE_LOCAL_STAGES(_IMPL_REWRITE_FUNCTOR)
 #undef _IMPL_REWRITE_FUNCTOR
 
 struct _codegen_functor {
+  _codegen_functor(ClassHierarchy* hierarchy) : hierarchy(hierarchy) {}
   inline void operator()(ASTStatementNode* root,
                          SemanticContext* ctx) const {
     CodeGenerator cg(ctx);
+    cg.setInlining(global_compile_opts.opt_level > 0);
+    cg.setClassHierarchy(hierarchy);
     root->codeGen(cg);
     if (global_compile_opts.print_bytecode) cg.printDebugStream();
+    PeepholeOptimizer peephole(&cg);
+    peephole.optimize();
+    RefCountElider elider(&cg);
+    if (global_compile_opts.opt_level) elider.optimize();
+    if (global_compile_opts.print_bytecode) {
+      cerr << endl << "; after peephole optimization" << endl;
+      cg.printDebugStream();
+      peephole.printStats(cerr);
+      if (global_compile_opts.opt_level) elider.printStats(cerr);
+    }
     cg.createObjectCodeAndSet(ctx);
   }
+  ClassHierarchy* hierarchy;
 };
 
 void
@@ -527,8 +548,14 @@ unsafe_compile(const string& fname, fstream& infile,
 
   if (global_compile_opts.semantic_check_only) return;
 
-  // code gen phase
-  ctx.getProgramRoot()->forEachModule(_codegen_functor());
+  // code gen phase. every module has been rewritten by now, so the class
+  // hierarchy is complete
+  ClassHierarchy hierarchy(ctx.getProgramRoot());
+  ctx.getProgramRoot()->forEachModule(
+      _codegen_functor(global_compile_opts.opt_level ? &hierarchy : NULL));
+  if (global_compile_opts.print_bytecode && global_compile_opts.opt_level) {
+    hierarchy.printStats(cerr);
+  }
 }
 
 #undef _REWRITE_LOCAL_STAGES
@@ -550,9 +577,31 @@ static void exec(SemanticContext& ctx) {
   assert(pos != objs.end());
 
   Executable *exec = linker.link(objs, pos - objs.begin());
+  if (!global_compile_opts.emit_cpp.empty()) {
+    ofstream out(global_compile_opts.emit_cpp.c_str());
+    if (!out.good()) {
+      throw invalid_argument(
+          "Invalid filename: " + global_compile_opts.emit_cpp);
+    }
+    CppEmitter(exec).emit(out);
+    delete exec;
+    return;
+  }
+  exec->enableJit(global_compile_opts.jit_mode);
+  runtime::SlabAllocator::Current().setHugePages(
+      global_compile_opts.huge_pages);
   ExecutionContext execCtx(exec);
+  execCtx.setDeferRefCounts(global_compile_opts.defer_ref_counts);
+  execCtx.setGcMode(global_compile_opts.gc_mode);
   ExecutionContext::DefaultCallback callback;
   execCtx.execute(callback);
+  if (global_compile_opts.print_ic_stats) exec->printInlineCacheStats(cerr);
+  if (global_compile_opts.print_gc_stats) {
+    execCtx.getCycleCollector().printStats(cerr);
+  }
+  if (global_compile_opts.print_alloc_stats) {
+    runtime::SlabAllocator::Current().printStats(cerr);
+  }
   delete exec;
 }
 
@@ -36,6 +36,9 @@
 #include <string>
 #include <vector>
 
+#include <backend/jit.h>
+#include <runtime/cyclecollector.h>
+
 namespace venom {
 
 namespace analysis {
@@ -119,14 +122,38 @@ public:
 struct compile_opts {
   compile_opts()
     : trace_lex(false), trace_parse(false),
-      print_ast(false), print_bytecode(false),
-      semantic_check_only(false), venom_import_path(".") {}
+      print_ast(false), print_bytecode(false), print_ic_stats(false),
+      print_gc_stats(false), print_alloc_stats(false), huge_pages(false),
+      semantic_check_only(false),
+      venom_import_path("."),
+      jit_mode(backend::Jit::On), opt_level(1), defer_ref_counts(false),
+      gc_mode(runtime::CycleCollector::Full) {}
   bool trace_lex;
   bool trace_parse;
   bool print_ast;
   bool print_bytecode;
+  bool print_ic_stats;
+  /** Print the statistics of the cycle collector (see
+   * runtime::CycleCollector) once the program is done */
+  bool print_gc_stats;
+  /** Print the statistics of the SlabAllocator once the program is done */
+  bool print_alloc_stats;
+  /** Back the slabs of the SlabAllocator with transparent huge pages */
+  bool huge_pages;
   bool semantic_check_only;
   std::string venom_import_path;
+  backend::Jit::Mode jit_mode;
+  /** 0 skips the Optimize rewrite stage, the inlining of small functions
+   * and the devirtualization of method calls (-O0), 1 does all three
+   * (-O1) */
+  unsigned opt_level;
+  /** If set, the linked program is written to this file as C++ (see
+   * backend::CppEmitter) instead of being run */
+  std::string emit_cpp;
+  /** Run with deferred reference counting (see
+   * backend::ExecutionContext::reconcile()) */
+  bool defer_ref_counts;
+  runtime::CycleCollector::Mode gc_mode;
 };
 extern compile_opts global_compile_opts;
 
@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+
+#include <runtime/allocator.h>
+
+using namespace std;
+
+namespace venom {
+namespace runtime {
+
+__thread SlabAllocator* SlabAllocator::current(NULL);
+
+SlabAllocator::SlabAllocator()
+  : chunk_cur(NULL), chunk_end(NULL), huge_pages(false),
+    large_allocs(0), large_frees(0), large_bytes(0) {
+  for (size_t i = 0; i < NumClasses; i++) {
+    SizeClass& c = classes[i];
+    c.free_list = NULL;
+    c.cur = c.end = NULL;
+    c.allocs = c.frees = c.slabs = 0;
+  }
+}
+
+SlabAllocator::~SlabAllocator() {
+  for (vector<void*>::iterator it = chunks.begin();
+       it != chunks.end(); ++it) {
+    munmap(*it, ChunkSize);
+  }
+}
+
+void* SlabAllocator::bump(SizeClass& c, size_t idx) {
+  size_t size = (idx + 1) * Granularity;
+  if (VENOM_UNLIKELY(c.cur + size > c.end)) {
+    // whatever is left of the old slab is too small for even one block
+    if (chunk_cur == chunk_end) {
+      // huge pages need a ChunkSize aligned chunk, so map twice as much and
+      // unmap the unaligned head and tail
+      char* p = static_cast<char*>(mmap(NULL, 2 * ChunkSize,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (p == MAP_FAILED) throw bad_alloc();
+      char* aligned = reinterpret_cast<char*>(
+          (intptr_t(p) + ChunkSize - 1) & ~intptr_t(ChunkSize - 1));
+      if (aligned != p) munmap(p, aligned - p);
+      munmap(aligned + ChunkSize, p + ChunkSize - aligned);
+#ifdef MADV_HUGEPAGE
+      if (huge_pages) madvise(aligned, ChunkSize, MADV_HUGEPAGE);
+#endif
+      chunks.push_back(aligned);
+      chunk_cur = aligned;
+      chunk_end = aligned + ChunkSize;
+    }
+    c.cur = chunk_cur;
+    c.end = chunk_cur + SlabSize;
+    chunk_cur += SlabSize;
+    c.slabs++;
+  }
+  void* p = c.cur;
+  c.cur += size;
+  return p;
+}
+
+void* SlabAllocator::allocateLarge(size_t size) {
+  large_allocs++;
+  large_bytes += size;
+  return operator new(size);
+}
+
+void SlabAllocator::deallocateLarge(void* p, size_t size) {
+  large_frees++;
+  large_bytes -= size;
+  operator delete(p);
+}
+
+void SlabAllocator::printStats(ostream& o) const {
+  o << "; allocator: " << chunks.size() << " chunks ("
+    << (chunks.size() * ChunkSize / 1024) << " kB mapped)" << endl;
+  for (size_t i = 0; i < NumClasses; i++) {
+    const SizeClass& c = classes[i];
+    if (!c.allocs) continue;
+    o << ";   " << (i + 1) * Granularity << " bytes: "
+      << c.allocs << " allocs, " << c.frees << " frees, "
+      << (c.allocs - c.frees) << " live, " << c.slabs << " slabs" << endl;
+  }
+  o << ";   large: " << large_allocs << " allocs, " << large_frees
+    << " frees, " << large_bytes << " bytes live" << endl;
+}
+
+}
+}
@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_RUNTIME_ALLOCATOR_H
+#define VENOM_RUNTIME_ALLOCATOR_H
+
+#include <cassert>
+#include <cstddef>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include <util/macros.h>
+#include <util/noncopyable.h>
+
+namespace venom {
+namespace runtime {
+
+/**
+ * Most venom objects (boxed primitives, strings, small user objects) are
+ * only a few dozen bytes large, and are allocated and freed all the time.
+ * The SlabAllocator serves them from size classes, one every Granularity
+ * bytes up to MaxSmallSize. Each size class carves the objects out of 64KB
+ * slabs, and keeps the freed ones on a free list. The slabs come from 2MB
+ * chunks, which are mmap()-ed (and backed by transparent huge pages if
+ * setHugePages() was called). Anything larger goes to operator new.
+ *
+ * Memory is never given back to the OS, and the allocator is not
+ * synchronized: each thread allocates from (and must free to) its own
+ * allocator, see Current().
+ *
+ * The size of a block is not stored anywhere, so it has to be passed to
+ * deallocate() again. venom objects get it from their class (see
+ * venom_object::Delete()).
+ */
+class SlabAllocator : private util::noncopyable {
+public:
+  static const size_t Granularity = 16;
+  static const size_t MaxSmallSize = 512;
+  static const size_t NumClasses = MaxSmallSize / Granularity;
+  static const size_t SlabSize = 64 * 1024;
+  static const size_t ChunkSize = 2 * 1024 * 1024;
+
+  SlabAllocator();
+  ~SlabAllocator();
+
+  /** The allocator of the calling thread. It is never freed, since the
+   * objects it holds can outlive anything else */
+  static inline SlabAllocator& Current() {
+    if (VENOM_UNLIKELY(!current)) current = new SlabAllocator;
+    return *current;
+  }
+
+  inline void* allocate(size_t size) {
+    if (VENOM_UNLIKELY(size > MaxSmallSize)) return allocateLarge(size);
+    SizeClass& c = classes[ClassOf(size)];
+    c.allocs++;
+    FreeBlock* block = c.free_list;
+    if (VENOM_UNLIKELY(!block)) return bump(c, ClassOf(size));
+    c.free_list = block->next;
+    return block;
+  }
+
+  /** size must be the one p was allocated with */
+  inline void deallocate(void* p, size_t size) {
+    assert(p);
+    if (VENOM_UNLIKELY(size > MaxSmallSize)) {
+      deallocateLarge(p, size);
+      return;
+    }
+    SizeClass& c = classes[ClassOf(size)];
+    c.frees++;
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next = c.free_list;
+    c.free_list = block;
+  }
+
+  /** Only affects the chunks mapped from now on */
+  inline void setHugePages(bool huge_pages) { this->huge_pages = huge_pages; }
+
+  void printStats(std::ostream& o) const;
+
+private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct SizeClass {
+    FreeBlock* free_list;
+    /** The rest of the current slab, which has never been handed out */
+    char* cur;
+    char* end;
+    /** Statistics */
+    size_t allocs;
+    size_t frees;
+    size_t slabs;
+  };
+
+  /** Zero sized blocks get the smallest class */
+  static inline size_t ClassOf(size_t size) {
+    return size ? (size - 1) / Granularity : 0;
+  }
+
+  /** Carves a block of class idx out of c's current slab (or a new one) */
+  void* bump(SizeClass& c, size_t idx);
+
+  void* allocateLarge(size_t size);
+  void deallocateLarge(void* p, size_t size);
+
+  SizeClass classes[NumClasses];
+
+  /** The rest of the current chunk, which slabs are taken from */
+  char* chunk_cur;
+  char* chunk_end;
+  std::vector<void*> chunks;
+  bool huge_pages;
+
+  /** Statistics for the blocks larger than MaxSmallSize */
+  size_t large_allocs;
+  size_t large_frees;
+  size_t large_bytes;
+
+  static __thread SlabAllocator* current;
+};
+
+/** An STL allocator, so that the backing stores of lists and dicts come
+ * from the SlabAllocator of the current thread too */
+template <typename T>
+class slab_allocator {
+public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind { typedef slab_allocator<U> other; };
+
+  slab_allocator() {}
+  template <typename U>
+  slab_allocator(const slab_allocator<U>&) {}
+
+  inline pointer address(reference x) const { return &x; }
+  inline const_pointer address(const_reference x) const { return &x; }
+
+  inline pointer allocate(size_type n, const void* = 0) {
+    return static_cast<pointer>(
+        SlabAllocator::Current().allocate(n * sizeof(T)));
+  }
+  inline void deallocate(pointer p, size_type n) {
+    SlabAllocator::Current().deallocate(p, n * sizeof(T));
+  }
+
+  inline size_type max_size() const { return size_t(-1) / sizeof(T); }
+
+  inline void construct(pointer p, const T& val) { new (p) T(val); }
+  inline void destroy(pointer p) { p->~T(); }
+
+  inline bool operator==(const slab_allocator&) const { return true; }
+  inline bool operator!=(const slab_allocator&) const { return false; }
+};
+
+}
+}
+
+#endif /* VENOM_RUNTIME_ALLOCATOR_H */
@@ -122,37 +122,43 @@ protected:
 
 template <typename Primitive>
 backend::FunctionDescriptor& venom_box_base<Primitive>::InitDescriptor() {
-  static backend::FunctionDescriptor f((void*)init, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<init>(), 1, 0x1);
   return f;
 }
 
 template <typename Primitive>
 backend::FunctionDescriptor& venom_box_base<Primitive>::ReleaseDescriptor() {
-  static backend::FunctionDescriptor f((void*)release, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<release>(), 1, 0x1);
   return f;
 }
 
 template <typename Primitive>
 backend::FunctionDescriptor& venom_box_base<Primitive>::CtorDescriptor() {
-  static backend::FunctionDescriptor f((void*)ctor, 2, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<ctor>(), 2, 0x1);
   return f;
 }
 
 template <typename Primitive>
 backend::FunctionDescriptor& venom_box_base<Primitive>::StringifyDescriptor() {
-  static backend::FunctionDescriptor f((void*)stringify, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<stringify>(), 1, 0x1);
   return f;
 }
 
 template <typename Primitive>
 backend::FunctionDescriptor& venom_box_base<Primitive>::HashDescriptor() {
-  static backend::FunctionDescriptor f((void*)hash, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<hash>(), 1, 0x1);
   return f;
 }
 
 template <typename Primitive>
 backend::FunctionDescriptor& venom_box_base<Primitive>::EqDescriptor() {
-  static backend::FunctionDescriptor f((void*)eq, 2, 0x3, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<eq>(), 2, 0x3);
   return f;
 }
 
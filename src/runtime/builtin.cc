@@ -39,7 +39,7 @@ namespace venom {
 namespace runtime {
 
 FunctionDescriptor& BuiltinPrintDescriptor() {
-  static FunctionDescriptor f((void*)print, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<print>(), 1, 0x1);
   return f;
 }
 
@@ -0,0 +1,299 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <algorithm>
+
+#include <runtime/cyclecollector.h>
+
+using namespace std;
+
+namespace venom {
+namespace runtime {
+
+bool CycleCollector::ParseMode(const string& s, Mode& mode) {
+  if (s == "off") mode = Off;
+  else if (s == "full") mode = Full;
+  else if (s == "generational") mode = Generational;
+  else return false;
+  return true;
+}
+
+CycleCollector::CycleCollector()
+  : mode(Full), tracing_old(true),
+    allocations(0), threshold(MinThreshold), major_threshold(MinThreshold),
+    collections(0), major_collections(0), objects_traced(0),
+    cycles_found(0), objects_reclaimed(0), bytes_reclaimed(0),
+    pause_usec(0), max_pause_usec(0) {}
+
+static inline uint64_t NowUsec() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return uint64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+void CycleCollector::collect(bool full) {
+  allocations = 0;
+  bool major = full || mode != Generational ||
+               old_roots.size() >= major_threshold;
+
+  // freeing the garbage can buffer new candidates, which are left for the
+  // next collection
+  vector<venom_object*> candidates;
+  candidates.swap(roots);
+  if (major) {
+    candidates.insert(candidates.end(), old_roots.begin(), old_roots.end());
+    old_roots.clear();
+  } else {
+    // old candidates stay buffered. the ones which are no longer purple are
+    // left for markRoots() to drop
+    vector<venom_object*>::iterator out = candidates.begin();
+    for (vector<venom_object*>::iterator it = candidates.begin();
+         it != candidates.end(); ++it) {
+      venom_object* obj = *it;
+      if ((obj->gc_flags & Old) && obj->gc_color == Purple) {
+        old_roots.push_back(obj);
+      } else {
+        *out++ = obj;
+      }
+    }
+    candidates.erase(out, candidates.end());
+  }
+  if (candidates.empty()) return;
+
+  uint64_t start = NowUsec();
+  collections++;
+  if (major) major_collections++;
+  size_t traced_before = objects_traced;
+  tracing_old = major;
+
+  markRoots(candidates);
+  for (vector<venom_object*>::iterator it = candidates.begin();
+       it != candidates.end(); ++it) {
+    scan(*it);
+  }
+  vector<venom_object*> garbage;
+  for (vector<venom_object*>::iterator it = candidates.begin();
+       it != candidates.end(); ++it) {
+    (*it)->gc_flags &= ~Buffered;
+    if (collectWhite(*it, garbage)) cycles_found++;
+  }
+  // restoring the counts is the last traversal, so the survivors can be
+  // promoted before any of them are released along with the garbage
+  restoreCounts(garbage);
+  for (vector<venom_object*>::iterator it = survivors.begin();
+       it != survivors.end(); ++it) {
+    (*it)->gc_flags |= Old;
+  }
+  survivors.clear();
+  freeGarbage(garbage);
+
+  // a collection costs about as much as the objects it traces, so waiting
+  // for as many allocations keeps the cost per allocation constant
+  threshold = max(size_t(MinThreshold), objects_traced - traced_before);
+  if (major) major_threshold = threshold;
+
+  uint64_t pause = NowUsec() - start;
+  pause_usec += pause;
+  max_pause_usec = max(max_pause_usec, pause);
+}
+
+void CycleCollector::printStats(ostream& o) const {
+  o << "; cycle collector: " << collections << " collections ("
+    << major_collections << " major), "
+    << objects_traced << " objects traced, "
+    << cycles_found << " cycles found, "
+    << objects_reclaimed << " objects (" << bytes_reclaimed
+    << " bytes) reclaimed, pause time " << (pause_usec / 1000.0)
+    << " ms total (" << (max_pause_usec / 1000.0) << " ms max)" << endl;
+
+  // ru_maxrss is in kilobytes on linux
+  rusage usage;
+  if (!getrusage(RUSAGE_SELF, &usage)) {
+    o << "; peak rss: " << usage.ru_maxrss << " kB" << endl;
+  }
+}
+
+/** Appends the objects referred to by the cells visited onto a vector */
+class CycleCollector::ChildPusher : public venom_cell_visitor {
+public:
+  ChildPusher(vector<venom_object*>& children, uint8_t skip_flags)
+    : children(children), skip_flags(skip_flags) {}
+  virtual void visit(venom_cell& cell) {
+    venom_object* obj = cell.asRawObject();
+    if (obj && !IsGreen(obj) && !(obj->gc_flags & skip_flags)) {
+      children.push_back(obj);
+    }
+  }
+private:
+  static inline bool IsGreen(const venom_object* obj) {
+    return !obj->getClassObj()->holdsRefs();
+  }
+  vector<venom_object*>& children;
+  const uint8_t skip_flags;
+};
+
+void CycleCollector::pushChildren(venom_object* obj,
+                                  vector<venom_object*>& children) {
+  assert(!(obj->gc_flags & Released));
+  ChildPusher pusher(children, tracing_old ? 0 : uint8_t(Old));
+  obj->traverse(pusher);
+}
+
+void CycleCollector::markRoots(vector<venom_object*>& candidates) {
+  // drop the candidates which are no longer purple (their counts have gone
+  // back up, or to zero)
+  vector<venom_object*>::iterator out = candidates.begin();
+  for (vector<venom_object*>::iterator it = candidates.begin();
+       it != candidates.end(); ++it) {
+    venom_object* obj = *it;
+    if (obj->gc_color == Purple) {
+      markGray(obj);
+      *out++ = obj;
+      continue;
+    }
+    obj->gc_flags &= ~Buffered;
+    if (obj->gc_flags & Released) {
+      // see venom_object::Free()
+      assert(!obj->getCount());
+      venom_object::Delete(obj);
+    }
+  }
+  candidates.erase(out, candidates.end());
+}
+
+void CycleCollector::markGray(venom_object* root) {
+  if (root->gc_color == Gray) return;
+  root->gc_color = Gray;
+  objects_traced++;
+  pushChildren(root, work);
+  while (!work.empty()) {
+    venom_object* obj = work.back();
+    work.pop_back();
+    // one for each reference from a gray object
+    assert(obj->count);
+    obj->count--;
+    if (obj->gc_color == Gray) continue;
+    obj->gc_color = Gray;
+    objects_traced++;
+    pushChildren(obj, work);
+  }
+}
+
+void CycleCollector::scan(venom_object* root) {
+  work.push_back(root);
+  while (!work.empty()) {
+    venom_object* obj = work.back();
+    work.pop_back();
+    if (obj->gc_color != Gray) continue;
+    // an object in the zero count table may still be held by a local
+    // variable slot, which does not count
+    if (obj->count || obj->in_zero_count_table) {
+      scanBlack(obj);
+    } else {
+      obj->gc_color = White;
+      pushChildren(obj, work);
+    }
+  }
+}
+
+void CycleCollector::scanBlack(venom_object* root) {
+  root->gc_color = Black;
+  survivors.push_back(root);
+  pushChildren(root, black_work);
+  while (!black_work.empty()) {
+    venom_object* obj = black_work.back();
+    black_work.pop_back();
+    // undo markGray()
+    obj->count++;
+    if (obj->gc_color == Black) continue;
+    obj->gc_color = Black;
+    survivors.push_back(obj);
+    pushChildren(obj, black_work);
+  }
+}
+
+bool CycleCollector::collectWhite(venom_object* root,
+                                  vector<venom_object*>& garbage) {
+  size_t garbage_before = garbage.size();
+  work.push_back(root);
+  while (!work.empty()) {
+    venom_object* obj = work.back();
+    work.pop_back();
+    // a buffered object is left for its own turn
+    if (obj->gc_color != White || (obj->gc_flags & Buffered)) continue;
+    obj->gc_color = Garbage;
+    garbage.push_back(obj);
+    pushChildren(obj, work);
+  }
+  return garbage.size() != garbage_before;
+}
+
+void CycleCollector::restoreCounts(const vector<venom_object*>& garbage) {
+  for (vector<venom_object*>::const_iterator it = garbage.begin();
+       it != garbage.end(); ++it) {
+    pushChildren(*it, work);
+    while (!work.empty()) {
+      work.back()->count++;
+      work.pop_back();
+    }
+  }
+}
+
+void CycleCollector::freeGarbage(const vector<venom_object*>& garbage) {
+  typedef vector<venom_object*>::const_iterator iterator;
+
+  // the counts of everything the garbage refers to have been restored, so
+  // hold on to the garbage while its contents are released. then the
+  // references it holds can be dropped as usual: the release of any object
+  // outside of the garbage then happens as it would have without a cycle
+  for (iterator it = garbage.begin(); it != garbage.end(); ++it) {
+    (*it)->incRef();
+  }
+  for (iterator it = garbage.begin(); it != garbage.end(); ++it) {
+    venom_object* obj = *it;
+    bytes_reclaimed += venom_object::venom_object_sizeof(
+        obj->getClassObj()->sizeof_obj_base, obj->getClassObj()->n_cells);
+    obj->releaseContents();
+  }
+
+  // nothing else referred to the garbage, so all that is left is the hold
+  for (iterator it = garbage.begin(); it != garbage.end(); ++it) {
+    venom_object* obj = *it;
+    assert(obj->count == 1);
+    obj->count = 0;
+    venom_object::Delete(obj);
+  }
+  objects_reclaimed += garbage.size();
+}
+
+}
+}
@@ -0,0 +1,213 @@
+/**
+ * Copyright (c) 2012 Stephen Tu
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names
+ * of its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VENOM_RUNTIME_CYCLECOLLECTOR_H
+#define VENOM_RUNTIME_CYCLECOLLECTOR_H
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <runtime/venomobject.h>
+#include <util/noncopyable.h>
+
+namespace venom {
+namespace runtime {
+
+/**
+ * Reference counting alone never frees a cycle of objects (a doubly linked
+ * list, or a child which points back at its parent). The CycleCollector
+ * finds such garbage cycles by trial deletion, synchronously, as described
+ * by Bacon and Rajan in "Concurrent Cycle Collection in Reference Counted
+ * Systems" (ECOOP 2001).
+ *
+ * Whenever the count of an object drops, but not to zero, the object might
+ * now only be held by a cycle. It is colored purple and buffered as a
+ * candidate root (see possibleRoot()). Every so many allocations, collect()
+ * then
+ *
+ *   1) subtracts from the count of every object reachable from a candidate
+ *      the references which other such objects hold (coloring them gray),
+ *   2) colors black again (restoring their counts) everything which is
+ *      still referenced from outside, along with everything reachable from
+ *      it, and colors the rest white, and
+ *   3) frees the white objects, which only refer to each other.
+ *
+ * The references an object holds are found through its ref_cell_bitmap,
+ * and the traverse() hook of builtin containers. Objects whose class can
+ * not hold references at all (strings, boxed primitives) are green, and
+ * never looked at.
+ *
+ * The collector only runs at a safepoint of the ExecutionContext which owns
+ * it (see ExecutionContext::collectCycles()), so everything the operand
+ * stack, local variables or the constant pool refer to is counted.
+ *
+ * Tracing from every candidate root can trace the same long lived
+ * structures over and over again. In Generational mode, an object which
+ * survives a collection it was traced by is promoted to the old
+ * generation. A minor collection then only traces from young candidates,
+ * and treats old objects as referenced from outside (which is safe, it
+ * only finds less garbage). Old candidates are set aside until enough of
+ * them pile up for a major collection, which traces through everything
+ * like a collection in Full mode does.
+ */
+class CycleCollector : private util::noncopyable {
+public:
+  /** The colors of Bacon and Rajan, stored in venom_object::gc_color */
+  enum Color {
+    Black,   // in use, or free
+    Gray,    // possibly part of a garbage cycle
+    White,   // part of a garbage cycle
+    Purple,  // a candidate root
+    Green,   // can not be part of a cycle (or is being constructed or
+             // released)
+    Garbage, // white, and about to be freed
+  };
+
+  /** Bits of venom_object::gc_flags */
+  enum Flags {
+    Buffered = 0x1, // in the candidate root buffer
+    Released = 0x2, // released, but the memory is not yet freed
+    Old      = 0x4, // survived a collection (see Generational)
+  };
+
+  enum Mode {
+    Off,          // reference counting only, garbage cycles leak
+    Full,         // every collection traces from all candidate roots
+    Generational, // minor collections only trace young objects
+  };
+
+  /** Parses "off", "full" or "generational" into mode. Returns false for
+   * anything else */
+  static bool ParseMode(const std::string& s, Mode& mode);
+
+  /** The minimum number of allocations between two collections, and of old
+   * candidates between two major collections */
+  static const size_t MinThreshold = 10000;
+
+  CycleCollector();
+  ~CycleCollector() { assert(roots.empty() && old_roots.empty()); }
+
+  /** Must be set before any object is allocated */
+  inline void setMode(Mode mode) { this->mode = mode; }
+
+  /** Objects allocated while this returns false are never candidates */
+  inline bool isEnabled() const { return mode != Off; }
+
+  /** Buffers obj, a black object whose count dropped (but not to zero), as
+   * a candidate root */
+  inline void possibleRoot(venom_object* obj) {
+    assert(obj->gc_color == Black);
+    assert(obj->getCount());
+    obj->gc_color = Purple;
+    if (obj->gc_flags & Buffered) return;
+    obj->gc_flags |= Buffered;
+    roots.push_back(obj);
+  }
+
+  /** Called for every new object which is not green */
+  inline void allocated() { allocations++; }
+
+  /** Have there been enough allocations since the last collection? */
+  inline bool shouldCollect() const { return allocations >= threshold; }
+
+  inline bool hasRoots() const {
+    return !roots.empty() || !old_roots.empty();
+  }
+
+  /** Frees every garbage cycle reachable from a candidate root. A minor
+   * collection (unless full is set) leaves out the old generation */
+  void collect(bool full);
+
+  void printStats(std::ostream& o) const;
+
+private:
+  class ChildPusher;
+
+  /** Appends the non-green objects obj refers to onto children (leaving
+   * out the old ones in a minor collection) */
+  void pushChildren(venom_object* obj, std::vector<venom_object*>& children);
+
+  void markRoots(std::vector<venom_object*>& candidates);
+  void markGray(venom_object* root);
+  void scan(venom_object* root);
+  void scanBlack(venom_object* root);
+
+  /** Appends the white objects reachable from root onto garbage, and
+   * returns whether there were any */
+  bool collectWhite(venom_object* root,
+                    std::vector<venom_object*>& garbage);
+
+  /** Undoes markGray() for the references the garbage holds */
+  void restoreCounts(const std::vector<venom_object*>& garbage);
+
+  void freeGarbage(const std::vector<venom_object*>& garbage);
+
+  Mode mode;
+
+  /** Candidate roots, in the order they were buffered */
+  std::vector<venom_object*> roots;
+
+  /** Old candidate roots, set aside by minor collections */
+  std::vector<venom_object*> old_roots;
+
+  /** Is the collection in progress a major one? */
+  bool tracing_old;
+
+  /** Explicit stacks for the traversals, which do not recurse, so that long
+   * chains of objects do not overflow the C++ stack. scanBlack() runs in
+   * the middle of scan(), so it needs its own */
+  std::vector<venom_object*> work;
+  std::vector<venom_object*> black_work;
+
+  /** The objects scanBlack() colored black, which are promoted once the
+   * collection is done tracing (a minor collection skips old objects, so
+   * promoting them any earlier would hide references to them) */
+  std::vector<venom_object*> survivors;
+
+  size_t allocations;
+  size_t threshold;
+  size_t major_threshold;
+
+  /** Statistics */
+  size_t collections;
+  size_t major_collections;
+  size_t objects_traced;
+  size_t cycles_found;
+  size_t objects_reclaimed;
+  size_t bytes_reclaimed;
+  uint64_t pause_usec;
+  uint64_t max_pause_usec;
+};
+
+}
+}
+
+#endif /* VENOM_RUNTIME_CYCLECOLLECTOR_H */
@@ -52,7 +52,8 @@ protected:
 };
 
 /** Ptr must derived from venom_countable,
- * or supply incRef() and decRef() methods */
+ * or supply incRef() and decRef() methods. Ptr::Unreferenced() is called
+ * with the pointer once its count drops to zero */
 template <typename Ptr>
 class ref_ptr {
 public:
@@ -65,14 +66,14 @@ public:
     if (ptr) ptr->incRef();
   }
 
-  ~ref_ptr() { if (ptr && !ptr->decRef()) delete ptr; }
+  ~ref_ptr() { if (ptr && !ptr->decRef()) Ptr::Unreferenced(ptr); }
 
   ref_ptr& operator=(const ref_ptr<Ptr>& that) { return operator=(that.ptr); }
   template <typename Derived>
   ref_ptr& operator=(const ref_ptr<Derived>& that) { return operator=(that.ptr); }
   ref_ptr& operator=(Ptr* ptr) {
     if (this->ptr != ptr) {
-      if (this->ptr && !this->ptr->decRef()) delete this->ptr;
+      if (this->ptr && !this->ptr->decRef()) Ptr::Unreferenced(this->ptr);
       this->ptr = ptr;
       if (this->ptr) this->ptr->incRef();
     }
@@ -107,7 +108,7 @@ template <typename Ptr>
 class scoped_ret_value : private util::noncopyable {
 public:
   scoped_ret_value(Ptr *ptr) : ptr(ptr) {}
-  ~scoped_ret_value() { if (ptr && !ptr->decRef()) delete ptr; }
+  ~scoped_ret_value() { if (ptr && !ptr->decRef()) Ptr::Unreferenced(ptr); }
   Ptr* operator->() const {
     assert(ptr); // null pointer exception?
     return ptr;
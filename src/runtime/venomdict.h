@@ -30,6 +30,7 @@
 #ifndef VENOM_RUNTIME_DICT_H
 #define VENOM_RUNTIME_DICT_H
 
+#include <algorithm>
 #include <cassert>
 #include <sstream>
 #include <string>
@@ -55,7 +56,8 @@ private:
     venom_cell,
     venom_cell,
     typename venom_cell_utils<Key>::hash,
-    typename venom_cell_utils<Key>::equal_to> cell_hash_map;
+    typename venom_cell_utils<Key>::equal_to,
+    slab_allocator< std::pair<const venom_cell, venom_cell> > > cell_hash_map;
 
   typedef venom_dict_impl<Key, Value> self_type;
 
@@ -190,8 +192,9 @@ public:
     } else {
       // old elem
 
-      // decRef the value
-      value_dec_ref(ret.first->second);
+      // insert() kept the old value, so replace it, and decRef the old one
+      std::swap(ret.first->second, value);
+      value_dec_ref(value);
 
       // no need to incRef the key, since it already exists
       // in the map
@@ -206,6 +209,20 @@ public:
         int64_t(venom_self_cast<self_type>::asSelf(self)->elems.size()));
   }
 
+  /** The traverse hook (see venom_class_object) of a dict whose keys or
+   * values are references. visitor must not modify the keys */
+  static void
+  traverse(venom_object* obj, venom_cell_visitor& visitor) {
+    cell_hash_map& elems = static_cast<self_type*>(obj)->elems;
+    for (typename cell_hash_map::iterator it = elems.begin();
+         it != elems.end(); ++it) {
+      if (key_utils::isRefCounted) {
+        visitor.visit(const_cast<venom_cell&>(it->first));
+      }
+      if (value_utils::isRefCounted) visitor.visit(it->second);
+    }
+  }
+
 protected:
   cell_hash_map elems;
 };
@@ -214,59 +231,67 @@ protected:
 
 template <typename Key, typename Value>
 backend::FunctionDescriptor& venom_dict_impl<Key, Value>::InitDescriptor() {
-  static backend::FunctionDescriptor f((void*)init, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<init>(), 1, 0x1);
   return f;
 }
 
 template <typename Key, typename Value>
 backend::FunctionDescriptor& venom_dict_impl<Key, Value>::ReleaseDescriptor() {
-  static backend::FunctionDescriptor f((void*)release, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<release>(), 1, 0x1);
   return f;
 }
 
 template <typename Key, typename Value>
 backend::FunctionDescriptor& venom_dict_impl<Key, Value>::CtorDescriptor() {
-  static backend::FunctionDescriptor f((void*)ctor, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<ctor>(), 1, 0x1);
   return f;
 }
 
 template <typename Key, typename Value>
 backend::FunctionDescriptor& venom_dict_impl<Key, Value>::StringifyDescriptor() {
-  static backend::FunctionDescriptor f((void*)stringify, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<stringify>(), 1, 0x1);
   return f;
 }
 
 template <typename Key, typename Value>
 backend::FunctionDescriptor& venom_dict_impl<Key, Value>::HashDescriptor() {
-  static backend::FunctionDescriptor f((void*)hash, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<hash>(), 1, 0x1);
   return f;
 }
 
 template <typename Key, typename Value>
 backend::FunctionDescriptor& venom_dict_impl<Key, Value>::EqDescriptor() {
-  static backend::FunctionDescriptor f((void*)eq, 2, 0x3, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<eq>(), 2, 0x3);
   return f;
 }
 
 template <typename Key, typename Value>
 backend::FunctionDescriptor& venom_dict_impl<Key, Value>::GetDescriptor() {
   static backend::FunctionDescriptor f(
-      (void*)get, 2, key_utils::isRefCounted ? 0x1 : 0x0, true);
+      backend::FunctionDescriptor::Native<get>(), 2,
+      0x1 | (key_utils::isRefCounted ? 0x2 : 0x0));
   return f;
 }
 
 template <typename Key, typename Value>
 backend::FunctionDescriptor& venom_dict_impl<Key, Value>::SetDescriptor() {
-  static backend::FunctionDescriptor f((void*)set, 3,
-      (value_utils::isRefCounted ? 0x2 : 0x0) |
-        (key_utils::isRefCounted ? 0x1 : 0x0),
-      true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<set>(), 3,
+      0x1 | (key_utils::isRefCounted ? 0x2 : 0x0) |
+        (value_utils::isRefCounted ? 0x4 : 0x0));
   return f;
 }
 
 template <typename Key, typename Value>
 backend::FunctionDescriptor& venom_dict_impl<Key, Value>::SizeDescriptor() {
-  static backend::FunctionDescriptor f((void*)size, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<size>(), 1, 0x1);
   return f;
 }
 
@@ -282,7 +307,8 @@ venom_class_object& venom_dict_impl<Key, Value>::DictClassTable() {
       &EqDescriptor(),
       &GetDescriptor(),
       &SetDescriptor(),
-      &SizeDescriptor()));
+      &SizeDescriptor()),
+    key_utils::isRefCounted || value_utils::isRefCounted ? &traverse : NULL);
   return c;
 }
 
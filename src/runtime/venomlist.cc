@@ -27,6 +27,8 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sstream>
+
 #include <backend/vm.h>
 #include <runtime/venomlist.h>
 #include <util/stl.h>
@@ -37,6 +39,12 @@ using namespace venom::backend;
 namespace venom {
 namespace runtime {
 
+void ListIndexOutOfRange(int64_t idx, size_t size) {
+  stringstream buf;
+  buf << "List index out of range: " << idx << " (size " << size << ")";
+  throw VenomRuntimeException(buf.str());
+}
+
 venom_class_object*
 venom_list::GetListClassTable(venom_cell::CellType listType) {
   switch (listType) {
@@ -44,28 +44,36 @@ namespace venom {
 
 namespace backend {
   /** Forward decl */
+  class AotRuntime;
   class Instruction;
 }
 
 namespace runtime {
 
+/** Throws the VenomRuntimeException for an access to element idx of a list
+ * holding size elements. Out of line, so the inline checks stay small */
+void ListIndexOutOfRange(int64_t idx, size_t size);
+
 /**
  * Even though list has a type parameter
  * in the language, the C++ object is not a template
  * type. For now, a list is backed by a std::vector, since
- * this is the most straightforward implementation.
+ * this is the most straightforward implementation. Its
+ * backing store comes from the SlabAllocator.
  */
 template <typename Elem>
 class venom_list_impl :
   public venom_object,
   public venom_self_cast< venom_list_impl<Elem> > {
 
+  friend class backend::AotRuntime;
   friend class backend::Instruction;
   friend class venom_list;
 
 private:
   typedef venom_list_impl<Elem> self_type;
   typedef venom_cell_utils<Elem> elem_utils;
+  typedef std::vector<venom_cell, slab_allocator<venom_cell> > elem_vector;
 
 protected:
   /** Construct an empty list */
@@ -92,31 +100,43 @@ protected:
 
   static venom_class_object& ListClassTable();
 
+  /** The element at idx, which must be in range */
+  inline venom_cell& elemAtUnchecked(int64_t idx) {
+    assert(uint64_t(idx) < elems.size());
+    return elems[idx];
+  }
+
+  /** The element at idx. An index outside of [0, size) is caught by the one
+   * unsigned comparison */
+  inline venom_cell& elemAt(int64_t idx) {
+    if (VENOM_UNLIKELY(uint64_t(idx) >= elems.size())) {
+      ListIndexOutOfRange(idx, elems.size());
+    }
+    return elems[idx];
+  }
+
 public:
 
   static venom_ret_cell
   init(backend::ExecutionContext* ctx, venom_cell self) {
     // must use placement new on elems
-    using namespace std;
-    new (&(venom_self_cast<self_type>::asSelf(self)->elems))
-      vector<venom_cell>();
+    new (&(venom_self_cast<self_type>::asSelf(self)->elems)) elem_vector();
     return venom_ret_cell(venom_object::Nil);
   }
 
   static venom_ret_cell
   release(backend::ExecutionContext* ctx, venom_cell self) {
-    std::vector<venom_cell>& elems =
+    elem_vector& elems =
       venom_self_cast<self_type>::asSelf(self)->elems;
     if (elem_utils::isRefCounted) {
-      for (std::vector<venom_cell>::iterator it = elems.begin();
+      for (typename elem_vector::iterator it = elems.begin();
            it != elems.end(); ++it) {
         it->decRef();
       }
     }
 
     // must manually call dtor on elems
-    using namespace std;
-    elems.~vector<venom_cell>();
+    elems.~elem_vector();
     return venom_ret_cell(venom_object::Nil);
   }
 
@@ -132,7 +152,7 @@ public:
     std::stringstream buf;
     buf << "[";
     self_type* list = venom_self_cast<self_type>::asSelf(self);
-    for (std::vector<venom_cell>::iterator it = list->elems.begin();
+    for (typename elem_vector::iterator it = list->elems.begin();
          it != list->elems.end(); ++it) {
       buf << stringer(*it);
       if (it + 1 != list->elems.end()) buf << ", ";
@@ -154,7 +174,7 @@ public:
   static venom_ret_cell
   get(backend::ExecutionContext* ctx, venom_cell self, venom_cell idx) {
     venom_cell elem =
-      venom_self_cast<self_type>::asSelf(self)->elems.at(idx.asInt());
+      venom_self_cast<self_type>::asSelf(self)->elemAt(idx.asInt());
     return venom_ret_cell(
         typename elem_utils::extractor()(elem)); // trigger the incRef
   }
@@ -168,15 +188,18 @@ public:
 
     self_type* list = venom_self_cast<self_type>::asSelf(self);
 
+    // check the index before touching any ref counts
+    venom_cell& slot = list->elemAt(idx.asInt());
+
     // inc ref new
     incr(elem);
 
     // dec ref old
-    venom_cell old = list->elems.at(idx.asInt());
+    venom_cell old = slot;
     decr(old);
 
     // set
-    list->elems.at(idx.asInt()) = elem;
+    slot = elem;
 
     return venom_ret_cell(venom_object::Nil);
   }
@@ -195,65 +218,85 @@ public:
         int64_t(venom_self_cast<self_type>::asSelf(self)->elems.size()));
   }
 
+  /** The traverse hook (see venom_class_object) of a list of references */
+  static void
+  traverse(venom_object* obj, venom_cell_visitor& visitor) {
+    elem_vector& elems = static_cast<self_type*>(obj)->elems;
+    for (typename elem_vector::iterator it = elems.begin();
+         it != elems.end(); ++it) {
+      visitor.visit(*it);
+    }
+  }
+
 protected:
-  std::vector<venom_cell> elems;
+  elem_vector elems;
 };
 
 // static implementations
 
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::InitDescriptor() {
-  static backend::FunctionDescriptor f((void*)init, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<init>(), 1, 0x1);
   return f;
 }
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::ReleaseDescriptor() {
-  static backend::FunctionDescriptor f((void*)release, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<release>(), 1, 0x1);
   return f;
 }
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::CtorDescriptor() {
-  static backend::FunctionDescriptor f((void*)ctor, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<ctor>(), 1, 0x1);
   return f;
 }
 
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::StringifyDescriptor() {
-  static backend::FunctionDescriptor f((void*)stringify, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<stringify>(), 1, 0x1);
   return f;
 }
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::HashDescriptor() {
-  static backend::FunctionDescriptor f((void*)hash, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<hash>(), 1, 0x1);
   return f;
 }
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::EqDescriptor() {
-  static backend::FunctionDescriptor f((void*)eq, 2, 0x3, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<eq>(), 2, 0x3);
   return f;
 }
 
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::GetDescriptor() {
-  static backend::FunctionDescriptor f((void*)get, 2, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<get>(), 2, 0x1);
   return f;
 }
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::SetDescriptor() {
   static backend::FunctionDescriptor f(
-      (void*)set, 3, 0x1 | (elem_utils::isRefCounted ? 0x4 : 0x0), true);
+      backend::FunctionDescriptor::Native<set>(), 3,
+      0x1 | (elem_utils::isRefCounted ? 0x4 : 0x0));
   return f;
 }
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::AppendDescriptor() {
   static backend::FunctionDescriptor f(
-      (void*)append, 2, 0x1 | (elem_utils::isRefCounted ? 0x2 : 0x0), true);
+      backend::FunctionDescriptor::Native<append>(), 2,
+      0x1 | (elem_utils::isRefCounted ? 0x2 : 0x0));
   return f;
 }
 
 template <typename Elem>
 backend::FunctionDescriptor& venom_list_impl<Elem>::SizeDescriptor() {
-  static backend::FunctionDescriptor f((void*)size, 1, 0x1, true);
+  static backend::FunctionDescriptor f(
+      backend::FunctionDescriptor::Native<size>(), 1, 0x1);
   return f;
 }
 
@@ -265,7 +308,8 @@ venom_class_object& venom_list_impl<Elem>::ListClassTable() {
       util::vec7(
         &StringifyDescriptor(), &HashDescriptor(), &EqDescriptor(),
         &GetDescriptor(), &SetDescriptor(), &AppendDescriptor(),
-        &SizeDescriptor()));
+        &SizeDescriptor()),
+      elem_utils::isRefCounted ? &traverse : NULL);
   return c;
 }
 
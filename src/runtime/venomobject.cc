@@ -32,6 +32,7 @@
 
 #include <backend/vm.h>
 #include <runtime/box.h>
+#include <runtime/cyclecollector.h>
 #include <runtime/venomobject.h>
 #include <runtime/venomstring.h>
 #include <util/stl.h>
@@ -51,14 +52,37 @@ void venom_cell::incRef() {
 }
 
 void venom_cell::decRef() {
-  if (data.obj && !data.obj->decRef()) {
-    delete data.obj;
+  if (!data.obj) return;
+  if (!data.obj->decRef()) venom_object::Unreferenced(data.obj);
+  // checked here as well, so that dropping a reference to a green object
+  // (every object is, while the collector is off) costs no call
+  else if (data.obj->gc_color == CycleCollector::Black) {
+    venom_object::Decremented(data.obj);
   }
 }
 
 #ifndef NDEBUG
 void venom_cell::AssertNonZeroRefCount(const venom_cell& cell) {
-  assert(!cell.asRawObject() || cell.asRawObject()->getCount());
+  // an object which only local variables refer to has no count, when ref
+  // counting is deferred
+  assert(!cell.asRawObject() || cell.asRawObject()->getCount() ||
+         cell.asRawObject()->inZeroCountTable());
+}
+
+void venom_cell::BeginBorrow(venom_cell& cell) {
+  AssertNonZeroRefCount(cell);
+  cell.incRef();
+}
+
+void venom_cell::EndBorrow(venom_cell& cell) {
+  // when ref counts are deferred, a reconcile() while the borrow is on the
+  // stack sees the count of the borrow, and so takes an object which only
+  // local slots hold out of the zero count table
+  ExecutionContext* ctx = ExecutionContext::current_context();
+  assert(!cell.asRawObject() || cell.asRawObject()->getCount() > 1 ||
+         cell.asRawObject()->inZeroCountTable() ||
+         (ctx && ctx->defersRefCounts()));
+  cell.decRef();
 }
 #endif
 
@@ -71,32 +95,32 @@ venom_object* venom_object::Nil(NULL);
 // TODO: we should w/ mutex for non-gcc compilers
 
 FunctionDescriptor& venom_object::InitDescriptor() {
-  static FunctionDescriptor f((void*)init, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<init>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_object::ReleaseDescriptor() {
-  static FunctionDescriptor f((void*)release, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<release>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_object::CtorDescriptor() {
-  static FunctionDescriptor f((void*)ctor, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<ctor>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_object::StringifyDescriptor() {
-  static FunctionDescriptor f((void*)stringify, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<stringify>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_object::HashDescriptor() {
-  static FunctionDescriptor f((void*)hash, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<hash>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_object::EqDescriptor() {
-  static FunctionDescriptor f((void*)eq, 2, 0x3, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<eq>(), 2, 0x3);
   return f;
 }
 
@@ -114,7 +138,10 @@ venom_class_object& venom_object::ObjClassTable() {
  * a complete declaration of ExecutionContext
  */
 venom_object::venom_object(venom_class_object* class_obj)
-  : class_obj(class_obj) {
+  : in_zero_count_table(false),
+    gc_color(CycleCollector::Green),
+    gc_flags(0),
+    class_obj(class_obj) {
   assert(class_obj);
 
   // this is equivalent to looping over each of the
@@ -129,8 +156,16 @@ venom_object::venom_object(venom_class_object* class_obj)
   // simulate calling the class constructor
   // we *must* bump the ref count here, so that we don't end up destructing the
   // object when virtualDispatch is finished
-  dispatchInit(ExecutionContext::current_context());
+  ExecutionContext* ctx = ExecutionContext::current_context();
+  dispatchInit(ctx);
   assert(count == 1);
+
+  // green until here, so that the reference init() dropped does not make
+  // this object a candidate root
+  if (class_obj->holdsRefs() && ctx && ctx->cycle_collector.isEnabled()) {
+    gc_color = CycleCollector::Black;
+    ctx->cycle_collector.allocated();
+  }
 }
 
 /**
@@ -139,13 +174,26 @@ venom_object::venom_object(venom_class_object* class_obj)
  */
 venom_object::~venom_object() {
   assert(!count);
+  assert(!in_zero_count_table);
+  assert(!(gc_flags & CycleCollector::Buffered));
+  if (!(gc_flags & CycleCollector::Released)) releaseContents();
+}
+
+void venom_object::releaseContents() {
+  assert(!(gc_flags & CycleCollector::Released));
+  gc_flags |= CycleCollector::Released;
+  // nothing refers to this object anymore, so it is no part of a cycle
+  gc_color = CycleCollector::Green;
+
+#ifndef NDEBUG
+  uint32_t count_before = count;
+#endif
   scoped_ref_counter<venom_object> helper(this);
-  assert(count == 1);
   // simulate virtual destructor
   // we *must* bump the ref count here, so that we don't end up destructing the
   // object again (infinitely) when virtualDispatch is finished
   dispatchRelease(ExecutionContext::current_context());
-  assert(count == 1);
+  assert(count == count_before + 1);
 
   // destroy the cells
   if (class_obj->n_cells) {
@@ -160,15 +208,57 @@ venom_object::~venom_object() {
   }
 }
 
+void venom_object::Unreferenced(venom_object* obj) {
+  ExecutionContext* ctx = ExecutionContext::current_context();
+  if (ctx && ctx->defersRefCounts()) ctx->deferRelease(obj);
+  else Free(obj);
+}
+
+void venom_object::Free(venom_object* obj) {
+  assert(!obj->count);
+  if (obj->gc_flags & CycleCollector::Buffered) {
+    obj->releaseContents();
+    return;
+  }
+  Delete(obj);
+}
+
+void venom_object::Delete(venom_object* obj) {
+  size_t size = venom_object_sizeof(
+      obj->class_obj->sizeof_obj_base, obj->class_obj->n_cells);
+  obj->~venom_object();
+  SlabAllocator::Current().deallocate(obj, size);
+}
+
+void venom_object::Decremented(venom_object* obj) {
+  // purple objects already are candidates, and green ones can not be. the
+  // other colors are only seen while the collector runs
+  if (obj->gc_color != CycleCollector::Black) return;
+  ExecutionContext* ctx = ExecutionContext::current_context();
+  if (ctx) ctx->cycle_collector.possibleRoot(obj);
+}
+
+/** Forwards the reference cells of an object to visitor */
+static inline void TraverseCells(venom_object* obj,
+                                 venom_cell_visitor& visitor) {
+  const venom_class_object* class_obj = obj->getClassObj();
+  for (uint64_t refs = class_obj->ref_cell_bitmap; refs; refs &= refs - 1) {
+    visitor.visit(obj->cell(__builtin_ctzll(refs)));
+  }
+}
+
+void venom_object::traverse(venom_cell_visitor& visitor) {
+  TraverseCells(this, visitor);
+  if (class_obj->traverse) class_obj->traverse(this, visitor);
+}
+
 string venom_object::stringifyNativeOnly() const {
   FunctionDescriptor *desc = class_obj->vtable[0];
   assert(desc);
   if (desc->isNative()) {
     assert(desc->getNumArgs() == 1);
-    FunctionDescriptor::F1 f =
-      reinterpret_cast<FunctionDescriptor::F1>(desc->getFunctionPtr());
-    venom_ret_cell str =
-      f(NULL, venom_cell(const_cast<venom_object*>(this)));
+    venom_cell self(const_cast<venom_object*>(this));
+    venom_ret_cell str = desc->getNativeFunction()(NULL, &self, 1);
     scoped_ret_value<venom_object> ptr(str.asRawObject());
     assert(ptr->getClassObj() == &venom_string::StringClassTable());
     return static_cast<venom_string*>(ptr.get())->getData();
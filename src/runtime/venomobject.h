@@ -38,6 +38,7 @@
 #include <string>
 #include <vector>
 
+#include <runtime/allocator.h>
 #include <runtime/refcount.h>
 #include <util/macros.h>
 #include <util/stl.h>
@@ -53,6 +54,7 @@ namespace backend {
 namespace runtime {
 
 /** Forward decls */
+class CycleCollector;
 class venom_object;
 
 /**
@@ -103,6 +105,19 @@ public:
   static void AssertNonZeroRefCount(const venom_cell& cell);
 #endif
 
+  /** A borrowed reference (see backend::RefCountElider) is not counted.
+   * Debug builds count it anyway, so every ref count is exactly what the
+   * code without the borrows gives, and check when the borrow ends that
+   * something else still holds the object, which is what makes skipping
+   * the count safe */
+#ifdef NDEBUG
+  static inline void BeginBorrow(venom_cell& cell) {}
+  static inline void EndBorrow(venom_cell& cell) {}
+#else
+  static void BeginBorrow(venom_cell& cell);
+  static void EndBorrow(venom_cell& cell);
+#endif
+
   // use specializations defined below
   template <typename T>
   struct ExtractFunctor {};
@@ -188,6 +203,16 @@ public:
   venom_ret_cell(const venom_cell& cell) { data = cell.data; }
 };
 
+/**
+ * Visits the cells of an object which hold references, see
+ * venom_object::traverse()
+ */
+class venom_cell_visitor {
+public:
+  virtual ~venom_cell_visitor() {}
+  virtual void visit(venom_cell& cell) = 0;
+};
+
 /**
  * A venom_class_object is created once per class, and holds the vtable for
  * that class. In the future, when reflection is implemented, it will also
@@ -195,6 +220,10 @@ public:
  */
 class venom_class_object {
 public:
+  /** Visits the references an instance of a builtin class holds other than
+   * in its cells (the elements of a container) */
+  typedef void (*Traverser)(venom_object* obj, venom_cell_visitor& visitor);
+
   venom_class_object(const std::string& name,
                      size_t sizeof_obj_base,
                      size_t n_cells,
@@ -202,10 +231,12 @@ public:
                      backend::FunctionDescriptor* cppInit,
                      backend::FunctionDescriptor* cppRelease,
                      backend::FunctionDescriptor* ctor,
-                     const std::vector<backend::FunctionDescriptor*>& vtable)
+                     const std::vector<backend::FunctionDescriptor*>& vtable,
+                     Traverser traverse = NULL)
     : name(name), sizeof_obj_base(sizeof_obj_base),
       n_cells(n_cells), ref_cell_bitmap(ref_cell_bitmap),
-      cppInit(cppInit), cppRelease(cppRelease), ctor(ctor), vtable(vtable) {
+      cppInit(cppInit), cppRelease(cppRelease), ctor(ctor), vtable(vtable),
+      traverse(traverse) {
     // TODO: implementation limitation for now
     assert(n_cells <= 64);
   }
@@ -236,6 +267,12 @@ public:
 
   /** The vtable for the class */
   const std::vector<backend::FunctionDescriptor*> vtable;
+
+  /** NULL if instances hold no references outside of their cells */
+  const Traverser traverse;
+
+  /** Can an instance refer to other objects (and so be part of a cycle)? */
+  inline bool holdsRefs() const { return ref_cell_bitmap || traverse; }
 };
 
 /**
@@ -246,17 +283,16 @@ public:
  * really a sizeof(venom_object) + n_cells * sizeof(venom_cell) bytes
  * contiguous piece of memory.
  *
- * To allocate a venom_object of N cells:
- *
- *   // allocate the memory
- *   venom_object *obj =
- *     (venom_object *) operator new (venom_object::venom_object_sizeof(N));
- *   // call constructor via placement new
- *   new (obj) venom_object(N);
+ * The memory comes from the SlabAllocator of the current thread, which
+ * needs the size of an object to free it again. To allocate a venom_object
+ * of class_obj (and its cells), use allocObj(class_obj). A builtin type
+ * without cells (such as venom_string) can also be allocated with new, as
+ * long as the sizeof_obj_base of its class is the size of the type.
  *
- * To de-allocate a venom_object obj, delete is sufficient:
+ * To de-allocate a venom_object obj (never with delete, which would not
+ * know the size of obj), use
  *
- *   delete obj;
+ *   venom_object::Delete(obj);
  *
  * A venom_object is not a polymorphic (virtual) class in C++.
  * Instead, a venom_object contains a pointer to its class's
@@ -265,6 +301,9 @@ public:
  * TODO: fill this in more completely
  */
 class venom_object : public venom_countable {
+  friend class backend::ExecutionContext;
+  friend class CycleCollector;
+  friend class venom_cell;
 public:
   static inline size_t
   venom_object_sizeof(size_t obj_base, size_t n_cells) {
@@ -291,19 +330,87 @@ public:
     size_t s =
       venom_object_sizeof(
           class_obj->sizeof_obj_base, class_obj->n_cells);
-    venom_object *obj = (venom_object *) operator new (s);
+    venom_object *obj =
+      static_cast<venom_object*>(SlabAllocator::Current().allocate(s));
     new (obj) venom_object(class_obj);
     return obj;
   }
 
+  /** Runs the destructor of obj, and frees its memory */
+  static void Delete(venom_object* obj);
+
+  static inline void* operator new(size_t size) {
+    return SlabAllocator::Current().allocate(size);
+  }
+  static inline void* operator new(size_t size, void* p) { return p; }
+
+  /** Only used if a constructor throws, when size is the one passed to
+   * operator new */
+  static inline void operator delete(void* p, size_t size) {
+    SlabAllocator::Current().deallocate(p, size);
+  }
+  static inline void operator delete(void* p, void* place) {}
+
   venom_object(venom_class_object* class_obj);
   ~venom_object();
 
+  /**
+   * Called once the ref count of obj drops to zero, which normally frees
+   * it. When the current context defers reference counting (see
+   * ExecutionContext::reconcile()), obj may still be held by a local
+   * variable slot, which does not count, so it is only entered into the
+   * context's zero count table instead
+   */
+  static void Unreferenced(venom_object* obj);
+
+  /**
+   * Frees obj, which nothing refers to anymore. If the cycle collector
+   * still has obj buffered as a candidate root, only the contents of obj
+   * are released, and the collector frees its memory once it gets to it
+   */
+  static void Free(venom_object* obj);
+
+  /**
+   * Called once the ref count of obj drops, but not to zero. obj may then
+   * only be held by a cycle, so it is buffered as a candidate root of the
+   * cycle collector (see runtime::CycleCollector)
+   */
+  static void Decremented(venom_object* obj);
+
+  /** Visits every cell which holds a reference to another object: the
+   * reference cells of this object, and whatever its class traverses */
+  void traverse(venom_cell_visitor& visitor);
+
+  /** Is this object in the zero count table of the current context? */
+  inline bool inZeroCountTable() const { return in_zero_count_table; }
+
   inline venom_cell& cell(size_t n) { return *cell_ptr(n); }
   inline const venom_cell& cell(size_t n) const {
     return *const_cast<venom_object*>(this)->cell_ptr(n);
   }
 
+  /** Do the cells of instances of class_obj start right after the
+   * venom_object part, as they do for every user class? */
+  static inline bool HasUserLayout(const venom_class_object* class_obj) {
+    return class_obj->sizeof_obj_base == sizeof(venom_object);
+  }
+
+  /** The byte offset of cell(n) in an object whose class HasUserLayout() */
+  static inline size_t UserCellOffset(size_t n) {
+    return sizeof(venom_object) + n * sizeof(venom_cell);
+  }
+
+  /** The cell offset bytes into this object (see UserCellOffset()). This is
+   * a single load, once the offset is known */
+  inline venom_cell& cellAt(size_t offset) {
+    assert(HasUserLayout(class_obj));
+    assert(offset >= UserCellOffset(0));
+    assert(offset < UserCellOffset(class_obj->n_cells));
+    assert((offset - UserCellOffset(0)) % sizeof(venom_cell) == 0);
+    return *reinterpret_cast<venom_cell*>(
+        reinterpret_cast<char*>(this) + offset);
+  }
+
   inline venom_class_object* getClassObj() { return class_obj; }
   inline const venom_class_object* getClassObj() const { return class_obj; }
 
@@ -390,11 +497,10 @@ protected:
   /**
    * return a pointer to the n-th cell of this object
    *
-   * TODO: locating a cell pointer requires one pointer deference
-   * in the current scheme, which means accessing an attribute in
-   * the venom VM requires two pointer deferences instead of one.
-   * See if we can come up with a scheme which does not require
-   * the extra pointer deference.
+   * Locating a cell pointer this way requires one pointer deference
+   * (of class_obj), which means accessing an attribute this way requires
+   * two pointer deferences instead of one. The VM avoids it wherever it
+   * knows the object's layout (see cellAt()).
    */
   inline venom_cell* cell_ptr(size_t n) {
     assert(n < class_obj->n_cells);
@@ -403,6 +509,17 @@ protected:
       (p + class_obj->sizeof_obj_base + n * sizeof(venom_cell));
   }
 
+  /** Runs the release method and releases the cells, which the destructor
+   * otherwise does. Also called ahead of the destructor (see Free()) */
+  void releaseContents();
+
+  /** See inZeroCountTable(). This, and the state of the cycle collector
+   * (see runtime::CycleCollector) fit in the padding after the ref count,
+   * so they do not make objects any larger */
+  bool in_zero_count_table;
+  uint8_t gc_color;
+  uint8_t gc_flags;
+
   /** vtable ptr + other class information */
   venom_class_object* class_obj;
 };
@@ -37,37 +37,37 @@ namespace venom {
 namespace runtime {
 
 FunctionDescriptor& venom_string::InitDescriptor() {
-  static FunctionDescriptor f((void*)init, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<init>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_string::ReleaseDescriptor() {
-  static FunctionDescriptor f((void*)release, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<release>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_string::CtorDescriptor() {
-  static FunctionDescriptor f((void*)ctor, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<ctor>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_string::StringifyDescriptor() {
-  static FunctionDescriptor f((void*)stringify, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<stringify>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_string::HashDescriptor() {
-  static FunctionDescriptor f((void*)hash, 1, 0x1, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<hash>(), 1, 0x1);
   return f;
 }
 
 FunctionDescriptor& venom_string::EqDescriptor() {
-  static FunctionDescriptor f((void*)eq, 2, 0x3, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<eq>(), 2, 0x3);
   return f;
 }
 
 FunctionDescriptor& venom_string::ConcatDescriptor() {
-  static FunctionDescriptor f((void*)concat, 2, 0x3, true);
+  static FunctionDescriptor f(FunctionDescriptor::Native<concat>(), 2, 0x3);
   return f;
 }
 
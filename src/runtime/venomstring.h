@@ -57,7 +57,7 @@ protected:
 private:
   /**
    * Takes ownership of data.
-   * Data MUST have been created via malloc()
+   * Data MUST have been created via SlabAllocator::allocate(n)
    */
   inline void initDataNoCopy(char *data, size_t n) {
     this->data = data;
@@ -65,15 +65,14 @@ private:
   }
 
   inline void initData(const char *data, size_t n) {
-    this->data = (char *) malloc(n);
+    this->data = static_cast<char*>(SlabAllocator::Current().allocate(n));
     this->size = n;
-    assert(this->data);
     memcpy(this->data, data, n);
   }
 
   inline void releaseData() {
     if (data) {
-      free(data);
+      SlabAllocator::Current().deallocate(data, size);
       data = NULL;
       size = 0;
     }
@@ -154,9 +153,8 @@ public:
     venom_string *this_s = asSelf(self);
     venom_string *that_s = asSelf(that);
     size_t total = this_s->size + that_s->size;
-    char *data = (char *) malloc(total);
-    // TODO: check data
-    assert(data);
+    char *data =
+      static_cast<char*>(SlabAllocator::Current().allocate(total));
     memcpy(data, this_s->data, this_s->size);
     memcpy(data + this_s->size, that_s->data, that_s->size);
     return venom_ret_cell(new venom_string(data, total));
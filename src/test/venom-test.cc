@@ -90,7 +90,9 @@ inline string pad(const string& orig, size_t s) {
 // returns true if passed, false if failed
 bool run_test(bool success, const string& srcfile, size_t alignSize) {
   // check to see if an .stdout file exists for srcfile.
-  // if so, then we want to do execution also
+  // if so, then we want to do execution also. a failure test with one
+  // must fail at run time (by exiting, not by being killed by a signal),
+  // and its output, followed by the error message, must match the file
   //
   // TODO: do the same for stderr
   string stdoutFname = util::strip_extension(srcfile) + ".stdout";
@@ -99,7 +101,7 @@ bool run_test(bool success, const string& srcfile, size_t alignSize) {
   string childExpect;
 
   bool capture;
-  if (success && stdoutFile.good()) {
+  if (stdoutFile.good()) {
     global_compile_opts.semantic_check_only = false;
     capture = true;
 
@@ -140,6 +142,7 @@ bool run_test(bool success, const string& srcfile, size_t alignSize) {
 
     compile_result result;
     bool res = compile_and_exec(srcfile, result);
+    if (!res && capture) cout << result.message << endl;
     _exit(res ? 0 : 1); // *must* be _exit() *not* exit()
   } else if (pid < 0) {
     // error in fork
@@ -170,15 +173,19 @@ bool run_test(bool success, const string& srcfile, size_t alignSize) {
   }
 
   bool res;
+  bool signaled = false;
   if (WIFEXITED(status)) {
     res = WEXITSTATUS(status) == 0;
   } else if (WIFSIGNALED(status)) {
     res = false;
+    signaled = true;
   } else VENOM_NOT_REACHED;
 
-  if (res && capture) {
+  if (capture) {
     // compare outputs
-    res = childExpect == childOutput;
+    bool match = childExpect == childOutput;
+    if (success) res = res && match;
+    else res = res || signaled || !match;
   }
 
   double exec_ms = t.lap_ms();
@@ -228,10 +235,13 @@ int main(int argc, char **argv) {
     static struct option long_options[] = {
       {"success-dir", required_argument, 0, 's'},
       {"failure-dir", required_argument, 0, 'b'},
+      {"jit", required_argument, 0, 'j'},
+      {"deferred-rc", no_argument, 0, 'd'},
+      {"gc", required_argument, 0, 'g'},
       {0, 0, 0, 0}
     };
     int option_index = 0;
-    int c = getopt_long(argc, argv, "s:f:",
+    int c = getopt_long(argc, argv, "s:f:O:",
                         long_options, &option_index);
     if (c == -1) break;
     switch (c) {
@@ -241,6 +251,32 @@ int main(int argc, char **argv) {
     case 'b':
       failure_dir = optarg;
       break;
+    case 'j':
+      if (!backend::Jit::ParseMode(optarg, global_compile_opts.jit_mode)) {
+        cerr << "Invalid jit mode (expected off, on, or eager): "
+             << optarg << endl;
+        return 1;
+      }
+      break;
+    case 'd':
+      global_compile_opts.defer_ref_counts = true;
+      break;
+    case 'g':
+      if (!runtime::CycleCollector::ParseMode(optarg,
+                                              global_compile_opts.gc_mode)) {
+        cerr << "Invalid gc mode (expected off, full, or generational): "
+             << optarg << endl;
+        return 1;
+      }
+      break;
+    case 'O':
+      if (optarg != string("0") && optarg != string("1")) {
+        cerr << "Invalid optimization level (expected 0 or 1): "
+             << optarg << endl;
+        return 1;
+      }
+      global_compile_opts.opt_level = optarg[0] - '0';
+      break;
     case '?':
       /* getopt_long already printed an error message. */
       break;
@@ -49,6 +49,36 @@ int main(int argc, char **argv) {
       global_compile_opts.print_ast = true;
     } else if (argv[ai] == string ("--print-bytecode")) {
       global_compile_opts.print_bytecode = true;
+    } else if (argv[ai] == string ("--print-ic-stats")) {
+      global_compile_opts.print_ic_stats = true;
+    } else if (argv[ai] == string ("--print-gc-stats")) {
+      global_compile_opts.print_gc_stats = true;
+    } else if (argv[ai] == string ("--print-alloc-stats")) {
+      global_compile_opts.print_alloc_stats = true;
+    } else if (argv[ai] == string ("--huge-pages")) {
+      global_compile_opts.huge_pages = true;
+    } else if (argv[ai] == string ("--deferred-rc")) {
+      global_compile_opts.defer_ref_counts = true;
+    } else if (argv[ai] == string ("-O0")) {
+      global_compile_opts.opt_level = 0;
+    } else if (argv[ai] == string ("-O1")) {
+      global_compile_opts.opt_level = 1;
+    } else if (string(argv[ai]).compare(0, 6, "--jit=") == 0) {
+      if (!backend::Jit::ParseMode(argv[ai] + 6,
+                                   global_compile_opts.jit_mode)) {
+        cerr << "Invalid jit mode (expected off, on, or eager): "
+             << argv[ai] + 6 << endl;
+        return 1;
+      }
+    } else if (string(argv[ai]).compare(0, 5, "--gc=") == 0) {
+      if (!runtime::CycleCollector::ParseMode(argv[ai] + 5,
+                                              global_compile_opts.gc_mode)) {
+        cerr << "Invalid gc mode (expected off, full, or generational): "
+             << argv[ai] + 5 << endl;
+        return 1;
+      }
+    } else if (string(argv[ai]).compare(0, 11, "--emit-cpp=") == 0) {
+      global_compile_opts.emit_cpp = argv[ai] + 11;
     } else {
       fname = argv[ai];
     }